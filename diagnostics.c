@@ -0,0 +1,337 @@
+///file:diagnostics.c
+///description:reports errors in Fred programs through a buffer, with a
+///  limit on the messages printed for each code and a summary
+///author: avv8047 : Azhur Viano
+
+
+#include "diagnostics.h"
+#include "probes.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+//size of the buffer messages are collected in before being written
+#define DIAGNOSTIC_BUFFER (64 * 1024)
+//longest message kept; longer ones are cut short
+#define MESSAGE_SIZE 512
+
+
+//Stable code and name of each kind of error
+typedef struct CodeInfo_ {
+  const char* code;
+  const char* name;
+} CodeInfo;
+
+static const CodeInfo codeInfo[DIAGNOSTIC_CODES] = {
+  [DiagSymbolFile] = {"E001", "symbol-file"},
+  [DiagDuplicateSymbol] = {"E002", "duplicate-symbol"},
+  [DiagUnknownSymbol] = {"E003", "unknown-symbol"},
+  [DiagInvalidToken] = {"E004", "invalid-token"},
+  [DiagBadDefine] = {"E005", "bad-define"},
+  [DiagBadLet] = {"E006", "bad-let"},
+  [DiagBadCondition] = {"E007", "bad-condition"},
+  [DiagBadPrint] = {"E008", "bad-print"},
+  [DiagBadExpression] = {"E009", "bad-expression"},
+  [DiagFloatModulo] = {"E010", "float-modulo"},
+  [DiagUnknownStatement] = {"E011", "unknown-statement"},
+  [DiagBadRow] = {"E012", "bad-row"},
+  [DiagDivideByZero] = {"E013", "divide-by-zero"},
+  [DiagBadFunction] = {"E014", "bad-function"},
+  [DiagPoolExhausted] = {"E015", "pool-exhausted"},
+};
+
+
+//guards everything below, since sessions and workers report errors
+//  from their own threads
+static pthread_mutex_t diagnosticLock = PTHREAD_MUTEX_INITIALIZER;
+static DiagnosticFormat diagnosticFormat = DiagText;
+static size_t diagnosticLimit = DIAGNOSTIC_LIMIT;
+//errors reported for each code, including those not printed
+static size_t counts[DIAGNOSTIC_CODES];
+static char buffer[DIAGNOSTIC_BUFFER];
+static size_t buffered;
+//-1 until stderr has been checked; a terminal gets each message at once
+static int interactive = -1;
+
+//line each thread is running
+static __thread size_t currentLine;
+//whether errors from each thread are dropped
+static __thread int muted;
+
+
+///Set how diagnostics are printed
+void configureDiagnostics(DiagnosticFormat format, size_t limit){
+  pthread_mutex_lock(&diagnosticLock);
+  diagnosticFormat = format;
+  diagnosticLimit = limit;
+  pthread_mutex_unlock(&diagnosticLock);
+  return;
+}
+
+
+///Set the line later diagnostics from this thread are reported at
+void setDiagnosticLine(size_t line){
+  currentLine = line;
+  return;
+}
+
+
+///Drop or keep the errors later reported from this thread
+int muteDiagnostics(int mute){
+  int previous = muted;
+
+  muted = mute;
+  return previous;
+}
+
+
+///Write the buffer to stderr; the lock must be held
+static void writeBuffer(void){
+  if(buffered){
+    fwrite(buffer, 1, buffered, stderr);
+    fflush(stderr);
+    PROBE2(output_flush, STDERR_FILENO, buffered);
+    buffered = 0;
+  }
+  return;
+}
+
+
+///Add text to the buffer, writing it out first if the text does not
+///  fit; the lock must be held
+///@param text the text
+///@param len the length of the text
+static void appendBuffer(const char* text, size_t len){
+  if(buffered + len > DIAGNOSTIC_BUFFER){
+    writeBuffer();
+  }
+  if(len > DIAGNOSTIC_BUFFER){
+    fwrite(text, 1, len, stderr);
+    return;
+  }
+  memcpy(buffer + buffered, text, len);
+  buffered += len;
+  return;
+}
+
+
+///Write what is buffered and die of the signal, as if it had not been
+///  caught. Only write() is safe here, and the lock is not taken, since
+///  the thread that crashed may hold it
+///@param signal the signal
+static void flushOnSignal(int signal){
+  size_t done = 0;
+  ssize_t written;
+
+  while(done < buffered){
+    written = write(STDERR_FILENO, buffer + done, buffered - done);
+    if(written <= 0){
+      break;
+    }
+    done += (size_t) written;
+  }
+  buffered = 0;
+  raise(signal);
+  return;
+}
+
+
+///Quote a message as a JSON string
+///@param out set to the quoted message
+///@param size the size of out
+///@param message the message
+static void quoteJson(char* out, size_t size, const char* message){
+  size_t len = 0;
+
+  out[len++] = '"';
+  for(; *message && len + 8 < size; message++){
+    if(*message == '"' || *message == '\\'){
+      out[len++] = '\\';
+      out[len++] = *message;
+    }
+    else if((unsigned char) *message < ' '){
+      len += snprintf(out + len, size - len, "\\u%04x", *message);
+    }
+    else{
+      out[len++] = *message;
+    }
+  }
+  out[len++] = '"';
+  out[len] = '\0';
+  return;
+}
+
+
+///Report an error at the current line of this thread
+void diagnoseList(DiagnosticCode code, const char* format, va_list args){
+  char message[MESSAGE_SIZE];
+  char quoted[MESSAGE_SIZE * 2];
+  char line[MESSAGE_SIZE * 3];
+  char* text = message;
+  size_t len;
+  int written;
+
+  if(muted){
+    return;
+  }
+
+  //messages written before this one lead and end with newlines
+  vsnprintf(message, sizeof(message), format, args);
+  text += strspn(text, "\n");
+  len = strlen(text);
+  while(len > 0 && text[len - 1] == '\n'){
+    text[--len] = '\0';
+  }
+
+  pthread_mutex_lock(&diagnosticLock);
+  counts[code]++;
+  if(diagnosticLimit && counts[code] > diagnosticLimit){
+    pthread_mutex_unlock(&diagnosticLock);
+    return;
+  }
+
+  if(diagnosticFormat == DiagJson){
+    quoteJson(quoted, sizeof(quoted), text);
+    written = snprintf(line, sizeof(line),
+		       "{\"code\":\"%s\",\"name\":\"%s\",\"line\":%zu,\"message\":%s}\n",
+		       codeInfo[code].code, codeInfo[code].name, currentLine, quoted);
+  }
+  else if(currentLine){
+    written = snprintf(line, sizeof(line), "%s line %zu: %s\n",
+		       codeInfo[code].code, currentLine, text);
+  }
+  else{
+    written = snprintf(line, sizeof(line), "%s %s\n", codeInfo[code].code, text);
+  }
+  if(written >= (int) sizeof(line)){
+    written = sizeof(line) - 1;
+    line[written - 1] = '\n';
+  }
+  appendBuffer(line, written);
+
+  if(diagnosticLimit && counts[code] == diagnosticLimit &&
+     diagnosticFormat == DiagText){
+    written = snprintf(line, sizeof(line), "%s: further errors not shown\n",
+		       codeInfo[code].code);
+    appendBuffer(line, written);
+  }
+
+  if(interactive < 0){
+    interactive = isatty(STDERR_FILENO);
+  }
+  if(interactive){
+    writeBuffer();
+  }
+  pthread_mutex_unlock(&diagnosticLock);
+  return;
+}
+
+
+///Report an error at the current line of this thread
+void diagnose(DiagnosticCode code, const char* format, ...){
+  va_list args;
+
+  va_start(args, format);
+  diagnoseList(code, format, args);
+  va_end(args);
+  return;
+}
+
+
+///Write the buffered diagnostics to stderr
+void flushDiagnostics(void){
+  pthread_mutex_lock(&diagnosticLock);
+  writeBuffer();
+  pthread_mutex_unlock(&diagnosticLock);
+  return;
+}
+
+
+///Write the buffered diagnostics before fred dies of a signal
+void catchFatalSignals(void){
+  static const int signals[] = {SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT,
+				SIGINT, SIGTERM, SIGHUP, SIGQUIT};
+  struct sigaction action;
+  size_t i;
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = flushOnSignal;
+  sigemptyset(&action.sa_mask);
+  //the handler is removed as it runs, so raising the signal again, or
+  //  returning to the instruction that faulted, kills the process
+  action.sa_flags = SA_RESETHAND | SA_NODEFER;
+  for(i = 0; i < sizeof(signals) / sizeof(signals[0]); i++){
+    sigaction(signals[i], &action, NULL);
+  }
+  return;
+}
+
+
+///Get the number of errors reported so far
+size_t diagnosticTotal(void){
+  size_t total = 0;
+  size_t i;
+
+  pthread_mutex_lock(&diagnosticLock);
+  for(i = 0; i < DIAGNOSTIC_CODES; i++){
+    total += counts[i];
+  }
+  pthread_mutex_unlock(&diagnosticLock);
+  return total;
+}
+
+
+///Print the number of errors of each code reported so far
+void summarizeDiagnostics(void){
+  char line[MESSAGE_SIZE];
+  size_t total = 0;
+  size_t shown;
+  size_t i;
+  int written;
+  int first = 1;
+
+  pthread_mutex_lock(&diagnosticLock);
+  for(i = 0; i < DIAGNOSTIC_CODES; i++){
+    total += counts[i];
+  }
+
+  if(total && diagnosticFormat == DiagJson){
+    appendBuffer("{\"summary\":[", 12);
+    for(i = 0; i < DIAGNOSTIC_CODES; i++){
+      if(!counts[i]){
+	continue;
+      }
+      shown = diagnosticLimit && counts[i] > diagnosticLimit ? diagnosticLimit : counts[i];
+      written = snprintf(line, sizeof(line),
+			 "%s{\"code\":\"%s\",\"name\":\"%s\",\"count\":%zu,\"suppressed\":%zu}",
+			 first ? "" : ",", codeInfo[i].code, codeInfo[i].name,
+			 counts[i], counts[i] - shown);
+      appendBuffer(line, written);
+      first = 0;
+    }
+    appendBuffer("]}\n", 3);
+  }
+  else if(total){
+    written = snprintf(line, sizeof(line), "Errors: %zu\n", total);
+    appendBuffer(line, written);
+    for(i = 0; i < DIAGNOSTIC_CODES; i++){
+      if(!counts[i]){
+	continue;
+      }
+      shown = diagnosticLimit && counts[i] > diagnosticLimit ? diagnosticLimit : counts[i];
+      written = snprintf(line, sizeof(line), "  %s %-18s %zu", codeInfo[i].code,
+			 codeInfo[i].name, counts[i]);
+      appendBuffer(line, written);
+      if(shown < counts[i]){
+	written = snprintf(line, sizeof(line), " (%zu not shown)", counts[i] - shown);
+	appendBuffer(line, written);
+      }
+      appendBuffer("\n", 1);
+    }
+  }
+  writeBuffer();
+  pthread_mutex_unlock(&diagnosticLock);
+  return;
+}
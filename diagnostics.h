@@ -0,0 +1,102 @@
+///file:diagnostics.h
+///description:declarations for reporting errors in Fred programs with
+///  stable codes, through a buffer and with a limit per code
+///author: avv8047 : Azhur Viano
+
+
+#ifndef DIAGNOSTICS_H
+#define DIAGNOSTICS_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdarg.h>
+#include <stddef.h>
+
+//messages printed for each code before the rest are only counted
+#define DIAGNOSTIC_LIMIT 100
+
+
+///Kinds of errors; each has a stable code such as E003 used in the
+///  output, which does not depend on the order here
+typedef enum DiagnosticCode_ {
+  DiagSymbolFile,
+  DiagDuplicateSymbol,
+  DiagUnknownSymbol,
+  DiagInvalidToken,
+  DiagBadDefine,
+  DiagBadLet,
+  DiagBadCondition,
+  DiagBadPrint,
+  DiagBadExpression,
+  DiagFloatModulo,
+  DiagUnknownStatement,
+  DiagBadRow,
+  DiagDivideByZero,
+  DiagBadFunction,
+  DiagPoolExhausted,
+  DIAGNOSTIC_CODES
+} DiagnosticCode;
+
+
+///Formats diagnostics can be printed in
+typedef enum DiagnosticFormat_ {
+  //code, line and message on one line
+  DiagText,
+  //one JSON object per line
+  DiagJson
+} DiagnosticFormat;
+
+
+///Set how diagnostics are printed
+///@param format the format of each message and of the summary
+///@param limit messages printed for each code, 0 for no limit
+void configureDiagnostics(DiagnosticFormat format, size_t limit);
+
+
+///Set the line later diagnostics from this thread are reported at
+///@param line the line number, 0 if there is none
+void setDiagnosticLine(size_t line);
+
+
+///Drop or keep the errors later reported from this thread, such as
+///  those already reported once for the same input
+///@param mute 1 to drop them, without counting them, 0 to keep them
+///@returns whether they were dropped before, to be restored after
+int muteDiagnostics(int mute);
+
+
+///Report an error at the current line of this thread
+///@param code the kind of error
+///@param format printf-style format of the message
+void diagnose(DiagnosticCode code, const char* format, ...);
+
+
+///Report an error at the current line of this thread
+///@param code the kind of error
+///@param format printf-style format of the message
+///@param args the arguments of the message
+void diagnoseList(DiagnosticCode code, const char* format, va_list args);
+
+
+///Write the buffered diagnostics to stderr
+void flushDiagnostics(void);
+
+
+///Write the buffered diagnostics to stderr if fred is killed by a
+///  signal, such as a crash or SIGTERM, that would otherwise lose them;
+///  handlers installed later for some of the signals replace these
+void catchFatalSignals(void);
+
+
+///Get the number of errors reported so far, of every code
+///@returns the count, including those not printed
+size_t diagnosticTotal(void);
+
+
+///Print the number of errors of each code reported so far, if any,
+///  and flush the diagnostics
+void summarizeDiagnostics(void);
+
+#endif
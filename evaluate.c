@@ -4,62 +4,152 @@
 
 
 #include "evaluate.h"
+#include "diagnostics.h"
+#include "memstats.h"
+#include "metrics.h"
+#include "probes.h"
+#include "reduce.h"
+#include <pthread.h>
 
 
 //default buffer size for string allocated in seperateString
 #define DEFAULT_SIZE 30
 //amount to increment buffer when reallocing
 #define SIZE_INC 10
+//number of slots in the cache of compiled expressions; a power of 2
+#define EXPRESSION_CACHE 4096
+//most functions that can be defined while fred runs
+#define MAX_FUNCTIONS 65536
+//pushed on the operator stack for the parenthesis that opens a call
+#define CALL_OPEN 'c'
 
-#define isOperator(c) (c == '+' || c == '-' || c == '*' || \
-		       c == '/' || c == '%' || c == '(' || c == ')')
+#define isOperator(c) (c == '+' || c == '-' || c == '*' || c == '/' || \
+		       c == '%' || c == '(' || c == ')' || c == ',')
+#define isOpening(c) ((c) == '(' || (c) == CALL_OPEN)
 
 
 
+//stack of values used when evaluating postfix expressions
+DEFINE_STACK(ValueStack, Token)
+
+
+//A call whose arguments are being converted to postfix
+typedef struct OpenCall_ {
+  //name of the function
+  char* name;
+  //commas seen so far between its arguments
+  int commas;
+  //number of tokens output before the first argument
+  size_t start;
+} OpenCall;
+
+//stack of the calls being converted, innermost on top
+DEFINE_STACK(CallStack, OpenCall)
+
+
+//A function defined by a function statement
+typedef struct FunctionDef_ {
+  //name it was defined with; tables defining the same function share it
+  SymbolName name;
+  //compiled body, with one reference held by the function for the
+  //  names its tokens point to
+  Expression* body;
+  //tokens of the body with the calls it makes to small functions
+  //  inlined as they were defined then
+  Expression code;
+  //number of times each parameter appears in the code
+  int uses[MAX_PARAMETERS];
+  //whether calls are inlined: the body is small and calls nothing
+  int inlinable;
+  //serial of the table the body is bound to, and its symbols
+  uint64_t boundTable;
+  SymbolId* bound;
+} FunctionDef;
+
+//Arguments of a call being evaluated
+typedef struct Frame_ {
+  Token arguments[MAX_PARAMETERS];
+} Frame;
+
+
+//whether evaluateCompiled reuses results
+static int memoEnabled = 1;
+//most tokens and deepest stack of values an expression may have, 0 for
+//  no limit
+static size_t tokenLimit;
+static size_t depthLimit;
+//counts of evaluations and reused results
+static MemoStats memoStats;
+//whether sums of reals may be split between threads
+static int fastMath;
+
+//recently compiled expressions, indexed by a hash of their source
+static Expression* expressionCache[EXPRESSION_CACHE];
+//protects the cache and reference counts, since parser threads compile
+static pthread_mutex_t cacheLock = PTHREAD_MUTEX_INITIALIZER;
+//error of an expression that could not be compiled for lack of memory,
+//  never freed; and the expression given out when there is not even
+//  memory for one, never cached or freed, and only read
+static char noMemory[] = "Error: no memory left to compile the expression\n";
+static Expression noMemoryExpression = {.error = noMemory, .refs = 1};
+
+//every function defined, indexed by the value of its symbols; entries
+//  are only added, under the lock, so they are read without it
+static FunctionDef* functions[MAX_FUNCTIONS];
+static size_t functionCount;
+static pthread_mutex_t functionLock = PTHREAD_MUTEX_INITIALIZER;
+//one frame per level of nested calls, allocated with the first
+//  function so that calls never allocate
+static Frame* frames;
+static int callDepth;
+
+
 //struct to represent a sequence of tokens
 typedef struct TokenList_ {
   //sequence of tokens
-  Token** list;
+  Token* list;
   //number of tokens in sequence
   size_t size;
   //max capacity of sequence
   size_t capacity;
+  //whether a token was dropped because there was no memory to grow
+  int failed;
 } TokenList;
 
 
-//Create a new token list
-//@returns a new token list
-static TokenList* CreateTokenList(void){
-  TokenList* tokList = malloc(sizeof(TokenList));
+//Initialize an empty token list
+//@param tokList the list to initialize
+static void InitTokenList(TokenList* tokList){
   tokList->size = 0;
   tokList->capacity = INITIAL_SIZE;
-  tokList->list = malloc(sizeof(Token*) * INITIAL_SIZE);
+  tokList->list = memAlloc(MemPostfix, sizeof(Token) * INITIAL_SIZE);
+  tokList->failed = !tokList->list;
 
-  return tokList;
-}
-
-
-//Free a token list, including the memory allocated for the tokens
-//@param tokList the list of tokens to destroy
-static void DestroyTokenList(TokenList* tokList){
-  size_t i;
-  for(i = 0; i < tokList->size; i++){
-    free(tokList->list[i]);
-  }
-  free(tokList->list);
-  free(tokList);
   return;
 }
 
-//Add a token to the list
+
+//Add a copy of a token to the list; once the list cannot grow, the
+//  token is dropped and the list marked as failed
 //@param tokList the list of tokens to add to
 //@param token the token to add
-static void AddToken(TokenList* tokList, Token* token){
-  tokList->list[tokList->size] = token;
+static void AddToken(TokenList* tokList, const Token* token){
+  Token* grown;
+
+  if(tokList->failed){
+    return;
+  }
+  tokList->list[tokList->size] = *token;
   tokList->size++;
 
   if(tokList->size == tokList->capacity){
-    tokList->list = (Token**) realloc(tokList->list, tokList->capacity * 2 * sizeof(Token*));
+    grown = (Token*) memRealloc(MemPostfix, tokList->list,
+				tokList->capacity * 2 * sizeof(Token));
+    if(!grown){
+      tokList->failed = 1;
+      return;
+    }
+    tokList->list = grown;
     tokList->capacity *= 2;
   }
 
@@ -81,7 +171,8 @@ int isFloat(char* str){
 
 ///Seperate the operands and operators/parentheses with whitespace in the string
 ///@param str the string to seperate
-///@returns a dynamically allocated copy of str with seperated operators and operands
+///@returns a dynamically allocated copy of str with seperated operators and operands,
+///  or NULL if there is no memory left
 static char* seperateString(const char* str){
   //index for str
   int i;
@@ -91,16 +182,24 @@ static char* seperateString(const char* str){
  
 
   //buffer to store the seperated string into
-  char* dest = (char*) malloc(sizeof(char) * size);
+  char* dest = (char*) memAlloc(MemTokens, sizeof(char) * size);
+  char* grown;
 
-  
+  if(!dest){
+    return NULL;
+  }
   for(i = 0, j = 0; str[i]; i++){
     
     //each iteration adds at most 4 characters to dest string, so we make
     //  sure there is enough space before moving on to the loop
     if(j >= size - 5){
       size += SIZE_INC;
-      dest = (char*) realloc((void*) dest, size * sizeof(char));
+      grown = (char*) memRealloc(MemTokens, (void*) dest, size * sizeof(char));
+      if(!grown){
+	memFree(dest);
+	return NULL;
+      }
+      dest = grown;
   }
     //char is an operator or parenthesis
     if(isOperator(str[i])){
@@ -144,141 +243,354 @@ static int verifyModulo(Token* dividend, Token* divisor){
 }
 
 
+//Divide two integers as the / or % of an operator token, reporting
+//  division by zero rather than letting the processor trap on it
+//@param operator the operator token, set to the result
+//@param dividend the dividend
+//@param divisor the divisor
+//@returns 1 if the division was performed, 0 if the divisor was zero
+static int divideIntegers(Token* operator, int dividend, int divisor){
+  int modulo = (operator->value.iVal == '%');
+
+  if(divisor == 0){
+    operator->valType = Unknown;
+    diagnose(DiagDivideByZero, "Error: division by zero\n");
+    return 0;
+  }
+  //the one quotient that overflows wraps around, as in the scenarios
+  if(divisor == -1){
+    operator->value.iVal = modulo ? 0 : (int) (0u - (unsigned) dividend);
+  }
+  else{
+    operator->value.iVal = modulo ? dividend % divisor : dividend / divisor;
+  }
+  return 1;
+}
+
+
+//Record a compile error in an expression
+//@param expression the expression being compiled
+//@param format printf-style format of the message
+//@param tokString the token the error is about
+static void setCompileError(Expression* expression, const char* format,
+			    const char* tokString){
+  size_t len = strlen(format) + strlen(tokString) + 1;
+  expression->error = memAlloc(MemPostfix, len);
+  if(!expression->error){
+    expression->error = noMemory;
+    return;
+  }
+  snprintf(expression->error, len, format, tokString);
+  return;
+}
+
+
+//Record that an expression could not be compiled for lack of memory,
+//  which is reported as DiagPoolExhausted rather than a bad expression
+//@param expression the expression being compiled
+static void setNoMemory(Expression* expression){
+  if(expression->error != noMemory){
+    memFree(expression->error);
+  }
+  expression->error = noMemory;
+  return;
+}
+
+
+//Add an operator to the list
+//@param tokList the list of tokens to add to
+//@param operator the operator character
+static void AddOperator(TokenList* tokList, char operator){
+  Token token;
+
+  token.type = Operator;
+  token.valType = Integer;
+  token.value.iVal = operator;
+  token.name = NULL;
+  AddToken(tokList, &token);
+  return;
+}
+
+
+//Check that every operator of a postfix expression has two operands
+//  and that exactly one value is left, recording an error if not
+//@param expression the converted expression
+static void checkOperands(Expression* expression){
+  size_t depth = 0;
+  size_t deepest = 0;
+  size_t i;
+
+  for(i = 0; i < expression->size; i++){
+    if(expression->tokens[i].type == Call){
+      //a call takes its arguments and leaves its result
+      if(depth < (size_t) expression->tokens[i].value.iVal){
+	break;
+      }
+      depth = depth - expression->tokens[i].value.iVal + 1;
+    }
+    else if(expression->tokens[i].type == Reduce){
+      depth = depth - reductionArity(expression->tokens[i].value.iVal) + 1;
+    }
+    else if(expression->tokens[i].type != Operator){
+      depth++;
+    }
+    else if(depth < 2){
+      break;
+    }
+    else{
+      depth--;
+    }
+    deepest = depth > deepest ? depth : deepest;
+  }
+
+  if(expression->size && (i < expression->size || depth != 1)){
+    setCompileError(expression, "Error: missing operand or operator in %s\n",
+		    expression->source);
+  }
+  else if(tokenLimit && expression->size > tokenLimit){
+    setCompileError(expression, "Error: too many tokens in %s\n", expression->source);
+  }
+  else if(depthLimit && deepest > depthLimit){
+    setCompileError(expression, "Error: too deeply nested in %s\n", expression->source);
+  }
+  return;
+}
+
+
+//Add a call to the list once its arguments have been output. A call
+//  to a built-in reduction becomes a Reduce, whose arguments must each
+//  be the name of an array
+//@param tokList the list of tokens to add to
+//@param call the call
+//@returns 1 on success, 0 if the arguments of a reduction are not names
+static int AddCall(TokenList* tokList, OpenCall* call){
+  Token token;
+  int kind = findReduction(call->name);
+  size_t i;
+
+  token.type = Call;
+  token.valType = Unknown;
+  //a call with nothing between its parentheses takes no arguments
+  token.value.iVal = (tokList->size == call->start && !call->commas) ? 0 : call->commas + 1;
+  token.name = call->name;
+
+  if(kind >= 0){
+    for(i = call->start; i < tokList->size; i++){
+      if(tokList->list[i].type != Reference){
+	break;
+      }
+      tokList->list[i].type = ArrayRef;
+    }
+    if(i < tokList->size || token.value.iVal != reductionArity(kind) ||
+       tokList->size - call->start != (size_t) token.value.iVal){
+      //the arrays are not resolved, so the error is reported as is
+      tokList->size = call->start;
+      return 0;
+    }
+    token.type = Reduce;
+    token.value.iVal = kind;
+  }
+  AddToken(tokList, &token);
+  return 1;
+}
+
+
+//Check whether the rest of the text starts with a left parenthesis
+//@param rest the text after the current token
+//@returns 1 if it does, 0 otherwise
+static int opensCall(const char* rest){
+  while(rest && (*rest == ' ' || *rest == '\t')){
+    rest++;
+  }
+  return rest && *rest == '(';
+}
+
+
+//Stop converting after an error, keeping the tokens output so far so
+//  that references before the error are still resolved first
+//@param expression the expression being converted
+//@param postExpression the tokens output so far
+//@param stack the operator stack
+//@param calls the stack of open calls
+static void abandonPostfix(Expression* expression, TokenList* postExpression,
+			   OperatorStack* stack, CallStack* calls){
+  FreeOperatorStack(stack);
+  FreeCallStack(calls);
+  expression->tokens = postExpression->list;
+  expression->size = postExpression->size;
+  return;
+}
+
+
 //Convert a string to a sequence of tokens in postfix notation
-//@param table the symbol table to use
-//@param expression the expression as a null-terminated string
-//@returns a sequence of tokens in postfix notation or NULL if any token is not recognized
-static TokenList* convertToPostfix(SymbolTable* table, char* expression){
+//@param expression the expression to fill in; its text is the
+//  seperated source and is tokenized in place
+static void convertToPostfix(Expression* expression){
   //used as the output for the postfix token sequence
-  TokenList* postExpression = CreateTokenList();
-  //stack to push operators on
-  Stack* stack = CreateStack();
+  TokenList postExpression;
+  //stack to push operators and left parentheses on
+  OperatorStack stack;
+  //calls whose closing parenthesis has not been read
+  CallStack calls;
+  OpenCall call;
 
   //string for the next token
   char* tokString;
+  //position within the text for strtok_r
+  char* save = NULL;
   const char* delim = " \t\n";
   char firstCh;
 
-  //used to store tokens that will be appended to the output list
-  Token* token = NULL;
-  //used to store tokens popped from the stack
-  Token* tempToken = NULL;
+  //operand token appended to the output list
+  Token token;
+
+  InitTokenList(&postExpression);
+  InitOperatorStack(&stack);
+  InitCallStack(&calls);
+  token.name = NULL;
 
   //while there are still tokens remaining, read the next
-  for(tokString = strtok(expression, delim);
+  for(tokString = strtok_r(expression->text, delim, &save);
       tokString;
-      tokString = strtok(NULL, delim)){
+      tokString = strtok_r(NULL, delim, &save)){
     
     firstCh = tokString[0];
-    token = malloc(sizeof(Token));
 
     
     //token is a number
     if(isdigit(firstCh)){
-      token->type = Operand;
+      token.type = Operand;
+      token.name = NULL;
       if(isFloat(tokString)){
-	token->valType = Float;
-	token->value.fVal = strtof(tokString, NULL);
+	token.valType = Float;
+	token.value.fVal = strtof(tokString, NULL);
       }
       else{
-	token->valType = Integer;
-	token->value.iVal = (int) strtol(tokString, NULL, 10);
+	token.valType = Integer;
+	token.value.iVal = (int) strtol(tokString, NULL, 10);
       }
-      AddToken(postExpression, token);
+      AddToken(&postExpression, &token);
     }
-    //token is a symbol identifier
-    else if(isalpha(firstCh)){
-      Symbol* symbol = GetSymbol(table, tokString);
-      //symbol does not exist in table
-      if(!symbol){
-	fprintf(stderr, "Error: symbol %s not found in table\n",
-		tokString);
-	free(token);
-	DestroyTokenList(postExpression);
-	return NULL;
+    //token is a function name followed by its parenthesis; the call is
+    //  output after its arguments
+    else if(isalpha(firstCh) && opensCall(save)){
+      call.name = tokString;
+      call.commas = 0;
+      call.start = postExpression.size;
+      if(!PushCallStack(&calls, call) || !PushOperatorStack(&stack, CALL_OPEN)){
+	setNoMemory(expression);
+	abandonPostfix(expression, &postExpression, &stack, &calls);
+	return;
       }
-      token->valType = symbol->type;
-      token->value = symbol->value;
-      token->type = Operand;
-      AddToken(postExpression, token);
+      strtok_r(NULL, delim, &save);
+    }
+    //token is a symbol identifier, resolved when evaluated
+    else if(isalpha(firstCh)){
+      token.type = Reference;
+      token.valType = Unknown;
+      token.value.iVal = 0;
+      token.name = tokString;
+      AddToken(&postExpression, &token);
     }
     //token is an operator or parenthesis
     else{
       switch(firstCh){
       case '(':
-	token->type = LParenthesis;
-	token->valType = Integer;
-	token->value.iVal = '(';
-	PushStack(stack, (void*) token);
+	if(!PushOperatorStack(&stack, '(')){
+	  setNoMemory(expression);
+	  abandonPostfix(expression, &postExpression, &stack, &calls);
+	  return;
+	}
 	break;
       case ')':
-	free(token);
-	token = (Token*) PopStack(stack);
 	//pop operators from the stack until the left paranthesis is reached
-	while(token->type != LParenthesis){
-	  AddToken(postExpression, token);
-	  token = (Token*) PopStack(stack);
+	while(!EmptyOperatorStack(&stack) && !isOpening(*TopOperatorStack(&stack))){
+	  AddOperator(&postExpression, PopOperatorStack(&stack));
+	}
+	//no left parenthesis to match
+	if(EmptyOperatorStack(&stack)){
+	  setCompileError(expression, "Error: unbalanced parentheses in %s\n",
+			  expression->source);
+	  abandonPostfix(expression, &postExpression, &stack, &calls);
+	  return;
+	}
+	//drop the left parenthesis, ending the call it opened
+	if(PopOperatorStack(&stack) == CALL_OPEN){
+	  call = PopCallStack(&calls);
+	  if(!AddCall(&postExpression, &call)){
+	    setCompileError(expression, "Error: bad arguments to a reduction in %s\n",
+			    expression->source);
+	    abandonPostfix(expression, &postExpression, &stack, &calls);
+	    return;
+	  }
 	}
-	//free the left parenthesis token
-	free(token);
+	break;
+      case ',':
+	//finish the argument before the comma
+	while(!EmptyOperatorStack(&stack) && !isOpening(*TopOperatorStack(&stack))){
+	  AddOperator(&postExpression, PopOperatorStack(&stack));
+	}
+	if(EmptyOperatorStack(&stack) || *TopOperatorStack(&stack) != CALL_OPEN){
+	  setCompileError(expression, "Error: comma outside of a function call in %s\n",
+			  expression->source);
+	  abandonPostfix(expression, &postExpression, &stack, &calls);
+	  return;
+	}
+	TopCallStack(&calls)->commas++;
 	break;
       case '+':
       case '-':
-	token->type = Operator;
-	token->valType = Integer;
-	token->value.iVal = firstCh;
-	while(!EmptyStack(stack)){
-	  tempToken = PopStack(stack);
-	  if(tempToken->type != LParenthesis){
-	    AddToken(postExpression, tempToken);
-	  }
-	  else{
-	    PushStack(stack, (void*) tempToken);
-	    break;
-	  }
+	while(!EmptyOperatorStack(&stack) && !isOpening(*TopOperatorStack(&stack))){
+	  AddOperator(&postExpression, PopOperatorStack(&stack));
+	}
+	if(!PushOperatorStack(&stack, firstCh)){
+	  setNoMemory(expression);
+	  abandonPostfix(expression, &postExpression, &stack, &calls);
+	  return;
 	}
-	PushStack(stack, (void*) token);
-	tempToken = NULL;
-	token = NULL;
 	break;
       case '*':
       case '/':
       case '%':
-	token->type = Operator;
-	token->valType = Integer;
-	token->value.iVal = firstCh;
-	while(!EmptyStack(stack)){
-	  tempToken = (Token*) PopStack(stack);
-	  if(tempToken->type != LParenthesis && tempToken->value.iVal != '+' &&
-	     tempToken->value.iVal != '-'){
-	    AddToken(postExpression, tempToken);
-	  }
-	  else{
-	    PushStack(stack, (void*) tempToken);
-	    break;
-	  }
+	while(!EmptyOperatorStack(&stack) && !isOpening(*TopOperatorStack(&stack)) &&
+	      *TopOperatorStack(&stack) != '+' && *TopOperatorStack(&stack) != '-'){
+	  AddOperator(&postExpression, PopOperatorStack(&stack));
+	}
+	if(!PushOperatorStack(&stack, firstCh)){
+	  setNoMemory(expression);
+	  abandonPostfix(expression, &postExpression, &stack, &calls);
+	  return;
 	}
-	PushStack(stack, (void*) token);
-	tempToken = NULL;
-	token = NULL;
 	break;
       default:
-	fprintf(stderr, "Unknown operator %s\n", tokString);
-	DestroyTokenList(postExpression);
-	free(token);
-	DestroyStack(stack);
-	return NULL;
+	//keep the tokens read so far so that references before the
+	//  bad operator are still resolved first when evaluated
+	setCompileError(expression, "Unknown operator %s\n", tokString);
+	abandonPostfix(expression, &postExpression, &stack, &calls);
+	return;
       }
     }
   }
 
-  while(!EmptyStack(stack)){
-    token = (Token*) PopStack(stack);
-    AddToken(postExpression, token);
+  while(!EmptyOperatorStack(&stack)){
+    if(isOpening(*TopOperatorStack(&stack)) && !expression->error){
+      setCompileError(expression, "Error: unbalanced parentheses in %s\n",
+		      expression->source);
+    }
+    AddOperator(&postExpression, PopOperatorStack(&stack));
   }
 
-  DestroyStack(stack);
-  return postExpression;
+  FreeOperatorStack(&stack);
+  FreeCallStack(&calls);
+  expression->tokens = postExpression.list;
+  expression->size = postExpression.size;
+  if(postExpression.failed){
+    setNoMemory(expression);
+  }
+  if(!expression->error){
+    checkOperands(expression);
+  }
+  return;
 }
 
 
@@ -307,6 +619,8 @@ static void performOperation(Token* operator,
 
   int isFloat = (operand1->valType == Float);
 
+  //integers wrap on overflow, so a run of + or * gives the same result
+  //  in any order
   switch(operator->value.iVal){
   case '+':
     if(isFloat){
@@ -314,8 +628,8 @@ static void performOperation(Token* operator,
 	operand1->value.fVal + operand2->value.fVal;
     }
     else{
-      operator->value.iVal =
-	operand1->value.iVal + operand2->value.iVal;
+      operator->value.iVal = (int)
+	((unsigned) operand1->value.iVal + (unsigned) operand2->value.iVal);
     }
     break;
   case '-':
@@ -324,8 +638,8 @@ static void performOperation(Token* operator,
 	operand1->value.fVal - operand2->value.fVal;
     }
     else{
-      operator->value.iVal =
-	operand1->value.iVal - operand2->value.iVal;
+      operator->value.iVal = (int)
+	((unsigned) operand1->value.iVal - (unsigned) operand2->value.iVal);
     }
     break;
   case '*':
@@ -334,8 +648,8 @@ static void performOperation(Token* operator,
 	operand1->value.fVal * operand2->value.fVal;
     }
     else{
-      operator->value.iVal =
-	operand1->value.iVal * operand2->value.iVal;
+      operator->value.iVal = (int)
+	((unsigned) operand1->value.iVal * (unsigned) operand2->value.iVal);
     }
     break;
   case '/':
@@ -343,30 +657,29 @@ static void performOperation(Token* operator,
       operator->value.fVal =
 	operand1->value.fVal / operand2->value.fVal;
     }
-    else{
-      operator->value.iVal =
-	operand1->value.iVal / operand2->value.iVal;
+    else if(!divideIntegers(operator, operand1->value.iVal, operand2->value.iVal)){
+      return;
     }
     break;
   case '%':
     if(isFloat){
       if(verifyModulo(operand1, operand2)){
-	operator->value.iVal =
-	  (int) operand1->value.fVal %
-	  (int) operand2->value.fVal;
 	operator->valType = Integer;
+	if(!divideIntegers(operator, (int) operand1->value.fVal,
+			   (int) operand2->value.fVal)){
+	  return;
+	}
       }
       else{
 	operator->valType = Unknown;
-	fprintf(stderr, "Error: modulo operator used on float operands %f and %f\n",
-		operand1->value.fVal,
-		operand2->value.fVal);
+	diagnose(DiagFloatModulo,
+		 "Error: modulo operator used on float operands %f and %f\n",
+		 operand1->value.fVal, operand2->value.fVal);
 	return;
       }
     }
-    else{
-      operator->value.iVal =
-	operand1->value.iVal % operand2->value.iVal;
+    else if(!divideIntegers(operator, operand1->value.iVal, operand2->value.iVal)){
+      return;
     }
     break;
   default:
@@ -379,57 +692,1318 @@ static void performOperation(Token* operator,
 }
 
 
-//Evaluate an arithmetic expression and return the result as a token
-Token* evaluateExpression(SymbolTable* table, char* expression){
-  char* processedExp = seperateString(expression);
-  
-  TokenList* postExpression = convertToPostfix(table, processedExp);
+//Hash the source of an expression into a cache slot
+//@param source the null-terminated source
+//@returns the slot
+static size_t hashSource(const char* source){
+  size_t hash = 5381;
+
+  while(*source){
+    hash = hash * 33 + (unsigned char) *source++;
+  }
+  return hash & (EXPRESSION_CACHE - 1);
+}
+
 
-  free(processedExp);
+//Drop a reference to an expression, freeing it if it was the last.
+//  The cache lock must be held
+//@param expression the expression
+static void releaseExpression(Expression* expression){
+  size_t i;
+
+  if(expression == &noMemoryExpression || --expression->refs > 0){
+    return;
+  }
+  memFree(expression->source);
+  if(expression->compiled != expression->tokens){
+    memFree(expression->compiled);
+  }
+  memFree(expression->tokens);
+  memFree(expression->text);
+  if(expression->error != noMemory){
+    memFree(expression->error);
+  }
+  memFree(expression->bound);
+  memFree(expression->versions);
+  for(i = 0; i < expression->chainCount; i++){
+    memFree(expression->chains[i].starts);
+  }
+  memFree(expression->chains);
+  memFree(expression);
+  return;
+}
+
+
+//Order runs of one operator by their first token, a run before the
+//  runs inside it
+//@param a the first run
+//@param b the second run
+//@returns the order of the two
+static int compareChains(const void* a, const void* b){
+  const Chain* x = a;
+  const Chain* y = b;
+
+  if(x->starts[0] != y->starts[0]){
+    return x->starts[0] < y->starts[0] ? -1 : 1;
+  }
+  return (x->end < y->end) - (x->end > y->end);
+}
+
+
+//Find the long runs of + or * in a compiled expression without calls.
+//  Each operator is the root of the value it leaves, whose left operand
+//  ends just before the first token of its right operand; a run
+//  continues while the left operand is left by the same operator
+//@param expression the expression
+static void findChains(Expression* expression){
+  size_t size = expression->size;
+  //first token of the value each token leaves, and the values on the
+  //  stack by the token that left them
+  size_t* first = memAlloc(MemPostfix, sizeof(size_t) * size);
+  size_t* stack = memAlloc(MemPostfix, sizeof(size_t) * size);
+  //terms of the run ending at each operator, 0 once it is known to be
+  //  part of a longer one
+  size_t* terms = memAlloc(MemPostfix, sizeof(size_t) * size);
+  Token* tokens = expression->tokens;
+  Chain* chains;
+  Chain* chain;
+  size_t depth = 0;
+  size_t left;
+  size_t i;
+  size_t j;
+  size_t k;
+  int arity;
 
-  //error converting to postfix; return
-  if(!postExpression){
+  //without the memory the runs are only evaluated in order
+  if(!first || !stack || !terms){
+    memFree(first);
+    memFree(stack);
+    memFree(terms);
+    return;
+  }
+  for(i = 0; i < size; i++){
+    terms[i] = 0;
+    first[i] = i;
+    if(tokens[i].type == Operator){
+      left = stack[depth - 2];
+      first[i] = first[left];
+      depth -= 2;
+      if(tokens[i].value.iVal == '+' || tokens[i].value.iVal == '*'){
+	terms[i] = 2;
+	if(tokens[left].type == Operator && tokens[left].value.iVal == tokens[i].value.iVal){
+	  terms[i] = terms[left] + 1;
+	  terms[left] = 0;
+	}
+      }
+    }
+    else if(tokens[i].type == Reduce){
+      arity = reductionArity(tokens[i].value.iVal);
+      first[i] = first[stack[depth - arity]];
+      depth -= arity;
+    }
+    stack[depth++] = i;
+  }
+
+  for(i = 0; i < size; i++){
+    if(terms[i] < 2 * CHAIN_TERMS){
+      continue;
+    }
+    chains = memRealloc(MemPostfix, expression->chains,
+			sizeof(Chain) * (expression->chainCount + 1));
+    if(!chains){
+      break;
+    }
+    expression->chains = chains;
+    chain = &expression->chains[expression->chainCount];
+    chain->starts = memAlloc(MemPostfix, sizeof(size_t) * terms[i]);
+    if(!chain->starts){
+      break;
+    }
+    expression->chainCount++;
+    chain->operator = (char) tokens[i].value.iVal;
+    chain->terms = terms[i];
+    chain->end = i + 1;
+    //walk down the left operands, taking each right operand as a term
+    for(j = i, k = terms[i] - 1; k > 0; k--){
+      chain->starts[k] = first[j - 1];
+      j = first[j - 1] - 1;
+    }
+    chain->starts[0] = first[j];
+  }
+  if(expression->chainCount > 1){
+    qsort(expression->chains, expression->chainCount, sizeof(Chain), compareChains);
+  }
+
+  memFree(first);
+  memFree(stack);
+  memFree(terms);
+  return;
+}
+
+
+//Create an expression and compile its source
+//@param source the infix expression
+//@param refs the number of references the caller holds
+//@returns the compiled expression
+static Expression* CreateExpression(const char* source, int refs){
+  Expression* compiled = memAlloc(MemPostfix, sizeof(Expression));
+  size_t i;
+
+  if(!compiled){
+    return &noMemoryExpression;
+  }
+  compiled->source = memStrdup(MemPostfix, source);
+  compiled->refs = refs;
+  compiled->tokens = NULL;
+  compiled->size = 0;
+  compiled->compiled = NULL;
+  compiled->compiledSize = 0;
+  compiled->inlinedFor = 0;
+  compiled->inlined = 0;
+  compiled->dispatched = 0;
+  compiled->parameters = 0;
+  compiled->error = NULL;
+  compiled->memoTable = 0;
+  compiled->bound = NULL;
+  compiled->versions = NULL;
+  compiled->memoValid = 0;
+  compiled->chains = NULL;
+  compiled->chainCount = 0;
+  compiled->text = seperateString(source);
+  //an expression is cached by its source and compiled from its text
+  if(!compiled->source || !compiled->text){
+    memFree(compiled->source);
+    memFree(compiled->text);
+    memFree(compiled);
+    return &noMemoryExpression;
+  }
+
+  convertToPostfix(compiled);
+
+  if(!compiled->error && compiled->size == 0){
+    compiled->error = memStrdup(MemPostfix, "Error: empty expression\n");
+    if(!compiled->error){
+      compiled->error = noMemory;
+    }
+  }
+
+  //keep the tokens as compiled, since inlining calls replaces them
+  for(i = 0; i < compiled->size; i++){
+    if(compiled->tokens[i].type == Call){
+      compiled->dispatched++;
+    }
+  }
+  if(compiled->dispatched){
+    compiled->compiled = compiled->tokens;
+    compiled->compiledSize = compiled->size;
+  }
+  //a run long enough to split has a token per term and per operator
+  else if(!compiled->error && compiled->size >= 4 * CHAIN_TERMS - 1){
+    findChains(compiled);
+  }
+  return compiled;
+}
+
+
+//Compile an infix expression
+Expression* compileExpression(const char* expression){
+  const char* source = expression ? expression : "";
+  size_t slot = hashSource(source);
+  Expression* compiled;
+  Expression* evicted;
+
+  pthread_mutex_lock(&cacheLock);
+  compiled = expressionCache[slot];
+  if(compiled && strcmp(compiled->source, source) == 0){
+    compiled->refs++;
+    pthread_mutex_unlock(&cacheLock);
+    return compiled;
+  }
+  pthread_mutex_unlock(&cacheLock);
+
+  //held by the caller and the cache
+  compiled = CreateExpression(source, 2);
+  if(compiled == &noMemoryExpression){
+    return compiled;
+  }
+
+  //replace whatever was in the slot
+  pthread_mutex_lock(&cacheLock);
+  evicted = expressionCache[slot];
+  expressionCache[slot] = compiled;
+  if(evicted){
+    releaseExpression(evicted);
+  }
+  pthread_mutex_unlock(&cacheLock);
+
+  return compiled;
+}
+
+
+//Compile the body of a function
+Expression* compileFunctionBody(const char* body, char** parameters, size_t count){
+  Expression* compiled = CreateExpression(body ? body : "", 1);
+  SymbolName name;
+  size_t i;
+  size_t j;
+
+  if(compiled == &noMemoryExpression){
+    return compiled;
+  }
+  compiled->parameters = count;
+  for(i = 0; i < compiled->size; i++){
+    if(compiled->tokens[i].type != Reference){
+      continue;
+    }
+    name = PackName(compiled->tokens[i].name);
+    for(j = 0; j < count; j++){
+      if(PackName(parameters[j]).word == name.word){
+	compiled->tokens[i].type = Parameter;
+	compiled->tokens[i].value.iVal = (int) j;
+	break;
+      }
+    }
+  }
+  return compiled;
+}
+
+
+//Release a compiled expression
+void DestroyExpression(Expression* expression){
+  pthread_mutex_lock(&cacheLock);
+  releaseExpression(expression);
+  pthread_mutex_unlock(&cacheLock);
+  return;
+}
+
+
+//Empty the cache of compiled expressions
+void clearExpressionCache(void){
+  size_t i;
+
+  pthread_mutex_lock(&cacheLock);
+  for(i = 0; i < EXPRESSION_CACHE; i++){
+    if(expressionCache[i]){
+      releaseExpression(expressionCache[i]);
+      expressionCache[i] = NULL;
+    }
+  }
+  pthread_mutex_unlock(&cacheLock);
+  return;
+}
+
+
+//Find the function a call is to, as defined in a table
+//@param table the symbol table
+//@param call the Call token
+//@param id set to the symbol of the function, if not NULL
+//@returns the function, or NULL if the name is not a function taking
+//  that many arguments
+static FunctionDef* findFunction(SymbolTable* table, const Token* call, SymbolId* id){
+  SymbolId symbol = GetSymbol(table, call->name);
+  FunctionDef* function;
+
+  if(symbol == NO_SYMBOL || GetSymbolType(table, symbol) != Function){
     return NULL;
   }
-  
-  Token* token;
-  Token* operand1;
-  Token* operand2;
-  Stack* stack = CreateStack();
+  function = functions[GetSymbolValue(table, symbol).iVal];
+  if(function->code.parameters != (size_t) call->value.iVal){
+    return NULL;
+  }
+  if(id){
+    *id = symbol;
+  }
+  return function;
+}
+
+
+//Check whether two token sequences are the same
+//@param a the first tokens
+//@param b the second tokens
+//@param size the number of tokens in each
+//@returns 1 if they are, 0 otherwise
+static int sameTokens(const Token* a, const Token* b, size_t size){
+  size_t i;
+
+  for(i = 0; i < size; i++){
+    if(a[i].type != b[i].type || a[i].valType != b[i].valType ||
+       a[i].value.iVal != b[i].value.iVal ||
+       (a[i].name && strcmp(a[i].name, b[i].name) != 0)){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+//Register a function, sharing an earlier one with the same name,
+//  parameters and code. The function lock must be held
+//@param name the packed name
+//@param body the compiled body, with its calls inlined
+//@returns the index of the function, -1 if too many are defined, or
+//  -2 if there is no memory left for it
+static int registerFunction(SymbolName name, Expression* body){
+  FunctionDef* function;
+  size_t i;
+
+  for(i = 0; i < functionCount; i++){
+    function = functions[i];
+    if(function->name.word == name.word &&
+       function->code.parameters == body->parameters &&
+       function->code.size == body->size &&
+       sameTokens(function->code.tokens, body->tokens, body->size)){
+      return (int) i;
+    }
+  }
+  if(functionCount == MAX_FUNCTIONS){
+    return -1;
+  }
+
+  if(!frames){
+    frames = memAlloc(MemStacks, sizeof(Frame) * MAX_CALL_DEPTH);
+  }
+  function = memAlloc(MemStatements, sizeof(FunctionDef));
+  if(!frames || !function){
+    memFree(function);
+    return -2;
+  }
+  //the body is inlined again for other tables, so the code is a copy
+  memset(&function->code, 0, sizeof(Expression));
+  function->code.tokens = memAlloc(MemStatements, sizeof(Token) * (body->size + 1));
+  function->bound = memAlloc(MemStatements, sizeof(SymbolId) * (body->size + 1));
+  if(!function->code.tokens || !function->bound){
+    memFree(function->code.tokens);
+    memFree(function->bound);
+    memFree(function);
+    return -2;
+  }
+  function->name = name;
+  function->body = body;
+  pthread_mutex_lock(&cacheLock);
+  body->refs++;
+  pthread_mutex_unlock(&cacheLock);
+
+  function->code.source = body->source;
+  function->code.parameters = body->parameters;
+  function->code.size = body->size;
+  memcpy(function->code.tokens, body->tokens, sizeof(Token) * body->size);
+
+  memset(function->uses, 0, sizeof(function->uses));
+  function->inlinable = body->size <= INLINE_TOKENS;
+  for(i = 0; i < body->size; i++){
+    if(body->tokens[i].type == Parameter){
+      function->uses[body->tokens[i].value.iVal]++;
+    }
+    else if(body->tokens[i].type == Call){
+      function->inlinable = 0;
+    }
+  }
+  function->boundTable = 0;
+  functions[functionCount] = function;
+  return (int) functionCount++;
+}
+
+
+//Check whether an expression failed to compile for lack of memory
+int outOfMemory(const Expression* expression){
+  return expression->error == noMemory;
+}
+
+
+//Define a function in a table
+SymbolId defineFunction(SymbolTable* table, const char* name, Expression* body){
+  Value value;
+  int index;
+  size_t i;
+
+  if(body->error){
+    diagnose(outOfMemory(body) ? DiagPoolExhausted : DiagBadFunction,
+	     "function error: %s", body->error);
+    return NO_SYMBOL;
+  }
+  //calls to small functions are inlined into the body, so a function
+  //  made of them can be inlined in turn
+  inlineCalls(table, body);
+  //only functions defined before this one can be called, which keeps
+  //  functions from calling themselves
+  for(i = 0; i < body->size; i++){
+    if(body->tokens[i].type == Call && !findFunction(table, &body->tokens[i], NULL)){
+      diagnose(DiagBadFunction,
+	       "function error: %s calls %s, which is not a function of %d arguments\n",
+	       name, body->tokens[i].name, body->tokens[i].value.iVal);
+      return NO_SYMBOL;
+    }
+  }
+  if(GetSymbol(table, name) != NO_SYMBOL){
+    diagnose(DiagDuplicateSymbol, "Symbol %s already exists in table\n", name);
+    return NO_SYMBOL;
+  }
 
+  pthread_mutex_lock(&functionLock);
+  index = registerFunction(PackName(name), body);
+  pthread_mutex_unlock(&functionLock);
+  if(index == -2){
+    diagnose(DiagPoolExhausted, "function error: no memory left to define %s\n", name);
+    return NO_SYMBOL;
+  }
+  if(index < 0){
+    diagnose(DiagBadFunction, "function error: more than %d functions defined\n",
+	     MAX_FUNCTIONS);
+    return NO_SYMBOL;
+  }
+
+  value.iVal = index;
+  return AddSymbol(table, name, Function, value);
+}
+
+
+//Forget every function defined so far
+void clearFunctions(void){
+  size_t i;
+
+  pthread_mutex_lock(&functionLock);
+  for(i = 0; i < functionCount; i++){
+    DestroyExpression(functions[i]->body);
+    memFree(functions[i]->code.tokens);
+    memFree(functions[i]->bound);
+    memFree(functions[i]);
+    functions[i] = NULL;
+  }
+  functionCount = 0;
+  memFree(frames);
+  frames = NULL;
+  pthread_mutex_unlock(&functionLock);
+  return;
+}
+
+
+//Check whether a call can be inlined with the arguments it is given.
+//  An argument used more than once is only copied when it is a single
+//  token, and one that is never used is only dropped when it is a number
+//@param function the function called
+//@param tokens the tokens output so far, ending with the arguments
+//@param size the number of tokens output
+//@param starts the index of the first token of each argument
+//@param argc the number of arguments
+//@returns 1 if the call can be inlined, 0 otherwise
+static int canInline(FunctionDef* function, Token* tokens, size_t size,
+		     size_t* starts, size_t argc){
+  size_t length;
+  size_t i;
+
+  if(!function->inlinable){
+    return 0;
+  }
+  for(i = 0; i < argc; i++){
+    length = (i + 1 < argc ? starts[i + 1] : size) - starts[i];
+    if(function->uses[i] != 1 && length != 1){
+      return 0;
+    }
+    if(!function->uses[i] && tokens[starts[i]].type != Operand){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+//Replace the arguments at the end of the output with the body of the
+//  function, with each parameter replaced by its argument
+//@param output the tokens output so far, ending with the arguments
+//@param function the function called
+//@param starts the index of the first token of each argument
+//@param argc the number of arguments
+static void inlineCall(TokenList* output, FunctionDef* function, size_t* starts,
+		       size_t argc){
+  Expression* body = &function->code;
+  size_t first = argc ? starts[0] : output->size;
+  size_t count = output->size - first;
+  Token* arguments = memAlloc(MemPostfix, sizeof(Token) * (count + 1));
+  size_t from;
+  size_t to;
   size_t i;
+  size_t j;
+
+  if(!arguments){
+    output->failed = 1;
+    return;
+  }
+  memcpy(arguments, output->list + first, sizeof(Token) * count);
+  output->size = first;
+  for(i = 0; i < body->size; i++){
+    if(body->tokens[i].type != Parameter){
+      AddToken(output, &body->tokens[i]);
+      continue;
+    }
+    j = body->tokens[i].value.iVal;
+    from = starts[j] - first;
+    to = (j + 1 < argc ? starts[j + 1] : first + count) - first;
+    for(; from < to; from++){
+      AddToken(output, &arguments[from]);
+    }
+  }
+  memFree(arguments);
+  return;
+}
+
+
+//Inline the calls of an expression to small functions
+void inlineCalls(SymbolTable* table, Expression* expression){
+  Token* compiled = expression->compiled;
+  TokenList output;
+  //index in the output of the first token of each value the tokens so
+  //  far leave on the stack
+  size_t* starts;
+  size_t depth = 0;
+  size_t start;
+  size_t argc;
+  int resolved = 1;
+  FunctionDef* function;
+  size_t i;
+
+  if(!compiled || expression->error || expression->inlinedFor == table->serial){
+    return;
+  }
+
+  InitTokenList(&output);
+  starts = memAlloc(MemPostfix, sizeof(size_t) * (expression->compiledSize + 1));
+  expression->inlined = 0;
+  expression->dispatched = 0;
+  output.failed = output.failed || !starts;
+
+  for(i = 0; i < expression->compiledSize && !output.failed; i++){
+    switch(compiled[i].type){
+    case Operator:
+      depth -= 2;
+      AddToken(&output, &compiled[i]);
+      depth++;
+      break;
+    case Call:
+      argc = compiled[i].value.iVal;
+      depth -= argc;
+      start = argc ? starts[depth] : output.size;
+      function = findFunction(table, &compiled[i], NULL);
+      resolved = resolved && function;
+      if(function && canInline(function, output.list, output.size, starts + depth, argc)){
+	inlineCall(&output, function, starts + depth, argc);
+	expression->inlined++;
+      }
+      else{
+	AddToken(&output, &compiled[i]);
+	expression->dispatched++;
+      }
+      starts[depth++] = start;
+      break;
+    case Reduce:
+      depth -= reductionArity(compiled[i].value.iVal);
+      start = starts[depth];
+      AddToken(&output, &compiled[i]);
+      starts[depth++] = start;
+      break;
+    default:
+      starts[depth++] = output.size;
+      AddToken(&output, &compiled[i]);
+    }
+  }
+  memFree(starts);
+
+  if(expression->tokens != compiled){
+    memFree(expression->tokens);
+  }
+  //without the memory to inline them, every call is dispatched, which
+  //  gives the same result
+  if(output.failed){
+    memFree(output.list);
+    expression->tokens = compiled;
+    expression->size = expression->compiledSize;
+    expression->inlined = 0;
+    expression->dispatched = 0;
+    for(i = 0; i < expression->size; i++){
+      expression->dispatched += compiled[i].type == Call;
+    }
+    resolved = 0;
+  }
+  else{
+    expression->tokens = output.list;
+    expression->size = output.size;
+  }
+  //calls to functions not yet defined are looked up again next time
+  expression->inlinedFor = resolved ? table->serial : 0;
+
+  //the tokens changed, so anything bound to them has to be redone
+  memFree(expression->bound);
+  memFree(expression->versions);
+  expression->bound = NULL;
+  expression->versions = NULL;
+  expression->memoTable = 0;
+  expression->memoValid = 0;
+  return;
+}
+
+
+//Resolve the references and calls of an expression to symbols
+//@param table the symbol table
+//@param expression the compiled expression
+//@param bound filled with the symbol for each Reference, ArrayRef and
+//  Call token
+//@returns the index of the first token that could not be resolved, or
+//  the size of the expression if every one was
+static size_t bindTokens(SymbolTable* table, Expression* expression, SymbolId* bound){
+  Type type;
+  size_t i;
+
+  //resolve references in source order before any operation is done
+  for(i = 0; i < expression->size; i++){
+    bound[i] = NO_SYMBOL;
+    if(expression->tokens[i].type == Reference ||
+       expression->tokens[i].type == ArrayRef){
+      bound[i] = GetSymbol(table, expression->tokens[i].name);
+      if(bound[i] == NO_SYMBOL){
+	return i;
+      }
+      //functions and arrays are not values, and only arrays are reduced
+      type = GetSymbolType(table, bound[i]);
+      if((expression->tokens[i].type == ArrayRef) != (type == Array) ||
+	 type == Function){
+	return i;
+      }
+    }
+    else if(expression->tokens[i].type == Call &&
+	    !findFunction(table, &expression->tokens[i], &bound[i])){
+      return i;
+    }
+  }
+
+  return expression->size;
+}
+
+
+//Report why a token of an expression could not be resolved
+//@param table the symbol table
+//@param token the Reference, ArrayRef or Call token
+static void reportUnbound(SymbolTable* table, const Token* token){
+  SymbolId id = GetSymbol(table, token->name);
+
+  if(id == NO_SYMBOL && token->type == Call){
+    diagnose(DiagUnknownSymbol, "Error: function %s not found in table\n", token->name);
+  }
+  else if(id == NO_SYMBOL){
+    diagnose(DiagUnknownSymbol, "Error: symbol %s not found in table\n", token->name);
+  }
+  else if(token->type == ArrayRef){
+    diagnose(DiagBadExpression, "Error: %s is not an array\n", token->name);
+  }
+  else if(token->type == Reference && GetSymbolType(table, id) == Array){
+    diagnose(DiagBadExpression, "Error: array %s can only be reduced\n", token->name);
+  }
+  else if(token->type == Reference){
+    diagnose(DiagBadExpression, "Error: function %s used without calling it\n",
+	     token->name);
+  }
+  else if(GetSymbolType(table, id) != Function){
+    diagnose(DiagBadExpression, "Error: %s is not a function\n", token->name);
+  }
+  else{
+    diagnose(DiagBadExpression, "Error: function %s does not take %d arguments\n",
+	     token->name, token->value.iVal);
+  }
+  return;
+}
+
+
+//Resolve the references of an expression to symbols
+const char* bindExpression(SymbolTable* table, Expression* expression,
+			   SymbolId* bound){
+  size_t i = bindTokens(table, expression, bound);
+
+  return i < expression->size ? expression->tokens[i].name : NULL;
+}
+
+
+//Check that a bound expression evaluates without errors
+int isSafeExpression(SymbolTable* table, Expression* expression,
+		     SymbolId* bound){
+  //types of the values on the evaluation stack
+  Type* types;
+  size_t depth = 0;
+  size_t i;
+  int safe = !expression->error;
+
+  types = memAlloc(MemPostfix, sizeof(Type) * (expression->size + 1));
+
+  for(i = 0; safe && i < expression->size; i++){
+    switch(expression->tokens[i].type){
+    case Reference:
+      types[depth++] = GetSymbolType(table, bound[i]);
+      break;
+    case Operand:
+      types[depth++] = expression->tokens[i].valType;
+      break;
+    //a function may fail in ways that depend on its arguments, and a
+    //  reduction on the lengths of its arrays
+    case Call:
+    case Parameter:
+    case ArrayRef:
+    case Reduce:
+      safe = 0;
+      break;
+    default:
+      if(depth < 2){
+	safe = 0;
+	break;
+      }
+      depth--;
+      //modulo of floats fails unless both happen to be whole numbers
+      if(expression->tokens[i].value.iVal == '%' &&
+	 (types[depth - 1] == Float || types[depth] == Float)){
+	safe = 0;
+      }
+      else if(expression->tokens[i].value.iVal == '%'){
+	types[depth - 1] = Integer;
+      }
+      else if(types[depth] == Float){
+	types[depth - 1] = Float;
+      }
+    }
+  }
+
+  memFree(types);
+  return safe && depth == 1;
+}
+
+
+static int evaluateTokens(SymbolTable* table, Expression* expression,
+			  SymbolId* bound, const Token* arguments, Token* result);
+static int shareChain(SymbolTable* table, Expression* expression, SymbolId* bound,
+		      const Chain* chain, Token* result);
+
+
+//Report that the stack of values could not grow
+//@returns 0, for the evaluation that failed
+static int stackExhausted(void){
+  diagnose(DiagPoolExhausted, "Error: no memory left for the evaluation stack\n");
+  return 0;
+}
+
+
+//Call a function, taking its arguments from the stack into the frame
+//  for the depth of the call
+//@param table the symbol table
+//@param id the symbol of the function
+//@param argc the number of arguments
+//@param stack the values of the caller, ending with the arguments
+//@param result set to the value of the call
+//@returns 1 if the call succeeded, 0 if it failed
+static int callFunction(SymbolTable* table, SymbolId id, int argc,
+			ValueStack* stack, Token* result){
+  FunctionDef* function = functions[GetSymbolValue(table, id).iVal];
+  Expression* body = &function->code;
+  Frame* frame;
+  size_t missing;
+  int success;
+
+  if(callDepth == MAX_CALL_DEPTH){
+    diagnose(DiagBadExpression, "Error: function calls nested more than %d deep\n",
+	     MAX_CALL_DEPTH);
+    return 0;
+  }
+  frame = &frames[callDepth];
+  for(; argc > 0; argc--){
+    frame->arguments[argc - 1] = PopValueStack(stack);
+  }
+
+  //the body is bound once for each table it is called in
+  if(function->boundTable != table->serial){
+    missing = bindTokens(table, body, function->bound);
+    if(missing < body->size){
+      reportUnbound(table, &body->tokens[missing]);
+      return 0;
+    }
+    function->boundTable = table->serial;
+  }
+
+  memoStats.dispatchedCalls++;
+  callDepth++;
+  success = evaluateTokens(table, body, function->bound, frame->arguments, result);
+  callDepth--;
+  return success;
+}
+
+
+//Evaluate a range of the tokens of a bound expression, leaving the
+//  values on a stack
+//@param table the symbol table the expression was bound in
+//@param expression the compiled expression
+//@param bound the symbols from bindTokens
+//@param arguments the values of the parameters of a function body
+//@param stack the stack of values
+//@param from the index of the first token
+//@param to the index after the last token
+//@param share whether long runs of one operator may be split between
+//  threads
+//@returns 1 if the evaluation succeeded, 0 if it failed
+static int runTokens(SymbolTable* table, Expression* expression, SymbolId* bound,
+		     const Token* arguments, ValueStack* stack, size_t from, size_t to,
+		     int share){
+  Chain* chains = expression->chains;
+  size_t count = share ? expression->chainCount : 0;
+  size_t chain = 0;
+  size_t next = count ? chains[0].starts[0] : to;
+  int split;
+  Token token;
+  Token operand1;
+  Token operand2;
+  int arrays[2];
+  int arity;
+
+  size_t i;
+
+  for(i = from; i < to; i++){
+    //a run is tried where it starts, and the runs inside it are skipped
+    //  once it has been split
+    if(i == next){
+      while(chain < count && chains[chain].starts[0] == i &&
+	    !shareChain(table, expression, bound, &chains[chain], &token)){
+	chain++;
+      }
+      split = chain < count && chains[chain].starts[0] == i;
+      if(split){
+	if(!PushValueStack(stack, token)){
+	  return stackExhausted();
+	}
+	i = chains[chain].end - 1;
+      }
+      while(chain < count && chains[chain].starts[0] <= i){
+	chain++;
+      }
+      next = chain < count ? chains[chain].starts[0] : to;
+      if(split){
+	continue;
+      }
+    }
+
+    token = expression->tokens[i];
+    if(token.type == Reference || token.type == ArrayRef){
+      token.type = Operand;
+      token.valType = GetSymbolType(table, bound[i]);
+      token.value = GetSymbolValue(table, bound[i]);
+    }
+    else if(token.type == Parameter){
+      token = arguments[token.value.iVal];
+    }
 
-  for(i = 0; i < postExpression->size; i++){
-    token = postExpression->list[i];
-    if(token->type == Operand){
-      PushStack(stack, (void*) token);
+    if(token.type == Operand){
+      if(!PushValueStack(stack, token)){
+	return stackExhausted();
+      }
+    }
+    else if(token.type == Call){
+      if(!callFunction(table, bound[i], token.value.iVal, stack, &token)){
+	return 0;
+      }
+      if(!PushValueStack(stack, token)){
+	return stackExhausted();
+      }
+    }
+    else if(token.type == Reduce){
+      for(arity = reductionArity(token.value.iVal); arity > 0; arity--){
+	arrays[arity - 1] = PopValueStack(stack).value.iVal;
+      }
+      if(!reduceArrays(token.value.iVal, arrays[0], arrays[1], &token.valType,
+		       &token.value)){
+	return 0;
+      }
+      token.type = Operand;
+      if(!PushValueStack(stack, token)){
+	return stackExhausted();
+      }
     }
     else{
-      operand2 = (Token*) PopStack(stack);
-      operand1 = (Token*) PopStack(stack);
+      operand2 = PopValueStack(stack);
+      operand1 = PopValueStack(stack);
+      //a scan leaves an array, which can only be stored
+      if(operand1.valType == Array || operand2.valType == Array){
+	diagnose(DiagBadExpression, "Error: an array can only be reduced\n");
+	return 0;
+      }
       //perform operation and store value in operator token
-      performOperation(token, operand1, operand2);
+      performOperation(&token, &operand1, &operand2);
 
-      //error in operation, free all memory and return NULL to indicate error
-      if(token->valType == Unknown){
-	DestroyTokenList(postExpression);
-	DestroyStack(stack);
-	return NULL;
+      //error in operation
+      if(token.valType == Unknown){
+	return 0;
       }
 	
       //operator token now has new value; push it onto the stack
-      PushStack(stack, (void*) token);
+      if(!PushValueStack(stack, token)){
+	return stackExhausted();
+      }
       }
   }
+  return 1;
+}
+
+
+//Evaluate the tokens of a bound expression
+//@param table the symbol table the expression was bound in
+//@param expression the compiled expression
+//@param bound the symbols from bindTokens
+//@param arguments the values of the parameters of a function body
+//@param result set to a token containing an int or float
+//@returns 1 if the evaluation succeeded, 0 if it failed
+static int evaluateTokens(SymbolTable* table, Expression* expression,
+			  SymbolId* bound, const Token* arguments, Token* result){
+  ValueStack stack;
+  Token token;
+
+  InitValueStack(&stack);
 
+  if(!runTokens(table, expression, bound, arguments, &stack, 0, expression->size, 1)){
+    FreeValueStack(&stack);
+    return 0;
+  }
   
-  token = (Token*) PopStack(stack);
+  token = PopValueStack(&stack);
+
+  result->type = Operand;
+  result->valType = token.valType;
+  result->value = token.value;
+  result->name = NULL;
+
+  FreeValueStack(&stack);
+  return 1;
+}
+
+
+//Type of the values of a run of one operator, if it can be split:
+//  Integer when every term is made of integers, and Float when it is a
+//  sum of terms made of reals without a modulo and sums of reals may be
+//  added in another order
+//@param table the symbol table the expression was bound in
+//@param expression the compiled expression
+//@param bound the symbols from bindTokens
+//@param chain the run
+//@returns Integer or Float, or Unknown if the run is not to be split
+static Type chainType(SymbolTable* table, Expression* expression, SymbolId* bound,
+		      const Chain* chain){
+  Token* tokens = expression->tokens;
+  int integers = 1;
+  int reals = chain->operator == '+' && fastMath;
+  Type type;
+  size_t i;
+
+  for(i = chain->starts[0]; i < chain->end && (integers || reals); i++){
+    if(tokens[i].type == Operator){
+      reals = reals && tokens[i].value.iVal != '%';
+      continue;
+    }
+    if(tokens[i].type == Reference){
+      type = GetSymbolType(table, bound[i]);
+    }
+    else if(tokens[i].type == Operand){
+      type = tokens[i].valType;
+    }
+    else{
+      return Unknown;
+    }
+    integers = integers && type == Integer;
+    reals = reals && type == Float;
+  }
+  return integers ? Integer : reals ? Float : Unknown;
+}
+
+
+//A run of one operator being evaluated by threads, a chunk of
+//  CHAIN_TERMS terms at a time
+typedef struct ChainWork_ {
+  SymbolTable* table;
+  Expression* expression;
+  SymbolId* bound;
+  const Chain* chain;
+  //value of each chunk
+  Token* partials;
+  int failed;
+} ChainWork;
+
+
+//Index of the operator after a term of a run other than the first
+//@param chain the run
+//@param term the index of the term
+//@returns the index of the operator
+static size_t operatorAfter(const Chain* chain, size_t term){
+  return term + 1 < chain->terms ? chain->starts[term + 1] - 1 : chain->end - 1;
+}
+
+
+//Evaluate the terms of a chunk of a run in the order they are written;
+//  a ChunkWork
+//@param data the ChainWork
+//@param chunk the index of the chunk
+static void evaluateChunk(void* data, size_t chunk){
+  ChainWork* work = data;
+  const Chain* chain = work->chain;
+  size_t first = chunk * CHAIN_TERMS;
+  size_t last = first + CHAIN_TERMS < chain->terms ? first + CHAIN_TERMS : chain->terms;
+  ValueStack stack;
+  int success;
+  int muted;
+
+  InitValueStack(&stack);
+  //a chunk that fails leaves the run to be evaluated in order, which
+  //  reports the error once, at the line of the statement
+  muted = muteDiagnostics(1);
+  //the first term alone, then the rest with their operators
+  success = runTokens(work->table, work->expression, work->bound, NULL, &stack,
+		      chain->starts[first],
+		      first ? operatorAfter(chain, first) : chain->starts[1], 0);
+  if(success && last > first + 1){
+    success = runTokens(work->table, work->expression, work->bound, NULL, &stack,
+			chain->starts[first + 1], operatorAfter(chain, last - 1) + 1, 0);
+  }
+  muteDiagnostics(muted);
+  if(success){
+    work->partials[chunk] = PopValueStack(&stack);
+  }
+  else{
+    work->failed = 1;
+  }
+  FreeValueStack(&stack);
+  return;
+}
+
+
+//Evaluate a long run of one operator by splitting its terms into
+//  chunks that threads evaluate at the same time, then combining the
+//  values of the chunks pairwise. Integers wrap, so this gives the
+//  result of evaluating the run in order; sums of reals are only split
+//  when setFastMath allows it. The run is left to be evaluated in
+//  order when it cannot be split or the threads are busy
+//@param table the symbol table the expression was bound in
+//@param expression the compiled expression
+//@param bound the symbols from bindTokens
+//@param chain the run
+//@param result set to the value of the run
+//@returns 1 if the run was evaluated, 0 otherwise
+static int shareChain(SymbolTable* table, Expression* expression, SymbolId* bound,
+		      const Chain* chain, Token* result){
+  size_t chunks = (chain->terms + CHAIN_TERMS - 1) / CHAIN_TERMS;
+  ChainWork work;
+  Token operator;
+  size_t step;
+  size_t i;
+
+  if(reduceThreads() == 1 || chainType(table, expression, bound, chain) == Unknown){
+    return 0;
+  }
+  work.table = table;
+  work.expression = expression;
+  work.bound = bound;
+  work.chain = chain;
+  work.failed = 0;
+  work.partials = memAlloc(MemStacks, sizeof(Token) * chunks);
+  if(!work.partials){
+    return 0;
+  }
+  if(!shareChunks(chunks, evaluateChunk, &work) || work.failed){
+    memFree(work.partials);
+    return 0;
+  }
+
+  //the tree only depends on the number of terms
+  for(step = 1; step < chunks; step *= 2){
+    for(i = 0; i + step < chunks; i += 2 * step){
+      operator = expression->tokens[chain->end - 1];
+      performOperation(&operator, &work.partials[i], &work.partials[i + step]);
+      work.partials[i] = operator;
+    }
+  }
+  *result = work.partials[0];
+  memFree(work.partials);
+  __atomic_fetch_add(&memoStats.sharedRuns, 1, __ATOMIC_RELAXED);
+  return 1;
+}
+
+
+//Evaluate a bound expression
+int evaluateBound(SymbolTable* table, Expression* expression,
+		  SymbolId* bound, Token* result){
+  int success = evaluateTokens(table, expression, bound, NULL, result);
+
+  //counted as evaluations that reuse nothing, from any thread
+  __atomic_fetch_add(&memoStats.evaluations, 1, __ATOMIC_RELAXED);
+  countMetric(MetricExpressions, 1);
+  countMetric(MetricEvalErrors, !success);
+  return success;
+}
+
+
+//Limit the size of expressions
+void setExpressionLimits(size_t tokens, size_t depth){
+  tokenLimit = tokens;
+  depthLimit = depth;
+  return;
+}
+
+
+//Turn memoization on or off
+void setMemoization(int enabled){
+  memoEnabled = enabled;
+  return;
+}
+
+
+//Let sums of reals be split between threads
+void setFastMath(int enabled){
+  fastMath = enabled;
+  return;
+}
+
+
+//Get the memoization counts
+void getMemoStats(MemoStats* stats){
+  *stats = memoStats;
+  return;
+}
+
+
+//Check whether any symbol read by a memoized expression has been
+//  written since its result was computed
+//@param table the table the expression is bound to
+//@param expression the expression
+//@returns 1 if the last result is still valid, 0 otherwise
+static int unchangedInputs(SymbolTable* table, Expression* expression){
+  size_t i;
+
+  for(i = 0; i < expression->size; i++){
+    if((expression->tokens[i].type == Reference || expression->tokens[i].type == ArrayRef) &&
+       GetSymbolVersion(table, expression->bound[i]) != expression->versions[i]){
+      return 0;
+    }
+  }
+  return 1;
+}
+
+
+//Evaluate an expression bound to a table and remember the result
+//  along with the versions of the symbols it read
+//@param table the table the expression is bound to
+//@param expression the expression
+//@param result set to the result
+//@returns 1 if the evaluation succeeded, 0 if it failed
+static int evaluateMemoized(SymbolTable* table, Expression* expression,
+			    Token* result){
+  size_t i;
+  int success;
+
+  memoStats.inlinedCalls += expression->inlined;
+  success = evaluateTokens(table, expression, expression->bound, NULL, result);
+  //functions that were not inlined read symbols of their own, whose
+  //  versions are not kept
+  expression->memoValid = success && !expression->dispatched;
+  if(expression->memoValid){
+    for(i = 0; i < expression->size; i++){
+      if(expression->tokens[i].type == Reference || expression->tokens[i].type == ArrayRef){
+	expression->versions[i] = GetSymbolVersion(table, expression->bound[i]);
+      }
+    }
+    expression->result = *result;
+  }
+  return success;
+}
+
+
+//Make room to keep the references of an expression bound to a table
+//@param expression the expression
+//@returns 1 if there is room, 0 if there is no memory left for it
+static int keepBound(Expression* expression){
+  if(!expression->bound){
+    expression->bound = memAlloc(MemPostfix, sizeof(SymbolId) * expression->size);
+    expression->versions = memAlloc(MemPostfix, sizeof(uint32_t) * expression->size);
+  }
+  if(!expression->bound || !expression->versions){
+    memFree(expression->bound);
+    memFree(expression->versions);
+    expression->bound = NULL;
+    expression->versions = NULL;
+    return 0;
+  }
+  return 1;
+}
+
+
+//Evaluate a compiled expression
+int evaluateCompiled(SymbolTable* table, Expression* expression, Token* result){
+  //bound symbols of a typical expression fit without using the heap
+  SymbolId buffer[STACK_INLINE];
+  SymbolId* bound = buffer;
+  size_t missing;
+  int success = 0;
+
+  memoStats.evaluations++;
+  countMetric(MetricExpressions, 1);
+  PROBE2(expression_start, expression, expression->size);
+
+  //symbols are never removed from a table, so references bound to it
+  //  stay valid; only their values need checking
+  if(memoEnabled && expression->memoTable == table->serial){
+    if(expression->memoValid && unchangedInputs(table, expression)){
+      memoStats.hits++;
+      *result = expression->result;
+      PROBE3(expression_done, expression, 1, 1);
+      return 1;
+    }
+    success = evaluateMemoized(table, expression, result);
+    countMetric(MetricEvalErrors, !success);
+    PROBE3(expression_done, expression, success, 0);
+    return success;
+  }
+
+  inlineCalls(table, expression);
+  if(expression->size > STACK_INLINE){
+    bound = memAlloc(MemPostfix, sizeof(SymbolId) * expression->size);
+    if(!bound){
+      diagnose(DiagPoolExhausted, "Error: no memory left to bind the expression\n");
+      countMetric(MetricEvalErrors, 1);
+      PROBE3(expression_done, expression, 0, 0);
+      return 0;
+    }
+  }
+  missing = bindTokens(table, expression, bound);
+
+  //symbol does not exist in table
+  if(missing < expression->size){
+    reportUnbound(table, &expression->tokens[missing]);
+  }
+  //error compiling the expression; report it now
+  else if(expression->error){
+    diagnose(outOfMemory(expression) ? DiagPoolExhausted : DiagBadExpression,
+	     "%s", expression->error);
+  }
+  //keep the references bound to this table, if there is memory for them
+  else if(memoEnabled && keepBound(expression)){
+    memcpy(expression->bound, bound, sizeof(SymbolId) * expression->size);
+    expression->memoTable = table->serial;
+    success = evaluateMemoized(table, expression, result);
+  }
+  else{
+    memoStats.inlinedCalls += expression->inlined;
+    success = evaluateTokens(table, expression, bound, NULL, result);
+  }
+
+  if(bound != buffer){
+    memFree(bound);
+  }
+  countMetric(MetricEvalErrors, !success);
+  PROBE3(expression_done, expression, success, 0);
+  return success;
+}
+
 
-  Token* returnToken = malloc(sizeof(Token));
-  returnToken->valType = token->valType;
-  returnToken->value = token->value;
+//Evaluate an arithmetic expression
+int evaluateExpression(SymbolTable* table, char* expression, Token* result){
+  Expression* compiled = compileExpression(expression);
+  int success = evaluateCompiled(table, compiled, result);
 
-  DestroyTokenList(postExpression);
-  DestroyStack(stack);
-  return returnToken;
+  DestroyExpression(compiled);
+  return success;
 }
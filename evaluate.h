@@ -5,6 +5,9 @@
 
 #ifndef EVALUATE_H
 #define EVALUATE_H
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 
 #include <string.h>
 #include <stdlib.h>
@@ -14,11 +17,23 @@
 #include "symbolTable.h"
 
 #define INITIAL_SIZE 20
+//most parameters a function can have
+#define MAX_PARAMETERS 16
+//deepest that calls to functions can be nested when evaluating
+#define MAX_CALL_DEPTH 64
+//largest function body, in tokens, that is inlined into its callers
+#define INLINE_TOKENS 32
+//terms of a long run of + or * that a thread evaluates at a time; runs
+//  of at least twice as many are split between threads
+#define CHAIN_TERMS 4096
 
 
-//Types for a token, used for converting to postfix
+//Types for a token, used for converting to postfix. A Call takes as
+//  many values as it has arguments and leaves the result; a Parameter
+//  stands for an argument inside the body of a function. An ArrayRef
+//  names an array passed to a built-in Reduce, which leaves the result
 typedef enum token_type {Operator, Operand, LParenthesis,
-RParenthesis} TokenType;
+RParenthesis, Reference, Call, Parameter, ArrayRef, Reduce} TokenType;
 
 
 //Token for an operand, operator, or parantheses
@@ -27,22 +42,235 @@ typedef struct Token_ {
   TokenType type;
   //type of value, Float or Integer
   Type valType;
-  //value of the token
+  //value of the token; the number of arguments of a Call, the index
+  //  of a Parameter and the ReduceKind of a Reduce
   Value value;
+  //name of the symbol a Reference or ArrayRef token stands for, or of
+  //  the function a Call calls
+  char* name;
 } Token;
 
 
+//A run of one associative operator, a + b + c + ..., as it is left in
+//  postfix: the first term, then each further term followed by the
+//  operator
+typedef struct Chain_ {
+  //the operator, + or *
+  char operator;
+  //number of terms, and the index of the first token of each
+  size_t terms;
+  size_t* starts;
+  //index after the last operator of the run
+  size_t end;
+} Chain;
+
+
+//A compiled expression: the postfix sequence of tokens for an infix
+//  expression, with symbols left as references that are resolved
+//  each time the expression is evaluated
+typedef struct Expression_ {
+  //source text the expression was compiled from
+  char* source;
+  //number of statements and cache slots holding the expression
+  int refs;
+  //postfix token sequence
+  Token* tokens;
+  //number of tokens in the sequence
+  size_t size;
+  //tokens as compiled when the expression calls functions, which
+  //  tokens holds with the calls to small functions inlined for the
+  //  table inlined for; NULL if it calls none
+  Token* compiled;
+  size_t compiledSize;
+  uint64_t inlinedFor;
+  //calls inlined into tokens, and calls left in it to be dispatched
+  size_t inlined;
+  size_t dispatched;
+  //number of parameters when the expression is the body of a function
+  size_t parameters;
+  //seperated copy of the source that reference names point into
+  char* text;
+  //error found while compiling, reported on evaluation, or NULL
+  char* error;
+  //serial of the table the references are bound to, or 0
+  uint64_t memoTable;
+  //symbol for each Reference token, once bound
+  SymbolId* bound;
+  //version of each referenced symbol when the result was computed
+  uint32_t* versions;
+  //whether result holds the value for those versions
+  int memoValid;
+  //last result computed
+  Token result;
+  //runs of at least 2 * CHAIN_TERMS terms, by their first token, a run
+  //  before the runs inside it
+  Chain* chains;
+  size_t chainCount;
+} Expression;
+
+
+//Counts of memoized evaluations and of function calls
+typedef struct MemoStats_ {
+  //calls to evaluateCompiled
+  unsigned long long evaluations;
+  //evaluations answered from the last result
+  unsigned long long hits;
+  //calls evaluated as part of the expression they were inlined into
+  unsigned long long inlinedCalls;
+  //calls evaluated by running the body of the function in a frame
+  unsigned long long dispatchedCalls;
+  //runs of one operator split between threads
+  unsigned long long sharedRuns;
+} MemoStats;
+
+
 //Check whether a string is a float
 //@param str a null terminated string
 //@returns 1 if the string is a float, 0 otherwise
 int isFloat(char* str);
 
 
+//Compile an infix expression into postfix form. Compiling does not
+//  use the symbol table, so it is safe to do ahead of execution.
+//  Recently compiled expressions are cached, so statements with the
+//  same expression text share one compiled expression and its result
+//@param expression the infix expression as a null-terminated string,
+//  or NULL
+//@returns the compiled expression; errors are kept in the expression
+//  and reported when it is evaluated
+Expression* compileExpression(const char* expression);
+
+
+//Compile the body of a function. The body is not cached, and
+//  references to the parameters become Parameter tokens
+//@param body the infix expression, or NULL
+//@param parameters the names of the parameters
+//@param count the number of parameters, at most MAX_PARAMETERS
+//@returns the compiled body; errors are kept in it
+Expression* compileFunctionBody(const char* body, char** parameters, size_t count);
+
+
+//Check whether an expression failed to compile for lack of memory,
+//  which only happens once the realtime pools are exhausted
+//@param expression the compiled expression
+//@returns 1 if it ran out of memory, 0 otherwise
+int outOfMemory(const Expression* expression);
+
+
+//Define a function in a table as a symbol of type Function. Every
+//  function the body calls must already be defined with the number of
+//  arguments it is called with, so functions cannot be recursive.
+//  Errors are reported with diagnose
+//@param table the table to add the function to
+//@param name the name of the function
+//@param body the compiled body from compileFunctionBody, held by the
+//  function from then on
+//@returns the id of the new symbol, or NO_SYMBOL on error
+SymbolId defineFunction(SymbolTable* table, const char* name, Expression* body);
+
+
+//Forget every function defined so far; tables holding them must not
+//  be used afterwards
+void clearFunctions(void);
+
+
+//Inline the calls of an expression to small functions that call no
+//  other function, as they are defined in a table. Done by
+//  evaluateCompiled; anything else binding an expression must do it
+//  first, since it can change the tokens
+//@param table the symbol table the calls are resolved in
+//@param expression the compiled expression
+void inlineCalls(SymbolTable* table, Expression* expression);
+
+
+//Release a compiled expression, freeing it once no statement or
+//  cache slot holds it
+//@param expression the expression to release
+void DestroyExpression(Expression* expression);
+
+
+//Empty the cache of compiled expressions; expressions still held by
+//  statements stay valid
+void clearExpressionCache(void);
+
+
+//Limit the size of expressions compiled from then on; larger ones
+//  get a compile error
+//@param tokens the most postfix tokens, 0 for no limit
+//@param depth the most values on the stack while evaluating, 0 for no
+//  limit
+void setExpressionLimits(size_t tokens, size_t depth);
+
+
+//Turn memoization of evaluateCompiled on or off; it is on by default
+//@param enabled 0 to always evaluate, otherwise reuse results
+void setMemoization(int enabled);
+
+
+//Let sums of reals be added in a different order when they are split
+//  between threads, which can change the last bits of the result; off
+//  by default, when only sums and products of integers are split
+//@param enabled 1 to split sums of reals as well
+void setFastMath(int enabled);
+
+
+//Get the memoization counts so far
+//@param stats filled with the counts
+void getMemoStats(MemoStats* stats);
+
+
+//Evaluate a compiled expression against the current symbol values.
+//  When none of the symbols it reads has been written since the last
+//  evaluation against the same table, the last result is reused.
+//  Must only be called by the thread executing statements
+//@param table the symbol table to resolve references in
+//@param expression the compiled expression
+//@param result set to a token containing an int or float, or the
+//  number of the new array of a scan with type Array
+//@returns 1 if the evaluation succeeded, 0 if it failed
+int evaluateCompiled(SymbolTable* table, Expression* expression, Token* result);
+
+
+//Resolve the symbol references and function calls of an expression
+//@param table the symbol table to resolve references in
+//@param expression the compiled expression
+//@param bound filled with the symbol id for each Reference and Call
+//  token, with room for one entry per token
+//@returns NULL if every reference was resolved, otherwise the name
+//  of the first one that was not, or of the first call that is not
+//  to a function taking that many arguments
+const char* bindExpression(SymbolTable* table, Expression* expression,
+			   SymbolId* bound);
+
+
+//Check that evaluating a bound expression cannot report an error: it
+//  compiled, is well formed, never takes the modulo of a float, and
+//  calls no function that was not inlined
+//@param table the symbol table the expression was bound in
+//@param expression the compiled expression
+//@param bound the symbols from bindExpression
+//@returns 1 if the expression is safe, 0 otherwise
+int isSafeExpression(SymbolTable* table, Expression* expression,
+		     SymbolId* bound);
+
+
+//Evaluate an expression whose references have been resolved. The
+//  expression must not have a compile error
+//@param table the symbol table the expression was bound in
+//@param expression the compiled expression
+//@param bound the symbols from bindExpression
+//@param result set to a token containing an int or float
+//@returns 1 if the evaluation succeeded, 0 if it failed
+int evaluateBound(SymbolTable* table, Expression* expression,
+		  SymbolId* bound, Token* result);
+
+
 //Evaluate an infix expression
 //@param table the symbol table to use
-//@returns a token struct  containing an int or float,
-//  or NULL if the evaluation failed
-Token* evaluateExpression(SymbolTable* table, char* expression);
+//@param expression the infix expression
+//@param result set to a token containing an int or float
+//@returns 1 if the evaluation succeeded, 0 if it failed
+int evaluateExpression(SymbolTable* table, char* expression, Token* result);
 
 
 #endif 
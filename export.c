@@ -0,0 +1,122 @@
+///file:export.c
+///description:exporting a symbol table to POSIX shared memory, where
+///  readers outside the interpreter copy it without locks
+///author: avv8047 : Azhur Viano
+
+
+#include "export.h"
+#include "symbolTable.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//bytes of a segment
+#define SEGMENT_BYTES (sizeof(ExportSegment) + \
+		       sizeof(ExportPage) * (EXPORT_CAPACITY / EXPORT_PAGE))
+
+//name the segment was created under, with its leading /
+static char segmentName[NAME_MAX + 1];
+
+
+///Check whether a segment left by an earlier run was written by a
+///  process that has exited
+///@param name the name of the segment
+///@returns 1 if it can be removed, 0 if it is in use or not a segment
+static int isStale(const char* name){
+  int fd = shm_open(name, O_RDONLY, 0);
+  struct stat status;
+  ExportSegment* segment;
+  int stale = 0;
+
+  if(fd < 0){
+    return 0;
+  }
+  if(fstat(fd, &status) == 0 && (size_t) status.st_size >= sizeof(ExportSegment)){
+    segment = mmap(NULL, sizeof(ExportSegment), PROT_READ, MAP_SHARED, fd, 0);
+    if(segment != MAP_FAILED){
+      stale = segment->magic == EXPORT_MAGIC &&
+	kill((pid_t) segment->pid, 0) != 0 && errno == ESRCH;
+      munmap(segment, sizeof(ExportSegment));
+    }
+  }
+  close(fd);
+  return stale;
+}
+
+
+//Create a segment and export a table to it
+int exportTable(SymbolTable* table, const char* name){
+  ExportSegment* segment;
+  int fd;
+  size_t i;
+
+  if(strlen(name) + 2 > sizeof(segmentName)){
+    fprintf(stderr, "Shared memory name %s is too long\n", name);
+    return 0;
+  }
+  snprintf(segmentName, sizeof(segmentName), "%s%s", name[0] == '/' ? "" : "/", name);
+
+  fd = shm_open(segmentName, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if(fd < 0 && errno == EEXIST){
+    if(!isStale(segmentName)){
+      fprintf(stderr, "Could not create shared memory %s: in use by another process\n",
+	      segmentName);
+      return 0;
+    }
+    shm_unlink(segmentName);
+    fd = shm_open(segmentName, O_RDWR | O_CREAT | O_EXCL, 0644);
+  }
+  if(fd < 0){
+    fprintf(stderr, "Could not create shared memory %s: %s\n", segmentName,
+	    strerror(errno));
+    return 0;
+  }
+  if(ftruncate(fd, SEGMENT_BYTES) != 0){
+    fprintf(stderr, "Could not size shared memory %s: %s\n", segmentName,
+	    strerror(errno));
+    close(fd);
+    shm_unlink(segmentName);
+    return 0;
+  }
+  segment = mmap(NULL, SEGMENT_BYTES, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(segment == MAP_FAILED){
+    fprintf(stderr, "Could not map shared memory %s: %s\n", segmentName,
+	    strerror(errno));
+    shm_unlink(segmentName);
+    return 0;
+  }
+
+  //the memory starts zeroed, so only the header and symbols are written
+  segment->version = EXPORT_VERSION;
+  segment->pageSymbols = EXPORT_PAGE;
+  segment->capacity = EXPORT_CAPACITY;
+  segment->pid = getpid();
+  for(i = 0; i < table->size; i++){
+    exportSymbol(segment, (uint32_t) i, table->slabs[i >> SLAB_SHIFT]->names[i & SLAB_MASK].word,
+		 GetSymbolType(table, i), (uint32_t) GetSymbolValue(table, i).iVal);
+  }
+  exportSize(segment, table->size);
+  __atomic_store_n(&segment->magic, EXPORT_MAGIC, __ATOMIC_RELEASE);
+
+  table->exported = segment;
+  return 1;
+}
+
+
+//Stop exporting a table
+void unexportTable(SymbolTable* table){
+  if(!table->exported){
+    return;
+  }
+  munmap(table->exported, SEGMENT_BYTES);
+  shm_unlink(segmentName);
+  table->exported = NULL;
+  return;
+}
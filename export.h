@@ -0,0 +1,149 @@
+///file:export.h
+///description:layout of the POSIX shared memory a symbol table is
+///  exported to for readers outside the interpreter, such as fred-top,
+///  and the seqlocks that keep their copies of it consistent
+///author: avv8047 : Azhur Viano
+
+
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+
+//"FREDSHM1", written once the rest of the header is
+#define EXPORT_MAGIC 0x314d485344455246ULL
+#define EXPORT_VERSION 1
+//symbols in each page, each page having a seqlock of its own; the same
+//  as the symbols of a slab
+#define EXPORT_PAGE 256
+//symbols the segment has room for; those added after are not exported.
+//  The pages are only touched once symbols are written to them
+#define EXPORT_CAPACITY (1 << 18)
+
+
+///A page of symbols. The writer makes sequence odd before changing
+///  the page and even again after, so a reader that sees the same even
+///  sequence before and after copying it has a consistent copy
+typedef struct ExportPage_ {
+  uint32_t sequence;
+  uint32_t unused;
+  //names packed as by PackName
+  uint64_t names[EXPORT_PAGE];
+  //the bits of each Value
+  uint32_t values[EXPORT_PAGE];
+  unsigned char types[EXPORT_PAGE];
+} ExportPage;
+
+
+///The segment, a header followed by its pages
+typedef struct ExportSegment_ {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t pageSymbols;
+  uint64_t capacity;
+  //symbols exported; the pages holding them can be read
+  uint64_t size;
+  //values written since the segment was created
+  uint64_t writes;
+  //process writing the segment
+  int64_t pid;
+  ExportPage pages[];
+} ExportSegment;
+
+
+//tables are declared in symbolTable.h, which includes this header
+struct SymbolTable_;
+
+
+///Create a segment in shared memory and export a table to it. The
+///  symbols already in the table are exported at once, and those added
+///  or written later as they are. Only the thread running statements
+///  may write the table from then on
+///@param table a pointer to the table, which must not be shared
+///@param name the name of the segment, with or without a leading /
+///@returns 1 on success, 0 if the segment could not be created
+int exportTable(struct SymbolTable_* table, const char* name);
+
+
+///Stop exporting a table and remove its segment
+///@param table a pointer to the table, which may not be exported
+void unexportTable(struct SymbolTable_* table);
+
+
+///Begin writing a page
+///@param page the page
+///@returns the sequence to give endWrite
+static inline uint32_t beginWrite(ExportPage* page){
+  uint32_t sequence = page->sequence;
+
+  __atomic_store_n(&page->sequence, sequence + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  return sequence;
+}
+
+
+///Finish writing a page, publishing what was written
+///@param page the page
+///@param sequence the sequence from beginWrite
+static inline void endWrite(ExportPage* page, uint32_t sequence){
+  __atomic_store_n(&page->sequence, sequence + 2, __ATOMIC_RELEASE);
+}
+
+
+///Export the value written to a symbol. Never waits; readers retry
+///  instead
+///@param segment the segment
+///@param id the id of the symbol
+///@param bits the bits of the value
+static inline void exportValue(ExportSegment* segment, uint32_t id, uint32_t bits){
+  ExportPage* page;
+  uint32_t sequence;
+
+  if(id >= EXPORT_CAPACITY){
+    return;
+  }
+  page = &segment->pages[id / EXPORT_PAGE];
+  sequence = beginWrite(page);
+  __atomic_store_n(&page->values[id % EXPORT_PAGE], bits, __ATOMIC_RELAXED);
+  endWrite(page, sequence);
+  __atomic_store_n(&segment->writes, segment->writes + 1, __ATOMIC_RELAXED);
+}
+
+
+///Export a symbol added to a table or reset in it
+///@param segment the segment
+///@param id the id of the symbol
+///@param name the packed name
+///@param type the type
+///@param bits the bits of the value
+static inline void exportSymbol(ExportSegment* segment, uint32_t id, uint64_t name,
+				unsigned char type, uint32_t bits){
+  ExportPage* page;
+  uint32_t sequence;
+
+  if(id >= EXPORT_CAPACITY){
+    return;
+  }
+  page = &segment->pages[id / EXPORT_PAGE];
+  sequence = beginWrite(page);
+  __atomic_store_n(&page->names[id % EXPORT_PAGE], name, __ATOMIC_RELAXED);
+  __atomic_store_n(&page->types[id % EXPORT_PAGE], type, __ATOMIC_RELAXED);
+  __atomic_store_n(&page->values[id % EXPORT_PAGE], bits, __ATOMIC_RELAXED);
+  endWrite(page, sequence);
+}
+
+
+///Set the number of symbols exported, once they have been
+///@param segment the segment
+///@param size the number of symbols in the table
+static inline void exportSize(ExportSegment* segment, size_t size){
+  __atomic_store_n(&segment->size, size < EXPORT_CAPACITY ? size : EXPORT_CAPACITY,
+		   __ATOMIC_RELEASE);
+}
+
+#endif
@@ -0,0 +1,179 @@
+///file:forkbench.c
+///description:benchmark for snapshots and forks of the symbol table.
+///  Fills a table, forks it many times, writes a few symbols in each
+///  branch and reports the time taken and the memory the branches add,
+///  next to a full copy of the table. Also times writes to the table
+///  with and without exporting it to shared memory
+///author: avv8047 : Azhur Viano
+
+
+#include "memstats.h"
+#include "symbolTable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+
+///Print the usage message for the benchmark
+void printUsage(){
+  fprintf(stderr, "Usage:  fred-forkbench [ -n symbols ] [ -b branches ]"
+	  "[ -w writes-per-branch ] [ -d defines-per-branch ]"
+	  "[ -l exported-writes ]\n");
+  return;
+}
+
+
+///Current monotonic time
+///@returns the time in nanoseconds
+static long long now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+///Next number of a xorshift generator, so every run writes the same
+///  symbols
+///@param state the state of the generator, updated
+///@returns the number
+static uint64_t nextRandom(uint64_t* state){
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+
+//Fill the table, fork it and report the cost of the branches
+int main(int argc, char** argv){
+  int c;
+  long symbols = 1000000;
+  long branches = 1000;
+  long writes = 16;
+  long defines = 1;
+  long sets = 10000000;
+  uint64_t state = 88172645463325252ULL;
+  char name[MAX_SYM_LEN + 1];
+  char segment[32];
+  SymbolTable* table;
+  SymbolTable* snapshot;
+  SymbolTable* copy;
+  SymbolTable** forks;
+  Value value;
+  size_t base;
+  size_t bytes;
+  long long start;
+  long long forkTime = 0;
+  long long writeTime = 0;
+  long long setTime;
+  long exportable;
+  long i;
+  long j;
+
+  while((c = getopt(argc, argv, "n:b:w:d:l:")) != -1){
+    switch(c){
+    case 'n':
+      symbols = strtol(optarg, NULL, 10);
+      break;
+    case 'b':
+      branches = strtol(optarg, NULL, 10);
+      break;
+    case 'w':
+      writes = strtol(optarg, NULL, 10);
+      break;
+    case 'd':
+      defines = strtol(optarg, NULL, 10);
+      break;
+    case 'l':
+      sets = strtol(optarg, NULL, 10);
+      break;
+    default:
+      printUsage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  //names are 7 characters, x and 6 hex digits
+  if(optind != argc || symbols < 1 || symbols > 0xffffff || branches < 1 ||
+     writes < 0 || defines < 0 || defines > 0xffffff || sets < 1){
+    printUsage();
+    return EXIT_FAILURE;
+  }
+
+  startMemStats();
+  table = CreateTable();
+  value.iVal = 0;
+  for(i = 0; i < symbols; i++){
+    snprintf(name, sizeof(name), "x%06lx", i);
+    AddSymbol(table, name, Integer, value);
+  }
+  base = liveBytes(MemSymbols);
+  printf("table     %ld symbols, %.1f MB\n", symbols, base / 1e6);
+
+  start = now();
+  copy = CopyTable(table);
+  printf("copy      %.3f ms, %.1f MB\n", (now() - start) / 1e6,
+	 (liveBytes(MemSymbols) - base) / 1e6);
+  DestroyTable(copy);
+
+  //the same writes as let makes, to symbols that can be exported
+  exportable = symbols < EXPORT_CAPACITY ? symbols : EXPORT_CAPACITY;
+  start = now();
+  for(i = 0; i < sets; i++){
+    value.iVal = (int) i;
+    SetSymbolValue(table, (SymbolId) (nextRandom(&state) % exportable), value);
+  }
+  setTime = now() - start;
+  snprintf(segment, sizeof(segment), "fred-forkbench-%d", (int) getpid());
+  if(exportTable(table, segment)){
+    start = now();
+    for(i = 0; i < sets; i++){
+      value.iVal = (int) i;
+      SetSymbolValue(table, (SymbolId) (nextRandom(&state) % exportable), value);
+    }
+    printf("set       %.2f ns per write, %.2f ns exported to shared memory\n",
+	   (double) setTime / sets, (double) (now() - start) / sets);
+    unexportTable(table);
+  }
+
+  start = now();
+  snapshot = SnapshotTable(table);
+  printf("snapshot  %.3f us\n", (now() - start) / 1e3);
+
+  forks = malloc(sizeof(SymbolTable*) * branches);
+  base = liveBytes(MemSymbols);
+  for(i = 0; i < branches; i++){
+    start = now();
+    forks[i] = ForkTable(snapshot);
+    forkTime += now() - start;
+
+    start = now();
+    for(j = 0; j < writes; j++){
+      value.iVal = (int) j;
+      SetSymbolValue(forks[i], (SymbolId) (nextRandom(&state) % symbols), value);
+    }
+    for(j = 0; j < defines; j++){
+      snprintf(name, sizeof(name), "y%06lx", j);
+      AddSymbol(forks[i], name, Integer, value);
+    }
+    writeTime += now() - start;
+  }
+  bytes = liveBytes(MemSymbols) - base;
+
+  printf("fork      %.3f us per branch, %ld branches\n", forkTime / 1e3 / branches,
+	 branches);
+  printf("writes    %.3f us per branch for %ld writes and %ld defines\n",
+	 writeTime / 1e3 / branches, writes, defines);
+  printf("memory    %.1f KB per branch, %.1f MB for every branch\n",
+	 bytes / 1e3 / branches, bytes / 1e6);
+
+  for(i = 0; i < branches; i++){
+    DestroyTable(forks[i]);
+  }
+  free(forks);
+  DestroyTable(snapshot);
+  DestroyTable(table);
+  return outstandingAllocations() == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,165 @@
+///file:forkserver.c
+///description:a fork server. The interpreter and baseline symbol table
+///  are loaded once, then each request is run in a child forked from
+///  the warm process, so a run costs a fork instead of a full start
+///@author: avv8047 : Azhur Viano
+
+
+#include "forkserver.h"
+#include "protocol.h"
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+//connections waiting to be accepted
+#define BACKLOG 128
+
+
+//set by the signal handler to stop accepting requests
+static volatile sig_atomic_t stopping = 0;
+
+
+///Stop the server on SIGINT or SIGTERM
+///@param sig the signal number
+static void stopServer(int sig){
+  (void) sig;
+  stopping = 1;
+}
+
+
+///Run a request in the child process. Never returns
+///@param connection the connection of the client
+///@param table the table inherited from the server
+///@param fds the descriptors sent by the client
+///@param count the number of descriptors
+static void runChild(int connection, SymbolTable* table, int* fds, int count){
+  FILE* input = stdin;
+  char status[4];
+  int result = EXIT_SUCCESS;
+  int i;
+
+  catchFatalSignals();
+  signal(SIGPIPE, SIG_DFL);
+
+  //the client's stdin, stdout and stderr become the child's
+  for(i = 0; i < 3; i++){
+    dup2(fds[i], i);
+    close(fds[i]);
+  }
+  if(count > 3){
+    input = fdopen(fds[3], "r");
+  }
+
+  if(input){
+    processStatements(table, input);
+    dumpTable(table, stdout);
+  }
+  else{
+    fprintf(stderr, "Error opening program file\n");
+    result = EXIT_FAILURE;
+  }
+  fflush(stdout);
+  summarizeDiagnostics();
+
+  snprintf(status, sizeof(status), "%d", result);
+  sendFrame(connection, FRAME_EXIT, status, strlen(status));
+  _exit(result);
+}
+
+
+///Take a request from a new connection and fork a child to run it
+///@param connection the connection of the client
+///@param listener the listening socket, closed in the child
+///@param table the table the child starts from
+static void handleRequest(int connection, int listener, SymbolTable* table){
+  int fds[MAX_FDS];
+  char type;
+  int count = receiveFds(connection, &type, fds);
+  pid_t pid;
+  int i;
+
+  if(count < 0){
+    return;
+  }
+  if(type != FRAME_RUN || count < 3){
+    sendFrame(connection, FRAME_ERROR, "bad run request", 15);
+  }
+  else{
+    //nothing buffered in the server may be written twice by the child
+    fflush(NULL);
+    pid = fork();
+    if(pid == 0){
+      close(listener);
+      runChild(connection, table, fds, count);
+    }
+    if(pid < 0){
+      perror("fork");
+      sendFrame(connection, FRAME_ERROR, "fork failed", 11);
+    }
+  }
+
+  for(i = 0; i < count; i++){
+    close(fds[i]);
+  }
+  return;
+}
+
+
+///Serve run requests until interrupted
+int runForkServer(const char* path, SymbolTable* baseline){
+  struct sockaddr_un address;
+  struct sigaction action;
+  int listener;
+  int connection;
+
+  if(strlen(path) >= sizeof(address.sun_path)){
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return EXIT_FAILURE;
+  }
+  //errors loading the symbols are not left for every child to print
+  flushDiagnostics();
+
+  listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+  //replace a socket left behind by an earlier server
+  unlink(path);
+
+  if(listener < 0 || bind(listener, (struct sockaddr*) &address, sizeof(address)) != 0 ||
+     listen(listener, BACKLOG) != 0){
+    fprintf(stderr, "Error listening on %s: %s\n", path, strerror(errno));
+    if(listener >= 0){
+      close(listener);
+    }
+    return EXIT_FAILURE;
+  }
+
+  //no SA_RESTART, so accept returns when a signal arrives
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stopServer;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+  //children report to their client, so nobody waits for them
+  signal(SIGCHLD, SIG_IGN);
+
+  while(!stopping){
+    connection = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    if(connection < 0){
+      if(errno != EINTR){
+	perror("accept");
+      }
+      continue;
+    }
+    handleRequest(connection, listener, baseline);
+    close(connection);
+  }
+
+  close(listener);
+  unlink(path);
+  return EXIT_SUCCESS;
+}
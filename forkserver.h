@@ -0,0 +1,22 @@
+///file:forkserver.h
+///description:declarations for the pre-warmed fred fork server
+///author: avv8047 : Azhur Viano
+
+
+#ifndef FORK_SERVER_H
+#define FORK_SERVER_H
+
+#include "processor.h"
+
+
+///Wait on a control socket and run each request in a forked child.
+///  The child shares the loaded table copy-on-write, takes over the
+///  stdin, stdout and stderr passed by the client, runs the program
+///  like fred does and reports its exit status back to the client
+///@param path the path of the control socket
+///@param baseline the table every run starts from
+///@returns EXIT_SUCCESS when stopped by SIGINT or SIGTERM,
+///  EXIT_FAILURE if the socket could not be set up
+int runForkServer(const char* path, SymbolTable* baseline);
+
+#endif
@@ -13,15 +13,154 @@
 
 #include "symbolTable.h"
 #include "processor.h"
+#include "pipeline.h"
+#include "parallel.h"
+#include "server.h"
+#include "forkserver.h"
+#include "evaluate.h"
+#include "scenario.h"
+#include "rows.h"
+#include "diagnostics.h"
+#include "memstats.h"
+#include "profile.h"
+#include "watch.h"
+#include "realtime.h"
+#include "reduce.h"
+#include "export.h"
+#include "lazy.h"
+#include "green.h"
+#include "metrics.h"
+
+
+//whether to print memory statistics on exit
+static int memstats = 0;
+//whether to fail if any memory is still allocated on exit
+static int checkLeaks = 0;
+//file to write the folded stacks of a profile to, NULL if not profiling
+static char* profilePath = NULL;
+//symbol file the table loads symbols from as they are used, NULL if none
+static SymbolSource* lazySymbols = NULL;
 
 ///Print the usage message for the main program
 void printUsage(){
   fprintf(stderr, "Usage:  fred [ -s symbol-table-file ]"
-	  "[ -f fred-program-file ]");
+	  "[ -f fred-program-file ] [ -p parser-threads ]"
+	  "[ -j worker-threads ] [ --serve socket-path ]"
+	  "[ --fork-server socket-path ][ --stats ][ --no-memo ][ --no-fuse ]"
+	  "[ --scenarios scenario-list [ --simd avx2|sse|scalar ] ]"
+	  "[ --rows data.csv [ --select symbols ][ --sink out.csv ] ]"
+	  "[ --diagnostics=text|json ][ --error-limit count ]"
+	  "[ --memstats ][ --check-leaks ][ --profile folded-file ]"
+	  "[ --watch [ --checkpoint-every statements ] ]"
+	  "[ --reduce-threads threads ][ --fast-math ]"
+	  "[ --realtime[=symbols=N,tokens=N,depth=N,line=N,memory=MB] ]"
+	  "[ --export-shm name ][ --lazy-symbols symbol-table-file ]"
+	  "[ --contexts program-list [ --slice statements=N,operators=N ]"
+	  "[ --context-cpu milliseconds ] ][ --metrics-socket socket-path ]\n");
+  return;
+}
+
+
+///Print the evaluation statistics
+///@param out the stream to print to
+static void printStats(FILE* out){
+  MemoStats stats;
+
+  getMemoStats(&stats);
+  flushDiagnostics();
+  fprintf(out, "Expression evaluations: %llu, reused results: %llu (%.1f%%)\n",
+	  stats.evaluations, stats.hits,
+	  stats.evaluations ? 100.0 * stats.hits / stats.evaluations : 0.0);
+  fprintf(out, "Function calls: %llu inlined, %llu dispatched\n",
+	  stats.inlinedCalls, stats.dispatchedCalls);
+  fprintf(out, "Superinstructions: %llu statements\n", fusedStatements());
+  fprintf(out, "Runs split between threads: %llu\n", stats.sharedRuns);
   return;
 }
 
 
+///Free what is left once a program has run, then report the profile
+///  and report and check the memory still allocated if asked to
+///@param table the table the program ran with
+///@param input the program input
+///@param status the exit status so far
+///@returns the exit status, a failure if checking for leaks found any
+static int finishRun(SymbolTable* table, FILE* input, int status){
+  size_t outstanding;
+
+  if(realtime){
+    printLatency(stderr);
+  }
+  stopMetrics();
+
+  //the program is read again for the text of the hottest lines
+  if(profilePath){
+    flushDiagnostics();
+    if(writeProfile(input)){
+      status = EXIT_FAILURE;
+    }
+  }
+
+  unexportTable(table);
+  DestroyTable(table);
+  closeLazySymbols(lazySymbols);
+  if(input && input != stdin){
+    fclose(input);
+  }
+  clearExpressionCache();
+  clearFunctions();
+  clearArrays();
+
+  outstanding = outstandingAllocations();
+  flushDiagnostics();
+  if(memstats || (checkLeaks && outstanding)){
+    printMemStats(stderr);
+  }
+  if(checkLeaks && outstanding){
+    fprintf(stderr, "Leak check failed: %zu allocations still outstanding\n",
+	    outstanding);
+    return EXIT_FAILURE;
+  }
+  return status;
+}
+
+
+//long forms of the command line options
+static const struct option longOptions[] = {
+  {"symbols", required_argument, NULL, 's'},
+  {"file", required_argument, NULL, 'f'},
+  {"pipeline", required_argument, NULL, 'p'},
+  {"parallel", required_argument, NULL, 'j'},
+  {"serve", required_argument, NULL, 'S'},
+  {"fork-server", required_argument, NULL, 'F'},
+  {"stats", no_argument, NULL, 'T'},
+  {"no-memo", no_argument, NULL, 'M'},
+  {"no-fuse", no_argument, NULL, 'U'},
+  {"scenarios", required_argument, NULL, 'C'},
+  {"simd", required_argument, NULL, 'V'},
+  {"rows", required_argument, NULL, 'R'},
+  {"select", required_argument, NULL, 'L'},
+  {"sink", required_argument, NULL, 'O'},
+  {"diagnostics", required_argument, NULL, 'D'},
+  {"error-limit", required_argument, NULL, 'E'},
+  {"memstats", no_argument, NULL, 'A'},
+  {"check-leaks", no_argument, NULL, 'K'},
+  {"profile", required_argument, NULL, 'P'},
+  {"watch", no_argument, NULL, 'W'},
+  {"checkpoint-every", required_argument, NULL, 'N'},
+  {"reduce-threads", required_argument, NULL, 'r'},
+  {"fast-math", no_argument, NULL, 'H'},
+  {"realtime", optional_argument, NULL, 'X'},
+  {"export-shm", required_argument, NULL, 'e'},
+  {"lazy-symbols", required_argument, NULL, 'Z'},
+  {"contexts", required_argument, NULL, 'G'},
+  {"slice", required_argument, NULL, 'Y'},
+  {"context-cpu", required_argument, NULL, 'Q'},
+  {"metrics-socket", required_argument, NULL, 'I'},
+  {NULL, 0, NULL, 0}
+};
+
+
 //Set up symbol table, reading symbols from the symbol file if provided, 
 //  and then process statements from standard input or
 //  a program file if provided
@@ -29,21 +168,80 @@ int main(int argc, char** argv){
   //used to store options from getop
   int c;
   //table to use while processing
-  SymbolTable* table = CreateTable();
+  SymbolTable* table;
   //stream for input statements
   FILE* input = NULL;
   //stream for symbols from a file
   FILE* symbolInput = NULL;
-  
+  //number of parser threads for pipelined processing, 0 if not pipelined
+  int parsers = 0;
+  //number of threads for parallel execution, 0 if not parallel
+  int workers = 0;
+  //path of the socket to serve sessions on, NULL if not serving
+  char* servePath = NULL;
+  //path of the fork server control socket, NULL if not a fork server
+  char* forkPath = NULL;
+  //whether to print statistics on exit
+  int stats = 0;
+  //whether a symbol file was read
+  int symbols = 0;
+  //file listing the symbol file of each scenario, NULL if not running scenarios
+  char* scenarioPath = NULL;
+  //kernels for running scenarios, NULL for the best supported
+  char* simd = NULL;
+  //CSV file to run the program for each row of, NULL if not running rows
+  char* rowsPath = NULL;
+  //symbols to write after each row, NULL for all of them
+  char* selected = NULL;
+  //file to write rows to, NULL for stdout
+  char* sinkPath = NULL;
+  //format of error messages
+  DiagnosticFormat format = DiagText;
+  //error messages printed for each code, 0 for all of them
+  long limit = DIAGNOSTIC_LIMIT;
+  //path of the program file, NULL if reading from stdin
+  char* programPath = NULL;
+  //whether to run the program again whenever its file changes
+  int watching = 0;
+  //statements between checkpoints when watching, 0 if not given
+  long interval = 0;
+  //exit status when serving
+  int status;
+  //whether to run in realtime mode, and the limits of its pools
+  int realtimeMode = 0;
+  RealtimeLimits limits;
+  //name of the shared memory to export the table to, NULL if not exported
+  char* exportName = NULL;
+  //file listing the programs to run as contexts, NULL if not running them
+  char* contextPath = NULL;
+  //budget of each turn of a context
+  size_t sliceStatements = SLICE_STATEMENTS;
+  size_t sliceOperators = SLICE_OPERATORS;
+  int slice = 0;
+  //CPU time after which a context is cancelled, 0 for no limit
+  long contextCpu = 0;
+  //socket the live counters are served on, NULL if they are not
+  char* metricsPath = NULL;
 
-  //Check for the correct number of arguments
-  if((argc - 1) % 2 != 0 || argc > 5){
-    fprintf(stderr, "Wrong number of arguments\n");
-    printUsage();
-    return EXIT_FAILURE;
+  //print a summary of the errors however fred exits
+  atexit(summarizeDiagnostics);
+  //and write those buffered if it is killed
+  catchFatalSignals();
+
+  //count allocations from the start when they are to be checked,
+  //  before the symbol files are read
+  for(c = 1; c < argc; c++){
+    if(strcmp(argv[c], "--memstats") == 0 || strcmp(argv[c], "--check-leaks") == 0){
+      startMemStats();
+    }
+    //counting starts before the symbol files add their symbols
+    if(strncmp(argv[c], "--metrics-socket", 16) == 0){
+      enableMetrics();
+    }
   }
+  table = CreateTable();
   
-  while((c = getopt(argc, argv, "f:s:")) != -1){
+  while((c = getopt_long(argc, argv, "f:s:p:j:", longOptions, NULL)) != -1){
     switch(c){
     //program file
     case 'f':
@@ -57,6 +255,7 @@ int main(int argc, char** argv){
 	fprintf(stderr, "Error opening program file %s\n", optarg);
 	return EXIT_FAILURE;
       }
+      programPath = optarg;
       break;
     //symbol file
     case 's':
@@ -74,6 +273,174 @@ int main(int argc, char** argv){
       processSymbolFile(table, symbolInput);
       fclose(symbolInput);
       symbolInput = NULL;
+      symbols = 1;
+      break;
+    //pipelined processing
+    case 'p':
+      parsers = (int) strtol(optarg, NULL, 10);
+      if(parsers < 1 || parsers > MAX_PARSERS){
+	fprintf(stderr, "Parser threads must be from 1 to %d\n", MAX_PARSERS);
+	return EXIT_FAILURE;
+      }
+      break;
+    //parallel execution of independent statements
+    case 'j':
+      workers = (int) strtol(optarg, NULL, 10);
+      if(workers < 1 || workers > MAX_WORKERS){
+	fprintf(stderr, "Worker threads must be from 1 to %d\n", MAX_WORKERS);
+	return EXIT_FAILURE;
+      }
+      break;
+    //serve sessions on a socket
+    case 'S':
+      servePath = optarg;
+      break;
+    //run as a fork server
+    case 'F':
+      forkPath = optarg;
+      break;
+    //print statistics on exit
+    case 'T':
+      stats = 1;
+      break;
+    //evaluate every expression instead of reusing results
+    case 'M':
+      setMemoization(0);
+      break;
+    //evaluate the expressions of every statement instead of running
+    //  superinstructions
+    case 'U':
+      setFusion(0);
+      break;
+    //run the program for many symbol files at once
+    case 'C':
+      scenarioPath = optarg;
+      break;
+    //kernels for running scenarios
+    case 'V':
+      simd = optarg;
+      break;
+    //run the program for each row of a CSV file
+    case 'R':
+      rowsPath = optarg;
+      break;
+    //symbols written after each row
+    case 'L':
+      selected = optarg;
+      break;
+    //file the rows are written to
+    case 'O':
+      sinkPath = optarg;
+      break;
+    //format of error messages
+    case 'D':
+      if(strcmp(optarg, "json") == 0){
+	format = DiagJson;
+      }
+      else if(strcmp(optarg, "text") != 0){
+	fprintf(stderr, "Diagnostics must be text or json\n");
+	return EXIT_FAILURE;
+      }
+      configureDiagnostics(format, limit);
+      break;
+    //error messages printed for each code
+    case 'E':
+      limit = strtol(optarg, NULL, 10);
+      if(limit < 0){
+	fprintf(stderr, "Error limit must not be negative\n");
+	return EXIT_FAILURE;
+      }
+      configureDiagnostics(format, limit);
+      break;
+    //print memory statistics on exit and on SIGUSR1
+    case 'A':
+      memstats = 1;
+      startMemStats();
+      installMemStatsSignal();
+      break;
+    //fail if any memory is still allocated on exit
+    case 'K':
+      checkLeaks = 1;
+      startMemStats();
+      break;
+    //profile the lines of the program
+    case 'P':
+      profilePath = optarg;
+      break;
+    //run the program again whenever its file changes
+    case 'W':
+      watching = 1;
+      break;
+    //statements between checkpoints when watching
+    case 'N':
+      interval = strtol(optarg, NULL, 10);
+      if(interval < 1){
+	fprintf(stderr, "Checkpoints must be at least 1 statement apart\n");
+	return EXIT_FAILURE;
+      }
+      break;
+    //threads for reductions over arrays
+    case 'r':
+      c = (int) strtol(optarg, NULL, 10);
+      if(c < 1 || c > MAX_REDUCERS){
+	fprintf(stderr, "Reduction threads must be from 1 to %d\n", MAX_REDUCERS);
+	return EXIT_FAILURE;
+      }
+      setReduceThreads(c);
+      break;
+    //let long sums of reals be split between threads
+    case 'H':
+      setFastMath(1);
+      break;
+    //run statements from pools reserved up front
+    case 'X':
+      if(!parseRealtimeLimits(optarg, &limits)){
+	fprintf(stderr, "Realtime limits must be symbols, tokens, depth, line or "
+		"memory=N\n");
+	return EXIT_FAILURE;
+      }
+      realtimeMode = 1;
+      break;
+    //export the table to shared memory as it is written
+    case 'e':
+      exportName = optarg;
+      break;
+    //load symbols from a symbol file only as they are used
+    case 'Z':
+      if(lazySymbols){
+	fprintf(stderr, "Duplicate argument for lazy symbol file: %s\n", optarg);
+	return EXIT_FAILURE;
+      }
+      lazySymbols = openLazySymbols(optarg);
+      if(!lazySymbols){
+	fprintf(stderr, "Error in opening symbol file %s\n", optarg);
+	return EXIT_FAILURE;
+      }
+      table->source = lazySymbols;
+      break;
+    //run the programs of a list as contexts
+    case 'G':
+      contextPath = optarg;
+      break;
+    //budget of each turn of a context
+    case 'Y':
+      if(!parseSlice(optarg, &sliceStatements, &sliceOperators)){
+	fprintf(stderr, "Slice must be statements or operators=N\n");
+	return EXIT_FAILURE;
+      }
+      slice = 1;
+      break;
+    //CPU time after which a context is cancelled
+    case 'Q':
+      contextCpu = strtol(optarg, NULL, 10);
+      if(contextCpu < 1){
+	fprintf(stderr, "Context CPU time must be at least 1 millisecond\n");
+	return EXIT_FAILURE;
+      }
+      break;
+    //serve live counters while running
+    case 'I':
+      metricsPath = optarg;
       break;
     default:
       printUsage();
@@ -81,21 +448,117 @@ int main(int argc, char** argv){
     }
   }
 
+  //Check for arguments that are not options
+  if(optind != argc || (parsers && workers) ||
+     ((servePath || forkPath) && (input || parsers || workers)) ||
+     (servePath && forkPath) || (simd && !scenarioPath) ||
+     (scenarioPath && (symbols || parsers || workers || servePath || forkPath)) ||
+     ((selected || sinkPath) && !rowsPath) ||
+     (rowsPath && (parsers || workers || servePath || forkPath || scenarioPath)) ||
+     (interval && !watching) ||
+     (watching && (!programPath || parsers || workers || servePath || forkPath ||
+		   scenarioPath || rowsPath)) ||
+     (realtimeMode && (parsers || workers || servePath || forkPath || scenarioPath ||
+		       rowsPath || watching)) ||
+     (exportName && (workers || servePath || forkPath || scenarioPath || rowsPath)) ||
+     (lazySymbols && (workers || servePath || forkPath || scenarioPath || rowsPath ||
+		      realtimeMode)) ||
+     ((slice || contextCpu) && !contextPath) ||
+     (contextPath && (input || parsers || servePath || forkPath || scenarioPath ||
+		      rowsPath || watching || realtimeMode || exportName || lazySymbols))){
+    fprintf(stderr, "Wrong number of arguments\n");
+    printUsage();
+    return EXIT_FAILURE;
+  }
+
+  if(profilePath && startProfile(profilePath)){
+    profilePath = NULL;
+    return finishRun(table, input, EXIT_FAILURE);
+  }
+  if(exportName && !exportTable(table, exportName)){
+    return finishRun(table, input, EXIT_FAILURE);
+  }
+  if(metricsPath && !startMetrics(metricsPath)){
+    return finishRun(table, input, EXIT_FAILURE);
+  }
+
+  //serve sessions starting from the symbols read so far
+  if(servePath){
+    status = serveSessions(servePath, table);
+    if(stats){
+      printStats(stderr);
+    }
+    return finishRun(table, input, status);
+  }
+  if(forkPath){
+    status = runForkServer(forkPath, table);
+    return finishRun(table, input, status);
+  }
+
+  //run every program as a context, each writing its own output
+  if(contextPath){
+    if(!workers){
+      workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+      workers = workers < 1 ? 1 : workers > MAX_GREEN_THREADS ? MAX_GREEN_THREADS : workers;
+    }
+    status = processContexts(contextPath, table, workers, sliceStatements, sliceOperators,
+			     contextCpu, stats);
+    if(stats){
+      printStats(stderr);
+    }
+    return finishRun(table, input, status);
+  }
+
   //Read from stdin if no program file was provided
   if(!input){
     input = stdin;
   }
 
+  //run every scenario, each writing its own output
+  if(scenarioPath){
+    status = processScenarios(scenarioPath, input, simd);
+    return finishRun(table, input, status);
+  }
+
+  //run the program for every row, writing a row of output for each
+  if(rowsPath){
+    status = processRows(table, input, rowsPath, selected, sinkPath);
+    if(stats){
+      printStats(stderr);
+    }
+    return finishRun(table, input, status);
+  }
+
+  //run the program again from a checkpoint whenever it changes
+  if(watching){
+    status = watchProgram(table, programPath, interval ? (size_t) interval : WATCH_INTERVAL);
+    if(stats){
+      printStats(stderr);
+    }
+    return finishRun(table, input, status);
+  }
+
+  //the rest of the run takes its memory from the pools
+  if(realtimeMode && !startRealtime(&limits, table->size, input)){
+    return finishRun(table, input, EXIT_FAILURE);
+  }
+
   //process program statements until EOF is reached 
-  processStatements(table, input);
+  if(parsers){
+    processStatementsPipelined(table, input, parsers);
+  }
+  else if(workers){
+    processStatementsParallel(table, input, workers);
+  }
+  else{
+    processStatements(table, input);
+  }
 
   //print table contents
-  dumpTable(table);
-  
-  DestroyTable(table);
-
-  //if a file was opened for reading statements from, close it
-  if(input != stdin){
-    fclose(input);
+  dumpTable(table, stdout);
+  if(stats){
+    printStats(stderr);
   }
+
+  return finishRun(table, input, EXIT_SUCCESS);
 }
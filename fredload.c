@@ -0,0 +1,197 @@
+///file:fredload.c
+///description:load generator for the fred server. Opens a number of
+///  connections, sends the same request on each one over and over,
+///  and reports the latency percentiles and request rate
+///author: avv8047 : Azhur Viano
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "protocol.h"
+
+//most connections the load generator opens
+#define MAX_CONNECTIONS 1024
+
+
+//A connection and the latencies measured on it
+typedef struct Client_ {
+  pthread_t thread;
+  const char* path;
+  const char* setup;
+  const char* request;
+  long requests;
+  //latency of each request in nanoseconds
+  long long* latencies;
+  int failed;
+} Client;
+
+
+///Print the usage message for the load generator
+void printUsage(){
+  fprintf(stderr, "Usage:  fred-load [ -c connections ] [ -n requests ]"
+	  "[ -i setup-statements ] [ -e request-statements ] socket-path\n");
+  return;
+}
+
+
+///Current monotonic time
+///@returns the time in nanoseconds
+static long long now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+///Send a request and wait for its response
+///@param fd the connection
+///@param request the statements to send
+///@returns 0 on success, -1 on error
+static int roundTrip(int fd, const char* request){
+  char type;
+  char* payload;
+  uint32_t size;
+
+  if(sendFrame(fd, FRAME_STATEMENTS, request, strlen(request)) != 0 ||
+     receiveFrame(fd, &type, &payload, &size) != 0){
+    return -1;
+  }
+  free(payload);
+  return type == FRAME_OUTPUT ? 0 : -1;
+}
+
+
+///Run the requests of one connection
+///@param arg the client
+///@returns NULL
+static void* runClient(void* arg){
+  Client* client = (Client*) arg;
+  struct sockaddr_un address;
+  long long start;
+  long i;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, client->path, sizeof(address.sun_path) - 1);
+
+  if(fd < 0 || connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0 ||
+     roundTrip(fd, client->setup) != 0){
+    client->failed = 1;
+    if(fd >= 0){
+      close(fd);
+    }
+    return NULL;
+  }
+
+  for(i = 0; i < client->requests; i++){
+    start = now();
+    if(roundTrip(fd, client->request) != 0){
+      client->failed = 1;
+      break;
+    }
+    client->latencies[i] = now() - start;
+  }
+
+  close(fd);
+  return NULL;
+}
+
+
+///Compare two latencies for qsort
+///@param a the first latency
+///@param b the second latency
+///@returns the order of a and b
+static int compareLatency(const void* a, const void* b){
+  long long x = *(const long long*) a;
+  long long y = *(const long long*) b;
+  return (x > y) - (x < y);
+}
+
+
+//Open the connections, run the requests and report the results
+int main(int argc, char** argv){
+  int c;
+  int connections = 8;
+  long requests = 10000;
+  const char* setup = "define integer x";
+  const char* request = "let x := x + 1\ndisplay x";
+  Client* clients;
+  long long* latencies;
+  long long start;
+  long long wall;
+  size_t total = 0;
+  int failed = 0;
+  int i;
+
+  while((c = getopt(argc, argv, "c:n:i:e:")) != -1){
+    switch(c){
+    case 'c':
+      connections = (int) strtol(optarg, NULL, 10);
+      break;
+    case 'n':
+      requests = strtol(optarg, NULL, 10);
+      break;
+    case 'i':
+      setup = optarg;
+      break;
+    case 'e':
+      request = optarg;
+      break;
+    default:
+      printUsage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if(optind != argc - 1 || connections < 1 || connections > MAX_CONNECTIONS ||
+     requests < 1){
+    printUsage();
+    return EXIT_FAILURE;
+  }
+
+  clients = calloc(connections, sizeof(Client));
+  latencies = malloc(sizeof(long long) * connections * requests);
+
+  start = now();
+  for(i = 0; i < connections; i++){
+    clients[i].path = argv[optind];
+    clients[i].setup = setup;
+    clients[i].request = request;
+    clients[i].requests = requests;
+    clients[i].latencies = latencies + (size_t) i * requests;
+    pthread_create(&clients[i].thread, NULL, runClient, &clients[i]);
+  }
+  for(i = 0; i < connections; i++){
+    pthread_join(clients[i].thread, NULL);
+    failed += clients[i].failed;
+  }
+  wall = now() - start;
+
+  if(failed){
+    fprintf(stderr, "%d of %d connections failed\n", failed, connections);
+    free(latencies);
+    free(clients);
+    return EXIT_FAILURE;
+  }
+
+  total = (size_t) connections * requests;
+  qsort(latencies, total, sizeof(long long), compareLatency);
+
+  printf("requests  %zu on %d connections\n", total, connections);
+  printf("p50       %.1f us\n", latencies[total / 2] / 1e3);
+  printf("p99       %.1f us\n", latencies[total * 99 / 100] / 1e3);
+  printf("max       %.1f us\n", latencies[total - 1] / 1e3);
+  printf("rate      %.0f requests/s\n", total / (wall / 1e9));
+
+  free(latencies);
+  free(clients);
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,234 @@
+///file:fredrun.c
+///description:client for the fred fork server. Passes its stdin,
+///  stdout and stderr, and the program file if given, to the server
+///  and exits with the status of the run. Can also compare the time
+///  of a run through the server with a cold start of fred
+///author: avv8047 : Azhur Viano
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+#include "protocol.h"
+
+
+///Print the usage message for the client
+void printUsage(){
+  fprintf(stderr, "Usage:  fred-run [ -f fred-program-file ] socket-path\n"
+	  "        fred-run -b runs [ -s symbol-table-file ]"
+	  "[ -x fred-binary ] socket-path\n");
+  return;
+}
+
+
+///Current monotonic time
+///@returns the time in nanoseconds
+static long long now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+///Ask the fork server to run a program with the given descriptors
+///@param path the path of the control socket
+///@param fds stdin, stdout, stderr and optionally the program file
+///@param count the number of descriptors
+///@returns the exit status of the run, or -1 on error
+static int runRemote(const char* path, const int* fds, int count){
+  struct sockaddr_un address;
+  char type;
+  char* payload;
+  uint32_t size;
+  int status = -1;
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+
+  if(fd < 0 || connect(fd, (struct sockaddr*) &address, sizeof(address)) != 0){
+    perror("connect");
+  }
+  else if(sendFds(fd, FRAME_RUN, fds, count) == 0 &&
+	  receiveFrame(fd, &type, &payload, &size) == 0){
+    if(type == FRAME_EXIT){
+      status = (int) strtol(payload, NULL, 10);
+    }
+    else{
+      fprintf(stderr, "fork server error: %s\n", payload);
+    }
+    free(payload);
+  }
+
+  if(fd >= 0){
+    close(fd);
+  }
+  return status;
+}
+
+
+///Start fred as a new process with the given descriptors and wait for it
+///@param binary the path of the fred binary
+///@param symbols the symbol file, or NULL
+///@param fds stdin, stdout and stderr for the process
+///@returns the exit status, or -1 on error
+static int runCold(const char* binary, const char* symbols, const int* fds){
+  int status;
+  int i;
+  pid_t pid = fork();
+
+  if(pid == 0){
+    for(i = 0; i < 3; i++){
+      dup2(fds[i], i);
+    }
+    if(symbols){
+      execl(binary, binary, "-s", symbols, (char*) NULL);
+    }
+    else{
+      execl(binary, binary, (char*) NULL);
+    }
+    _exit(127);
+  }
+  if(pid < 0 || waitpid(pid, &status, 0) < 0){
+    return -1;
+  }
+  return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+
+///Compare two times for qsort
+///@param a the first time
+///@param b the second time
+///@returns the order of a and b
+static int compareTime(const void* a, const void* b){
+  long long x = *(const long long*) a;
+  long long y = *(const long long*) b;
+  return (x > y) - (x < y);
+}
+
+
+///Print the spread of a set of times
+///@param label the name of the set
+///@param times the times in nanoseconds, sorted in place
+///@param count the number of times
+static void printTimes(const char* label, long long* times, int count){
+  long long total = 0;
+  int i;
+
+  qsort(times, count, sizeof(long long), compareTime);
+  for(i = 0; i < count; i++){
+    total += times[i];
+  }
+  printf("%-12s mean %8.1f us  p50 %8.1f us  p99 %8.1f us\n", label,
+	 total / 1e3 / count, times[count / 2] / 1e3,
+	 times[(long long) count * 99 / 100] / 1e3);
+  return;
+}
+
+
+///Time empty runs through the fork server and as cold starts
+///@param path the path of the control socket
+///@param runs the number of runs of each kind
+///@param binary the fred binary for cold starts
+///@param symbols the symbol file for cold starts, or NULL
+///@returns EXIT_SUCCESS, or EXIT_FAILURE if a run failed
+static int benchmark(const char* path, int runs, const char* binary,
+		     const char* symbols){
+  long long* warm = malloc(sizeof(long long) * runs);
+  long long* cold = malloc(sizeof(long long) * runs);
+  long long start;
+  int fds[3];
+  int failed = 0;
+  int i;
+
+  //empty program in, all output discarded
+  fds[0] = open("/dev/null", O_RDONLY);
+  fds[1] = open("/dev/null", O_WRONLY);
+  fds[2] = fds[1];
+
+  for(i = 0; i < runs && !failed; i++){
+    start = now();
+    failed = runRemote(path, fds, 3) != 0;
+    warm[i] = now() - start;
+  }
+  for(i = 0; i < runs && !failed; i++){
+    start = now();
+    failed = runCold(binary, symbols, fds) != 0;
+    cold[i] = now() - start;
+  }
+
+  if(!failed){
+    printf("%d runs of an empty program\n", runs);
+    printTimes("fork server", warm, runs);
+    printTimes("cold start", cold, runs);
+  }
+  else{
+    fprintf(stderr, "benchmark run failed\n");
+  }
+
+  close(fds[0]);
+  close(fds[1]);
+  free(warm);
+  free(cold);
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+
+//Run a program through the fork server, or benchmark it
+int main(int argc, char** argv){
+  int c;
+  int fds[4] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO, -1};
+  int count = 3;
+  int runs = 0;
+  const char* binary = "./fred";
+  const char* symbols = NULL;
+  int status;
+
+  while((c = getopt(argc, argv, "f:b:s:x:")) != -1){
+    switch(c){
+    case 'f':
+      if(count == 4){
+	close(fds[3]);
+      }
+      fds[3] = open(optarg, O_RDONLY);
+      if(fds[3] < 0){
+	fprintf(stderr, "Error opening program file %s\n", optarg);
+	return EXIT_FAILURE;
+      }
+      count = 4;
+      break;
+    case 'b':
+      runs = (int) strtol(optarg, NULL, 10);
+      break;
+    case 's':
+      symbols = optarg;
+      break;
+    case 'x':
+      binary = optarg;
+      break;
+    default:
+      printUsage();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if(optind != argc - 1 || runs < 0){
+    printUsage();
+    return EXIT_FAILURE;
+  }
+
+  if(runs){
+    return benchmark(argv[optind], runs, binary, symbols);
+  }
+
+  status = runRemote(argv[optind], fds, count);
+  return status < 0 ? EXIT_FAILURE : status;
+}
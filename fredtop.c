@@ -0,0 +1,213 @@
+///file:fredtop.c
+///description:shows the symbols fred exports with --export-shm as they
+///  change, copying each page of them without taking any lock
+///author: avv8047 : Azhur Viano
+
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "symbolTable.h"
+
+//times a page is copied before giving up on it for a refresh
+#define READ_ATTEMPTS 1000
+
+
+///Print the usage message for the reader
+void printUsage(){
+  fprintf(stderr, "Usage:  fred-top [ -i milliseconds ] [ -n refreshes ] name\n");
+  return;
+}
+
+
+///Current monotonic time
+///@returns the time in nanoseconds
+static long long now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+///Copy the first symbols of a page, retrying while the writer is
+///  changing it so the copy is consistent
+///@param page the page in the segment
+///@param copy set to the copy
+///@param count the number of symbols to copy
+///@returns 1 on success, 0 if the page kept changing
+static int readPage(const ExportPage* page, ExportPage* copy, size_t count){
+  uint32_t before;
+  uint32_t after;
+  size_t attempt;
+  size_t i;
+
+  for(attempt = 0; attempt < READ_ATTEMPTS; attempt++){
+    before = __atomic_load_n(&page->sequence, __ATOMIC_ACQUIRE);
+    if(before & 1){
+      continue;
+    }
+    for(i = 0; i < count; i++){
+      copy->names[i] = __atomic_load_n(&page->names[i], __ATOMIC_RELAXED);
+      copy->values[i] = __atomic_load_n(&page->values[i], __ATOMIC_RELAXED);
+      copy->types[i] = __atomic_load_n(&page->types[i], __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    after = __atomic_load_n(&page->sequence, __ATOMIC_RELAXED);
+    if(before == after){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+///Print the symbols of a page
+///@param copy the copy of the page
+///@param count the number of symbols in it
+static void printPage(const ExportPage* copy, size_t count){
+  SymbolName name;
+  Value value;
+  size_t i;
+
+  for(i = 0; i < count; i++){
+    name.word = copy->names[i];
+    value.iVal = (int) copy->values[i];
+    printf("  %-8.*s ", MAX_SYM_LEN, name.text);
+    switch((Type) copy->types[i]){
+    case Integer:
+      printf("integer  %d\n", value.iVal);
+      break;
+    case Float:
+      printf("real     %.3f\n", value.fVal);
+      break;
+    case Function:
+      printf("function\n");
+      break;
+    case Array:
+      printf("array    [%d]\n", value.iVal);
+      break;
+    default:
+      printf("unknown\n");
+      break;
+    }
+  }
+  return;
+}
+
+
+///Show every symbol of the segment once
+///@param segment the segment
+///@param rate the values written each second since the last refresh
+///@returns 1 if the writer is still running, 0 once it has exited
+static int refresh(const ExportSegment* segment, double rate){
+  static ExportPage copy;
+  size_t size = __atomic_load_n(&segment->size, __ATOMIC_ACQUIRE);
+  int running = kill((pid_t) segment->pid, 0) == 0 || errno != ESRCH;
+  size_t count;
+  size_t i;
+
+  if(isatty(STDOUT_FILENO)){
+    printf("\033[H\033[2J");
+  }
+  printf("fred %lld%s: %zu symbols, %llu writes, %.0f writes/s\n",
+	 (long long) segment->pid, running ? "" : " (exited)", size,
+	 (unsigned long long) __atomic_load_n(&segment->writes, __ATOMIC_RELAXED), rate);
+  for(i = 0; i * EXPORT_PAGE < size; i++){
+    count = size - i * EXPORT_PAGE < EXPORT_PAGE ? size - i * EXPORT_PAGE : EXPORT_PAGE;
+    if(readPage(&segment->pages[i], &copy, count)){
+      printPage(&copy, count);
+    }
+    else{
+      printf("  (symbols %zu to %zu are changing too fast to read)\n",
+	     i * EXPORT_PAGE, i * EXPORT_PAGE + count - 1);
+    }
+  }
+  fflush(stdout);
+  return running;
+}
+
+
+//Map the segment read only and show it every interval
+int main(int argc, char** argv){
+  //used to store options from getopt
+  int c;
+  //time between refreshes
+  long interval = 500;
+  //refreshes before exiting, 0 to keep going until the writer exits
+  long refreshes = 0;
+  //name of the segment, with its leading /
+  char name[256];
+  const ExportSegment* segment;
+  struct stat status;
+  struct timespec pause;
+  unsigned long long lastWrites;
+  unsigned long long writes;
+  long long lastTime;
+  long long time;
+  long count;
+  int fd;
+
+  while((c = getopt(argc, argv, "i:n:")) != -1){
+    switch(c){
+    case 'i':
+      interval = strtol(optarg, NULL, 10);
+      break;
+    case 'n':
+      refreshes = strtol(optarg, NULL, 10);
+      break;
+    default:
+      printUsage();
+      return EXIT_FAILURE;
+    }
+  }
+  if(optind + 1 != argc || interval <= 0 || refreshes < 0){
+    printUsage();
+    return EXIT_FAILURE;
+  }
+  snprintf(name, sizeof(name), "%s%s", argv[optind][0] == '/' ? "" : "/", argv[optind]);
+
+  fd = shm_open(name, O_RDONLY, 0);
+  if(fd < 0 || fstat(fd, &status) != 0 || (size_t) status.st_size < sizeof(ExportSegment)){
+    fprintf(stderr, "Could not open shared memory %s: %s\n", name,
+	    fd < 0 ? strerror(errno) : "not exported by fred");
+    return EXIT_FAILURE;
+  }
+  segment = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if(segment == MAP_FAILED){
+    perror("mmap");
+    return EXIT_FAILURE;
+  }
+  if(__atomic_load_n(&segment->magic, __ATOMIC_ACQUIRE) != EXPORT_MAGIC ||
+     segment->version != EXPORT_VERSION || segment->pageSymbols != EXPORT_PAGE ||
+     sizeof(ExportSegment) + sizeof(ExportPage) * (segment->capacity / EXPORT_PAGE) >
+     (size_t) status.st_size){
+    fprintf(stderr, "Shared memory %s was not exported by this version of fred\n", name);
+    return EXIT_FAILURE;
+  }
+
+  pause.tv_sec = interval / 1000;
+  pause.tv_nsec = (interval % 1000) * 1000000L;
+  lastWrites = __atomic_load_n(&segment->writes, __ATOMIC_RELAXED);
+  lastTime = now();
+  for(count = 1; ; count++){
+    time = now();
+    writes = __atomic_load_n(&segment->writes, __ATOMIC_RELAXED);
+    if(!refresh(segment, time > lastTime ? (writes - lastWrites) * 1e9 / (time - lastTime) : 0.0) ||
+       count == refreshes){
+      break;
+    }
+    lastWrites = writes;
+    lastTime = time;
+    nanosleep(&pause, NULL);
+  }
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,614 @@
+///file:green.c
+///description:runs many Fred programs at once as contexts, each a
+///  table and the offset of its next line, that a few threads take
+///  turns running from one queue. A turn ends after a budget of
+///  statements or operators, so no program keeps the others waiting
+///author: avv8047 : Azhur Viano
+
+
+#include "green.h"
+#include "memstats.h"
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+//time between checks of the CPU time of contexts against a limit, in
+//  milliseconds
+#define LIMIT_INTERVAL 5
+
+
+//A program in progress
+struct Context_ {
+  Scheduler* scheduler;
+  SymbolTable* table;
+  const char* program;
+  //offset of the next line to run, and the number of the last one run
+  size_t next;
+  size_t line;
+  FILE* out;
+  //buffer each line is copied into to be run
+  char* buffer;
+  size_t capacity;
+  //set once the context is cancelled
+  int cancelled;
+  ContextState state;
+  //counts, written by the thread running the context at the end of a
+  //  turn and read by any thread
+  unsigned long long statements;
+  unsigned long long operators;
+  unsigned long long slices;
+  long long cpu;
+  long long longestWait;
+  long long elapsed;
+  //times the context was spawned and last became ready
+  long long spawned;
+  long long readySince;
+  //next context in the queue
+  Context* queued;
+};
+
+
+//The threads and the contexts waiting for a turn, first in first out
+struct Scheduler_ {
+  pthread_mutex_t lock;
+  //signalled when a context is queued or the threads are stopping
+  pthread_cond_t ready;
+  //signalled when the last context finishes
+  pthread_cond_t finished;
+  Context* head;
+  Context* tail;
+  //every context spawned, to be freed
+  Context** contexts;
+  size_t count;
+  size_t capacity;
+  //contexts that have not finished
+  size_t live;
+  //budget of a turn
+  size_t statements;
+  size_t operators;
+  int stopping;
+  pthread_t threads[MAX_GREEN_THREADS];
+  int threadCount;
+};
+
+
+//held while a statement that touches what tables share runs, such as
+//  the memoized results of expressions, functions and arrays
+static pthread_mutex_t sharedLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+///Current monotonic time
+///@returns the time in nanoseconds
+static long long now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+///CPU time of the calling thread
+///@returns the time in nanoseconds
+static long long threadTime(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+///Count the operators, calls and reductions of an expression as it was
+///  compiled
+///@param expression the expression, or NULL
+///@returns the count
+static size_t countOperators(const Expression* expression){
+  const Token* tokens;
+  size_t size;
+  size_t count = 0;
+  size_t i;
+
+  if(!expression){
+    return 0;
+  }
+  //the tokens of an expression calling functions are rewritten when
+  //  calls are inlined, but those as compiled are not
+  tokens = expression->compiled ? expression->compiled : expression->tokens;
+  size = expression->compiled ? expression->compiledSize : expression->size;
+  for(i = 0; i < size; i++){
+    if(tokens[i].type == Operator || tokens[i].type == Call || tokens[i].type == Reduce){
+      count++;
+    }
+  }
+  return count;
+}
+
+
+///Count the operators a statement can evaluate, a comparison counting
+///  as one
+///@param statement the statement
+///@returns the count
+static size_t statementOperators(const Statement* statement){
+  size_t count = 0;
+  size_t i;
+
+  if(statement->error){
+    return 0;
+  }
+  if(statement->kind == LetStatement){
+    return countOperators(statement->left);
+  }
+  if(statement->kind == IfStatement){
+    for(i = 0; i < statement->branchCount; i++){
+      count += countOperators(statement->branches[i].left) +
+	countOperators(statement->branches[i].right) + 1;
+    }
+    return count + statementOperators(statement->then);
+  }
+  return 0;
+}
+
+
+///Run the next line of a context, echoing it as processStatements does
+///@param context the context
+///@returns the operators of the statement
+static size_t runLine(Context* context){
+  const char* start = context->program + context->next;
+  const char* newline = strchr(start, '\n');
+  size_t length = newline ? (size_t) (newline - start) + 1 : strlen(start);
+  Statement* statement;
+  size_t operators;
+
+  //copy the line so it ends like one from readLine
+  if(length + 1 > context->capacity){
+    context->capacity = length + 1;
+    context->buffer = memRealloc(MemLines, context->buffer, context->capacity);
+  }
+  memcpy(context->buffer, start, length);
+  context->buffer[length] = '\0';
+  context->next += length;
+  context->line++;
+
+  fprintf(context->out, ":::%s\n", context->buffer);
+  setDiagnosticLine(context->line);
+  statement = compileStatement(context->buffer);
+  statement->line = context->line;
+  operators = statementOperators(statement);
+  if(!executeIsolated(context->table, statement, context->out)){
+    pthread_mutex_lock(&sharedLock);
+    executeStatement(context->table, statement, context->out);
+    pthread_mutex_unlock(&sharedLock);
+  }
+  DestroyStatement(statement);
+  fputs(">", context->out);
+  setDiagnosticLine(0);
+
+  return operators;
+}
+
+
+///Give a context a turn
+///@param scheduler the scheduler
+///@param context the context
+///@returns 1 if it has finished, 0 if it is to be queued again
+static int runSlice(Scheduler* scheduler, Context* context){
+  long long start = threadTime();
+  size_t statements = 0;
+  size_t operators = 0;
+  int done;
+
+  if(context->slices == 0){
+    fputs(">", context->out);
+  }
+  while(!__atomic_load_n(&context->cancelled, __ATOMIC_ACQUIRE) &&
+	context->program[context->next]){
+    operators += runLine(context);
+    statements++;
+    if((scheduler->statements && statements >= scheduler->statements) ||
+       (scheduler->operators && operators >= scheduler->operators)){
+      break;
+    }
+  }
+  done = !context->program[context->next];
+  if(done){
+    fputs("\n", context->out);
+  }
+
+  __atomic_store_n(&context->statements, context->statements + statements, __ATOMIC_RELAXED);
+  __atomic_store_n(&context->operators, context->operators + operators, __ATOMIC_RELAXED);
+  __atomic_store_n(&context->slices, context->slices + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&context->cpu, context->cpu + threadTime() - start, __ATOMIC_RELAXED);
+  if(done || __atomic_load_n(&context->cancelled, __ATOMIC_ACQUIRE)){
+    __atomic_store_n(&context->elapsed, now() - context->spawned, __ATOMIC_RELAXED);
+    __atomic_store_n(&context->state, done ? ContextDone : ContextCancelled, __ATOMIC_RELEASE);
+    return 1;
+  }
+  __atomic_store_n(&context->state, ContextReady, __ATOMIC_RELAXED);
+  return 0;
+}
+
+
+///Add a context to the end of the queue; the lock must be held
+///@param scheduler the scheduler
+///@param context the context
+static void queueContext(Scheduler* scheduler, Context* context){
+  context->readySince = now();
+  context->queued = NULL;
+  if(scheduler->tail){
+    scheduler->tail->queued = context;
+  }
+  else{
+    scheduler->head = context;
+  }
+  scheduler->tail = context;
+  pthread_cond_signal(&scheduler->ready);
+  return;
+}
+
+
+///Thread of a scheduler: give turns to contexts until it is stopped
+///@param arg the scheduler
+///@returns NULL
+static void* workerMain(void* arg){
+  Scheduler* scheduler = (Scheduler*) arg;
+  Context* context;
+  long long wait;
+  int finished;
+
+  pthread_mutex_lock(&scheduler->lock);
+  while(1){
+    while(!scheduler->head && !scheduler->stopping){
+      pthread_cond_wait(&scheduler->ready, &scheduler->lock);
+    }
+    if(!scheduler->head){
+      break;
+    }
+    context = scheduler->head;
+    scheduler->head = context->queued;
+    if(!scheduler->head){
+      scheduler->tail = NULL;
+    }
+    pthread_mutex_unlock(&scheduler->lock);
+
+    wait = now() - context->readySince;
+    if(wait > context->longestWait){
+      __atomic_store_n(&context->longestWait, wait, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&context->state, ContextRunning, __ATOMIC_RELAXED);
+    finished = runSlice(scheduler, context);
+
+    pthread_mutex_lock(&scheduler->lock);
+    if(!finished){
+      queueContext(scheduler, context);
+    }
+    else if(--scheduler->live == 0){
+      pthread_cond_broadcast(&scheduler->finished);
+    }
+  }
+  pthread_mutex_unlock(&scheduler->lock);
+  return NULL;
+}
+
+
+//Create a scheduler and start its threads
+Scheduler* CreateScheduler(int threads, size_t statements, size_t operators){
+  Scheduler* scheduler = memAlloc(MemStatements, sizeof(Scheduler));
+  int i;
+
+  pthread_mutex_init(&scheduler->lock, NULL);
+  pthread_cond_init(&scheduler->ready, NULL);
+  pthread_cond_init(&scheduler->finished, NULL);
+  scheduler->head = NULL;
+  scheduler->tail = NULL;
+  scheduler->contexts = NULL;
+  scheduler->count = 0;
+  scheduler->capacity = 0;
+  scheduler->live = 0;
+  scheduler->statements = statements;
+  scheduler->operators = operators;
+  scheduler->stopping = 0;
+  scheduler->threadCount = 0;
+  for(i = 0; i < threads && i < MAX_GREEN_THREADS; i++){
+    if(pthread_create(&scheduler->threads[i], NULL, workerMain, scheduler) != 0){
+      break;
+    }
+    scheduler->threadCount++;
+  }
+  return scheduler;
+}
+
+
+//Start running a program as a context
+Context* spawnContext(Scheduler* scheduler, SymbolTable* baseline, const char* program,
+		      FILE* out){
+  Context* context = memAlloc(MemStatements, sizeof(Context));
+
+  memset(context, 0, sizeof(Context));
+  context->scheduler = scheduler;
+  context->table = baseline ? ForkTable(baseline) : CreateTable();
+  context->program = program;
+  context->out = out;
+  context->state = ContextReady;
+  context->spawned = now();
+
+  pthread_mutex_lock(&scheduler->lock);
+  if(scheduler->count == scheduler->capacity){
+    scheduler->capacity = scheduler->capacity ? scheduler->capacity * 2 : 64;
+    scheduler->contexts = memRealloc(MemStatements, scheduler->contexts,
+				     sizeof(Context*) * scheduler->capacity);
+  }
+  scheduler->contexts[scheduler->count++] = context;
+  scheduler->live++;
+  queueContext(scheduler, context);
+  pthread_mutex_unlock(&scheduler->lock);
+  return context;
+}
+
+
+//Cancel a context
+void cancelContext(Context* context){
+  __atomic_store_n(&context->cancelled, 1, __ATOMIC_RELEASE);
+  return;
+}
+
+
+//Wait for the contexts to finish
+size_t waitContexts(Scheduler* scheduler, long milliseconds){
+  struct timespec deadline;
+  size_t live;
+
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  if(milliseconds > 0){
+    deadline.tv_sec += milliseconds / 1000;
+    deadline.tv_nsec += (milliseconds % 1000) * 1000000L;
+    if(deadline.tv_nsec >= 1000000000L){
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000L;
+    }
+  }
+
+  pthread_mutex_lock(&scheduler->lock);
+  while(scheduler->live && milliseconds != 0){
+    if(milliseconds < 0){
+      pthread_cond_wait(&scheduler->finished, &scheduler->lock);
+    }
+    else if(pthread_cond_timedwait(&scheduler->finished, &scheduler->lock,
+				   &deadline) == ETIMEDOUT){
+      break;
+    }
+  }
+  live = scheduler->live;
+  pthread_mutex_unlock(&scheduler->lock);
+  return live;
+}
+
+
+//Get what a context has run
+void getContextStats(Context* context, ContextStats* stats){
+  stats->state = __atomic_load_n(&context->state, __ATOMIC_ACQUIRE);
+  stats->statements = __atomic_load_n(&context->statements, __ATOMIC_RELAXED);
+  stats->operators = __atomic_load_n(&context->operators, __ATOMIC_RELAXED);
+  stats->slices = __atomic_load_n(&context->slices, __ATOMIC_RELAXED);
+  stats->cpu = __atomic_load_n(&context->cpu, __ATOMIC_RELAXED);
+  stats->longestWait = __atomic_load_n(&context->longestWait, __ATOMIC_RELAXED);
+  stats->elapsed = __atomic_load_n(&context->elapsed, __ATOMIC_RELAXED);
+  return;
+}
+
+
+//Get the table of a context
+SymbolTable* contextTable(Context* context){
+  return context->table;
+}
+
+
+//Stop a scheduler and free its contexts
+void DestroyScheduler(Scheduler* scheduler){
+  size_t i;
+  int t;
+
+  for(i = 0; i < scheduler->count; i++){
+    cancelContext(scheduler->contexts[i]);
+  }
+  waitContexts(scheduler, -1);
+
+  pthread_mutex_lock(&scheduler->lock);
+  scheduler->stopping = 1;
+  pthread_cond_broadcast(&scheduler->ready);
+  pthread_mutex_unlock(&scheduler->lock);
+  for(t = 0; t < scheduler->threadCount; t++){
+    pthread_join(scheduler->threads[t], NULL);
+  }
+
+  for(i = 0; i < scheduler->count; i++){
+    DestroyTable(scheduler->contexts[i]->table);
+    memFree(scheduler->contexts[i]->buffer);
+    memFree(scheduler->contexts[i]);
+  }
+  memFree(scheduler->contexts);
+  pthread_cond_destroy(&scheduler->ready);
+  pthread_cond_destroy(&scheduler->finished);
+  pthread_mutex_destroy(&scheduler->lock);
+  memFree(scheduler);
+  return;
+}
+
+
+//Read the budget of a turn
+int parseSlice(const char* spec, size_t* statements, size_t* operators){
+  char* copy = strdup(spec);
+  char* item;
+  char* value;
+  char* end;
+  char* save = NULL;
+  unsigned long long number;
+  int valid = 1;
+
+  for(item = strtok_r(copy, ",", &save); item && valid; item = strtok_r(NULL, ",", &save)){
+    value = strchr(item, '=');
+    if(!value){
+      valid = 0;
+      break;
+    }
+    *value++ = '\0';
+    number = strtoull(value, &end, 10);
+    valid = *value && !*end && number <= (1ULL << 30);
+    if(strcmp(item, "statements") == 0){
+      *statements = number;
+    }
+    else if(strcmp(item, "operators") == 0){
+      *operators = number;
+    }
+    else{
+      valid = 0;
+    }
+  }
+  free(copy);
+  return valid;
+}
+
+
+///Read a whole program file
+///@param path the path of the file
+///@returns the text, to be freed with memFree, or NULL if it could not
+///  be read
+static char* readProgram(const char* path){
+  FILE* file = fopen(path, "r");
+  char* text;
+  long length;
+
+  if(!file || fseek(file, 0, SEEK_END) != 0 || (length = ftell(file)) < 0){
+    if(file){
+      fclose(file);
+    }
+    return NULL;
+  }
+  rewind(file);
+  text = memAlloc(MemLines, length + 1);
+  length = (long) fread(text, 1, length, file);
+  text[length] = '\0';
+  fclose(file);
+  return text;
+}
+
+
+///Print what a context has run
+///@param path the program of the context
+///@param stats the counts of the context
+static void printContextStats(const char* path, const ContextStats* stats){
+  fprintf(stderr, "Context %s: %s, %llu statements, %llu operators, %llu turns, "
+	  "%.3f ms CPU, longest wait %.3f ms\n", path,
+	  stats->state == ContextDone ? "done" : "cancelled", stats->statements,
+	  stats->operators, stats->slices, stats->cpu / 1e6, stats->longestWait / 1e6);
+  return;
+}
+
+
+//Run every program of a list as a context
+int processContexts(const char* listPath, SymbolTable* baseline, int threads,
+		    size_t statements, size_t operators, long cpuLimit, int stats){
+  FILE* list = fopen(listPath, "r");
+  Scheduler* scheduler;
+  char** paths = NULL;
+  char** programs;
+  FILE** outs;
+  Context** contexts;
+  ContextStats counts;
+  char* line = NULL;
+  size_t len = 0;
+  size_t count = 0;
+  size_t capacity = 0;
+  size_t cancelled = 0;
+  unsigned long long total = 0;
+  long long start;
+  char* path;
+  size_t i;
+  int status = EXIT_SUCCESS;
+
+  if(!list){
+    fprintf(stderr, "Error opening context list %s\n", listPath);
+    return EXIT_FAILURE;
+  }
+  while(readLine(&line, &len, list) != -1){
+    line[strcspn(line, "\r\n")] = '\0';
+    if(!*line){
+      continue;
+    }
+    if(count == capacity){
+      capacity = capacity ? capacity * 2 : 16;
+      paths = memRealloc(MemLines, paths, sizeof(char*) * capacity);
+    }
+    paths[count++] = memStrdup(MemLines, line);
+  }
+  memFree(line);
+  fclose(list);
+  if(!count){
+    fprintf(stderr, "No programs listed in %s\n", listPath);
+    memFree(paths);
+    return EXIT_FAILURE;
+  }
+
+  programs = memAlloc(MemLines, sizeof(char*) * count);
+  outs = memAlloc(MemLines, sizeof(FILE*) * count);
+  contexts = memAlloc(MemLines, sizeof(Context*) * count);
+  scheduler = CreateScheduler(threads, statements, operators);
+  start = now();
+  for(i = 0; i < count; i++){
+    programs[i] = readProgram(paths[i]);
+    path = memAlloc(MemLines, strlen(paths[i]) + 5);
+    sprintf(path, "%s.out", paths[i]);
+    outs[i] = programs[i] ? fopen(path, "w") : NULL;
+    if(!programs[i] || !outs[i]){
+      fprintf(stderr, "Error opening %s\n", programs[i] ? path : paths[i]);
+      status = EXIT_FAILURE;
+      contexts[i] = NULL;
+    }
+    else{
+      contexts[i] = spawnContext(scheduler, baseline, programs[i], outs[i]);
+    }
+    memFree(path);
+  }
+
+  //cancel the contexts that have had more CPU time than they may
+  while(waitContexts(scheduler, cpuLimit ? LIMIT_INTERVAL : -1)){
+    for(i = 0; i < count; i++){
+      if(contexts[i]){
+	getContextStats(contexts[i], &counts);
+	if(counts.cpu > cpuLimit * 1000000LL){
+	  cancelContext(contexts[i]);
+	}
+      }
+    }
+  }
+
+  for(i = 0; i < count; i++){
+    if(contexts[i]){
+      getContextStats(contexts[i], &counts);
+      if(counts.state == ContextCancelled){
+	fprintf(stderr, "Context %s cancelled after %.3f ms of CPU\n", paths[i],
+		counts.cpu / 1e6);
+	fputs("\n", outs[i]);
+	cancelled++;
+      }
+      dumpTable(contextTable(contexts[i]), outs[i]);
+      if(stats){
+	printContextStats(paths[i], &counts);
+      }
+      total += counts.statements;
+    }
+    if(outs[i]){
+      fclose(outs[i]);
+    }
+    memFree(programs[i]);
+    memFree(paths[i]);
+  }
+  if(stats){
+    fprintf(stderr, "Contexts: %zu run on %d threads, %zu cancelled, %llu statements "
+	    "in %.3f s\n", count, threads, cancelled, total, (now() - start) / 1e9);
+  }
+
+  DestroyScheduler(scheduler);
+  memFree(contexts);
+  memFree(outs);
+  memFree(programs);
+  memFree(paths);
+  return cancelled ? EXIT_FAILURE : status;
+}
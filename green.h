@@ -0,0 +1,138 @@
+///file:green.h
+///description:declarations for running many Fred programs at once as
+///  contexts that a few threads take turns running, each for a budget
+///  of statements and operators at a time
+///author: avv8047 : Azhur Viano
+
+
+#ifndef GREEN_H
+#define GREEN_H
+
+#include "processor.h"
+
+//most threads a scheduler can run contexts on
+#define MAX_GREEN_THREADS 64
+//statements and operators a context runs before another gets a turn,
+//  unless the scheduler is given others
+#define SLICE_STATEMENTS 64
+#define SLICE_OPERATORS 4096
+
+
+//States of a context: waiting for a turn, taking one, or finished by
+//  running its last statement or by being cancelled
+typedef enum context_state {ContextReady, ContextRunning, ContextDone,
+			    ContextCancelled} ContextState;
+
+
+//What a context has run and the time it has taken
+typedef struct ContextStats_ {
+  ContextState state;
+  //statements run, and the operators of their expressions as compiled
+  unsigned long long statements;
+  unsigned long long operators;
+  //turns taken
+  unsigned long long slices;
+  //CPU time of the turns, in nanoseconds
+  long long cpu;
+  //longest time the context was ready before its next turn, in
+  //  nanoseconds
+  long long longestWait;
+  //time from being spawned until finishing, in nanoseconds; 0 until
+  //  it has finished
+  long long elapsed;
+} ContextStats;
+
+
+//A program in progress, with its own table and the offset of the next
+//  line to run
+typedef struct Context_ Context;
+
+//Threads running contexts and the contexts waiting for a turn
+typedef struct Scheduler_ Scheduler;
+
+
+///Create a scheduler and start its threads. A context gets turns in
+///  the order it becomes ready, and its turn ends once it has run
+///  either budget; a statement is never split between turns.
+///  Statements that only touch the table of their context run at the
+///  same time on every thread, the rest one at a time
+///@param threads the number of threads, from 1 to MAX_GREEN_THREADS
+///@param statements the statements of a turn, 0 for no limit
+///@param operators the operators of a turn, 0 for no limit
+///@returns the scheduler, freed with DestroyScheduler
+Scheduler* CreateScheduler(int threads, size_t statements, size_t operators);
+
+
+///Start running a program as a context. It prints to its stream as
+///  processStatements does, without the dump of its table
+///@param scheduler the scheduler
+///@param baseline the table the context starts from, forked so that it
+///  is not written, or NULL to start from an empty table
+///@param program the text of the program, kept until the context has
+///  finished
+///@param out the stream the context prints to; contexts sharing one
+///  have their lines mixed
+///@returns the context, freed with its scheduler
+Context* spawnContext(Scheduler* scheduler, SymbolTable* baseline, const char* program,
+		      FILE* out);
+
+
+///Cancel a context from any thread. It runs no statement after the one
+///  it is running, if any
+///@param context the context
+void cancelContext(Context* context);
+
+
+///Wait for every context spawned so far to finish
+///@param scheduler the scheduler
+///@param milliseconds the longest time to wait, or -1 to wait until
+///  they have finished
+///@returns the number of contexts that have not finished
+size_t waitContexts(Scheduler* scheduler, long milliseconds);
+
+
+///Get what a context has run so far; the counts are updated at the end
+///  of each of its turns
+///@param context the context
+///@param stats filled with the counts
+void getContextStats(Context* context, ContextStats* stats);
+
+
+///Get the table of a context, which is only to be read once the
+///  context has finished
+///@param context the context
+///@returns the table
+SymbolTable* contextTable(Context* context);
+
+
+///Cancel every context, stop the threads and free the contexts and
+///  their tables
+///@param scheduler the scheduler
+void DestroyScheduler(Scheduler* scheduler);
+
+
+///Read the budget of a turn from statements=N,operators=N, either of
+///  which may be left out to keep its value; 0 is no limit
+///@param spec the budget
+///@param statements set to the statements of a turn if given
+///@param operators set to the operators of a turn if given
+///@returns 1 if the budget is valid, 0 otherwise
+int parseSlice(const char* spec, size_t* statements, size_t* operators);
+
+
+///Run every program of a list as a context starting from the same
+///  table. The output of program path, the same as running fred -f path
+///  alone, is written to path.out
+///@param listPath file naming one program file per line
+///@param baseline the table every context starts from
+///@param threads the threads to run the contexts on
+///@param statements the statements of a turn, 0 for no limit
+///@param operators the operators of a turn, 0 for no limit
+///@param cpuLimit the CPU time in milliseconds after which a context is
+///  cancelled, 0 for no limit
+///@param stats whether to print what each context ran to stderr
+///@returns the exit status, a failure if any context was cancelled
+int processContexts(const char* listPath, SymbolTable* baseline, int threads,
+		    size_t statements, size_t operators, long cpuLimit, int stats);
+
+#endif
@@ -0,0 +1,251 @@
+///file:greenbench.c
+///description:benchmark for running many programs at once as contexts.
+///  Spawns thousands of short programs and a few runaways that are far
+///  longer, cancels each runaway once it has had its CPU time, and
+///  reports the throughput and how evenly the short programs were served
+///author: avv8047 : Azhur Viano
+
+
+#include "green.h"
+#include "memstats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+//different short programs, spread over the contexts
+#define VARIANTS 16
+
+
+///Print the usage message for the benchmark
+void printUsage(){
+  fprintf(stderr, "Usage:  fred-greenbench [ -c contexts ] [ -t threads ]"
+	  "[ -l lines-per-program ] [ -r runaways ] [ -k runaway-cpu-ms ]"
+	  "[ -s statements-per-turn ] [ -o operators-per-turn ]\n");
+  return;
+}
+
+
+///Current monotonic time
+///@returns the time in nanoseconds
+static long long now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+///Next number of a xorshift generator, so every run has the same
+///  programs
+///@param state the state of the generator, updated
+///@returns the number
+static uint64_t nextRandom(uint64_t* state){
+  *state ^= *state << 13;
+  *state ^= *state >> 7;
+  *state ^= *state << 17;
+  return *state;
+}
+
+
+///Write a program of lets, ifs and the odd prt and display
+///@param lines the number of lines after the defines
+///@param state the state of the generator
+///@returns the text, freed with free
+static char* makeProgram(long lines, uint64_t* state){
+  size_t capacity = 128 + (size_t) lines * 64;
+  char* text = malloc(capacity);
+  size_t length;
+  long i;
+
+  length = sprintf(text, "define integer a, b, c, i\ndefine real x, y\nlet y = 2.5\n");
+  for(i = 0; i < lines; i++){
+    switch(nextRandom(state) % 10){
+    case 0:
+    case 1:
+    case 2:
+      length += sprintf(text + length, "let a = a + %d\n", (int) (nextRandom(state) % 9) + 1);
+      break;
+    case 3:
+    case 4:
+      length += sprintf(text + length, "let b = (a * 3 + c) %% %d\n",
+			(int) (nextRandom(state) % 97) + 2);
+      break;
+    case 5:
+      length += sprintf(text + length, "let x = x * 1.5 + b / 4 - y\n");
+      break;
+    case 6:
+    case 7:
+      length += sprintf(text + length, "if a > %d then let c = c + 1\n",
+			(int) (nextRandom(state) % 200));
+      break;
+    case 8:
+      length += sprintf(text + length, "if x < y or a = b then let y = y + 0.5\n");
+      break;
+    default:
+      length += sprintf(text + length, nextRandom(state) % 2 ? "prt \"step\\n\"\n" :
+			"display a, x\n");
+      break;
+    }
+  }
+  return text;
+}
+
+
+///Compare longs for qsort
+///@param a the first
+///@param b the second
+///@returns the order of the two
+static int compareLong(const void* a, const void* b){
+  long long x = *(const long long*) a;
+  long long y = *(const long long*) b;
+  return (x > y) - (x < y);
+}
+
+
+//Spawn the contexts, cancel the runaways and report the service
+int main(int argc, char** argv){
+  int c;
+  long contexts = 10000;
+  long threads = 4;
+  long lines = 200;
+  long runaways = 4;
+  long runawayCpu = 20;
+  long statements = SLICE_STATEMENTS;
+  long operators = SLICE_OPERATORS;
+  uint64_t state = 88172645463325252ULL;
+  char* programs[VARIANTS];
+  char* runaway;
+  Context** spawned;
+  Scheduler* scheduler;
+  ContextStats stats;
+  FILE* out;
+  long long* elapsed;
+  long long* waits;
+  long long start;
+  long long wall;
+  long long cpu = 0;
+  long long runawayTime = 0;
+  unsigned long long total = 0;
+  unsigned long long runawayStatements = 0;
+  double sum = 0.0;
+  double squares = 0.0;
+  long cancelled = 0;
+  long i;
+
+  while((c = getopt(argc, argv, "c:t:l:r:k:s:o:")) != -1){
+    switch(c){
+    case 'c':
+      contexts = strtol(optarg, NULL, 10);
+      break;
+    case 't':
+      threads = strtol(optarg, NULL, 10);
+      break;
+    case 'l':
+      lines = strtol(optarg, NULL, 10);
+      break;
+    case 'r':
+      runaways = strtol(optarg, NULL, 10);
+      break;
+    case 'k':
+      runawayCpu = strtol(optarg, NULL, 10);
+      break;
+    case 's':
+      statements = strtol(optarg, NULL, 10);
+      break;
+    case 'o':
+      operators = strtol(optarg, NULL, 10);
+      break;
+    default:
+      printUsage();
+      return EXIT_FAILURE;
+    }
+  }
+  if(optind != argc || contexts < 1 || threads < 1 || threads > MAX_GREEN_THREADS ||
+     lines < 1 || runaways < 0 || runawayCpu < 1 || statements < 0 || operators < 0){
+    printUsage();
+    return EXIT_FAILURE;
+  }
+
+  out = fopen("/dev/null", "w");
+  if(!out){
+    perror("/dev/null");
+    return EXIT_FAILURE;
+  }
+  for(i = 0; i < VARIANTS; i++){
+    programs[i] = makeProgram(lines, &state);
+  }
+  runaway = makeProgram(lines * 1000, &state);
+  spawned = malloc(sizeof(Context*) * (contexts + runaways));
+  elapsed = malloc(sizeof(long long) * contexts);
+  waits = malloc(sizeof(long long) * contexts);
+
+  //the runaways are spawned first, so they would have every thread to
+  //  themselves if turns were not limited
+  scheduler = CreateScheduler((int) threads, statements, operators);
+  start = now();
+  for(i = 0; i < runaways; i++){
+    spawned[contexts + i] = spawnContext(scheduler, NULL, runaway, out);
+  }
+  for(i = 0; i < contexts; i++){
+    spawned[i] = spawnContext(scheduler, NULL, programs[i % VARIANTS], out);
+  }
+  while(waitContexts(scheduler, 1)){
+    for(i = 0; i < runaways; i++){
+      getContextStats(spawned[contexts + i], &stats);
+      if(stats.cpu > runawayCpu * 1000000LL){
+	cancelContext(spawned[contexts + i]);
+      }
+    }
+  }
+  wall = now() - start;
+
+  for(i = 0; i < contexts + runaways; i++){
+    getContextStats(spawned[i], &stats);
+    total += stats.statements;
+    cpu += stats.cpu;
+    if(i >= contexts){
+      runawayStatements += stats.statements;
+      runawayTime += stats.cpu;
+      cancelled += stats.state == ContextCancelled;
+      continue;
+    }
+    elapsed[i] = stats.elapsed;
+    waits[i] = stats.longestWait;
+    sum += stats.elapsed;
+    squares += (double) stats.elapsed * stats.elapsed;
+  }
+  qsort(elapsed, contexts, sizeof(long long), compareLong);
+  qsort(waits, contexts, sizeof(long long), compareLong);
+
+  printf("%ld contexts of %ld lines and %ld runaways of %ld lines on %ld threads, "
+	 "turns of %ld statements or %ld operators\n", contexts, lines + 3, runaways,
+	 lines * 1000 + 3, threads, statements, operators);
+  printf("  throughput:   %.0f statements/s, %.0f contexts/s (%.3f s wall, %.3f s CPU)\n",
+	 total / (wall / 1e9), contexts / (wall / 1e9), wall / 1e9, cpu / 1e9);
+  printf("  completion:   p50 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+	 elapsed[contexts / 2] / 1e6, elapsed[contexts * 99 / 100] / 1e6,
+	 elapsed[contexts - 1] / 1e6);
+  printf("  longest wait: p50 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+	 waits[contexts / 2] / 1e6, waits[contexts * 99 / 100] / 1e6, waits[contexts - 1] / 1e6);
+  //Jain's index of the completion times of programs that are all as
+  //  long: 1 when they finish together, as they do when served evenly
+  printf("  fairness:     %.4f (Jain's index of completion times)\n",
+	 squares > 0 ? sum * sum / (contexts * squares) : 1.0);
+  if(runaways){
+    printf("  runaways:     %ld of %ld cancelled, %.2f ms CPU and %llu statements each\n",
+	   cancelled, runaways, runawayTime / 1e6 / runaways, runawayStatements / runaways);
+  }
+
+  DestroyScheduler(scheduler);
+  for(i = 0; i < VARIANTS; i++){
+    free(programs[i]);
+  }
+  free(runaway);
+  free(spawned);
+  free(elapsed);
+  free(waits);
+  fclose(out);
+  clearExpressionCache();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,455 @@
+///file:lazy.c
+///description:symbol files loaded lazily through an index of their
+///  names sorted in the order dumpTable prints them, built in one scan
+///  of the mapped file or read from the index file beside it
+///author: avv8047 : Azhur Viano
+
+
+#include "lazy.h"
+#include "diagnostics.h"
+#include "memstats.h"
+#include "processor.h"
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//"FREDIDX1"
+#define INDEX_MAGIC 0x3158444944455246ULL
+#define INDEX_VERSION 1
+
+
+//Name and line of a symbol. The key is the packed name with its bytes
+//  reversed, so keys are ordered as the names are by strcmp
+typedef struct LazyEntry_ {
+  uint64_t key;
+  //offset of the line in the symbol file
+  uint64_t offset;
+} LazyEntry;
+
+
+//Start of an index file, followed by its entries
+typedef struct IndexHeader_ {
+  uint64_t magic;
+  uint64_t version;
+  //size and modification time of the symbol file it indexes
+  uint64_t fileSize;
+  int64_t seconds;
+  int64_t nanoseconds;
+  uint64_t count;
+} IndexHeader;
+
+
+//A symbol file loaded lazily
+typedef struct LazySymbols_ {
+  //first, so the source a table holds is the lazy symbols
+  SymbolSource source;
+  //the mapped symbol file
+  char* text;
+  size_t length;
+  //entries sorted by key, either built or in the mapped index file
+  LazyEntry* entries;
+  LazyEntry* built;
+  void* index;
+  size_t indexLength;
+  //buffer a line is copied into to be parsed
+  char* line;
+  size_t capacity;
+} LazySymbols;
+
+
+///Copy a line of the symbol file into the buffer of the lazy symbols,
+///  with its newline, so it can be parsed in place
+///@param lazy the lazy symbols
+///@param offset the offset of the line
+///@returns the copy, NULL if there was no memory for it
+static char* copyLine(LazySymbols* lazy, size_t offset){
+  const char* start = lazy->text + offset;
+  const char* newline = memchr(start, '\n', lazy->length - offset);
+  size_t length = newline ? (size_t) (newline - start) + 1 : lazy->length - offset;
+  char* grown;
+
+  if(length + 1 > lazy->capacity){
+    grown = memRealloc(MemLines, lazy->line, length + 1);
+    if(!grown){
+      return NULL;
+    }
+    lazy->line = grown;
+    lazy->capacity = length + 1;
+  }
+  memcpy(lazy->line, start, length);
+  lazy->line[length] = '\0';
+  return lazy->line;
+}
+
+
+///Find a symbol of lazy symbols by its packed name
+///@param source the lazy symbols
+///@param name the packed name
+///@returns its index, or the number of symbols if there is none
+static size_t findLazy(SymbolSource* source, uint64_t name){
+  LazySymbols* lazy = (LazySymbols*) source;
+  uint64_t key = __builtin_bswap64(name);
+  size_t low = 0;
+  size_t high = source->size;
+  size_t middle;
+
+  while(low < high){
+    middle = low + (high - low) / 2;
+    if(lazy->entries[middle].key < key){
+      low = middle + 1;
+    }
+    else{
+      high = middle;
+    }
+  }
+  return low < source->size && lazy->entries[low].key == key ? low : source->size;
+}
+
+
+///Get the name of a symbol of lazy symbols
+///@param source the lazy symbols
+///@param index the index of the symbol
+///@returns the packed name
+static SymbolName nameLazy(SymbolSource* source, size_t index){
+  SymbolName name;
+
+  name.word = __builtin_bswap64(((LazySymbols*) source)->entries[index].key);
+  return name;
+}
+
+
+///Parse the line of a symbol of lazy symbols
+///@param source the lazy symbols
+///@param index the index of the symbol
+///@param create whether to create an array
+///@param type set to the type
+///@param value set to the value
+///@returns 1 on success, 0 if it could not be read
+static int readLazy(SymbolSource* source, size_t index, int create, Type* type,
+		    Value* value){
+  LazySymbols* lazy = (LazySymbols*) source;
+  char* line = copyLine(lazy, lazy->entries[index].offset);
+  char* name;
+  int read;
+  int muted;
+
+  //the scan reported the errors of the line already
+  muted = muteDiagnostics(1);
+  read = line && parseSymbolLine(line, NULL, create, &name, type, value);
+  muteDiagnostics(muted);
+  return read;
+}
+
+
+///Sort entries by key, keeping entries with the same key in order
+///@param entries the entries
+///@param scratch memory for as many entries
+///@param count the number of entries
+static void sortEntries(LazyEntry* entries, LazyEntry* scratch, size_t count){
+  size_t counts[256];
+  LazyEntry* from = entries;
+  LazyEntry* to = scratch;
+  LazyEntry* swap;
+  size_t total;
+  size_t bucket;
+  size_t i;
+  int shift;
+
+  if(count == 0){
+    return;
+  }
+  //a radix sort, a byte at a time from the last character of the names
+  for(shift = 0; shift < 64; shift += 8){
+    memset(counts, 0, sizeof(counts));
+    for(i = 0; i < count; i++){
+      counts[(from[i].key >> shift) & 0xff]++;
+    }
+    //names that are all as long or short leave many bytes the same
+    if(counts[(from[0].key >> shift) & 0xff] == count){
+      continue;
+    }
+    for(total = 0, i = 0; i < 256; i++){
+      bucket = counts[i];
+      counts[i] = total;
+      total += bucket;
+    }
+    for(i = 0; i < count; i++){
+      to[counts[(from[i].key >> shift) & 0xff]++] = from[i];
+    }
+    swap = from;
+    from = to;
+    to = swap;
+  }
+  if(from != entries){
+    memcpy(entries, from, sizeof(LazyEntry) * count);
+  }
+  return;
+}
+
+
+///Count the lines before an offset of the symbol file
+///@param lazy the lazy symbols
+///@param offset the offset
+///@returns the number of the line the offset is in, from 1
+static size_t lineAt(LazySymbols* lazy, size_t offset){
+  const char* text = lazy->text;
+  const char* end = lazy->text + offset;
+  size_t number = 1;
+
+  while((text = memchr(text, '\n', end - text))){
+    number++;
+    text++;
+  }
+  return number;
+}
+
+
+///Drop the entries whose name an earlier line already gave. A line
+///  giving an array is reported as a duplicate, as processSymbolFile
+///  would
+///@param lazy the lazy symbols, with built entries sorted
+///@param count the number of entries
+///@returns the number of entries left
+static size_t dropDuplicates(LazySymbols* lazy, size_t count){
+  LazyEntry* entries = lazy->built;
+  SymbolName name;
+  char* line;
+  char* token;
+  char* save;
+  size_t kept = 0;
+  size_t i;
+
+  for(i = 0; i < count; i++){
+    if(kept == 0 || entries[i].key != entries[kept - 1].key){
+      entries[kept++] = entries[i];
+      continue;
+    }
+    //skip the type; an array has its length after its name
+    save = NULL;
+    line = copyLine(lazy, entries[i].offset);
+    token = line && strtok_r(line, " \t", &save) ? strtok_r(NULL, " \t", &save) : NULL;
+    if(token && strchr(token, '[')){
+      setDiagnosticLine(lineAt(lazy, entries[i].offset));
+      name.word = __builtin_bswap64(entries[i].key);
+      diagnose(DiagDuplicateSymbol, "Symbol %s already exists in table\n", name.text);
+    }
+  }
+  setDiagnosticLine(0);
+  return kept;
+}
+
+
+///Build the index of the symbol file by parsing every line of it
+///@param lazy the lazy symbols, with the file mapped
+///@returns the number of entries, or -1 if there was no memory for
+///  them; the entries are in built
+static ssize_t scanSymbols(LazySymbols* lazy){
+  size_t capacity = 1024;
+  size_t count = 0;
+  size_t offset = 0;
+  size_t number = 0;
+  const char* newline;
+  LazyEntry* grown;
+  LazyEntry* scratch;
+  char* line;
+  char* name;
+  Type type;
+  Value value;
+
+  lazy->built = memAlloc(MemSymbols, sizeof(LazyEntry) * capacity);
+  while(lazy->built && offset < lazy->length){
+    setDiagnosticLine(++number);
+    newline = memchr(lazy->text + offset, '\n', lazy->length - offset);
+    line = copyLine(lazy, offset);
+    if(line && parseSymbolLine(line, NULL, 0, &name, &type, &value)){
+      if(count == capacity){
+	capacity *= 2;
+	grown = memRealloc(MemSymbols, lazy->built, sizeof(LazyEntry) * capacity);
+	if(!grown){
+	  break;
+	}
+	lazy->built = grown;
+      }
+      lazy->built[count].key = __builtin_bswap64(PackName(name).word);
+      lazy->built[count].offset = offset;
+      count++;
+    }
+    offset = newline ? (size_t) (newline - lazy->text) + 1 : lazy->length;
+  }
+  setDiagnosticLine(0);
+
+  scratch = memAlloc(MemSymbols, sizeof(LazyEntry) * (count + 1));
+  if(!lazy->built || offset < lazy->length || !scratch){
+    memFree(scratch);
+    return -1;
+  }
+  sortEntries(lazy->built, scratch, count);
+  memFree(scratch);
+  return dropDuplicates(lazy, count);
+}
+
+
+///Map the index file of a symbol file, if it was written for the
+///  symbol file as it is
+///@param lazy the lazy symbols
+///@param path the path of the index file
+///@param status the status of the symbol file
+///@returns the number of entries, or -1 if there is no index to use
+static ssize_t readIndex(LazySymbols* lazy, const char* path, const struct stat* status){
+  int fd = open(path, O_RDONLY);
+  struct stat indexStatus;
+  IndexHeader* header;
+  ssize_t count = -1;
+
+  if(fd < 0){
+    return -1;
+  }
+  if(fstat(fd, &indexStatus) == 0 && (size_t) indexStatus.st_size >= sizeof(IndexHeader)){
+    lazy->indexLength = indexStatus.st_size;
+    lazy->index = mmap(NULL, lazy->indexLength, PROT_READ, MAP_SHARED, fd, 0);
+    if(lazy->index == MAP_FAILED){
+      lazy->index = NULL;
+    }
+  }
+  close(fd);
+  if(!lazy->index){
+    return -1;
+  }
+
+  header = lazy->index;
+  if(header->magic == INDEX_MAGIC && header->version == INDEX_VERSION &&
+     header->fileSize == (uint64_t) status->st_size &&
+     header->seconds == (int64_t) status->st_mtim.tv_sec &&
+     header->nanoseconds == (int64_t) status->st_mtim.tv_nsec &&
+     header->count == (lazy->indexLength - sizeof(IndexHeader)) / sizeof(LazyEntry) &&
+     (lazy->indexLength - sizeof(IndexHeader)) % sizeof(LazyEntry) == 0){
+    lazy->entries = (LazyEntry*) (header + 1);
+    count = (ssize_t) header->count;
+  }
+  else{
+    munmap(lazy->index, lazy->indexLength);
+    lazy->index = NULL;
+  }
+  return count;
+}
+
+
+///Write the index of a symbol file beside it, through a temporary file
+///  so a reader never sees part of one. Failing to is not an error;
+///  the file is scanned again next time
+///@param lazy the lazy symbols, with built entries
+///@param path the path of the index file
+///@param status the status of the symbol file
+///@param count the number of entries
+static void writeIndex(LazySymbols* lazy, const char* path, const struct stat* status,
+		       size_t count){
+  char temporary[PATH_MAX];
+  IndexHeader header;
+  FILE* out;
+  int written;
+
+  if(snprintf(temporary, sizeof(temporary), "%s.%d", path, (int) getpid()) >=
+     (int) sizeof(temporary)){
+    return;
+  }
+  out = fopen(temporary, "wb");
+  if(!out){
+    return;
+  }
+  memset(&header, 0, sizeof(header));
+  header.magic = INDEX_MAGIC;
+  header.version = INDEX_VERSION;
+  header.fileSize = status->st_size;
+  header.seconds = status->st_mtim.tv_sec;
+  header.nanoseconds = status->st_mtim.tv_nsec;
+  header.count = count;
+  written = fwrite(&header, sizeof(header), 1, out) == 1 &&
+    fwrite(lazy->built, sizeof(LazyEntry), count, out) == count;
+  if(fclose(out) == 0 && written){
+    rename(temporary, path);
+  }
+  else{
+    unlink(temporary);
+  }
+  return;
+}
+
+
+//Open a symbol file to load lazily
+SymbolSource* openLazySymbols(const char* path){
+  LazySymbols* lazy;
+  char indexPath[PATH_MAX];
+  struct stat status;
+  ssize_t count;
+  size_t errors;
+  int fd = open(path, O_RDONLY);
+
+  if(fd < 0 || fstat(fd, &status) != 0 ||
+     snprintf(indexPath, sizeof(indexPath), "%s%s", path, LAZY_INDEX_SUFFIX) >=
+     (int) sizeof(indexPath)){
+    if(fd >= 0){
+      close(fd);
+    }
+    return NULL;
+  }
+
+  lazy = memAlloc(MemSymbols, sizeof(LazySymbols));
+  memset(lazy, 0, sizeof(LazySymbols));
+  lazy->source.find = findLazy;
+  lazy->source.name = nameLazy;
+  lazy->source.read = readLazy;
+  lazy->length = status.st_size;
+  if(lazy->length){
+    lazy->text = mmap(NULL, lazy->length, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if(lazy->text == MAP_FAILED){
+    memFree(lazy);
+    return NULL;
+  }
+
+  count = readIndex(lazy, indexPath, &status);
+  if(count < 0){
+    errors = diagnosticTotal();
+    count = scanSymbols(lazy);
+    if(count < 0){
+      closeLazySymbols(&lazy->source);
+      return NULL;
+    }
+    lazy->entries = lazy->built;
+    //a file with errors is scanned again, so they are reported again
+    if(diagnosticTotal() == errors){
+      writeIndex(lazy, indexPath, &status, count);
+    }
+    //the scan read every page, which are read again only when used
+    if(lazy->length){
+      madvise(lazy->text, lazy->length, MADV_DONTNEED);
+    }
+  }
+  lazy->source.size = count;
+  return &lazy->source;
+}
+
+
+//Close a symbol file loaded lazily
+void closeLazySymbols(SymbolSource* source){
+  LazySymbols* lazy = (LazySymbols*) source;
+
+  if(!lazy){
+    return;
+  }
+  if(lazy->text){
+    munmap(lazy->text, lazy->length);
+  }
+  if(lazy->index){
+    munmap(lazy->index, lazy->indexLength);
+  }
+  memFree(lazy->built);
+  memFree(lazy->line);
+  memFree(lazy);
+  return;
+}
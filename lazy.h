@@ -0,0 +1,39 @@
+///file:lazy.h
+///description:declarations for loading a symbol file lazily: the file
+///  is mapped into memory and indexed by name, and a symbol is only
+///  parsed and added to a table the first time it is looked up
+///author: avv8047 : Azhur Viano
+
+
+#ifndef LAZY_H
+#define LAZY_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "symbolTable.h"
+
+//suffix of the file the index of a symbol file is kept in
+#define LAZY_INDEX_SUFFIX ".idx"
+
+
+///Open a symbol file to load lazily. The index of its names is read
+///  from the file beside it named with LAZY_INDEX_SUFFIX when that was
+///  written for the same size and modification time of the symbol
+///  file. Otherwise the symbol file is scanned, reporting its bad lines
+///  with diagnose as processSymbolFile would, and the index is written
+///  there if it had none. A name given more than once keeps its first
+///  symbol
+///@param path the path of the symbol file
+///@returns the source to give a table, or NULL if the file could not
+///  be read
+SymbolSource* openLazySymbols(const char* path);
+
+
+///Close a symbol file loaded lazily; tables using it must not be
+///  used afterwards
+///@param source the source from openLazySymbols, or NULL
+void closeLazySymbols(SymbolSource* source);
+
+#endif
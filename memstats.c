@@ -0,0 +1,457 @@
+///file:memstats.c
+///description:allocator that counts the memory used by each part of
+///  the interpreter
+///author: avv8047 : Azhur Viano
+
+
+#include "memstats.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+//size of the text of a report
+#define REPORT_SIZE 1024
+//blocks of the pools are powers of 2 from 1 << POOL_SHIFT bytes
+#define POOL_SHIFT 5
+#define POOL_CLASSES 32
+
+
+//Stored in front of every allocation; the union keeps the memory
+//  after it aligned for any type
+typedef union Header_ {
+  struct {
+    size_t size;
+    MemTag tag;
+    //whether the allocation was counted, so it is only uncounted if so
+    unsigned char counted;
+    //size class + 1 of a block from the pools, 0 if from the heap
+    unsigned char pool;
+  } info;
+  long double align;
+} Header;
+
+
+//Counts for one part of the interpreter, updated atomically since
+//  every thread allocates
+typedef struct Counter_ {
+  size_t live;
+  size_t peak;
+  size_t allocations;
+  size_t blocks;
+} Counter;
+
+
+static const char* tagNames[MEM_TAGS] = {
+  [MemSymbols] = "symbols",
+  [MemTokens] = "tokens",
+  [MemPostfix] = "postfix",
+  [MemStacks] = "stacks",
+  [MemStatements] = "statements",
+  [MemLines] = "lines",
+  [MemArrays] = "arrays",
+};
+
+static Counter counters[MEM_TAGS];
+//all parts together, so the peak is of the sum
+static Counter total;
+//counting costs atomic updates on every allocation, so it is off
+//  unless asked for
+static int counting = 0;
+
+//memory reserved up front that allocations are taken from once it is,
+//  instead of the heap; blocks freed go on the list for their size
+static char* poolArena;
+static size_t poolSize;
+static size_t poolUsed;
+static Header* poolFree[POOL_CLASSES];
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+///Count bytes coming into use
+///@param counter the counter
+///@param size the number of bytes
+static void addLive(Counter* counter, size_t size){
+  size_t live = __atomic_add_fetch(&counter->live, size, __ATOMIC_RELAXED);
+  size_t peak = __atomic_load_n(&counter->peak, __ATOMIC_RELAXED);
+
+  while(live > peak &&
+	!__atomic_compare_exchange_n(&counter->peak, &peak, live, 1,
+				     __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+  }
+  return;
+}
+
+
+///Count an allocation
+///@param tag the part it is for
+///@param size the number of bytes
+static void countAlloc(MemTag tag, size_t size){
+  addLive(&counters[tag], size);
+  addLive(&total, size);
+  __atomic_add_fetch(&counters[tag].allocations, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&counters[tag].blocks, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&total.allocations, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&total.blocks, 1, __ATOMIC_RELAXED);
+  return;
+}
+
+
+///Count a free
+///@param tag the part it was for
+///@param size the number of bytes
+static void countFree(MemTag tag, size_t size){
+  __atomic_sub_fetch(&counters[tag].live, size, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&total.live, size, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&counters[tag].blocks, 1, __ATOMIC_RELAXED);
+  __atomic_sub_fetch(&total.blocks, 1, __ATOMIC_RELAXED);
+  return;
+}
+
+
+///Take a block from the pools
+///@param size the number of bytes, including the header
+///@returns the block with its size class set, or NULL if the pools
+///  have no room left for it
+static Header* poolAlloc(size_t size){
+  Header* block = NULL;
+  int pool = 0;
+
+  while(pool < POOL_CLASSES && ((size_t) 1 << (pool + POOL_SHIFT)) < size){
+    pool++;
+  }
+  if(pool == POOL_CLASSES){
+    return NULL;
+  }
+
+  pthread_mutex_lock(&poolLock);
+  if(poolFree[pool]){
+    block = poolFree[pool];
+    poolFree[pool] = *(Header**) (block + 1);
+  }
+  else if(poolSize - poolUsed >= ((size_t) 1 << (pool + POOL_SHIFT))){
+    block = (Header*) (poolArena + poolUsed);
+    poolUsed += (size_t) 1 << (pool + POOL_SHIFT);
+  }
+  pthread_mutex_unlock(&poolLock);
+
+  if(block){
+    block->info.pool = pool + 1;
+  }
+  return block;
+}
+
+
+///Put a block back on the list for its size
+///@param block the block from poolAlloc
+static void poolRelease(Header* block){
+  int pool = block->info.pool - 1;
+
+  pthread_mutex_lock(&poolLock);
+  *(Header**) (block + 1) = poolFree[pool];
+  poolFree[pool] = block;
+  pthread_mutex_unlock(&poolLock);
+  return;
+}
+
+
+///Allocate counted memory
+void* memAlloc(MemTag tag, size_t size){
+  Header* header;
+
+  if(poolArena){
+    header = poolAlloc(sizeof(Header) + size);
+  }
+  else{
+    header = malloc(sizeof(Header) + size);
+    if(header){
+      header->info.pool = 0;
+    }
+  }
+
+  if(!header){
+    return NULL;
+  }
+  header->info.size = size;
+  header->info.tag = tag;
+  header->info.counted = counting;
+  if(counting){
+    countAlloc(tag, size);
+  }
+  return header + 1;
+}
+
+
+///Resize counted memory
+void* memRealloc(MemTag tag, void* memory, size_t size){
+  Header* header;
+  Header* resized;
+  void* copy;
+
+  if(!memory){
+    return memAlloc(tag, size);
+  }
+
+  header = (Header*) memory - 1;
+  tag = header->info.tag;
+  //a block from the pools stays where it is while it is big enough
+  if(header->info.pool &&
+     sizeof(Header) + size <= ((size_t) 1 << (header->info.pool - 1 + POOL_SHIFT))){
+    resized = header;
+  }
+  //otherwise, once there are pools, it moves into them
+  else if(header->info.pool || poolArena){
+    copy = memAlloc(tag, size);
+    if(copy){
+      memcpy(copy, memory, size < header->info.size ? size : header->info.size);
+      memFree(memory);
+    }
+    return copy;
+  }
+  else{
+    resized = realloc(header, sizeof(Header) + size);
+    if(!resized){
+      return NULL;
+    }
+  }
+  //counted as the old block freed and a new one allocated
+  if(resized->info.counted){
+    countFree(tag, resized->info.size);
+  }
+  resized->info.size = size;
+  resized->info.counted = counting;
+  if(counting){
+    countAlloc(tag, size);
+  }
+  return resized + 1;
+}
+
+
+///Free counted memory
+void memFree(void* memory){
+  Header* header;
+
+  if(!memory){
+    return;
+  }
+  header = (Header*) memory - 1;
+  if(header->info.counted){
+    countFree(header->info.tag, header->info.size);
+  }
+  if(header->info.pool){
+    poolRelease(header);
+  }
+  else{
+    free(header);
+  }
+  return;
+}
+
+
+///Reserve the memory later allocations are taken from
+int reservePools(size_t bytes){
+  void* arena = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+
+  if(arena == MAP_FAILED){
+    return 0;
+  }
+  poolArena = arena;
+  poolSize = bytes;
+  poolUsed = 0;
+  return 1;
+}
+
+
+///Get the bytes of the pools never yet allocated
+size_t poolAvailable(void){
+  size_t available;
+
+  pthread_mutex_lock(&poolLock);
+  available = poolSize - poolUsed;
+  pthread_mutex_unlock(&poolLock);
+  return available;
+}
+
+
+///Start counting allocations
+void startMemStats(void){
+  counting = 1;
+  return;
+}
+
+
+///Copy a string into counted memory
+char* memStrdup(MemTag tag, const char* string){
+  size_t len = strlen(string) + 1;
+  char* copy = memAlloc(tag, len);
+
+  if(copy){
+    memcpy(copy, string, len);
+  }
+  return copy;
+}
+
+
+///Read a line like getline, into counted memory
+ssize_t readLine(char** line, size_t* capacity, FILE* input){
+  size_t len = 0;
+  char* grown;
+  int c;
+
+  if(!*line || *capacity < 2){
+    *capacity = 128;
+    *line = memRealloc(MemLines, *line, *capacity);
+  }
+
+  while(fgets(*line + len, *capacity - len, input)){
+    len += strlen(*line + len);
+    if(len > 0 && (*line)[len - 1] == '\n'){
+      return len;
+    }
+    //the line did not fit; grow the buffer and read the rest
+    if(len + 1 == *capacity){
+      grown = memRealloc(MemLines, *line, *capacity * 2);
+      //out of memory; the rest of the line is dropped, and the line
+      //  returned fills the buffer without a newline
+      if(!grown){
+	while((c = fgetc(input)) != EOF && c != '\n'){
+	}
+	return len;
+      }
+      *line = grown;
+      *capacity *= 2;
+    }
+  }
+
+  return len ? (ssize_t) len : -1;
+}
+
+
+///Add text to a report without using stdio, so a signal handler can
+///  build one
+///@param report the report
+///@param len the length of the report, updated
+///@param text the text
+static void appendText(char* report, size_t* len, const char* text){
+  while(*text && *len + 1 < REPORT_SIZE){
+    report[(*len)++] = *text++;
+  }
+  report[*len] = '\0';
+  return;
+}
+
+
+///Add a number to a report, right aligned
+///@param report the report
+///@param len the length of the report, updated
+///@param number the number
+///@param width the width of the column
+static void appendNumber(char* report, size_t* len, size_t number, int width){
+  char digits[32];
+  int count = 0;
+
+  do{
+    digits[count++] = '0' + number % 10;
+    number /= 10;
+  }while(number);
+
+  while(width-- > count && *len + 1 < REPORT_SIZE){
+    report[(*len)++] = ' ';
+  }
+  while(count > 0 && *len + 1 < REPORT_SIZE){
+    report[(*len)++] = digits[--count];
+  }
+  report[*len] = '\0';
+  return;
+}
+
+
+///Add the counts of one part to a report
+///@param report the report
+///@param len the length of the report, updated
+///@param name the name of the part
+///@param counter the counts
+static void appendCounter(char* report, size_t* len, const char* name,
+			  Counter* counter){
+  size_t nameLen = strlen(name);
+
+  appendText(report, len, "  ");
+  appendText(report, len, name);
+  while(nameLen++ < 10){
+    appendText(report, len, " ");
+  }
+  appendNumber(report, len, __atomic_load_n(&counter->live, __ATOMIC_RELAXED), 12);
+  appendNumber(report, len, __atomic_load_n(&counter->peak, __ATOMIC_RELAXED), 12);
+  appendNumber(report, len, __atomic_load_n(&counter->allocations, __ATOMIC_RELAXED), 14);
+  appendNumber(report, len, __atomic_load_n(&counter->blocks, __ATOMIC_RELAXED), 12);
+  appendText(report, len, "\n");
+  return;
+}
+
+
+///Build a report of every part
+///@param report set to the report, REPORT_SIZE bytes
+static void formatStats(char* report){
+  size_t len = 0;
+  int i;
+
+  appendText(report, &len,
+	     "Memory:        live bytes  peak bytes   allocations  live blocks\n");
+  for(i = 0; i < MEM_TAGS; i++){
+    appendCounter(report, &len, tagNames[i], &counters[i]);
+  }
+  appendCounter(report, &len, "total", &total);
+  return;
+}
+
+
+///Print the live bytes, peak bytes and allocations of each part
+void printMemStats(FILE* out){
+  char report[REPORT_SIZE];
+
+  formatStats(report);
+  fputs(report, out);
+  return;
+}
+
+
+///Write the report to stderr
+///@param received the signal received
+static void reportStats(int received){
+  char report[REPORT_SIZE];
+  ssize_t written;
+
+  (void) received;
+  formatStats(report);
+  written = write(STDERR_FILENO, report, strlen(report));
+  (void) written;
+  return;
+}
+
+
+///Print the memory statistics to stderr whenever SIGUSR1 is received
+void installMemStatsSignal(void){
+  struct sigaction action;
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = reportStats;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGUSR1, &action, NULL);
+  return;
+}
+
+
+///Get the number of allocations not yet freed
+size_t outstandingAllocations(void){
+  return __atomic_load_n(&total.blocks, __ATOMIC_RELAXED);
+}
+
+
+///Get the bytes in use by a part of the interpreter
+size_t liveBytes(MemTag tag){
+  return __atomic_load_n(&counters[tag].live, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,116 @@
+///file:memstats.h
+///description:declarations for an allocator that counts the memory
+///  used by each part of the interpreter
+///author: avv8047 : Azhur Viano
+
+
+#ifndef MEMSTATS_H
+#define MEMSTATS_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+
+///Parts of the interpreter memory is counted for
+typedef enum MemTag_ {
+  //symbol tables, their slabs and indexes
+  MemSymbols,
+  //seperated expression text and token lists being built
+  MemTokens,
+  //compiled expressions and their postfix tokens
+  MemPostfix,
+  //stacks that outgrew their inline buffers
+  MemStacks,
+  //compiled statements
+  MemStatements,
+  //lines read from programs and symbol files
+  MemLines,
+  //values of arrays
+  MemArrays,
+  MEM_TAGS
+} MemTag;
+
+
+///Start counting allocations; memory allocated before is not counted
+///  and not reported
+void startMemStats(void);
+
+
+///Allocate counted memory
+///@param tag the part of the interpreter the memory is for
+///@param size the number of bytes
+///@returns the memory, to be freed with memFree
+void* memAlloc(MemTag tag, size_t size);
+
+
+///Resize counted memory
+///@param tag the part of the interpreter the memory is for, used when
+///  memory is NULL
+///@param memory the memory from memAlloc, or NULL
+///@param size the new number of bytes
+///@returns the resized memory
+void* memRealloc(MemTag tag, void* memory, size_t size);
+
+
+///Free counted memory
+///@param memory the memory from memAlloc or memRealloc, or NULL
+void memFree(void* memory);
+
+
+///Copy a string into counted memory
+///@param tag the part of the interpreter the copy is for
+///@param string the string
+///@returns the copy, to be freed with memFree, or NULL if there is no
+///  memory left
+char* memStrdup(MemTag tag, const char* string);
+
+
+///Read a line like getline, into counted memory. If the buffer cannot
+///  grow to hold the line, it is filled and the rest of the line dropped
+///@param line the buffer, NULL or from an earlier call; freed with memFree
+///@param capacity the size of the buffer
+///@param input the stream to read from
+///@returns the length of the line, or -1 at the end of the input
+ssize_t readLine(char** line, size_t* capacity, FILE* input);
+
+
+///Reserve memory that every later allocation is taken from instead of
+///  the heap, in blocks of powers of 2 that are reused once freed.
+///  Allocations fail once it is used up. The memory is touched up
+///  front, so it does not fault when first used
+///@param bytes the size of the memory
+///@returns 1 on success, 0 if it could not be reserved
+int reservePools(size_t bytes);
+
+
+///Get the bytes of the pools never yet allocated; blocks that were
+///  freed are not counted, although they are reused
+///@returns the bytes, 0 if there are no pools
+size_t poolAvailable(void);
+
+
+///Print the live bytes, peak bytes and allocations of each part
+///@param out the stream to print to
+void printMemStats(FILE* out);
+
+
+///Print the memory statistics to stderr whenever SIGUSR1 is received
+void installMemStatsSignal(void);
+
+
+///Get the number of allocations not yet freed
+///@returns the live blocks of every part together
+size_t outstandingAllocations(void);
+
+
+///Get the bytes in use by a part of the interpreter
+///@param tag the part
+///@returns the live bytes, 0 unless counting has started
+size_t liveBytes(MemTag tag);
+
+#endif
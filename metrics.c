@@ -0,0 +1,367 @@
+///file:metrics.c
+///description:live counters of a running interpreter. Each thread
+///  counts into a block of its own without taking a lock, and a thread
+///  serving a Unix domain socket adds the blocks up for every
+///  connection and answers in the Prometheus text format
+///author: avv8047 : Azhur Viano
+
+
+#include "metrics.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+
+//connections waiting to be accepted
+#define BACKLOG 16
+//milliseconds a connection is given to send a request before it is
+//  answered without one
+#define REQUEST_WAIT 100
+//most bytes of the counters as text
+#define METRICS_TEXT 8192
+
+
+__thread MetricBlock* metricBlock;
+int metering;
+
+//every block taken by a thread, never freed since threads keep using
+//  theirs until they exit
+static MetricBlock* blocks;
+static pthread_mutex_t blockLock = PTHREAD_MUTEX_INITIALIZER;
+//gives a block back when its thread exits
+static pthread_key_t blockKey;
+//used by threads when there is no memory left for a block of their own
+static MetricBlock spareBlock;
+
+//socket the counters are served on, and the pipe that stops the thread
+//  serving them
+static const char* socketPath;
+static int listener = -1;
+static int wake[2] = {-1, -1};
+static pthread_t server;
+
+//names of the StatementKinds as labels
+static const char* kindNames[METRIC_STATEMENT_KINDS] = {
+  "empty", "define", "let", "if", "prt", "display", "bad", "function"
+};
+
+
+///Give the block of a thread that exits to the next thread that counts
+///@param block the block
+static void releaseBlock(void* block){
+  pthread_mutex_lock(&blockLock);
+  ((MetricBlock*) block)->owned = 0;
+  pthread_mutex_unlock(&blockLock);
+  return;
+}
+
+
+//Take a block of counters for the calling thread
+MetricBlock* claimMetricBlock(void){
+  MetricBlock* block;
+
+  pthread_mutex_lock(&blockLock);
+  for(block = blocks; block && block->owned; block = block->next){
+  }
+  if(!block){
+    block = calloc(1, sizeof(MetricBlock));
+    if(block){
+      block->next = blocks;
+      blocks = block;
+    }
+  }
+  if(block){
+    block->owned = 1;
+    pthread_setspecific(blockKey, block);
+  }
+  else{
+    block = &spareBlock;
+  }
+  pthread_mutex_unlock(&blockLock);
+  metricBlock = block;
+  return block;
+}
+
+
+//Start keeping counters
+void enableMetrics(void){
+  if(!metering){
+    pthread_key_create(&blockKey, releaseBlock);
+    metering = 1;
+  }
+  return;
+}
+
+
+///Add up the counters of every thread
+///@param totals set to the totals
+static void sumMetrics(uint64_t totals[METRICS]){
+  MetricBlock* block;
+  int i;
+
+  memset(totals, 0, sizeof(uint64_t) * METRICS);
+  pthread_mutex_lock(&blockLock);
+  for(block = blocks; block; block = block->next){
+    for(i = 0; i < METRICS; i++){
+      totals[i] += __atomic_load_n(&block->counts[i], __ATOMIC_RELAXED);
+    }
+  }
+  pthread_mutex_unlock(&blockLock);
+  for(i = 0; i < METRICS; i++){
+    totals[i] += __atomic_load_n(&spareBlock.counts[i], __ATOMIC_RELAXED);
+  }
+  return;
+}
+
+
+///Get the resident memory of the process
+///@returns the size in bytes, 0 if it could not be read
+static unsigned long long residentBytes(void){
+  FILE* statm = fopen("/proc/self/statm", "r");
+  unsigned long long size = 0;
+  unsigned long long resident = 0;
+
+  if(!statm){
+    return 0;
+  }
+  if(fscanf(statm, "%llu %llu", &size, &resident) != 2){
+    resident = 0;
+  }
+  fclose(statm);
+  return resident * (unsigned long long) sysconf(_SC_PAGESIZE);
+}
+
+
+///Append formatted text, dropping what does not fit
+///@param text the text
+///@param length the length of the text so far
+///@param format the format of what to append
+///@returns the new length
+static size_t append(char* text, size_t length, const char* format, ...){
+  va_list args;
+  int written;
+
+  va_start(args, format);
+  written = vsnprintf(text + length, METRICS_TEXT - length, format, args);
+  va_end(args);
+  if(written < 0){
+    return length;
+  }
+  return length + (size_t) written < METRICS_TEXT ? length + (size_t) written : METRICS_TEXT - 1;
+}
+
+
+///Write the counters in the Prometheus text format
+///@param text filled with the text, METRICS_TEXT bytes
+///@returns the length of the text
+static size_t formatMetrics(char* text){
+  uint64_t totals[METRICS];
+  size_t length = 0;
+  int kind;
+
+  sumMetrics(totals);
+  length = append(text, length, "# HELP fred_statements_total Statements executed, by kind.\n"
+		  "# TYPE fred_statements_total counter\n");
+  for(kind = 0; kind < METRIC_STATEMENT_KINDS; kind++){
+    length = append(text, length, "fred_statements_total{kind=\"%s\"} %llu\n", kindNames[kind],
+		    (unsigned long long) totals[MetricStatements + kind]);
+  }
+  length = append(text, length, "# HELP fred_expressions_total Expressions evaluated.\n"
+		  "# TYPE fred_expressions_total counter\n"
+		  "fred_expressions_total %llu\n",
+		  (unsigned long long) totals[MetricExpressions]);
+  length = append(text, length, "# HELP fred_evaluation_errors_total Expressions whose "
+		  "evaluation failed.\n"
+		  "# TYPE fred_evaluation_errors_total counter\n"
+		  "fred_evaluation_errors_total %llu\n",
+		  (unsigned long long) totals[MetricEvalErrors]);
+  length = append(text, length, "# HELP fred_symbols Symbols held by the symbol tables.\n"
+		  "# TYPE fred_symbols gauge\n"
+		  "fred_symbols %lld\n", (long long) totals[MetricSymbols]);
+  length = append(text, length, "# HELP fred_symbol_lookups_total Symbols looked up by name.\n"
+		  "# TYPE fred_symbol_lookups_total counter\n"
+		  "fred_symbol_lookups_total %llu\n",
+		  (unsigned long long) totals[MetricLookups]);
+  length = append(text, length, "# HELP fred_output_bytes_total Bytes printed by prt and "
+		  "display statements.\n"
+		  "# TYPE fred_output_bytes_total counter\n"
+		  "fred_output_bytes_total %llu\n",
+		  (unsigned long long) totals[MetricOutputBytes]);
+  length = append(text, length, "# HELP process_resident_memory_bytes Resident memory size "
+		  "in bytes.\n"
+		  "# TYPE process_resident_memory_bytes gauge\n"
+		  "process_resident_memory_bytes %llu\n", residentBytes());
+  return length;
+}
+
+
+///Send all of a buffer, giving up if the connection fails
+///@param fd the connection
+///@param data the bytes
+///@param size the number of bytes
+///@returns 1 if every byte was sent, 0 otherwise
+static int sendAll(int fd, const char* data, size_t size){
+  ssize_t sent;
+
+  while(size > 0){
+    sent = send(fd, data, size, MSG_NOSIGNAL);
+    if(sent < 0 && errno == EINTR){
+      continue;
+    }
+    if(sent <= 0){
+      return 0;
+    }
+    data += sent;
+    size -= (size_t) sent;
+  }
+  return 1;
+}
+
+
+///Answer a connection with the counters, as an HTTP response if it
+///  sent a GET request
+///@param fd the connection
+static void answer(int fd){
+  char text[METRICS_TEXT];
+  char header[256];
+  char request[1024];
+  struct pollfd ready = {fd, POLLIN, 0};
+  //a client that stops reading does not hold up the next one for long
+  struct timeval timeout = {1, 0};
+  ssize_t received = 0;
+  size_t length;
+  int headerLength;
+
+  setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+  if(poll(&ready, 1, REQUEST_WAIT) == 1){
+    received = recv(fd, request, sizeof(request) - 1, MSG_DONTWAIT);
+  }
+  length = formatMetrics(text);
+  if(received >= 4 && strncmp(request, "GET ", 4) == 0){
+    headerLength = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+			    "Content-Type: text/plain; version=0.0.4\r\n"
+			    "Content-Length: %zu\r\nConnection: close\r\n\r\n", length);
+    if(!sendAll(fd, header, (size_t) headerLength)){
+      return;
+    }
+  }
+  sendAll(fd, text, length);
+  return;
+}
+
+
+///Answer each connection until told to stop through the pipe
+///@param arg unused
+///@returns NULL
+static void* serveMetrics(void* arg){
+  struct pollfd fds[2];
+  int fd;
+
+  (void) arg;
+  fds[0].fd = listener;
+  fds[0].events = POLLIN;
+  fds[1].fd = wake[0];
+  fds[1].events = POLLIN;
+  for(;;){
+    if(poll(fds, 2, -1) < 0){
+      if(errno == EINTR){
+	continue;
+      }
+      perror("poll");
+      break;
+    }
+    if(fds[1].revents){
+      break;
+    }
+    fd = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    if(fd < 0){
+      continue;
+    }
+    answer(fd);
+    close(fd);
+  }
+  return NULL;
+}
+
+
+//Serve the counters on a Unix domain socket
+int startMetrics(const char* path){
+  struct sockaddr_un address;
+  sigset_t all;
+  sigset_t previous;
+  int error;
+
+  if(strlen(path) >= sizeof(address.sun_path)){
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return 0;
+  }
+  enableMetrics();
+  //the thread executing statements counts without allocating from then on
+  if(!metricBlock){
+    claimMetricBlock();
+  }
+
+  listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if(listener < 0){
+    perror("socket");
+    return 0;
+  }
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+  //replace a socket left behind by an earlier run
+  unlink(path);
+  if(bind(listener, (struct sockaddr*) &address, sizeof(address)) != 0 ||
+     listen(listener, BACKLOG) != 0 || pipe2(wake, O_CLOEXEC) != 0){
+    fprintf(stderr, "Error listening on %s: %s\n", path, strerror(errno));
+    close(listener);
+    listener = -1;
+    return 0;
+  }
+
+  //signals are left to the other threads, so the profiler never samples
+  //  this one and the servers still see SIGINT
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &previous);
+  error = pthread_create(&server, NULL, serveMetrics, NULL);
+  pthread_sigmask(SIG_SETMASK, &previous, NULL);
+  if(error){
+    fprintf(stderr, "Error starting the metrics thread: %s\n", strerror(error));
+    close(listener);
+    close(wake[0]);
+    close(wake[1]);
+    listener = -1;
+    unlink(path);
+    return 0;
+  }
+  socketPath = path;
+  return 1;
+}
+
+
+//Stop serving the counters
+void stopMetrics(void){
+  if(!socketPath){
+    return;
+  }
+  if(write(wake[1], "", 1) != 1){
+    perror("write");
+  }
+  pthread_join(server, NULL);
+  close(listener);
+  close(wake[0]);
+  close(wake[1]);
+  listener = -1;
+  unlink(socketPath);
+  socketPath = NULL;
+  return;
+}
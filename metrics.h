@@ -0,0 +1,90 @@
+///file:metrics.h
+///description:declarations for live counters of a running interpreter,
+///  served over a Unix domain socket in the Prometheus text format
+///author: avv8047 : Azhur Viano
+
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+
+//kinds of statements counted, one for each StatementKind
+#define METRIC_STATEMENT_KINDS 8
+
+
+///Counters kept for each thread and added up when they are served
+typedef enum Metric_ {
+  //statements executed, one counter for each StatementKind from here
+  MetricStatements,
+  //expressions evaluated, and those whose evaluation failed
+  MetricExpressions = MetricStatements + METRIC_STATEMENT_KINDS,
+  MetricEvalErrors,
+  //symbols held by every table, which goes down as tables are freed
+  MetricSymbols,
+  //symbols looked up by name
+  MetricLookups,
+  //bytes printed by prt and display
+  MetricOutputBytes,
+  METRICS
+} Metric;
+
+
+//Counters of one thread. Only the thread owning it writes them, so a
+//  count is a load and a store rather than a locked add
+typedef struct MetricBlock_ {
+  uint64_t counts[METRICS];
+  //whether a running thread owns the block; a thread that exits leaves
+  //  its counts to the next one
+  int owned;
+  struct MetricBlock_* next;
+} MetricBlock;
+
+extern __thread MetricBlock* metricBlock;
+//whether counters are kept, set before the first is
+extern int metering;
+
+
+///Add to a counter of the calling thread, if counters are kept; a
+///  macro so it costs a load and a branch when they are not, even in
+///  unoptimized builds
+///@param metric the Metric
+///@param amount the amount, which may be negative for MetricSymbols
+#define countMetric(metric, amount)					\
+  do{									\
+    if(metering){							\
+      MetricBlock* block_ = metricBlock ? metricBlock : claimMetricBlock(); \
+      __atomic_store_n(&block_->counts[(metric)],			\
+		       block_->counts[(metric)] + (uint64_t) (amount),	\
+		       __ATOMIC_RELAXED);				\
+    }									\
+  } while(0)
+
+
+///Take a block of counters for the calling thread, reusing one left by
+///  a thread that exited
+///@returns the block, also kept in metricBlock
+MetricBlock* claimMetricBlock(void);
+
+
+///Start keeping counters; called before anything is counted, so
+///  MetricSymbols sees every symbol added
+void enableMetrics(void);
+
+
+///Serve the counters on a Unix domain socket from a thread of their
+///  own. Each connection gets the counters and is closed; one that
+///  sends an HTTP request first gets them as an HTTP response
+///@param path the path of the socket
+///@returns 1 if the socket is listening, 0 otherwise
+int startMetrics(const char* path);
+
+
+///Stop serving the counters and remove the socket
+void stopMetrics(void);
+
+#endif
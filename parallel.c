@@ -0,0 +1,642 @@
+///file:parallel.c
+///description:parallel execution of independent let statements. Runs
+///  of let statements are collected into a segment, a dependency graph
+///  is built from the symbols each one reads and writes, and the graph
+///  is run on a pool of work-stealing threads
+///@author: avv8047 : Azhur Viano
+
+
+#include "parallel.h"
+#include "memstats.h"
+#include "metrics.h"
+#include "profile.h"
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+
+//most statements collected into a segment before it is run
+#define SEGMENT_SIZE 4096
+//times to look for work before yielding the processor
+#define SPIN_LIMIT 64
+
+
+//A statement in a segment, run as a task of the dependency graph
+typedef struct Task_ {
+  Statement* statement;
+  //source line, echoed once the task has run
+  char* line;
+  //symbol assigned by a let
+  SymbolId target;
+  //symbol for each token of the let expression
+  SymbolId* bound;
+  //1 if the statement can run in the graph, 0 if it has to run alone
+  int parallel;
+  //number of unfinished tasks this one depends on
+  int pending;
+  //number of tasks in the longest chain ending with this one
+  size_t level;
+  //tasks that depend on this one
+  size_t* successors;
+  size_t successorCount;
+  size_t successorCapacity;
+} Task;
+
+
+//Ready tasks of one worker. The owner works from the tail and other
+//  workers steal from the head
+typedef struct Deque_ {
+  pthread_mutex_t lock;
+  size_t* items;
+  size_t head;
+  size_t tail;
+} Deque;
+
+
+//Pool of worker threads running one graph at a time
+typedef struct Pool_ {
+  //table the graphs run against
+  SymbolTable* table;
+  pthread_t threads[MAX_WORKERS];
+  Deque deques[MAX_WORKERS];
+  int workers;
+
+  //tasks of the graph being run
+  Task* tasks;
+  //tasks of the graph that have not finished
+  size_t remaining;
+  //nanoseconds each worker has spent running tasks
+  long long busy[MAX_WORKERS];
+
+  //wakes the workers for each new graph
+  pthread_mutex_t lock;
+  pthread_cond_t start;
+  pthread_cond_t idle;
+  unsigned long generation;
+  //workers that have not finished with the current graph
+  int active;
+  int shutdown;
+} Pool;
+
+
+//Argument for a worker thread
+typedef struct Worker_ {
+  Pool* pool;
+  int id;
+} Worker;
+
+
+//Statistics reported at the end
+typedef struct Report_ {
+  size_t statements;
+  size_t tasks;
+  size_t graphs;
+  //sum of the critical path lengths of the graphs
+  size_t span;
+  //time spent running graphs
+  long long wall;
+} Report;
+
+
+//Last writer and readers since then of one symbol while building a graph
+typedef struct Access_ {
+  SymbolId symbol;
+  long writer;
+  size_t* readers;
+  size_t readerCount;
+  size_t readerCapacity;
+} Access;
+
+
+///Current monotonic time
+///@returns the time in nanoseconds
+static long long now(void){
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long) ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+
+///Push a ready task onto the tail of a deque
+///@param deque the deque of the current worker
+///@param task the index of the task
+static void pushTask(Deque* deque, size_t task){
+  pthread_mutex_lock(&deque->lock);
+  deque->items[deque->tail++] = task;
+  pthread_mutex_unlock(&deque->lock);
+  return;
+}
+
+
+///Pop a task from the tail of the current worker's deque
+///@param deque the deque of the current worker
+///@param task set to the index of the task
+///@returns 1 if a task was popped, 0 if the deque was empty
+static int popTask(Deque* deque, size_t* task){
+  int found = 0;
+
+  pthread_mutex_lock(&deque->lock);
+  if(deque->tail > deque->head){
+    *task = deque->items[--deque->tail];
+    found = 1;
+  }
+  pthread_mutex_unlock(&deque->lock);
+
+  return found;
+}
+
+
+///Steal a task from the head of another worker's deque
+///@param pool the pool
+///@param id the worker that is stealing
+///@param task set to the index of the task
+///@returns 1 if a task was stolen, 0 if every deque was empty
+static int stealTask(Pool* pool, int id, size_t* task){
+  Deque* deque;
+  int i;
+  int found = 0;
+
+  for(i = 1; !found && i < pool->workers; i++){
+    deque = &pool->deques[(id + i) % pool->workers];
+    pthread_mutex_lock(&deque->lock);
+    if(deque->tail > deque->head){
+      *task = deque->items[deque->head++];
+      found = 1;
+    }
+    pthread_mutex_unlock(&deque->lock);
+  }
+
+  return found;
+}
+
+
+///Run a task and make the tasks waiting only on it ready
+///@param pool the pool
+///@param id the worker running the task
+///@param index the index of the task
+static void runTask(Pool* pool, int id, size_t index){
+  Task* task = &pool->tasks[index];
+  long long start = now();
+  Token result;
+  size_t i;
+
+  profileAt(task->statement->line, ProfEval);
+  if(profiling){
+    countExecution(task->statement->line);
+  }
+  countMetric(MetricStatements + task->statement->kind, 1);
+  if(task->statement->kind == LetStatement
+     && evaluateBound(pool->table, task->statement->left, task->bound, &result)){
+    assignSymbol(pool->table, task->target, &result);
+  }
+  pool->busy[id] += now() - start;
+  profileAt(0, ProfOther);
+
+  for(i = 0; i < task->successorCount; i++){
+    if(__atomic_sub_fetch(&pool->tasks[task->successors[i]].pending, 1,
+			  __ATOMIC_ACQ_REL) == 0){
+      pushTask(&pool->deques[id], task->successors[i]);
+    }
+  }
+
+  __atomic_sub_fetch(&pool->remaining, 1, __ATOMIC_RELEASE);
+  return;
+}
+
+
+///Work on the current graph until all of its tasks have finished
+///@param pool the pool
+///@param id the worker
+static void workGraph(Pool* pool, int id){
+  size_t task;
+  int spins = 0;
+
+  while(__atomic_load_n(&pool->remaining, __ATOMIC_ACQUIRE) > 0){
+    if(popTask(&pool->deques[id], &task) || stealTask(pool, id, &task)){
+      runTask(pool, id, task);
+      spins = 0;
+    }
+    else if(++spins >= SPIN_LIMIT){
+      sched_yield();
+      spins = 0;
+    }
+  }
+  return;
+}
+
+
+///Worker thread: run each graph the pool is given
+///@param arg the worker
+///@returns NULL
+static void* workerMain(void* arg){
+  Worker* worker = (Worker*) arg;
+  Pool* pool = worker->pool;
+  unsigned long seen = 0;
+
+  pthread_mutex_lock(&pool->lock);
+  while(1){
+    while(pool->generation == seen && !pool->shutdown){
+      pthread_cond_wait(&pool->start, &pool->lock);
+    }
+    if(pool->shutdown){
+      break;
+    }
+    seen = pool->generation;
+    pthread_mutex_unlock(&pool->lock);
+
+    workGraph(pool, worker->id);
+
+    pthread_mutex_lock(&pool->lock);
+    if(--pool->active == 0){
+      pthread_cond_signal(&pool->idle);
+    }
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  free(worker);
+  return NULL;
+}
+
+
+///Start the worker threads of a pool
+///@param pool the pool to initialize
+///@param workers the number of workers, including the calling thread
+static void startPool(Pool* pool, int workers){
+  Worker* worker;
+  int i;
+
+  pool->workers = workers;
+  pool->tasks = NULL;
+  pool->remaining = 0;
+  pool->generation = 0;
+  pool->active = 0;
+  pool->shutdown = 0;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->start, NULL);
+  pthread_cond_init(&pool->idle, NULL);
+
+  for(i = 0; i < workers; i++){
+    pthread_mutex_init(&pool->deques[i].lock, NULL);
+    pool->deques[i].items = NULL;
+    pool->busy[i] = 0;
+  }
+
+  //worker 0 is the calling thread
+  for(i = 1; i < workers; i++){
+    worker = malloc(sizeof(Worker));
+    worker->pool = pool;
+    worker->id = i;
+    pthread_create(&pool->threads[i], NULL, workerMain, worker);
+  }
+  return;
+}
+
+
+///Stop the worker threads of a pool
+///@param pool the pool
+static void stopPool(Pool* pool){
+  int i;
+
+  pthread_mutex_lock(&pool->lock);
+  pool->shutdown = 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  for(i = 1; i < pool->workers; i++){
+    pthread_join(pool->threads[i], NULL);
+  }
+  for(i = 0; i < pool->workers; i++){
+    pthread_mutex_destroy(&pool->deques[i].lock);
+    free(pool->deques[i].items);
+  }
+  pthread_cond_destroy(&pool->idle);
+  pthread_cond_destroy(&pool->start);
+  pthread_mutex_destroy(&pool->lock);
+  return;
+}
+
+
+///Add a dependency between two tasks
+///@param tasks the tasks of the graph
+///@param from the task that has to finish first
+///@param to the task that depends on it, after from in source order
+static void addEdge(Task* tasks, size_t from, size_t to){
+  Task* task = &tasks[from];
+
+  if(task->successorCount == task->successorCapacity){
+    task->successorCapacity = task->successorCapacity ? task->successorCapacity * 2 : 4;
+    task->successors = realloc(task->successors,
+			       sizeof(size_t) * task->successorCapacity);
+  }
+  task->successors[task->successorCount++] = to;
+  tasks[to].pending++;
+  if(tasks[to].level < task->level + 1){
+    tasks[to].level = task->level + 1;
+  }
+  return;
+}
+
+
+///Find the access record of a symbol, adding it if needed
+///@param accesses open addressed table of records
+///@param mask one less than the size of the table
+///@param symbol the symbol
+///@returns the record for the symbol
+static Access* findAccess(Access* accesses, size_t mask, SymbolId symbol){
+  size_t i = ((size_t) symbol * 0x9e3779b1u) & mask;
+
+  while(accesses[i].symbol != NO_SYMBOL && accesses[i].symbol != symbol){
+    i = (i + 1) & mask;
+  }
+  if(accesses[i].symbol == NO_SYMBOL){
+    accesses[i].symbol = symbol;
+    accesses[i].writer = -1;
+  }
+  return &accesses[i];
+}
+
+
+///Build the dependency graph of a run of tasks from the symbols they
+///  read and write. A task reading a symbol waits for its last writer,
+///  and a task writing one also waits for the readers since then
+///@param tasks the tasks, all of which can run in parallel
+///@param count the number of tasks
+///@returns the length of the longest chain of dependent tasks
+static size_t buildGraph(Task* tasks, size_t count){
+  size_t size = 16;
+  size_t refs = 0;
+  size_t span = 0;
+  size_t i;
+  size_t j;
+  Access* accesses;
+  Access* access;
+  Expression* expression;
+
+  for(i = 0; i < count; i++){
+    if(tasks[i].statement->kind == LetStatement){
+      refs += tasks[i].statement->left->size + 1;
+    }
+  }
+  while(size < refs * 2){
+    size *= 2;
+  }
+  accesses = calloc(size, sizeof(Access));
+  for(i = 0; i < size; i++){
+    accesses[i].symbol = NO_SYMBOL;
+  }
+
+  for(i = 0; i < count; i++){
+    tasks[i].level = 1;
+    if(tasks[i].statement->kind != LetStatement){
+      continue;
+    }
+
+    expression = tasks[i].statement->left;
+    for(j = 0; j < expression->size; j++){
+      if(tasks[i].bound[j] == NO_SYMBOL){
+	continue;
+      }
+      access = findAccess(accesses, size - 1, tasks[i].bound[j]);
+      if(access->writer >= 0){
+	addEdge(tasks, access->writer, i);
+      }
+      if(access->readerCount == access->readerCapacity){
+	access->readerCapacity = access->readerCapacity ? access->readerCapacity * 2 : 4;
+	access->readers = realloc(access->readers,
+				  sizeof(size_t) * access->readerCapacity);
+      }
+      access->readers[access->readerCount++] = i;
+    }
+
+    access = findAccess(accesses, size - 1, tasks[i].target);
+    if(access->writer >= 0){
+      addEdge(tasks, access->writer, i);
+    }
+    for(j = 0; j < access->readerCount; j++){
+      if(access->readers[j] != i){
+	addEdge(tasks, access->readers[j], i);
+      }
+    }
+    access->readerCount = 0;
+    access->writer = i;
+
+    if(tasks[i].level > span){
+      span = tasks[i].level;
+    }
+  }
+
+  for(i = 0; i < size; i++){
+    free(accesses[i].readers);
+  }
+  free(accesses);
+  return span;
+}
+
+
+///Run a run of tasks on the pool, waiting until all have finished
+///@param pool the pool
+///@param report the statistics to add to
+///@param tasks the tasks
+///@param count the number of tasks
+static void runGraph(Pool* pool, Report* report, Task* tasks, size_t count){
+  long long start;
+  size_t i;
+  int next = 0;
+
+  report->span += buildGraph(tasks, count);
+  report->graphs++;
+  for(i = 0; i < count; i++){
+    if(tasks[i].statement->kind == LetStatement){
+      report->tasks++;
+    }
+  }
+
+  start = now();
+  pool->tasks = tasks;
+  pool->remaining = count;
+  for(i = 0; i < (size_t) pool->workers; i++){
+    pool->deques[i].items = realloc(pool->deques[i].items, sizeof(size_t) * count);
+    pool->deques[i].head = 0;
+    pool->deques[i].tail = 0;
+  }
+  //share the tasks that are ready from the start between the workers
+  for(i = 0; i < count; i++){
+    if(tasks[i].pending == 0){
+      pushTask(&pool->deques[next], i);
+      next = (next + 1) % pool->workers;
+    }
+  }
+
+  pthread_mutex_lock(&pool->lock);
+  pool->generation++;
+  pool->active = pool->workers - 1;
+  pthread_cond_broadcast(&pool->start);
+  pthread_mutex_unlock(&pool->lock);
+
+  workGraph(pool, 0);
+
+  //wait for every worker to be done with the graph before it is freed
+  pthread_mutex_lock(&pool->lock);
+  while(pool->active > 0){
+    pthread_cond_wait(&pool->idle, &pool->lock);
+  }
+  pthread_mutex_unlock(&pool->lock);
+
+  report->wall += now() - start;
+  return;
+}
+
+
+///Run a segment of let statements. Each let is bound to its symbols
+///  first; one that could report an error runs alone, in order, and the
+///  lets between those run as a graph
+///@param pool the pool
+///@param report the statistics to add to
+///@param table the symbol table to use
+///@param tasks the segment
+///@param count the number of statements in the segment
+static void runSegment(Pool* pool, Report* report, SymbolTable* table,
+		       Task* tasks, size_t count){
+  Statement* statement;
+  size_t start = 0;
+  size_t i;
+  size_t j;
+
+  //lets do not add symbols, so the whole segment can be bound up front
+  for(i = 0; i < count; i++){
+    statement = tasks[i].statement;
+    tasks[i].parallel = 1;
+    if(statement->kind != LetStatement){
+      continue;
+    }
+    tasks[i].target = GetSymbol(table, statement->target);
+    //inlining can change the tokens, so it is done before binding
+    inlineCalls(table, statement->left);
+    tasks[i].bound = malloc(sizeof(SymbolId) * (statement->left->size + 1));
+    tasks[i].parallel = tasks[i].target != NO_SYMBOL &&
+      GetSymbolType(table, tasks[i].target) != Function &&
+      GetSymbolType(table, tasks[i].target) != Array &&
+      !bindExpression(table, statement->left, tasks[i].bound) &&
+      isSafeExpression(table, statement->left, tasks[i].bound);
+  }
+
+  for(i = 0; i <= count; i++){
+    if(i < count && tasks[i].parallel){
+      continue;
+    }
+
+    if(i > start){
+      runGraph(pool, report, tasks + start, i - start);
+      for(j = start; j < i; j++){
+	printf(":::%s\n", tasks[j].line);
+	printf(">");
+      }
+    }
+    if(i < count){
+      printf(":::%s\n", tasks[i].line);
+      executeStatement(table, tasks[i].statement, stdout);
+      printf(">");
+    }
+    start = i + 1;
+  }
+
+  for(i = 0; i < count; i++){
+    DestroyStatement(tasks[i].statement);
+    memFree(tasks[i].line);
+    free(tasks[i].bound);
+    free(tasks[i].successors);
+  }
+  return;
+}
+
+
+///Print the statistics of a parallel run
+///@param pool the pool that was used
+///@param report the statistics
+static void printReport(Pool* pool, Report* report){
+  long long busy = 0;
+  int i;
+
+  for(i = 0; i < pool->workers; i++){
+    busy += pool->busy[i];
+  }
+
+  //keep the report after the errors of the statements
+  flushDiagnostics();
+  fprintf(stderr, "Parallel execution: %zu statements, %zu lets in %zu "
+	  "dependency graphs\n", report->statements, report->tasks, report->graphs);
+  fprintf(stderr, "  critical path %zu, available parallelism %.2f\n",
+	  report->span,
+	  report->span ? (double) report->tasks / report->span : 0.0);
+  fprintf(stderr, "  task time %.3f ms, wall time %.3f ms, speedup %.2f "
+	  "with %d workers\n", busy / 1e6, report->wall / 1e6,
+	  report->wall ? (double) busy / report->wall : 0.0, pool->workers);
+  return;
+}
+
+
+///Process statements, running independent lets in parallel
+void processStatementsParallel(SymbolTable* table, FILE* input, int workers){
+  Pool pool;
+  Report report = {0, 0, 0, 0, 0};
+  Task* tasks = malloc(sizeof(Task) * SEGMENT_SIZE);
+  size_t count = 0;
+  Statement* statement;
+  char* line = NULL;
+  size_t len = 0;
+
+  startPool(&pool, workers);
+  pool.table = table;
+
+  printf(">");
+
+  //get lines from input; lines are dynamically allocated by readLine
+  while(readLine(&line, &len, input) != -1){
+    report.statements++;
+    profileAt(report.statements, ProfParse);
+    statement = compileStatement(line);
+    statement->line = report.statements;
+
+    //lets and blank lines join the segment; anything else is a barrier
+    if(!statement->error && (statement->kind == LetStatement ||
+			     statement->kind == EmptyStatement)){
+      tasks[count].statement = statement;
+      tasks[count].line = line;
+      tasks[count].target = NO_SYMBOL;
+      tasks[count].bound = NULL;
+      tasks[count].pending = 0;
+      tasks[count].successors = NULL;
+      tasks[count].successorCount = 0;
+      tasks[count].successorCapacity = 0;
+      count++;
+      if(count == SEGMENT_SIZE){
+	runSegment(&pool, &report, table, tasks, count);
+	count = 0;
+      }
+    }
+    else{
+      runSegment(&pool, &report, table, tasks, count);
+      count = 0;
+
+      profileAt(statement->line, ProfOutput);
+      printf(":::%s\n", line);
+      executeStatement(table, statement, stdout);
+      DestroyStatement(statement);
+      memFree(line);
+      profilePhase(ProfOutput);
+      printf(">");
+    }
+
+    profileAt(0, ProfOther);
+    line = NULL;
+  }
+  runSegment(&pool, &report, table, tasks, count);
+  
+  printf("\n");
+
+  memFree(line);
+  free(tasks);
+
+  stopPool(&pool);
+  printReport(&pool, &report);
+  return;
+}
@@ -0,0 +1,26 @@
+///file:parallel.h
+///description:declarations for running independent Fred statements
+///  in parallel
+///author: avv8047 : Azhur Viano
+
+
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "processor.h"
+
+//most threads the parallel executor can use
+#define MAX_WORKERS 64
+
+
+///Process statements from an input stream, running let statements that
+///  do not depend on each other in parallel. Every other statement is a
+///  barrier that runs once the statements before it have finished.
+///  Output and the final table are the same as processStatements, and a
+///  report of the parallelism found is printed to stderr at the end
+///@param table the symbol table to use
+///@param input the input stream to read from
+///@param workers the number of threads to use, including this one
+void processStatementsParallel(SymbolTable* table, FILE* input, int workers);
+
+#endif
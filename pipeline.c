@@ -0,0 +1,195 @@
+///file:pipeline.c
+///description:pipelined statement processing. A reader thread splits
+///  the input into lines and hands batches of them round-robin to the
+///  parser threads; the executor takes the compiled batches back in
+///  the same round-robin order, so statements run in source order
+///@author: avv8047 : Azhur Viano
+
+
+#include "pipeline.h"
+#include "memstats.h"
+#include "profile.h"
+#include "ring.h"
+#include <pthread.h>
+
+//number of lines passed between threads at a time
+#define BATCH_SIZE 64
+//number of batches that can be waiting between two threads
+#define RING_SIZE 16
+
+
+//A batch of lines on its way through the pipeline. A batch with no
+//  lines marks the end of the input
+typedef struct Batch_ {
+  size_t count;
+  //line number of the first line
+  size_t first;
+  char* lines[BATCH_SIZE];
+  Statement* statements[BATCH_SIZE];
+} Batch;
+
+
+//A parser thread and the rings it is connected by
+typedef struct Parser_ {
+  pthread_t thread;
+  //batches of lines from the reader
+  Ring* lines;
+  //batches of compiled statements for the executor
+  Ring* statements;
+} Parser;
+
+
+//State shared by the reader thread
+typedef struct Reader_ {
+  pthread_t thread;
+  FILE* input;
+  Parser* parsers;
+  int count;
+} Reader;
+
+
+///Create an empty batch
+///@returns the new batch
+static Batch* CreateBatch(void){
+  Batch* batch = malloc(sizeof(Batch));
+  batch->count = 0;
+  return batch;
+}
+
+
+///Read lines and hand them out to the parsers in batches
+///@param arg the reader state
+///@returns NULL
+static void* readLines(void* arg){
+  Reader* reader = (Reader*) arg;
+  Batch* batch = CreateBatch();
+  //parser that gets the next batch
+  int next = 0;
+  int i;
+  char* line = NULL;
+  size_t len = 0;
+  size_t number = 0;
+
+  //lines are dynamically allocated by readLine and owned by the batch
+  while(readLine(&line, &len, reader->input) != -1){
+    if(!batch->count){
+      batch->first = number + 1;
+    }
+    number++;
+    batch->lines[batch->count++] = line;
+    line = NULL;
+
+    if(batch->count == BATCH_SIZE){
+      PushRing(reader->parsers[next].lines, batch);
+      next = (next + 1) % reader->count;
+      batch = CreateBatch();
+    }
+  }
+  memFree(line);
+
+  //send the last partial batch, then an empty batch to each parser
+  if(batch->count){
+    PushRing(reader->parsers[next].lines, batch);
+    next = (next + 1) % reader->count;
+    batch = CreateBatch();
+  }
+  free(batch);
+
+  for(i = 0; i < reader->count; i++){
+    PushRing(reader->parsers[(next + i) % reader->count].lines, CreateBatch());
+  }
+
+  return NULL;
+}
+
+
+///Compile batches of lines until the end of the input
+///@param arg the parser
+///@returns NULL
+static void* parseLines(void* arg){
+  Parser* parser = (Parser*) arg;
+  Batch* batch;
+  //lines in the current batch; the batch belongs to the executor once pushed
+  size_t count;
+  size_t i;
+
+  do{
+    batch = (Batch*) PopRing(parser->lines);
+    count = batch->count;
+    for(i = 0; i < count; i++){
+      batch->statements[i] = NULL;
+      if(strnlen(batch->lines[i], 1) != 0){
+	profileAt(batch->first + i, ProfParse);
+	batch->statements[i] = compileStatement(batch->lines[i]);
+	batch->statements[i]->line = batch->first + i;
+      }
+    }
+    profileAt(0, ProfOther);
+    PushRing(parser->statements, batch);
+  }while(count);
+
+  return NULL;
+}
+
+
+///Process statements with a reader, parsers and this thread as executor
+void processStatementsPipelined(SymbolTable* table, FILE* input, int parsers){
+  Parser parserList[MAX_PARSERS];
+  Reader reader;
+  Batch* batch;
+  //parser the next batch in source order comes from
+  int next = 0;
+  //parsers that have not yet sent their end of input batch
+  int remaining = parsers;
+  int i;
+  size_t j;
+
+  for(i = 0; i < parsers; i++){
+    parserList[i].lines = CreateRing(RING_SIZE);
+    parserList[i].statements = CreateRing(RING_SIZE);
+    pthread_create(&parserList[i].thread, NULL, parseLines, &parserList[i]);
+  }
+
+  reader.input = input;
+  reader.parsers = parserList;
+  reader.count = parsers;
+  pthread_create(&reader.thread, NULL, readLines, &reader);
+
+  printf(">");
+
+  while(remaining){
+    batch = (Batch*) PopRing(parserList[next].statements);
+    next = (next + 1) % parsers;
+
+    if(!batch->count){
+      remaining--;
+    }
+
+    for(j = 0; j < batch->count; j++){
+      profileAt(batch->first + j, ProfOutput);
+      printf(":::%s\n", batch->lines[j]);
+
+      if(batch->statements[j]){
+	executeStatement(table, batch->statements[j], stdout);
+	DestroyStatement(batch->statements[j]);
+      }
+
+      memFree(batch->lines[j]);
+
+      profilePhase(ProfOutput);
+      printf(">");
+    }
+    free(batch);
+  }
+
+  printf("\n");
+
+  pthread_join(reader.thread, NULL);
+  for(i = 0; i < parsers; i++){
+    pthread_join(parserList[i].thread, NULL);
+    DestroyRing(parserList[i].lines);
+    DestroyRing(parserList[i].statements);
+  }
+
+  return;
+}
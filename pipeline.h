@@ -0,0 +1,24 @@
+///file:pipeline.h
+///description:declarations for processing Fred statements with
+///  seperate reader, parser and executor threads
+///author: avv8047 : Azhur Viano
+
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "processor.h"
+
+//most parser threads a pipeline can use
+#define MAX_PARSERS 16
+
+
+///Process statements from an input stream, reading and compiling
+///  them on other threads while they are executed in order on this one.
+///  Output is the same as processStatements
+///@param table the symbol table to use while executing
+///@param input the input stream to read from
+///@param parsers the number of parser threads, 1 to MAX_PARSERS
+void processStatementsPipelined(SymbolTable* table, FILE* input, int parsers);
+
+#endif
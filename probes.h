@@ -0,0 +1,80 @@
+///file:probes.h
+///description:static tracepoints that tools such as bpftrace and
+///  SystemTap can attach to while fred runs; each is a single nop
+///  until something attaches
+///author: avv8047 : Azhur Viano
+
+
+#ifndef PROBES_H
+#define PROBES_H
+
+//Each probe is a nop with a note in the .note.stapsdt section giving
+//  its address, provider, name and where each argument is, in the
+//  same format as SystemTap's sys/sdt.h, so no other header is needed.
+//  Arguments are passed as 8 byte signed integers
+//
+//Probes of the fred provider:
+//  statement_start(line, kind)      a statement starts executing
+//  statement_done(line, kind)       a statement has executed
+//  expression_start(expression, tokens)
+//                                   a compiled expression is evaluated
+//  expression_done(expression, success, reused)
+//                                   an evaluation finished; reused is 1
+//                                   when the memoized result was used
+//  symbol_add(name, id)             a symbol was added to a table
+//  symbol_lookup(name, id)          a symbol was looked up, id -1 if
+//                                   it is not in the table
+//  output_flush(fd, bytes)          buffered output was written
+
+#if defined(__GNUC__) && defined(__ELF__) && \
+  (defined(__x86_64__) || defined(__i386__) || defined(__aarch64__))
+
+#ifdef __LP64__
+#define PROBE_ADDRESS ".8byte"
+#else
+#define PROBE_ADDRESS ".4byte"
+#endif
+
+//note for a probe; the operands of the asm fill in the arguments
+#define PROBE_NOTE(name, arguments)					\
+  "990: nop\n"								\
+  ".pushsection .note.stapsdt,\"?\",\"note\"\n"				\
+  ".balign 4\n"								\
+  ".4byte 992f-991f, 994f-993f, 3\n"					\
+  "991: .asciz \"stapsdt\"\n"						\
+  "992: .balign 4\n"							\
+  "993: " PROBE_ADDRESS " 990b\n"					\
+  PROBE_ADDRESS " _.stapsdt.base\n"					\
+  PROBE_ADDRESS " 0\n"							\
+  ".asciz \"fred\"\n"							\
+  ".asciz \"" #name "\"\n"						\
+  ".asciz \"" arguments "\"\n"						\
+  "994: .balign 4\n"							\
+  ".popsection\n"							\
+  ".ifndef _.stapsdt.base\n"						\
+  ".pushsection .stapsdt.base,\"aG\",\"progbits\",.stapsdt.base,comdat\n" \
+  ".weak _.stapsdt.base\n"						\
+  ".hidden _.stapsdt.base\n"						\
+  "_.stapsdt.base: .space 1\n"						\
+  ".size _.stapsdt.base, 1\n"						\
+  ".popsection\n"							\
+  ".endif\n"
+
+#define PROBE2(name, a, b)						\
+  __asm__ __volatile__(PROBE_NOTE(name, "-8@%0 -8@%1")			\
+		       :: "nor" ((long) (a)), "nor" ((long) (b)))
+
+#define PROBE3(name, a, b, c)						\
+  __asm__ __volatile__(PROBE_NOTE(name, "-8@%0 -8@%1 -8@%2")		\
+		       :: "nor" ((long) (a)), "nor" ((long) (b)),	\
+			  "nor" ((long) (c)))
+
+#else
+
+//no probes where the note format is not known
+#define PROBE2(name, a, b) ((void) (a), (void) (b))
+#define PROBE3(name, a, b, c) ((void) (a), (void) (b), (void) (c))
+
+#endif
+
+#endif
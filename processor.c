@@ -5,16 +5,26 @@
 
 
 #include "processor.h"
+#include "memstats.h"
+#include "metrics.h"
+#include "profile.h"
+#include "probes.h"
+#include "realtime.h"
+#include "reduce.h"
+#include <stdarg.h>
 
-//types for boolean operators in if statements
-typedef enum bool_ops {GT, LT, EQ}
-  BoolOperator;
+
+//most symbols statements can leave in a table, 0 for no limit
+static size_t symbolLimit;
+//whether statements of common shapes run as superinstructions
+static int fusionEnabled = 1;
+//statements run as superinstructions; only the thread executing
+//  statements counts them
+static unsigned long long fusedRuns;
 
 
 ///Round a float to an int using the even rounding method
-///@param f the float number to round
-///@returns f rounded to an integer using even rounding
-static int roundEven(float f){
+int roundEven(float f){
   //decimal part of the float
   float diff = f - (int) f;
   //used to round number away from 0
@@ -53,218 +63,1337 @@ static int roundEven(float f){
 }
 
 
-///Process a symbol file, storing the symbols and their values
-///  in the table
-void processSymbolFile(SymbolTable* table, FILE* symbolFile){
-  const char* delim = " \t";
-  char* line = NULL;
-  size_t len = 0;
+///Read the values of an array from the rest of a line of a symbol
+///  file, as name[length] followed by up to length values; the values
+///  not given are 0
+///@param table the table the array must not already be in, or NULL
+///@param name the name and length, tokenized by strtok_r; the length
+///  is cut off
+///@param type the type of the values
+///@param delim the delimiters between values
+///@param save the state of strtok_r
+///@param create whether to create the array, or only check the line
+///@returns the number of the new array, 0 if not created, or -1 on error
+static int readArray(SymbolTable* table, char* name, Type type, const char* delim,
+		     char** save, int create){
+  char* bracket = strchr(name, '[');
+  char* end;
+  char* tok;
+  unsigned long length;
+  size_t i = 0;
+  NumericArray* array = NULL;
+  int number = 0;
+
+  *bracket = '\0';
+  length = strtoul(bracket + 1, &end, 10);
+  if(!isdigit(bracket[1]) || strcmp(end, "]") != 0 || length > MAX_ARRAY_LENGTH){
+    diagnose(DiagSymbolFile, "Error processing symbol file: bad length for array %s\n",
+	     name);
+    return -1;
+  }
+  if(table && GetSymbol(table, name) != NO_SYMBOL){
+    diagnose(DiagDuplicateSymbol, "Symbol %s already exists in table\n", name);
+    return -1;
+  }
+
+  if(create){
+    number = createArray(type, length);
+    if(number < 0){
+      diagnose(DiagSymbolFile, "Error processing symbol file: no memory for array %s\n",
+	       name);
+      return -1;
+    }
+    array = getArray(number);
+  }
+  for(tok = strtok_r(NULL, delim, save); tok && *tok != '\n'; tok = strtok_r(NULL, delim, save)){
+    if(i == length){
+      diagnose(DiagSymbolFile, "Error processing symbol file: more than %lu values for %s\n",
+	       length, name);
+      break;
+    }
+    if(!array){
+      i++;
+    }
+    else if(type == Integer){
+      array->values[i++].iVal = (int) strtol(tok, NULL, 10);
+    }
+    else{
+      array->values[i++].fVal = strtof(tok, NULL);
+    }
+  }
+  return number;
+}
+
+
+///Parse a line of a symbol file
+int parseSymbolLine(char* line, SymbolTable* table, int create, char** name,
+		    Type* type, Value* value){
+  const char* delim = " \t";
+  char* save = NULL;
+  char* tok = strtok_r(line, delim, &save);
+
+  //skip blank lines
+  if(!tok || *tok == '\n'){
+    return 0;
+  }
+
+  if(strcmp("integer", tok) == 0){
+    *type = Integer;
+  }
+  else if(strcmp("real", tok) == 0){
+    *type = Float;
+  }
+  else{
+    diagnose(DiagSymbolFile,
+	     "Error processing symbol file: unknown type - %s\n", tok);
+    return 0;
+  }
+
+  *name = strtok_r(NULL, delim, &save);
+  if(*name && strchr(*name, '[')){
+    value->iVal = readArray(table, *name, *type, delim, &save, create);
+    *type = Array;
+    return value->iVal >= 0;
+  }
+
+  tok = strtok_r(NULL, delim, &save);
+  if(!tok){
+    diagnose(DiagSymbolFile, "Error processing symbol file: no value for %s\n",
+	     *name ? *name : "symbol");
+    return 0;
+  }
+
+  if(*type == Integer){
+    value->iVal = (int) strtol(tok, NULL, 10);
+  }
+  else{
+    value->fVal = strtof(tok, NULL);
+  }
+  return 1;
+}
+
+
+///Process a symbol file, storing the symbols and their values
+///  in the table
+void processSymbolFile(SymbolTable* table, FILE* symbolFile){
+  char* line = NULL;
+  size_t len = 0;
+
+  Type type;
+  Value value;
+  char* name;
+  size_t number = 0;
+
+  while(readLine(&line, &len, symbolFile) != -1){
+    setDiagnosticLine(++number);
+    if(parseSymbolLine(line, table, 1, &name, &type, &value)){
+      AddSymbol(table, name, type, value);
+    }
+  }
+
+  //the line buffer is reused for every line
+  memFree(line);
+  setDiagnosticLine(0);
+
+  return;
+}
+
+
+//error of a statement that could not be compiled for lack of memory,
+//  never freed
+static char noMemory[] = "Error: no memory left to compile the statement\n";
+
+
+///Record that a statement could not be compiled for lack of memory,
+///  which only happens once the realtime pools are exhausted
+///@param statement the statement
+static void setNoMemory(Statement* statement){
+  if(statement->error != noMemory){
+    memFree(statement->error);
+  }
+  statement->error = noMemory;
+  statement->errorCode = DiagPoolExhausted;
+  return;
+}
+
+
+///Record an error reported instead of executing a statement
+///@param statement the statement
+///@param code the kind of error
+///@param format printf-style format of the message
+static void setError(Statement* statement, DiagnosticCode code,
+		     const char* format, ...){
+  va_list args;
+  va_list copy;
+  int len;
+
+  va_start(args, format);
+  va_copy(copy, args);
+  len = vsnprintf(NULL, 0, format, copy);
+  va_end(copy);
+
+  statement->error = memAlloc(MemStatements, len + 1);
+  if(!statement->error){
+    va_end(args);
+    setNoMemory(statement);
+    return;
+  }
+  vsnprintf(statement->error, len + 1, format, args);
+  va_end(args);
+  statement->errorCode = code;
+
+  return;
+}
+
+
+///Create an empty statement
+///@param kind the kind of statement
+///@returns the new statement, or NULL if there is no memory left
+static Statement* CreateStatement(StatementKind kind){
+  Statement* statement = memAlloc(MemStatements, sizeof(Statement));
+
+  if(!statement){
+    return NULL;
+  }
+  statement->kind = kind;
+  statement->source = NULL;
+  statement->text = NULL;
+  statement->error = NULL;
+  statement->errorCode = DiagBadDefine;
+  statement->line = 0;
+  statement->type = Unknown;
+  statement->items = NULL;
+  statement->count = 0;
+  statement->lengths = NULL;
+  statement->target = NULL;
+  statement->left = NULL;
+  statement->branches = NULL;
+  statement->branchCount = 0;
+  statement->then = NULL;
+  statement->output = NULL;
+  statement->fused.kind = NotFused;
+  statement->fused.boundTable = 0;
+
+  return statement;
+}
+
+
+///Free a statement
+void DestroyStatement(Statement* statement){
+  size_t i;
+
+  if(statement->left){
+    DestroyExpression(statement->left);
+  }
+  for(i = 0; i < statement->branchCount; i++){
+    DestroyExpression(statement->branches[i].left);
+    DestroyExpression(statement->branches[i].right);
+  }
+  memFree(statement->branches);
+  if(statement->then){
+    DestroyStatement(statement->then);
+  }
+  memFree(statement->items);
+  memFree(statement->lengths);
+  memFree(statement->output);
+  if(statement->error != noMemory){
+    memFree(statement->error);
+  }
+  memFree(statement->text);
+  memFree(statement->source);
+  memFree(statement);
+  return;
+}
+
+
+///Split the rest of a statement into a list of tokens
+///@param statement the statement to store the tokens in
+///@param str the string to split, or NULL
+///@param delim the delimiters between tokens
+static void splitItems(Statement* statement, char* str, const char* delim){
+  size_t capacity = INITIAL_SIZE;
+  char* save = NULL;
+  char* tok;
+  char** grown;
+
+  statement->items = memAlloc(MemStatements, sizeof(char*) * capacity);
+  if(!statement->items){
+    setNoMemory(statement);
+    return;
+  }
+  if(!str){
+    return;
+  }
+
+  for(tok = strtok_r(str, delim, &save);
+      tok;
+      tok = strtok_r(NULL, delim, &save)){
+    if(statement->count == capacity){
+      grown = memRealloc(MemStatements, statement->items, sizeof(char*) * capacity * 2);
+      if(!grown){
+	setNoMemory(statement);
+	return;
+      }
+      statement->items = grown;
+      capacity *= 2;
+    }
+    statement->items[statement->count++] = tok;
+  }
+  return;
+}
+
+
+///Compile a define statement
+///@param statement the statement to fill in
+///@param save the strtok_r position after the define keyword
+static void compileDefine(Statement* statement, char** save){
+  const char* delim = " ,\t\n";
+  char* tok = strtok_r(NULL, delim, save);
+  char* bracket;
+  char* end;
+  unsigned long length;
+  size_t i;
+  size_t j;
+
+  if(!tok){
+    setError(statement, DiagBadDefine,
+	     "define error: no type or variable provided\n");
+    return;
+  }
+
+  if(strcmp("integer", tok) == 0){
+    statement->type = Integer;
+  }
+  else if(strcmp("real", tok) == 0){
+    statement->type = Float;
+  }
+  else{
+    setError(statement, DiagBadDefine, "Unknown type: %s\n", tok);
+    return;
+  }
+
+  splitItems(statement, strtok_r(NULL, "", save), delim);
+  if(statement->error){
+    return;
+  }
+
+  //a name followed by a length in brackets is an array
+  for(i = 0; i < statement->count; i++){
+    bracket = strchr(statement->items[i], '[');
+    if(!bracket){
+      continue;
+    }
+    if(!statement->lengths){
+      statement->lengths = memAlloc(MemStatements, sizeof(size_t) * statement->count);
+      if(!statement->lengths){
+	setNoMemory(statement);
+	return;
+      }
+      for(j = 0; j < statement->count; j++){
+	statement->lengths[j] = NOT_ARRAY;
+      }
+    }
+    *bracket = '\0';
+    length = strtoul(bracket + 1, &end, 10);
+    if(!isdigit(bracket[1]) || strcmp(end, "]") != 0 || length > MAX_ARRAY_LENGTH){
+      setError(statement, DiagBadDefine, "define error: bad length for array %s\n",
+	       statement->items[i]);
+      return;
+    }
+    statement->lengths[i] = length;
+  }
+  return;
+}
+
+
+///Check whether a table has as many symbols as statements may define,
+///  reporting it if so
+///@param table the table
+///@returns 1 if it is full, 0 otherwise
+static int tableFull(SymbolTable* table){
+  if(symbolLimit && table->size >= symbolLimit){
+    diagnose(DiagPoolExhausted, "define error: the table is full at %zu symbols\n",
+	     symbolLimit);
+    return 1;
+  }
+  return 0;
+}
+
+
+//Limit the symbols statements can define
+void setSymbolLimit(size_t symbols){
+  symbolLimit = symbols;
+  return;
+}
+
+
+///Process a define statement, putting each symbol into the table
+///with an initial value of 0
+///@param table a pointer to the sybol table to use
+///@param statement the compiled define statement
+static void processDefine(SymbolTable* table, Statement* statement){
+  Value value;
+  Value array;
+  size_t i;
+
+  if(statement->type == Integer){
+    value.iVal = 0;
+  }
+  else{
+    value.fVal = 0;
+  }
+
+  for(i = 0; i < statement->count; i++){
+    ///Symbol already exists
+    if(GetSymbol(table, statement->items[i]) != NO_SYMBOL){
+      diagnose(DiagDuplicateSymbol, "Symbol %s already exists in table\n",
+	       statement->items[i]);
+    }
+    else if(tableFull(table)){
+      return;
+    }
+    //the value of an array symbol is the number of the array
+    else if(statement->lengths && statement->lengths[i] != NOT_ARRAY){
+      array.iVal = createArray(statement->type, statement->lengths[i]);
+      if(array.iVal < 0){
+	diagnose(DiagPoolExhausted, "define error: no memory for array %s\n",
+		 statement->items[i]);
+      }
+      else{
+	AddSymbol(table, statement->items[i], Array, array);
+      }
+    }
+    else{
+      AddSymbol(table, statement->items[i], statement->type, value);
+    }
+  }
+  return;
+}
+
+
+///Assign a value to a symbol, converting it to the symbol's type
+void assignSymbol(SymbolTable* table, SymbolId symbol, const Token* value){
+  Value converted;
+
+  if(GetSymbolType(table, symbol) == Integer){
+    if(value->valType != Integer){
+      converted.iVal = roundEven(value->value.fVal);
+    }
+    else{
+      converted.iVal = value->value.iVal;
+    }
+  }
+  else{
+    if(value->valType != Float){
+      converted.fVal = (float) value->value.iVal;
+    }
+    else{
+      converted.fVal = value->value.fVal;
+    }
+  }
+
+  SetSymbolValue(table, symbol, converted);
+  return;
+}
+
+
+///Turn superinstructions on or off
+void setFusion(int enabled){
+  fusionEnabled = enabled;
+  return;
+}
+
+
+///Get the number of statements run as superinstructions
+unsigned long long fusedStatements(void){
+  return fusedRuns;
+}
+
+
+///Take an operand of a superinstruction from a token of a compiled
+///  expression
+///@param operand set to the operand
+///@param token the token
+///@returns 1 if the token is a symbol or a number, 0 otherwise
+static int fuseOperand(FusedOperand* operand, const Token* token){
+  if(token->type == Reference){
+    operand->name = token->name;
+    operand->packed = PackName(token->name).word;
+    return 1;
+  }
+  if(token->type == Operand && (token->valType == Integer || token->valType == Float)){
+    operand->name = NULL;
+    operand->constantType = token->valType;
+    operand->constant = token->value;
+    return 1;
+  }
+  return 0;
+}
+
+
+///Compile a let statement to a superinstruction if its expression is
+///  one operator applied to two symbols or numbers
+///@param statement the compiled let statement
+static void fuseLet(Statement* statement){
+  Expression* expression = statement->left;
+  Fused* fused = &statement->fused;
+  const Token* tokens;
+
+  //the tokens of an expression with calls are rewritten by inlineCalls
+  //  for whichever table runs it, so only calls are left to evaluate
+  if(!expression || expression->error || expression->compiled || expression->size != 3){
+    return;
+  }
+  tokens = expression->tokens;
+  if(tokens[2].type != Operator || (tokens[2].value.iVal != '+' &&
+				    tokens[2].value.iVal != '-' &&
+				    tokens[2].value.iVal != '*') ||
+     !fuseOperand(&fused->operands[0], &tokens[0]) ||
+     !fuseOperand(&fused->operands[1], &tokens[1])){
+    return;
+  }
+  fused->operator = (char) tokens[2].value.iVal;
+  fused->kind = FusedOperation;
+  fused->targetName = PackName(statement->target).word;
+  return;
+}
+
+
+///Compile an if statement to a superinstruction if its condition is a
+///  single comparison of two symbols or numbers
+///@param statement the compiled if statement
+static void fuseIf(Statement* statement){
+  Branch* branch = statement->branches;
+  Fused* fused = &statement->fused;
+
+  if(statement->branchCount != 1 ||
+     branch->left->error || branch->left->compiled || branch->left->size != 1 ||
+     branch->right->error || branch->right->compiled || branch->right->size != 1 ||
+     !fuseOperand(&fused->operands[0], &branch->left->tokens[0]) ||
+     !fuseOperand(&fused->operands[1], &branch->right->tokens[0])){
+    return;
+  }
+  fused->kind = FusedCompare;
+  return;
+}
+
+
+///Check whether the symbols a superinstruction was bound to have the
+///  same ids, names and types in a table, as they do in a table reset
+///  to the symbols of the one it was bound to
+///@param table a pointer to the symbol table
+///@param fused the superinstruction, bound to a type
+///@param target whether it is a let with a target
+///@returns 1 if they do, 0 otherwise
+static int sameSymbols(SymbolTable* table, const Fused* fused, int target){
+  const FusedOperand* operand;
+  int i;
+
+  for(i = 0; i < 2; i++){
+    operand = &fused->operands[i];
+    if(operand->name &&
+       (operand->id >= table->size ||
+	table->slabs[operand->id >> SLAB_SHIFT]->names[operand->id & SLAB_MASK].word !=
+	operand->packed || GetSymbolType(table, operand->id) != fused->type)){
+      return 0;
+    }
+  }
+  return !target ||
+    (fused->target < table->size &&
+     table->slabs[fused->target >> SLAB_SHIFT]->names[fused->target & SLAB_MASK].word ==
+     fused->targetName && GetSymbolType(table, fused->target) == fused->type);
+}
+
+
+///Bind a superinstruction to a table and find the type it runs in
+///@param table a pointer to the symbol table to use
+///@param fused the superinstruction
+///@param target the name of the symbol a let assigns, or NULL
+static void bindFused(SymbolTable* table, Fused* fused, const char* target){
+  Type types[2];
+  FusedOperand* operand;
+  int i;
+
+  //rows reset the table for each row, which keeps the ids
+  if(fused->boundTable && fused->type != Unknown && sameSymbols(table, fused, target != NULL)){
+    fused->boundTable = table->serial;
+    return;
+  }
+
+  fused->type = Unknown;
+  for(i = 0; i < 2; i++){
+    operand = &fused->operands[i];
+    if(!operand->name){
+      types[i] = operand->constantType;
+      continue;
+    }
+    operand->id = GetSymbol(table, operand->name);
+    //a symbol may still be defined, so nothing is kept
+    if(operand->id == NO_SYMBOL){
+      return;
+    }
+    types[i] = GetSymbolType(table, operand->id);
+    if(types[i] != Integer && types[i] != Float){
+      return;
+    }
+  }
+  if(target){
+    fused->target = GetSymbol(table, target);
+    if(fused->target == NO_SYMBOL){
+      return;
+    }
+  }
+  fused->boundTable = table->serial;
+
+  //operations are done as evaluating would: in floats if either
+  //  operand is one, with integer constants converted. A symbol that
+  //  would have to be converted, or a result that would have to be,
+  //  leaves the statement to be evaluated
+  fused->type = types[0] == Float || types[1] == Float ? Float : Integer;
+  for(i = 0; i < 2; i++){
+    operand = &fused->operands[i];
+    if(operand->name && types[i] != fused->type){
+      fused->type = Unknown;
+      return;
+    }
+    operand->value = operand->constant;
+    if(!operand->name && types[i] != fused->type){
+      operand->value.fVal = (float) operand->constant.iVal;
+    }
+  }
+  if(target && GetSymbolType(table, fused->target) != fused->type){
+    fused->type = Unknown;
+  }
+  return;
+}
+
+
+///Get the value of an operand of a bound superinstruction
+///@param table a pointer to the symbol table it is bound to
+///@param operand the operand
+///@returns the value, in the type of the superinstruction
+static inline Value fusedValue(SymbolTable* table, const FusedOperand* operand){
+  return operand->name ? GetSymbolValue(table, operand->id) : operand->value;
+}
+
+
+///Run a let statement as a superinstruction
+///@param table a pointer to the symbol table to use
+///@param statement the compiled let statement
+///@returns 1 if it ran, 0 if it must be run by evaluating its expression
+static int runFusedLet(SymbolTable* table, Statement* statement){
+  Fused* fused = &statement->fused;
+  Value left;
+  Value right;
+  Value result;
+
+  if(!fusionEnabled || fused->kind == NotFused){
+    return 0;
+  }
+  if(fused->boundTable != table->serial){
+    bindFused(table, fused, statement->target);
+  }
+  if(fused->boundTable != table->serial || fused->type == Unknown){
+    return 0;
+  }
+
+  left = fusedValue(table, &fused->operands[0]);
+  right = fusedValue(table, &fused->operands[1]);
+  //integers wrap on overflow, as in performOperation
+  if(fused->type == Integer){
+    switch(fused->operator){
+    case '+':
+      result.iVal = (int) ((unsigned) left.iVal + (unsigned) right.iVal);
+      break;
+    case '-':
+      result.iVal = (int) ((unsigned) left.iVal - (unsigned) right.iVal);
+      break;
+    default:
+      result.iVal = (int) ((unsigned) left.iVal * (unsigned) right.iVal);
+      break;
+    }
+  }
+  else{
+    switch(fused->operator){
+    case '+':
+      result.fVal = left.fVal + right.fVal;
+      break;
+    case '-':
+      result.fVal = left.fVal - right.fVal;
+      break;
+    default:
+      result.fVal = left.fVal * right.fVal;
+      break;
+    }
+  }
+  SetSymbolValue(table, fused->target, result);
+  fusedRuns++;
+  countMetric(MetricExpressions, 1);
+  return 1;
+}
+
+
+///Run the condition of an if statement as a superinstruction
+///@param table a pointer to the symbol table to use
+///@param statement the compiled if statement
+///@param truth set to whether the condition is true
+///@returns 1 if it ran, 0 if it must be run by evaluating its
+///  expressions
+static int runFusedIf(SymbolTable* table, Statement* statement, int* truth){
+  Fused* fused = &statement->fused;
+  Branch* branch = statement->branches;
+  Value left;
+  Value right;
+
+  if(!fusionEnabled || fused->kind != FusedCompare){
+    return 0;
+  }
+  if(fused->boundTable != table->serial){
+    bindFused(table, fused, NULL);
+  }
+  if(fused->boundTable != table->serial || fused->type == Unknown){
+    return 0;
+  }
+
+  left = fusedValue(table, &fused->operands[0]);
+  right = fusedValue(table, &fused->operands[1]);
+  switch(branch->operator){
+  case EQ:
+    *truth = fused->type == Integer ? left.iVal == right.iVal : left.fVal == right.fVal;
+    break;
+  case GT:
+    *truth = fused->type == Integer ? left.iVal > right.iVal : left.fVal > right.fVal;
+    break;
+  default:
+    *truth = fused->type == Integer ? left.iVal < right.iVal : left.fVal < right.fVal;
+    break;
+  }
+  *truth = branch->invert ? !*truth : *truth;
+  fusedRuns++;
+  //the two sides of the comparison
+  countMetric(MetricExpressions, 2);
+  return 1;
+}
+
+
+///Compile a let statement
+///@param statement the statement to fill in
+///@param expression the text after the let keyword, or NULL
+static void compileLet(Statement* statement, char* expression){
+  const char* delim = " ,\t\n";
+  char* save = NULL;
+  char* tok = NULL;
+
+  if(expression){
+    tok = strtok_r(expression, delim, &save);
+  }
+
+  if(!tok){
+    setError(statement, DiagBadLet, "Error: no symbol provided to let\n");
+    return;
+  }
+  statement->target = tok;
+
+  ///skip past :=
+  strtok_r(NULL, delim, &save);
+  //get rest of line to evaluate
+  tok = strtok_r(NULL, "\n", &save);
+
+  statement->left = compileExpression(tok);
+  fuseLet(statement);
+  return;
+}
+
+
+///Process a let statement
+///@param table a pointer to the symbol table to use
+///@param statement the compiled let statement
+static void processLet(SymbolTable* table, Statement* statement){
+  SymbolId symbol;
+  Token result;
+
+  symbol = GetSymbol(table, statement->target);
+
+  if(symbol == NO_SYMBOL){
+    diagnose(DiagUnknownSymbol, "let error: no symbol %s in table\n",
+	     statement->target);
+    return;
+  }
+  if(GetSymbolType(table, symbol) == Function){
+    diagnose(DiagBadExpression, "let error: %s is a function\n", statement->target);
+    return;
+  }
+
+  //error processing let expression; return
+  if(!evaluateCompiled(table, statement->left, &result)){
+    return;
+  }
+
+  //arrays are never changed, but an array symbol can be given the
+  //  new array of a scan
+  if((GetSymbolType(table, symbol) == Array) != (result.valType == Array)){
+    diagnose(DiagBadExpression, "let error: %s\n", result.valType == Array ?
+	     "an array can only be stored in an array" : "an array can only be given an array");
+    return;
+  }
+  if(result.valType == Array){
+    SetSymbolValue(table, symbol, result.value);
+    return;
+  }
+
+  assignSymbol(table, symbol, &result);
+  return;
+}
+
+
+static void compileClause(Statement* statement, char* clause);
+
+
+///Skip the spaces and tabs at the start of a string
+///@param str the string
+///@returns the first character that is not a space or tab
+static char* skipBlanks(char* str){
+  while(*str == ' ' || *str == '\t'){
+    str++;
+  }
+  return str;
+}
+
+
+///Read a name at the start of a string, ending it with a null
+///  character once the separator after it has been read
+///@param str the string, starting with the name
+///@param separator set to the first character after the name and
+///  any blanks
+///@returns the character after the separator
+static char* readName(char* str, char* separator){
+  char* end = str;
+
+  while(isalnum(*end)){
+    end++;
+  }
+  str = skipBlanks(end);
+  *separator = *str;
+  if(*str){
+    str++;
+  }
+  *end = '\0';
+  return str;
+}
+
+
+///Compile a function statement, function name(a, b) := expression
+///@param statement the statement to fill in
+///@param definition the text after the function keyword, or NULL
+static void compileFunction(Statement* statement, char* definition){
+  char* cursor = definition ? skipBlanks(definition) : "";
+  char* name = cursor;
+  char* parameter;
+  char separator;
+  size_t i;
+
+  if(!isalpha(*name)){
+    setError(statement, DiagBadFunction, "function error: no function name provided\n");
+    return;
+  }
+  cursor = readName(name, &separator);
+  if(separator != '('){
+    setError(statement, DiagBadFunction, "function error: no parameters given for %s\n",
+	     name);
+    return;
+  }
+
+  statement->items = memAlloc(MemStatements, sizeof(char*) * MAX_PARAMETERS);
+  if(!statement->items){
+    setNoMemory(statement);
+    return;
+  }
+  cursor = skipBlanks(cursor);
+  if(*cursor == ')'){
+    cursor++;
+  }
+  else{
+    do{
+      parameter = cursor;
+      if(!isalpha(*parameter)){
+	setError(statement, DiagBadFunction, "function error: bad parameters for %s\n",
+		 name);
+	return;
+      }
+      cursor = skipBlanks(readName(parameter, &separator));
+      if(separator != ',' && separator != ')'){
+	setError(statement, DiagBadFunction, "function error: bad parameters for %s\n",
+		 name);
+	return;
+      }
+      if(statement->count == MAX_PARAMETERS){
+	setError(statement, DiagBadFunction,
+		 "function error: %s has more than %d parameters\n", name, MAX_PARAMETERS);
+	return;
+      }
+      //names are compared the way the symbol table compares them
+      for(i = 0; i < statement->count; i++){
+	if(PackName(statement->items[i]).word == PackName(parameter).word){
+	  setError(statement, DiagBadFunction,
+		   "function error: parameter %s of %s is repeated\n", parameter, name);
+	  return;
+	}
+      }
+      statement->items[statement->count++] = parameter;
+    }while(separator == ',');
+  }
+
+  cursor = skipBlanks(cursor);
+  if(strncmp(cursor, ":=", 2) != 0){
+    setError(statement, DiagBadFunction, "function error: no := after the parameters of %s\n",
+	     name);
+    return;
+  }
+
+  if(findReduction(name) >= 0){
+    setError(statement, DiagBadFunction, "function error: %s is a built-in reduction\n",
+	     name);
+    return;
+  }
+  statement->target = name;
+  statement->left = compileFunctionBody(cursor + 2, statement->items, statement->count);
+  if(statement->left->error){
+    setError(statement, outOfMemory(statement->left) ? DiagPoolExhausted : DiagBadFunction,
+	     "function error: %s", statement->left->error);
+  }
+  return;
+}
+
+
+//kinds of nodes in a parsed if condition
+typedef enum condition_kind {Comparison, AndCondition, OrCondition,
+			     NotCondition} ConditionKind;
 
-  Symbol* symbol;
-  
-  char* tok;
-  
 
-  while(getline(&line, &len, symbolFile) != -1){
-    symbol = malloc(sizeof(Symbol));
+//Parsed if condition, flattened into branches once it is complete
+typedef struct Condition_ {
+  ConditionKind kind;
+  //comparison: the compiled comparison, with no targets yet
+  Branch branch;
+  //and, or: both operands; not: the operand in first
+  struct Condition_* first;
+  struct Condition_* second;
+} Condition;
 
-    tok = strtok(line, delim);
- 
-    if(strcmp("integer", tok) == 0){
-      symbol->type = Integer;
-    }
-    else if(strcmp("real", tok) == 0){
-      symbol->type = Float;
-    }
-    else{
-      fprintf(stderr, "Error processing symbol file: unknown type - %s\n", tok);
-      free(symbol);
-      continue;
-    }
 
-    tok = strtok(NULL, delim);
-    symbol->name = strndup(tok, MAX_SYM_LEN);
+static void DestroyCondition(Condition* condition, int expressions);
 
-    tok = strtok(NULL, delim);
-    
-    if(symbol->type == Integer){
-      symbol->value.iVal = (int) strtol(tok, NULL, 10);
-    }
-    else if(symbol->type == Float){
-      symbol->value.fVal = strtof(tok, NULL);
-    }
 
-    AddSymbol(table, symbol);
-    
-    free(line);
-    line = NULL;
+///Create a condition node
+///@param statement the statement to report a lack of memory in
+///@param kind the kind of node
+///@param first the first operand, or NULL
+///@param second the second operand, or NULL
+///@returns the new node, or NULL if there is no memory left, in which
+///  case the operands are freed
+static Condition* CreateCondition(Statement* statement, ConditionKind kind,
+				  Condition* first, Condition* second){
+  Condition* condition = memAlloc(MemStatements, sizeof(Condition));
 
+  if(!condition){
+    setNoMemory(statement);
+    DestroyCondition(first, 1);
+    DestroyCondition(second, 1);
+    return NULL;
   }
+  condition->kind = kind;
+  condition->branch.left = NULL;
+  condition->branch.right = NULL;
+  condition->first = first;
+  condition->second = second;
+  return condition;
+}
 
-  free(line);
 
+///Free a parsed condition
+///@param condition the condition, or NULL
+///@param expressions whether to free the compiled comparisons too,
+///  which is not done once they have been moved into branches
+static void DestroyCondition(Condition* condition, int expressions){
+  if(!condition){
+    return;
+  }
+  if(expressions && condition->kind == Comparison){
+    DestroyExpression(condition->branch.left);
+    DestroyExpression(condition->branch.right);
+  }
+  DestroyCondition(condition->first, expressions);
+  DestroyCondition(condition->second, expressions);
+  memFree(condition);
   return;
 }
 
 
-///Process a define statement, putting each symbol into the table
-///with an initial value of 0
-///@param table a pointer to the sybol table to use
-static void processDefine(SymbolTable* table){
-  const char* delim = " ,\t\n";
-  char* tok;
-  Type type;
-  Symbol* symbol;
+///Check whether a keyword starts at a position in a condition
+///@param text the position, which must not follow a letter or digit
+///@param word the keyword
+///@returns 1 if the keyword is there as a whole word, else 0
+static int isKeyword(const char* text, const char* word){
+  size_t len = strlen(word);
 
-  tok = strtok(NULL, delim);
+  return (strncmp(text, word, len) == 0 && !isalnum(text[len]));
+}
 
-  if(!tok){
-    fprintf(stderr, "define error: no type or variable provided\n");
-    return;
+
+///Check whether a position in a condition starts an and or or
+///@param start the start of the text being scanned
+///@param text the position
+///@returns 1 if it does, else 0
+static int isJoin(const char* start, const char* text){
+  return ((text == start || !isalnum(text[-1])) &&
+	  (isKeyword(text, "and") || isKeyword(text, "or")));
+}
+
+
+///Check whether parentheses in a condition group a condition rather
+///  than part of an arithmetic expression
+///@param open the opening parenthesis
+///@returns 1 if the group holds a comparison or keyword, else 0
+static int isConditionGroup(const char* open){
+  const char* text;
+  int depth = 0;
+
+  for(text = open; *text; text++){
+    if(*text == '('){
+      depth++;
+    }
+    else if(*text == ')' && --depth == 0){
+      return 0;
+    }
+    else if(strchr("<>=!", *text) || (!isalnum(text[-1]) &&
+				       (isJoin(open, text) ||
+					isKeyword(text, "not")))){
+      return 1;
+    }
   }
+  return 0;
+}
 
-  if(strcmp("integer", tok) == 0){
-    type = Integer;
+
+///Compile part of a condition as an expression
+///@param start the start of the expression text
+///@param end the end of the expression text, restored afterwards
+///@returns the compiled expression
+static Expression* compileSlice(char* start, char* end){
+  char saved = *end;
+  Expression* expression;
+
+  *end = '\0';
+  expression = compileExpression(start);
+  *end = saved;
+  return expression;
+}
+
+
+static Condition* parseOr(Statement* statement, char** cursor);
+
+
+///Parse a single comparison of a condition
+///@param statement the statement to report errors in
+///@param cursor the position to parse from, moved past the comparison
+///@returns the comparison, or NULL if there was an error
+static Condition* parseComparison(Statement* statement, char** cursor){
+  char* start = *cursor;
+  char* compOperator;
+  char* right;
+  char* end;
+  int depth = 0;
+  Condition* condition;
+
+  //find the boolean operator outside of any parentheses
+  for(compOperator = start; *compOperator; compOperator++){
+    if(*compOperator == '('){
+      depth++;
+    }
+    else if(*compOperator == ')' && depth-- == 0){
+      break;
+    }
+    else if(depth == 0 && strchr("<>=!", *compOperator)){
+      break;
+    }
   }
-  else if(strcmp("real", tok) == 0){
-    type = Float;
+
+  condition = CreateCondition(statement, Comparison, NULL, NULL);
+  if(!condition){
+    return NULL;
   }
-  else{
-    fprintf(stderr, "Unknown type: %s\n", tok);
-    return;
+  condition->branch.operator = EQ;
+  condition->branch.invert = 0;
+  right = compOperator;
+  if(*right == '!'){
+    condition->branch.invert = 1;
+    right++;
   }
-
-  while((tok = strtok(NULL, delim)) != NULL){
-    symbol = malloc(sizeof(Symbol));
-    symbol->name = strndup(tok, MAX_SYM_LEN);
-    symbol->type = type;
-    if(type == Integer){
-      symbol->value.iVal = 0;
+  switch(*right){
+  case '=':
+    condition->branch.operator = EQ;
+    break;
+  case '<':
+    condition->branch.operator = LT;
+    //<= is the same as !>
+    if(right[1] == '=' && !condition->branch.invert){
+      condition->branch.operator = GT;
+      condition->branch.invert = 1;
+      right++;
     }
-    else{
-      symbol->value.fVal = 0;
+    break;
+  case '>':
+    condition->branch.operator = GT;
+    //>= is the same as !<
+    if(right[1] == '=' && !condition->branch.invert){
+      condition->branch.operator = LT;
+      condition->branch.invert = 1;
+      right++;
     }
+    break;
+  case '\0':
+  case ')':
+    setError(statement, DiagBadCondition,
+	     "No boolean operator found in if clause\n");
+    memFree(condition);
+    return NULL;
+  default:
+    setError(statement, DiagBadCondition,
+	     "Unknown boolean operator %c\n", *right);
+    memFree(condition);
+    return NULL;
+  }
+  right++;
 
-    ///Symbol already exists
-    if(!AddSymbol(table, symbol)){
-      free(symbol->name);
-      free(symbol);
-      fprintf(stderr, "Symbol %s already exists in table\n", tok);
+  //the right hand side ends at and, or, or the end of a group
+  depth = 0;
+  for(end = right; *end && !isJoin(right, end); end++){
+    if(*end == '('){
+      depth++;
+    }
+    else if(*end == ')' && depth-- == 0){
+      break;
     }
   }
-  return;
+
+  condition->branch.left = compileSlice(start, compOperator);
+  condition->branch.right = compileSlice(right, end);
+  *cursor = end;
+  return condition;
 }
 
 
-///Process a let statement
-///@param table a pointer to the symbol table to use
-static void processLet(SymbolTable* table, char* expression){
-  const char* delim = " ,\t\n";
-  char* tok;
-  Symbol* symbol;
-  Token* returnToken;
+///Parse a negation, a parenthesized condition or a comparison
+///@param statement the statement to report errors in
+///@param cursor the position to parse from, moved past what was parsed
+///@returns the condition, or NULL if there was an error
+static Condition* parseNot(Statement* statement, char** cursor){
+  Condition* condition;
 
-  tok = strtok(expression, delim);
+  while(isspace(**cursor)){
+    (*cursor)++;
+  }
 
-  if(!tok){
-    fprintf(stderr, "Error: no symbol provided to let\n");
-    return;
+  if(isKeyword(*cursor, "not")){
+    *cursor += 3;
+    condition = parseNot(statement, cursor);
+    return condition ? CreateCondition(statement, NotCondition, condition, NULL) : NULL;
   }
-  
-  symbol = GetSymbol(table, tok);
 
-  if(!symbol){
-    fprintf(stderr, "let error: no symbol %s in table\n", tok);
-    return;
+  if(**cursor != '(' || !isConditionGroup(*cursor)){
+    return parseComparison(statement, cursor);
   }
 
-  ///skip past :=
-  tok = strtok(NULL, delim);
-  //get rest of line to evaluate
-  tok = strtok(NULL, "\n");
-  
+  (*cursor)++;
+  condition = parseOr(statement, cursor);
+  if(condition && **cursor != ')'){
+    setError(statement, DiagBadCondition,
+	     "Unbalanced parentheses in if clause\n");
+    DestroyCondition(condition, 1);
+    return NULL;
+  }
+  (*cursor)++;
+  return condition;
+}
 
-  returnToken = evaluateExpression(table, tok);
 
-  //error processing let expression; return
-  if(!returnToken){
-    return;
-  }
+///Parse conditions joined by and
+///@param statement the statement to report errors in
+///@param cursor the position to parse from, moved past what was parsed
+///@returns the condition, or NULL if there was an error
+static Condition* parseAnd(Statement* statement, char** cursor){
+  Condition* condition = parseNot(statement, cursor);
+  Condition* second;
 
-  if(symbol->type == Integer){
-    if(returnToken->valType != Integer){
-      symbol->value.iVal = roundEven(returnToken->value.fVal);
+  while(condition){
+    while(isspace(**cursor)){
+      (*cursor)++;
     }
-    else{
-      symbol->value.iVal = returnToken->value.iVal;
+    if(!isKeyword(*cursor, "and")){
+      break;
     }
+    *cursor += 3;
+    second = parseNot(statement, cursor);
+    if(!second){
+      DestroyCondition(condition, 1);
+      return NULL;
+    }
+    condition = CreateCondition(statement, AndCondition, condition, second);
   }
-  else{
-    if(returnToken->valType != Float){
-      symbol->value.fVal = (float) returnToken->value.iVal;
+  return condition;
+}
+
+
+///Parse conditions joined by or
+///@param statement the statement to report errors in
+///@param cursor the position to parse from, moved past what was parsed
+///@returns the condition, or NULL if there was an error
+static Condition* parseOr(Statement* statement, char** cursor){
+  Condition* condition = parseAnd(statement, cursor);
+  Condition* second;
+
+  while(condition){
+    if(!isKeyword(*cursor, "or")){
+      break;
     }
-    else{
-      symbol->value.fVal = returnToken->value.fVal;
+    *cursor += 2;
+    second = parseAnd(statement, cursor);
+    if(!second){
+      DestroyCondition(condition, 1);
+      return NULL;
     }
+    condition = CreateCondition(statement, OrCondition, condition, second);
   }
-
-  free(returnToken);
-  return;
+  return condition;
 }
 
 
-///Process an if statement
-///@param table a pointer to the symbol table to use
-///@param clause the conditional clause to use
-///@returns 1 if statement is true, else 0 
-static int processIf(SymbolTable* table, char* clause){
-  char* compOperator = clause;
-  BoolOperator operator;
-  //indicates whether or not to invert the result with the ! operator
-  int invert = 0;
-  //truth value to be returned
-  int returnVal = 0;
-  //find the boolean operator in the clause
-  while(*compOperator != '!' && *compOperator != '='
-	&& *compOperator != '>' && *compOperator != '<'){
-    compOperator++;
+///Count the comparisons in a condition
+///@param condition the condition
+///@returns the number of branches it flattens into
+static int countBranches(Condition* condition){
+  switch(condition->kind){
+  case Comparison:
+    return 1;
+  case NotCondition:
+    return countBranches(condition->first);
+  default:
+    return countBranches(condition->first) + countBranches(condition->second);
   }
+}
 
-  if(*compOperator == '!'){
-    invert = 1;
-    *compOperator = '\0';
-    compOperator++;
-  }
-  switch(*compOperator){
-  case '=':
-    operator = EQ;
+
+///Flatten a condition into the branches of a statement, in source order
+///@param statement the statement to add branches to
+///@param condition the condition
+///@param onTrue where to go when the condition is true
+///@param onFalse where to go when the condition is false
+static void emitCondition(Statement* statement, Condition* condition,
+			  int onTrue, int onFalse){
+  //index of the branch following the first operand
+  int next = (int) statement->branchCount;
+  Branch* branch;
+
+  switch(condition->kind){
+  case Comparison:
+    branch = &statement->branches[statement->branchCount++];
+    *branch = condition->branch;
+    branch->onTrue = onTrue;
+    branch->onFalse = onFalse;
     break;
-  case '<':
-    operator = LT;
+  case NotCondition:
+    emitCondition(statement, condition->first, onFalse, onTrue);
     break;
-  case '>':
-    operator = GT;
+  //the second operand only runs when the first does not decide
+  case AndCondition:
+    next += countBranches(condition->first);
+    emitCondition(statement, condition->first, next, onFalse);
+    emitCondition(statement, condition->second, onTrue, onFalse);
+    break;
+  case OrCondition:
+    next += countBranches(condition->first);
+    emitCondition(statement, condition->first, onTrue, next);
+    emitCondition(statement, condition->second, onTrue, onFalse);
     break;
-  default:
-    fprintf(stderr, "Unknown boolean operator %c\n", *compOperator);
-    return 0;
   }
+  return;
+}
 
-  *compOperator = '\0';
-  compOperator++;
 
-  
-  Token* leftResult = evaluateExpression(table, clause);
-  Token* rightResult = evaluateExpression(table, compOperator);
+///Compile an if statement
+///@param statement the statement to fill in
+///@param ifClause the text after the if keyword, or NULL
+static void compileIf(Statement* statement, char* ifClause){
+  char* thenClause = NULL;
+  char* cursor = ifClause;
+  Condition* condition;
+
+  if(ifClause){
+    thenClause = strstr(ifClause, " then ");
+  }
+  if(!thenClause){
+    setError(statement, DiagBadCondition,
+	     "No then clause found for if clause\n");
+    return;
+  }
+  //seperate then clause from if clause so processing with strtok behaves correctly
+  *thenClause = '\0';
+  //move past then statement to beginning of clause
+  thenClause += 6;
+
+  condition = parseOr(statement, &cursor);
+  if(!condition){
+    return;
+  }
+  if(*cursor){
+    setError(statement, DiagBadCondition,
+	     "Unbalanced parentheses in if clause\n");
+    DestroyCondition(condition, 1);
+    return;
+  }
+
+  statement->branches = memAlloc(MemStatements,
+				 sizeof(Branch) * countBranches(condition));
+  if(!statement->branches){
+    setNoMemory(statement);
+    DestroyCondition(condition, 1);
+    return;
+  }
+  emitCondition(statement, condition, CONDITION_TRUE, CONDITION_FALSE);
+  DestroyCondition(condition, 0);
+  fuseIf(statement);
+
+  statement->then = CreateStatement(EmptyStatement);
+  if(!statement->then){
+    setNoMemory(statement);
+    return;
+  }
+  compileClause(statement->then, thenClause);
+  return;
+}
+
+
+///Compare the values of both sides of a comparison
+///@param branch the comparison
+///@param left the value of the left side, converted in place
+///@param right the value of the right side, converted in place
+///@returns the truth value of the comparison
+static int compareResults(const Branch* branch, Token* left, Token* right){
+  //truth value to be returned
+  int returnVal = 0;
+
+  Token* leftResult = left;
+  Token* rightResult = right;
   int isFloat = 0;
 
-  //perform type conversions if necessary
-  if(leftResult->valType != rightResult->valType){
-    if(leftResult->valType == Float){
+  //perform type conversions if necessary; reals are always compared
+  //  as reals
+  if(leftResult->valType == Float || rightResult->valType == Float){
+    if(rightResult->valType != Float){
       rightResult->valType = Float;
       rightResult->value.fVal = (float) rightResult->value.iVal;
     }
-    else{
+    if(leftResult->valType != Float){
       leftResult->valType = Float;
       leftResult->value.fVal = (float) leftResult->value.iVal;
     }
@@ -272,7 +1401,7 @@ static int processIf(SymbolTable* table, char* clause){
   }
 
   
-  switch(operator){
+  switch(branch->operator){
   case EQ:
     if(isFloat){
       returnVal = (leftResult->value.fVal == rightResult->value.fVal);
@@ -301,10 +1430,8 @@ static int processIf(SymbolTable* table, char* clause){
     break;
   }
 
-  free(leftResult);
-  free(rightResult);
   //if ! was used, invert the truth value
-  if(invert){
+  if(branch->invert){
     return (!returnVal);
   }
   
@@ -312,11 +1439,137 @@ static int processIf(SymbolTable* table, char* clause){
 }
 
 
+///Run one comparison of an if condition
+///@param table a pointer to the symbol table to use
+///@param branch the comparison
+///@param valid set to 0 if either side failed to evaluate
+///@returns 1 if the comparison is true, else 0
+static int processComparison(SymbolTable* table, Branch* branch, int* valid){
+  Token left;
+  Token right;
+  int leftValid = evaluateCompiled(table, branch->left, &left);
+  int rightValid = evaluateCompiled(table, branch->right, &right);
+
+  *valid = leftValid && rightValid;
+  if(*valid && (left.valType == Array || right.valType == Array)){
+    diagnose(DiagBadExpression, "Error: arrays cannot be compared\n");
+    *valid = 0;
+  }
+  if(!*valid){
+    return 0;
+  }
+  return compareResults(branch, &left, &right);
+}
+
+
+///Process an if statement
+///@param table a pointer to the symbol table to use
+///@param statement the compiled if statement
+///@returns 1 if statement is true, else 0 
+static int processIf(SymbolTable* table, Statement* statement){
+  int next = 0;
+  int valid;
+  Branch* branch;
+
+  //run comparisons until one decides the condition
+  while(next >= 0){
+    branch = &statement->branches[next];
+    next = processComparison(table, branch, &valid) ? branch->onTrue : branch->onFalse;
+
+    //either side failed to evaluate; the condition is false
+    if(!valid){
+      return 0;
+    }
+  }
+
+  return (next == CONDITION_TRUE);
+}
+
+
+///Bind an expression to a table if evaluating it reads and writes
+///  nothing else, so that it can be evaluated alongside statements
+///  running against other tables
+///@param table the table
+///@param expression the compiled expression
+///@param bound filled with the symbols of the expression, with room for
+///  STACK_INLINE
+///@returns 1 if it is bound and cannot fail, 0 otherwise
+static int bindIsolated(SymbolTable* table, Expression* expression, SymbolId* bound){
+  //the tokens of an expression calling functions are rewritten when
+  //  they are inlined, so they are not read at all
+  return !expression->compiled && !expression->error && expression->size <= STACK_INLINE &&
+    !bindExpression(table, expression, bound) && isSafeExpression(table, expression, bound);
+}
+
+
+///Process a let statement whose expression is isolated
+///@param table a pointer to the symbol table to use
+///@param statement the compiled let statement
+///@returns 1 if it ran, 0 if it must be run by executeStatement
+static int isolatedLet(SymbolTable* table, Statement* statement){
+  SymbolId bound[STACK_INLINE];
+  SymbolId symbol = GetSymbol(table, statement->target);
+  Token result;
+
+  if(symbol == NO_SYMBOL || (GetSymbolType(table, symbol) != Integer &&
+			     GetSymbolType(table, symbol) != Float) ||
+     !bindIsolated(table, statement->left, bound)){
+    return 0;
+  }
+  if(evaluateBound(table, statement->left, bound, &result)){
+    assignSymbol(table, symbol, &result);
+  }
+  return 1;
+}
+
+
+///Decide the condition of an if statement whose expressions are all
+///  isolated
+///@param table a pointer to the symbol table to use
+///@param statement the compiled if statement
+///@param truth set to 1 if the condition is true, else 0
+///@returns 1 if it was decided, 0 if it must be run by executeStatement
+static int isolatedIf(SymbolTable* table, Statement* statement, int* truth){
+  SymbolId bound[STACK_INLINE];
+  SymbolId boundRight[STACK_INLINE];
+  Token left;
+  Token right;
+  Branch* branch;
+  int leftValid;
+  int rightValid;
+  int next = 0;
+
+  while(next >= 0){
+    branch = &statement->branches[next];
+    //both sides are bound before either reports an error, so falling
+    //  back to executeStatement never reports one twice
+    if(!bindIsolated(table, branch->left, bound) ||
+       !bindIsolated(table, branch->right, boundRight)){
+      return 0;
+    }
+    //as in processComparison, both sides are evaluated and a side that
+    //  fails makes the condition false
+    leftValid = evaluateBound(table, branch->left, bound, &left);
+    rightValid = evaluateBound(table, branch->right, boundRight, &right);
+    if(!leftValid || !rightValid){
+      *truth = 0;
+      return 1;
+    }
+    next = compareResults(branch, &left, &right) ? branch->onTrue : branch->onFalse;
+  }
+  *truth = next == CONDITION_TRUE;
+  return 1;
+}
+
+
+
+
 ///Validate that a print string is enclosed in quotes. Place a null terminator at the closing quote
 ///  and return the index of the beginning of the string if the string is properly quoted
 ///@parameter the ascii string to validate
+///@parameter error set to the error message if the string is not properly quoted
 ///@returns the starting position of the string, or -1 if the string is not properly quoted
-static int validatePrtString(char* str){
+static int validatePrtString(char* str, const char** error){
   int i = 0;
   int start;
   char mark;
@@ -329,7 +1582,7 @@ static int validatePrtString(char* str){
   mark = str[i];
   if(mark != '\'' && mark != '\"'){
     //no quote at beginning
-    fprintf(stderr, "Error: no opening quotes for print statement string\n");
+    *error = "Error: no opening quotes for print statement string\n";
     return -1;
   }
 
@@ -344,13 +1597,13 @@ static int validatePrtString(char* str){
   }
   
   if(str[i] != '\'' && str[i] != '\"'){
-    fprintf(stderr, "Error: no closing quotes for print statement string\n");
+    *error = "Error: no closing quotes for print statement string\n";
     return -1;
   }
 
   if(mark != str[i]){
     //quotes don't match
-    fprintf(stderr, "Error: mismatching quotes in print statement\n");
+    *error = "Error: mismatching quotes in print statement\n";
     return -1;
   }
 
@@ -361,20 +1614,30 @@ static int validatePrtString(char* str){
 }
 
 
-///Process a print statement
-static void processPrint(void){
-  //get entire line
-  char* str = strtok(NULL, "\n");
+///Compile a print statement, processing the escapes in its string
+///@param statement the statement to fill in
+///@param str the text after the prt keyword, or NULL
+static void compilePrint(Statement* statement, char* str){
+  const char* error = NULL;
+  char* out;
+  int i;
+
   if(!str){
     return;
   }
 
-  int i = validatePrtString(str);
+  i = validatePrtString(str, &error);
 
   if(i == -1){
+    setError(statement, DiagBadPrint, "%s", error);
+    return;
+  }
+
+  out = statement->output = memAlloc(MemStatements, strlen(str) + 1);
+  if(!out){
+    setNoMemory(statement);
     return;
   }
-    
 
   for(; str[i]; i++){
     if(str[i] == '\\'){
@@ -382,62 +1645,107 @@ static void processPrint(void){
       switch(str[i]){
       case 'n':
 	//newline escape
-	putchar((unsigned char) '\n');
+	*out++ = '\n';
 	break;
       case 't':
 	//tab escape
-	putchar((unsigned char) '\t');
+	*out++ = '\t';
 	break;
       case '\\':
 	//backslack escape
-	putchar((unsigned char) '\t');
+	*out++ = '\t';
+	break;
+      case '\0':
+	//escape at the very end; print a space and stop
+	*out++ = ' ';
+	i--;
 	break;
       default:
 	//unknown escape; just print a space
-	putchar((unsigned char) ' ');
+	*out++ = ' ';
       }
     }
     else{
       //normal ASCII character, just put on the output stream
-      putchar((unsigned char) str[i]);
+      *out++ = str[i];
     }
   }
+  *out = '\0';
+
+  return;
+}
+
+
+///Process a print statement
+///@param statement the compiled print statement
+///@param out the stream to print to
+static void processPrint(Statement* statement, FILE* out){
+  if(statement->output){
+    fputs(statement->output, out);
+    countMetric(MetricOutputBytes, strlen(statement->output));
+  }
+  return;
+}
+
 
+///Display every value of an array
+///@param array the array
+///@param out the stream to display to
+static void displayArray(const NumericArray* array, FILE* out){
+  size_t bytes = 0;
+  size_t i;
+
+  for(i = 0; i < array->length; i++){
+    if(array->type == Float){
+      bytes += fprintf(out, " %.3f ", array->values[i].fVal);
+    }
+    else{
+      bytes += fprintf(out, " %d ", array->values[i].iVal);
+    }
+  }
+  countMetric(MetricOutputBytes, bytes);
   return;
 }
 
 
 ///Process a display statement
 ///@param table a pointer to the symbol table to use
-///@param expression the string containing the elements to display
-static void processDisplay(SymbolTable* table, char* expression){
-  //delimiters for strtok
-  char* delim = " \t,\n";
-
+///@param statement the compiled display statement
+///@param out the stream to display to
+static void processDisplay(SymbolTable* table, Statement* statement, FILE* out){
   char* tokString;
+  size_t bytes = 1;
+  size_t i;
 
   //used for correctly printing negative constants
   int multiplier;
 
-  for(tokString = strtok(expression, delim);
-      tokString;
-      tokString = strtok(NULL, delim)){
+  for(i = 0; i < statement->count; i++){
+    tokString = statement->items[i];
     //reset multiplier each time
     multiplier = 1;
     
     //token is a variable identifier
     if(isalpha(tokString[0])){
-      Symbol* symbol = GetSymbol(table, tokString);
-      if(symbol){
-	if(symbol->type == Float){
-	  printf(" %.3f ", symbol->value.fVal);
+      SymbolId symbol = GetSymbol(table, tokString);
+      if(symbol != NO_SYMBOL && GetSymbolType(table, symbol) == Function){
+	diagnose(DiagBadExpression, "Error: function %s cannot be displayed\n",
+		 tokString);
+      }
+      else if(symbol != NO_SYMBOL && GetSymbolType(table, symbol) == Array){
+	displayArray(getArray(GetSymbolValue(table, symbol).iVal), out);
+      }
+      else if(symbol != NO_SYMBOL){
+	if(GetSymbolType(table, symbol) == Float){
+	  bytes += fprintf(out, " %.3f ", GetSymbolValue(table, symbol).fVal);
 	}
 	else{
-	  printf(" %d ", symbol->value.iVal);
+	  bytes += fprintf(out, " %d ", GetSymbolValue(table, symbol).iVal);
 	}
       }
       else{
-	fprintf(stderr, "\nError: symbol %s not found in symbol table\n", tokString);
+	diagnose(DiagUnknownSymbol, "Error: symbol %s not found in symbol table\n",
+		 tokString);
       }
     }
     //token is a numeric constant
@@ -445,70 +1753,185 @@ static void processDisplay(SymbolTable* table, char* expression){
       if(isFloat(tokString)){
 	//float constant
 	float fval = strtof(tokString, NULL);
-        printf(" %.3f ", multiplier * fval);
+        bytes += fprintf(out, " %.3f ", multiplier * fval);
       }
       else{
 	//integer constant
 	int ival = (int) strtol(tokString, NULL, 10);
-	printf(" %d ", multiplier * ival);
+	bytes += fprintf(out, " %d ", multiplier * ival);
       }
     }
     else{
-      fprintf(stderr, "\nError: invalid token %s\n", tokString);
+      diagnose(DiagInvalidToken, "Error: invalid token %s\n", tokString);
     }
   }
-  printf("\n");
+  fputc('\n', out);
+  countMetric(MetricOutputBytes, bytes);
   return;
 }
 
 
-///Execute a Fred statement
-///@param table the symbol table to use
-///@param statement the statement to execute
-static void executeStatement(SymbolTable* table, char* statement){
-
+///Compile the text of a statement in place
+///@param statement the statement to fill in
+///@param clause the statement text, tokenized in place
+static void compileClause(Statement* statement, char* clause){
   const char* delim = " \t\n";
-  char* tok = strtok(statement, delim);
+  char* save = NULL;
+  char* tok = strtok_r(clause, delim, &save);
   
   if(!tok){
+    statement->kind = EmptyStatement;
     return;
   }
 
   
 
   if(strcmp("define", tok) == 0){
-    processDefine(table);
+    statement->kind = DefineStatement;
+    compileDefine(statement, &save);
   }
   else if(strcmp("let", tok) == 0){
-    char* expression = strtok(NULL, "\n");
-    processLet(table, expression);
+    statement->kind = LetStatement;
+    compileLet(statement, strtok_r(NULL, "\n", &save));
   }
   else if(strcmp("if", tok) == 0){
-    char* ifClause = strtok(NULL, "\n");
-    char* thenClause = strstr(ifClause, " then ");
-    if(!thenClause){
-      fprintf(stderr, "No then clause found for if clause\n");
-      return;
-    }
-    //seperate then clause from if clause so processing with strtok behaves correctly
-    *thenClause = '\0';
-    //move past then statement to beginning of clause
-    thenClause += 6;
-    if(processIf(table, ifClause)){
-      executeStatement(table, thenClause);
-    }
+    statement->kind = IfStatement;
+    compileIf(statement, strtok_r(NULL, "\n", &save));
   }
   else if(strcmp("prt", tok) == 0){
-    processPrint();
+    statement->kind = PrtStatement;
+    compilePrint(statement, strtok_r(NULL, "\n", &save));
   }
   else if(strcmp("display", tok) == 0){
-    char* expression = strtok(NULL, "\n");
-    processDisplay(table, expression);
+    statement->kind = DisplayStatement;
+    splitItems(statement, strtok_r(NULL, "\n", &save), " \t,\n");
+  }
+  else if(strcmp("function", tok) == 0){
+    statement->kind = FunctionStatement;
+    compileFunction(statement, strtok_r(NULL, "\n", &save));
   }
   //unknown statement keyword; print error and do nothing
   else{
-    fprintf(stderr, "Unknown statement %s\n", tok);
+    statement->kind = BadStatement;
+    setError(statement, DiagUnknownStatement, "Unknown statement %s\n", tok);
+  }
+}
+
+
+///Compile a line of Fred
+Statement* compileStatement(const char* line){
+  Statement* statement = CreateStatement(EmptyStatement);
+
+  if(!statement){
+    return NULL;
+  }
+  statement->source = memStrdup(MemStatements, line);
+  statement->text = memStrdup(MemStatements, line);
+  if(!statement->source || !statement->text){
+    setNoMemory(statement);
+    return statement;
+  }
+  compileClause(statement, statement->text);
+
+  return statement;
+}
+
+
+///Execute a compiled Fred statement
+void executeStatement(SymbolTable* table, Statement* statement, FILE* out){
+  int truth;
+
+  PROBE2(statement_start, statement->line, statement->kind);
+  countMetric(MetricStatements + statement->kind, 1);
+  if(statement->line){
+    setDiagnosticLine(statement->line);
+    profileAt(statement->line, ProfEval);
+    if(profiling){
+      countExecution(statement->line);
+    }
+  }
+  if(statement->error){
+    diagnose(statement->errorCode, "%s", statement->error);
+    PROBE2(statement_done, statement->line, statement->kind);
+    return;
+  }
+
+  switch(statement->kind){
+  case DefineStatement:
+    processDefine(table, statement);
+    break;
+  case LetStatement:
+    if(!runFusedLet(table, statement)){
+      processLet(table, statement);
+    }
+    break;
+  case IfStatement:
+    if(!runFusedIf(table, statement, &truth)){
+      truth = processIf(table, statement);
+    }
+    if(truth){
+      executeStatement(table, statement->then, out);
+    }
+    break;
+  case PrtStatement:
+    profilePhase(ProfOutput);
+    processPrint(statement, out);
+    break;
+  case DisplayStatement:
+    profilePhase(ProfOutput);
+    processDisplay(table, statement, out);
+    break;
+  case FunctionStatement:
+    if(!tableFull(table)){
+      defineFunction(table, statement->target, statement->left);
+    }
+    break;
+  default:
+    break;
+  }
+  PROBE2(statement_done, statement->line, statement->kind);
+}
+
+
+///Execute a statement if it touches nothing but its table and stream
+int executeIsolated(SymbolTable* table, Statement* statement, FILE* out){
+  int truth;
+
+  if(statement->error){
+    return 0;
+  }
+  switch(statement->kind){
+  case EmptyStatement:
+    break;
+  //arrays are kept apart from the tables
+  case DefineStatement:
+    if(statement->lengths){
+      return 0;
+    }
+    processDefine(table, statement);
+    break;
+  case LetStatement:
+    if(!isolatedLet(table, statement)){
+      return 0;
+    }
+    break;
+  //the condition reads the table and nothing else, so it is decided
+  //  again if the clause has to be run by executeStatement
+  case IfStatement:
+    if(!isolatedIf(table, statement, &truth) ||
+       (truth && !executeIsolated(table, statement->then, out))){
+      return 0;
+    }
+    break;
+  case PrtStatement:
+    processPrint(statement, out);
+    break;
+  default:
+    return 0;
   }
+  //counted once it has run, since executeStatement runs it otherwise
+  countMetric(MetricStatements + statement->kind, 1);
+  return 1;
 }
 
 
@@ -517,27 +1940,47 @@ static void executeStatement(SymbolTable* table, char* statement){
 void processStatements(SymbolTable* table, FILE* input){
   char* line = NULL;
   size_t len = 0;
+  ssize_t length;
+  size_t number = 0;
+  Statement* statement;
+  long long start;
   
   printf(">");
 
-  //get lines from input; lines are dynamically allocated by getline
-  while(getline(&line, &len, input) != -1){
+  //get lines from input; the line buffer is reused for every line
+  while((length = readLine(&line, &len, input)) != -1){
+    number++;
+    profileAt(number, ProfOutput);
     printf(":::%s\n", line);
 
     if(strnlen(line, 1) != 0){
-      executeStatement(table, line);
+      start = realtime ? realtimeClock() : 0;
+      setDiagnosticLine(number);
+      if(!realtime || admitLine(length, table->size)){
+	profilePhase(ProfParse);
+	statement = compileStatement(line);
+	if(statement){
+	  statement->line = number;
+	  executeStatement(table, statement, stdout);
+	  DestroyStatement(statement);
+	}
+	else{
+	  diagnose(DiagPoolExhausted, "Error: no memory left to compile the statement\n");
+	}
+      }
+      if(realtime){
+	recordLatency(realtimeClock() - start);
+      }
     }
 
-    //free dynamically allocated line
-    free(line);
-    line = NULL;
-
+    profilePhase(ProfOutput);
     printf(">");
+    profileAt(0, ProfOther);
   }
   
   printf("\n");
 
-  free(line);
+  memFree(line);
 
   return;
 }
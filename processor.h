@@ -12,6 +12,140 @@
 
 #include "symbolTable.h"
 #include "evaluate.h"
+#include "diagnostics.h"
+
+
+//types for boolean operators in if statements; <=, >= and != are
+//  the inverted forms of >, < and =
+typedef enum bool_ops {GT, LT, EQ}
+  BoolOperator;
+
+//targets of a branch that decide the condition of an if statement
+#define CONDITION_TRUE -1
+#define CONDITION_FALSE -2
+
+
+//One comparison of a compiled if condition. The comparisons of a
+//  condition are run starting from the first, each one choosing the
+//  next, so and/or skip the comparisons that cannot change the result
+typedef struct Branch_ {
+  Expression* left;
+  Expression* right;
+  //comparison and whether it is negated with !
+  BoolOperator operator;
+  int invert;
+  //index of the next branch when the comparison is true or false,
+  //  or CONDITION_TRUE or CONDITION_FALSE
+  int onTrue;
+  int onFalse;
+} Branch;
+
+//Shapes of statements run as superinstructions, without evaluating
+//  their expressions: a let whose expression is one +, - or * of two
+//  symbols or constants, which covers let x = x + 1, let x = x + y and
+//  let x = a * b alike, and an if statement whose condition is a
+//  single comparison of two symbols or constants
+typedef enum fused_kind {NotFused, FusedOperation, FusedCompare} FusedKind;
+
+
+//An operand of a superinstruction, a symbol or a constant
+typedef struct FusedOperand_ {
+  //name of the symbol, or NULL for a constant, and its packed form
+  char* name;
+  uint64_t packed;
+  //the constant as compiled
+  Type constantType;
+  Value constant;
+  //the symbol, or the constant in the type of the operation, once bound
+  SymbolId id;
+  Value value;
+} FusedOperand;
+
+
+//A superinstruction. Its symbols are bound the first time it runs
+//  against a table, which also fixes the types it runs in, since the
+//  type of a symbol never changes
+typedef struct Fused_ {
+  FusedKind kind;
+  //let: +, - or *
+  char operator;
+  FusedOperand operands[2];
+  //serial of the table the symbols are bound to, 0 if none
+  uint64_t boundTable;
+  //let: the packed name of the symbol assigned, and the symbol once
+  //  bound
+  uint64_t targetName;
+  SymbolId target;
+  //Integer or Float, the type every operand and the target has once
+  //  bound; Unknown if they differ, and the statement is run by
+  //  evaluating its expressions instead
+  Type type;
+} Fused;
+
+//length of a symbol of a define statement that is not an array
+#define NOT_ARRAY ((size_t) -1)
+
+//kinds of Fred statements
+typedef enum statement_kind {EmptyStatement, DefineStatement, LetStatement,
+			     IfStatement, PrtStatement, DisplayStatement,
+			     BadStatement, FunctionStatement} StatementKind;
+
+
+//A compiled Fred statement. Compiling only splits up the text, so
+//  statements can be compiled ahead of the ones before them executing
+typedef struct Statement_ {
+  StatementKind kind;
+  //source line echoed before execution, NULL for a then clause
+  char* source;
+  //tokenized copy of the statement that the fields below point into
+  char* text;
+  //error reported instead of executing the statement, or NULL
+  char* error;
+  DiagnosticCode errorCode;
+  //line of the program the statement is from, 0 if not known
+  size_t line;
+
+  //define: type of the new symbols
+  Type type;
+  //define: names of the new symbols; display: tokens to display;
+  //  function: names of the parameters
+  char** items;
+  size_t count;
+  //define: length of each symbol that is an array, otherwise
+  //  NOT_ARRAY; NULL if none is
+  size_t* lengths;
+
+  //let: symbol to assign; function: name of the function
+  char* target;
+  //let: value to assign; function: the body
+  Expression* left;
+  //if: comparisons of the condition
+  Branch* branches;
+  size_t branchCount;
+  //if: statement executed when the condition is true
+  struct Statement_* then;
+
+  //prt: the string to print with escapes already processed
+  char* output;
+
+  //let and if: the superinstruction it runs as, if it has one of
+  //  their shapes
+  Fused fused;
+} Statement;
+
+
+///Parse a line of a symbol file: a type, a name and a value, or an
+///  array as described for readArray. Errors are reported with diagnose
+///@param line the line, tokenized in place
+///@param table the table an array must not already be in, or NULL
+///@param create whether to create an array, or only check its values
+///@param name set to the name of the symbol, pointing into the line
+///@param type set to the type of the symbol, Array for an array
+///@param value set to the value, or the number of the new array (0
+///  if not created)
+///@returns 1 if the line has a symbol, 0 if it is blank or not valid
+int parseSymbolLine(char* line, SymbolTable* table, int create, char** name,
+		    Type* type, Value* value);
 
 
 //Process a file of symbols and store them in the table
@@ -20,6 +154,68 @@
 void processSymbolFile(SymbolTable* table, FILE* symbolFile);
 
 
+///Compile a line of Fred into a statement
+///@param line the source line
+///@returns the compiled statement, to be freed with DestroyStatement, or NULL
+///  once the realtime pools are exhausted
+Statement* compileStatement(const char* line);
+
+
+///Free a compiled statement
+///@param statement the statement to free
+void DestroyStatement(Statement* statement);
+
+
+///Execute a compiled statement
+///@param table the symbol table to use
+///@param statement the statement to execute
+///@param out the stream prt and display statements print to
+void executeStatement(SymbolTable* table, Statement* statement, FILE* out);
+
+
+///Execute a statement if it reads and writes nothing but its table and
+///  stream: a define of symbols that are not arrays, a prt, or a let or
+///  if whose expressions call no functions, reduce no arrays and cannot
+///  fail. Such statements can run alongside others with other tables.
+///  Nothing is profiled or counted as a superinstruction
+///@param table the symbol table to use
+///@param statement the statement to execute
+///@param out the stream prt statements print to
+///@returns 1 if it ran, 0 if it did nothing and must be run by
+///  executeStatement instead
+int executeIsolated(SymbolTable* table, Statement* statement, FILE* out);
+
+
+///Round a float to an int using the even rounding method
+///@param f the float number to round
+///@returns f rounded to an integer using even rounding
+int roundEven(float f);
+
+
+///Assign a value to a symbol, converting it to the symbol's type
+///  with even rounding if needed
+///@param table the table holding the symbol
+///@param symbol the symbol to assign
+///@param value the value to assign
+void assignSymbol(SymbolTable* table, SymbolId symbol, const Token* value);
+
+
+///Turn superinstructions on or off; they are on by default
+///@param enabled 0 to evaluate the expressions of every statement
+void setFusion(int enabled);
+
+
+///Get the number of statements run as superinstructions so far
+///@returns the count
+unsigned long long fusedStatements(void);
+
+
+///Limit the symbols statements can define; the symbol file is not
+///  limited
+///@param symbols the most symbols in a table, 0 for no limit
+void setSymbolLimit(size_t symbols);
+
+
 ///Process statements from an input stream
 ///@param table the symbol table to use while processing
 ///@param input the input stream to read from
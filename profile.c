@@ -0,0 +1,462 @@
+///file:profile.c
+///description:sampling profiler counting the CPU time of each line of
+///  a Fred program, split into parsing, evaluation and output
+///author: avv8047 : Azhur Viano
+
+
+#include "profile.h"
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+
+//lines counted on their own; later lines are counted with no line
+#define PROFILE_LINES (1 << 21)
+//longest source text shown for a line
+#define TEXT_SIZE 48
+
+
+//Counts for one line of the program
+typedef struct ProfileEntry_ {
+  uint32_t executions;
+  uint32_t samples[PROFILE_PHASES];
+} ProfileEntry;
+
+//A line that ran or has samples, gathered for the report
+typedef struct Hot_ {
+  size_t line;
+  ProfileEntry counts;
+  size_t total;
+  char* text;
+} Hot;
+
+
+__thread ProfileState profileState;
+int profiling = 0;
+
+static const char* phaseNames[PROFILE_PHASES] = {
+  [ProfOther] = "other",
+  [ProfParse] = "parse",
+  [ProfEval] = "eval",
+  [ProfOutput] = "output",
+};
+
+//counts of each line, indexed by line; only the pages of lines that
+//  run are ever touched
+static ProfileEntry* entries;
+//lines past the last one counted, so the report only looks at those
+static size_t usedLines;
+//samples outside any line, and of lines past PROFILE_LINES
+static ProfileEntry outside;
+//CPU time used when the profiler started, in seconds
+static double startTime;
+//file the folded stacks are written to
+static FILE* folded;
+
+
+///Get the CPU time used by every thread of the process
+///@returns the time in seconds
+static double cpuTime(void){
+  struct timespec now;
+
+  clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+  return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+
+///Find the counts of a line; safe to call from the signal handler
+///@param line the line of the program
+///@returns the counts
+static ProfileEntry* findEntry(size_t line){
+  size_t used;
+
+  if(!line || line >= PROFILE_LINES){
+    return &outside;
+  }
+
+  used = __atomic_load_n(&usedLines, __ATOMIC_RELAXED);
+  while(line >= used &&
+	!__atomic_compare_exchange_n(&usedLines, &used, line + 1, 1,
+				     __ATOMIC_RELAXED, __ATOMIC_RELAXED)){
+  }
+  return &entries[line];
+}
+
+
+///Count a sample under the line and phase of the interrupted thread
+///@param received the signal received
+static void takeSample(int received){
+  ProfileEntry* entry = findEntry(profileState.line);
+  int phase = profileState.phase;
+
+  (void) received;
+  if(phase < 0 || phase >= PROFILE_PHASES){
+    phase = ProfOther;
+  }
+  __atomic_add_fetch(&entry->samples[phase], 1, __ATOMIC_RELAXED);
+  return;
+}
+
+
+///Start taking a sample every PROFILE_INTERVAL of CPU time
+int startProfile(const char* path){
+  struct sigaction action;
+  struct itimerval timer;
+
+  folded = fopen(path, "w");
+  if(!folded){
+    fprintf(stderr, "Error opening profile file %s\n", path);
+    return -1;
+  }
+  entries = calloc(PROFILE_LINES, sizeof(ProfileEntry));
+  if(!entries){
+    fclose(folded);
+    return -1;
+  }
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = takeSample;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  sigaction(SIGPROF, &action, NULL);
+
+  timer.it_interval.tv_sec = 0;
+  timer.it_interval.tv_usec = PROFILE_INTERVAL;
+  timer.it_value = timer.it_interval;
+  if(setitimer(ITIMER_PROF, &timer, NULL) < 0){
+    fprintf(stderr, "Error starting the profiler timer\n");
+    fclose(folded);
+    free(entries);
+    entries = NULL;
+    return -1;
+  }
+  startTime = cpuTime();
+  profiling = 1;
+  return 0;
+}
+
+
+///Count one execution of a line
+void countExecution(size_t line){
+  __atomic_add_fetch(&findEntry(line)->executions, 1, __ATOMIC_RELAXED);
+  return;
+}
+
+
+///Compare lines by their number
+static int byLine(const void* a, const void* b){
+  const Hot* left = a;
+  const Hot* right = b;
+
+  return (left->line > right->line) - (left->line < right->line);
+}
+
+
+///Compare lines by their samples, most first
+static int bySamples(const void* a, const void* b){
+  const Hot* left = a;
+  const Hot* right = b;
+
+  if(left->total != right->total){
+    return left->total < right->total ? 1 : -1;
+  }
+  return byLine(a, b);
+}
+
+
+///Compare lines by their executions, most first
+static int byExecutions(const void* a, const void* b){
+  const Hot* left = a;
+  const Hot* right = b;
+
+  if(left->counts.executions != right->counts.executions){
+    return left->counts.executions < right->counts.executions ? 1 : -1;
+  }
+  return bySamples(a, b);
+}
+
+
+///Add the counts of a line to the lines gathered if it has samples
+///@param hot the lines gathered
+///@param count the number of lines, updated
+///@param capacity the lines there is room for, updated
+///@param line the line, 0 for samples outside any line
+///@param entry the counts of the line
+///@returns the lines gathered, moved if they had to grow
+static Hot* gatherEntry(Hot* hot, size_t* count, size_t* capacity,
+			size_t line, ProfileEntry* entry){
+  size_t total = 0;
+  int phase;
+
+  for(phase = 0; phase < PROFILE_PHASES; phase++){
+    total += entry->samples[phase];
+  }
+  if(!total){
+    return hot;
+  }
+  if(*count == *capacity){
+    *capacity *= 2;
+    hot = realloc(hot, *capacity * sizeof(Hot));
+  }
+  hot[*count].line = line;
+  hot[*count].counts = *entry;
+  hot[*count].total = total;
+  hot[*count].text = NULL;
+  (*count)++;
+  return hot;
+}
+
+
+///Add the PROFILE_TOP lines run most often among those without samples
+///  to the lines gathered, so they can be ranked by executions
+///@param hot the lines gathered
+///@param count the number of lines, updated
+///@param capacity the lines there is room for, updated
+///@returns the lines gathered, moved if they had to grow
+static Hot* gatherBusiest(Hot* hot, size_t* count, size_t* capacity){
+  //kept with the most executions first
+  size_t busiest[PROFILE_TOP];
+  size_t found = 0;
+  size_t line;
+  size_t i;
+  int phase;
+  int sampled;
+
+  for(line = 1; line < usedLines; line++){
+    sampled = 0;
+    for(phase = 0; phase < PROFILE_PHASES; phase++){
+      sampled |= entries[line].samples[phase] != 0;
+    }
+    if(sampled || !entries[line].executions ||
+       (found == PROFILE_TOP &&
+	entries[line].executions <= entries[busiest[found - 1]].executions)){
+      continue;
+    }
+    i = found < PROFILE_TOP ? found++ : found - 1;
+    for(; i > 0 && entries[busiest[i - 1]].executions < entries[line].executions; i--){
+      busiest[i] = busiest[i - 1];
+    }
+    busiest[i] = line;
+  }
+
+  for(i = 0; i < found; i++){
+    if(*count == *capacity){
+      *capacity *= 2;
+      hot = realloc(hot, *capacity * sizeof(Hot));
+    }
+    hot[*count].line = busiest[i];
+    hot[*count].counts = entries[busiest[i]];
+    hot[*count].total = 0;
+    hot[*count].text = NULL;
+    (*count)++;
+  }
+  return hot;
+}
+
+
+///Copy the text of a line, keeping it short and without the ; used
+///  between frames
+///@param start the start of the line
+///@param end the end of the line
+///@returns the copy
+static char* copyText(const char* start, const char* end){
+  size_t len = end - start < TEXT_SIZE ? (size_t) (end - start) : TEXT_SIZE - 1;
+  char* text = malloc(len + 1);
+  size_t i;
+
+  for(i = 0; i < len; i++){
+    text[i] = start[i] == ';' || start[i] == '\t' || start[i] == '\r' ? ' ' : start[i];
+  }
+  text[len] = '\0';
+  return text;
+}
+
+
+///Map the program and find the text of each line gathered; a program
+///  that cannot be mapped, such as a pipe, is left without
+///@param hot the lines gathered, sorted by line
+///@param count the number of lines
+///@param program the program
+static void readTexts(Hot* hot, size_t count, FILE* program){
+  struct stat info;
+  const char* data;
+  const char* cursor;
+  const char* end;
+  const char* newline;
+  size_t number = 1;
+  size_t next = 0;
+
+  if(!program || fstat(fileno(program), &info) < 0 || !S_ISREG(info.st_mode) ||
+     info.st_size == 0){
+    return;
+  }
+  data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fileno(program), 0);
+  if(data == MAP_FAILED){
+    return;
+  }
+  madvise((void*) data, info.st_size, MADV_SEQUENTIAL);
+
+  while(next < count && hot[next].line == 0){
+    next++;
+  }
+  cursor = data;
+  end = data + info.st_size;
+  while(next < count && cursor < end){
+    newline = memchr(cursor, '\n', end - cursor);
+    if(!newline){
+      newline = end;
+    }
+    if(number == hot[next].line){
+      hot[next++].text = copyText(cursor, newline);
+    }
+    cursor = newline + 1;
+    number++;
+  }
+
+  munmap((void*) data, info.st_size);
+  return;
+}
+
+
+///Write every sample as a folded stack, fred;line;phase count
+///@param out the stream to write to
+///@param hot the lines gathered
+///@param count the number of lines
+static void writeFolded(FILE* out, Hot* hot, size_t count){
+  size_t i;
+  int phase;
+
+  for(i = 0; i < count; i++){
+    for(phase = 0; phase < PROFILE_PHASES; phase++){
+      if(!hot[i].counts.samples[phase]){
+	continue;
+      }
+      if(hot[i].line == 0){
+	fprintf(out, "fred;%s %u\n", phaseNames[phase], hot[i].counts.samples[phase]);
+      }
+      else{
+	fprintf(out, "fred;%zu %s;%s %u\n", hot[i].line,
+		hot[i].text ? hot[i].text : "", phaseNames[phase],
+		hot[i].counts.samples[phase]);
+      }
+    }
+  }
+  return;
+}
+
+
+///Print the samples of each phase and the hottest lines, ranked by
+///  their samples, or by their executions when there are too few
+///  samples to tell lines apart
+///@param out the stream to print to
+///@param hot the lines gathered, sorted again for the ranking
+///@param count the number of lines
+///@param seconds the CPU time used while profiling, shared out among
+///  the samples since the timer only fires on clock ticks
+static void printHottest(FILE* out, Hot* hot, size_t count, double seconds){
+  size_t phases[PROFILE_PHASES] = {0};
+  size_t total = 0;
+  size_t i;
+  int phase;
+
+  for(i = 0; i < count; i++){
+    for(phase = 0; phase < PROFILE_PHASES; phase++){
+      phases[phase] += hot[i].counts.samples[phase];
+    }
+    total += hot[i].total;
+  }
+
+  fprintf(out, "Profile: %zu samples over %.3f s of CPU time", total, seconds);
+  seconds = total ? seconds / total : 0;
+  for(phase = 0; phase < PROFILE_PHASES && total; phase++){
+    fprintf(out, "%s%s %.1f%%", phase ? "  " : "\n  ", phaseNames[phase],
+	    100.0 * phases[phase] / total);
+  }
+  fprintf(out, "\n");
+  if(!count){
+    return;
+  }
+  if(total < PROFILE_MIN_SAMPLES){
+    fprintf(out, "Too few samples to rank lines by time; ranked by executions, "
+	    "a longer run gives more\n");
+    qsort(hot, count, sizeof(Hot), byExecutions);
+  }
+  else{
+    qsort(hot, count, sizeof(Hot), bySamples);
+  }
+  fprintf(out, "\n      line  executions   samples   time s    parse     eval   output  source\n");
+
+  for(i = 0; i < count && i < PROFILE_TOP; i++){
+    if(hot[i].line == 0){
+      fprintf(out, "         -           -");
+    }
+    else{
+      fprintf(out, "%10zu  %10u", hot[i].line, hot[i].counts.executions);
+    }
+    fprintf(out, "%10zu %8.3f %8u %8u %8u  %s\n", hot[i].total,
+	    hot[i].total * seconds, hot[i].counts.samples[ProfParse],
+	    hot[i].counts.samples[ProfEval], hot[i].counts.samples[ProfOutput],
+	    hot[i].line ? (hot[i].text ? hot[i].text : "") : "(outside any line)");
+  }
+  return;
+}
+
+
+///Stop taking samples, print the hottest lines and write the folded stacks
+int writeProfile(FILE* program){
+  struct itimerval timer;
+  double seconds = cpuTime() - startTime;
+  Hot* hot;
+  size_t count = 0;
+  size_t capacity;
+  size_t samples = 0;
+  size_t i;
+  int status = 0;
+
+  if(!profiling){
+    return 0;
+  }
+  memset(&timer, 0, sizeof(timer));
+  setitimer(ITIMER_PROF, &timer, NULL);
+  signal(SIGPROF, SIG_IGN);
+  profiling = 0;
+
+  //only lines with samples are kept, and the busiest others when they
+  //  are ranked by executions
+  capacity = 256;
+  hot = malloc(capacity * sizeof(Hot));
+  hot = gatherEntry(hot, &count, &capacity, 0, &outside);
+  for(i = 1; i < usedLines; i++){
+    hot = gatherEntry(hot, &count, &capacity, i, &entries[i]);
+  }
+
+  for(i = 0; i < count; i++){
+    samples += hot[i].total;
+  }
+  if(samples < PROFILE_MIN_SAMPLES){
+    hot = gatherBusiest(hot, &count, &capacity);
+  }
+
+  qsort(hot, count, sizeof(Hot), byLine);
+  readTexts(hot, count, program);
+
+  writeFolded(folded, hot, count);
+  if(fclose(folded) != 0){
+    fprintf(stderr, "Error writing the profile\n");
+    status = -1;
+  }
+
+  printHottest(stderr, hot, count, seconds);
+
+  for(i = 0; i < count; i++){
+    free(hot[i].text);
+  }
+  free(hot);
+  free(entries);
+  entries = NULL;
+  return status;
+}
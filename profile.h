@@ -0,0 +1,86 @@
+///file:profile.h
+///description:declarations for a sampling profiler that finds the
+///  lines of a Fred program that take the most time
+///author: avv8047 : Azhur Viano
+
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+
+//hottest lines printed at exit
+#define PROFILE_TOP 20
+//CPU time between samples, in microseconds; the kernel rounds it up
+//  to a clock tick
+#define PROFILE_INTERVAL 1000
+//samples a run needs before its lines are ranked by them; shorter runs
+//  have too few for the ranking to mean much, and rank lines by their
+//  exact executions instead
+#define PROFILE_MIN_SAMPLES 1000
+
+
+///What a thread is doing for a line, which samples are counted under
+typedef enum ProfilePhase_ {
+  //reading input or anything outside a statement
+  ProfOther,
+  //compiling a statement
+  ProfParse,
+  //executing a statement
+  ProfEval,
+  //echoing a line and printing from prt and display
+  ProfOutput,
+  PROFILE_PHASES
+} ProfilePhase;
+
+
+//Line and phase of a thread, read by the signal handler taking samples
+typedef struct ProfileState_ {
+  volatile size_t line;
+  volatile int phase;
+} ProfileState;
+
+extern __thread ProfileState profileState;
+//whether the profiler is running, so executions are only counted then
+extern int profiling;
+
+
+///Set the line and phase samples from this thread are counted under;
+///  a macro so it costs only two stores whether or not the profiler is
+///  running, even in unoptimized builds
+///@param lineNumber the line of the program, 0 for none
+///@param what the ProfilePhase of the thread
+#define profileAt(lineNumber, what) \
+  (profileState.line = (lineNumber), profileState.phase = (what))
+
+
+///Set the phase samples from this thread are counted under, keeping
+///  the line
+///@param what the ProfilePhase of the thread
+#define profilePhase(what) (profileState.phase = (what))
+
+
+///Start taking a sample every PROFILE_INTERVAL of CPU time
+///@param path the file to write the folded stacks to at the end
+///@returns 0 on success, -1 if the file or the timer could not be set up
+int startProfile(const char* path);
+
+
+///Count one execution of a line
+///@param line the line of the program
+void countExecution(size_t line);
+
+
+///Stop taking samples, print the hottest lines to stderr and write
+///  every sample as folded stacks for flame graph tools
+///@param program the program, read again for the text of the lines
+///  if it is a file that can be mapped
+///@returns 0 on success, -1 if the folded stacks could not be written
+int writeProfile(FILE* program);
+
+#endif
@@ -0,0 +1,190 @@
+///file:protocol.c
+///description:functions for framing messages on the fred server socket
+///author: avv8047 : Azhur Viano
+
+
+#include "protocol.h"
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+
+///Write a frame header
+void packFrameHeader(unsigned char* header, char type, uint32_t size){
+  uint32_t length = size + 1;
+
+  header[0] = (unsigned char) (length >> 24);
+  header[1] = (unsigned char) (length >> 16);
+  header[2] = (unsigned char) (length >> 8);
+  header[3] = (unsigned char) length;
+  header[4] = (unsigned char) type;
+  return;
+}
+
+
+///Read a frame header
+uint32_t unpackFrameHeader(const unsigned char* header, char* type){
+  uint32_t length = ((uint32_t) header[0] << 24) | ((uint32_t) header[1] << 16) |
+    ((uint32_t) header[2] << 8) | (uint32_t) header[3];
+
+  *type = (char) header[4];
+  //a length of 0 has no room for the type; treat it as an empty frame
+  return length ? length - 1 : 0;
+}
+
+
+///Write all of a buffer to a blocking descriptor
+///@param fd the descriptor
+///@param data the bytes to write
+///@param size the number of bytes
+///@returns 0 on success, -1 on error
+static int writeAll(int fd, const char* data, size_t size){
+  ssize_t n;
+
+  while(size){
+    n = write(fd, data, size);
+    if(n < 0 && errno == EINTR){
+      continue;
+    }
+    if(n <= 0){
+      return -1;
+    }
+    data += n;
+    size -= n;
+  }
+  return 0;
+}
+
+
+///Read exactly size bytes from a blocking descriptor
+///@param fd the descriptor
+///@param data the buffer to read into
+///@param size the number of bytes
+///@returns 0 on success, -1 on error or end of stream
+static int readAll(int fd, char* data, size_t size){
+  ssize_t n;
+
+  while(size){
+    n = read(fd, data, size);
+    if(n < 0 && errno == EINTR){
+      continue;
+    }
+    if(n <= 0){
+      return -1;
+    }
+    data += n;
+    size -= n;
+  }
+  return 0;
+}
+
+
+///Send a frame
+int sendFrame(int fd, char type, const char* payload, uint32_t size){
+  unsigned char header[FRAME_HEADER];
+
+  packFrameHeader(header, type, size);
+  if(writeAll(fd, (const char*) header, FRAME_HEADER) != 0){
+    return -1;
+  }
+  return writeAll(fd, payload, size);
+}
+
+
+///Receive a frame
+int receiveFrame(int fd, char* type, char** payload, uint32_t* size){
+  unsigned char header[FRAME_HEADER];
+
+  if(readAll(fd, (char*) header, FRAME_HEADER) != 0){
+    return -1;
+  }
+  *size = unpackFrameHeader(header, type);
+  if(*size > MAX_FRAME){
+    return -1;
+  }
+
+  *payload = malloc(*size + 1);
+  if(readAll(fd, *payload, *size) != 0){
+    free(*payload);
+    return -1;
+  }
+  (*payload)[*size] = '\0';
+  return 0;
+}
+
+
+///Send an empty frame and descriptors
+int sendFds(int fd, char type, const int* fds, int count){
+  unsigned char header[FRAME_HEADER];
+  char control[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+  struct iovec iov;
+  struct msghdr message;
+  struct cmsghdr* cmsg;
+  ssize_t n;
+
+  packFrameHeader(header, type, 0);
+  iov.iov_base = header;
+  iov.iov_len = FRAME_HEADER;
+
+  memset(&message, 0, sizeof(message));
+  memset(control, 0, sizeof(control));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+  cmsg = CMSG_FIRSTHDR(&message);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(int) * count);
+
+  do{
+    n = sendmsg(fd, &message, 0);
+  }while(n < 0 && errno == EINTR);
+
+  return n == FRAME_HEADER ? 0 : -1;
+}
+
+
+///Receive an empty frame and descriptors
+int receiveFds(int fd, char* type, int* fds){
+  unsigned char header[FRAME_HEADER];
+  char control[CMSG_SPACE(sizeof(int) * MAX_FDS)];
+  struct iovec iov;
+  struct msghdr message;
+  struct cmsghdr* cmsg;
+  ssize_t n;
+  int count = 0;
+
+  iov.iov_base = header;
+  iov.iov_len = FRAME_HEADER;
+
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control;
+  message.msg_controllen = sizeof(control);
+
+  do{
+    n = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+  }while(n < 0 && errno == EINTR);
+
+  for(cmsg = CMSG_FIRSTHDR(&message); n > 0 && cmsg;
+      cmsg = CMSG_NXTHDR(&message, cmsg)){
+    if(cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS){
+      count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(int) * count);
+    }
+  }
+
+  if(n != FRAME_HEADER || unpackFrameHeader(header, type) != 0 ||
+     (message.msg_flags & MSG_CTRUNC)){
+    while(count > 0){
+      close(fds[--count]);
+    }
+    return -1;
+  }
+  return count;
+}
@@ -0,0 +1,97 @@
+///file:protocol.h
+///description:the length-prefixed protocol spoken over the fred
+///  server socket
+///author: avv8047 : Azhur Viano
+///
+///Every message is a frame: a 4 byte length in network byte order,
+///  then a 1 byte type, then length - 1 bytes of payload.
+///Requests:
+///  'S' statements: one or more lines of Fred, executed in order
+///  'D' dump: print the session's symbol table
+///Responses, one per request:
+///  'O' the output of the prt, display and dump statements
+///  'E' an error message; the server closes the connection after it
+///
+///The fork server takes one request per connection:
+///  'R' run: an empty frame carrying the client's stdin, stdout and
+///      stderr descriptors, and optionally a program file descriptor,
+///      as SCM_RIGHTS
+///and answers, once the program has finished, with
+///  'X' exit: the exit status of the run as a decimal string
+
+
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stdlib.h>
+
+//frame types
+#define FRAME_STATEMENTS 'S'
+#define FRAME_DUMP 'D'
+#define FRAME_OUTPUT 'O'
+#define FRAME_ERROR 'E'
+#define FRAME_RUN 'R'
+#define FRAME_EXIT 'X'
+
+//size of the frame header: length and type
+#define FRAME_HEADER 5
+//largest payload accepted in a frame
+#define MAX_FRAME (16 * 1024 * 1024)
+//most descriptors passed with a frame
+#define MAX_FDS 4
+
+
+///Write the header of a frame into a buffer
+///@param header the buffer, at least FRAME_HEADER bytes
+///@param type the frame type
+///@param size the size of the payload
+void packFrameHeader(unsigned char* header, char type, uint32_t size);
+
+
+///Read the header of a frame from a buffer
+///@param header the buffer, at least FRAME_HEADER bytes
+///@param type set to the frame type
+///@returns the size of the payload
+uint32_t unpackFrameHeader(const unsigned char* header, char* type);
+
+
+///Send a frame on a blocking socket
+///@param fd the socket
+///@param type the frame type
+///@param payload the payload
+///@param size the size of the payload
+///@returns 0 on success, -1 on error
+int sendFrame(int fd, char type, const char* payload, uint32_t size);
+
+
+///Receive a frame from a blocking socket
+///@param fd the socket
+///@param type set to the frame type
+///@param payload set to the payload, dynamically allocated and null
+///  terminated
+///@param size set to the size of the payload
+///@returns 0 on success, -1 on error or end of stream
+int receiveFrame(int fd, char* type, char** payload, uint32_t* size);
+
+
+///Send an empty frame with descriptors attached
+///@param fd the Unix domain socket
+///@param type the frame type
+///@param fds the descriptors to pass
+///@param count the number of descriptors, at most MAX_FDS
+///@returns 0 on success, -1 on error
+int sendFds(int fd, char type, const int* fds, int count);
+
+
+///Receive an empty frame with descriptors attached
+///@param fd the Unix domain socket
+///@param type set to the frame type
+///@param fds filled with the descriptors received, room for MAX_FDS
+///@returns the number of descriptors received, or -1 on error
+int receiveFds(int fd, char* type, int* fds);
+
+#endif
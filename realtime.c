@@ -0,0 +1,263 @@
+///file:realtime.c
+///description:realtime mode, which runs statements without using the
+///  heap or faulting in pages, and a histogram of the time each
+///  statement takes in the manner of HdrHistogram
+///author: avv8047 : Azhur Viano
+
+
+#include "realtime.h"
+#include "diagnostics.h"
+#include "evaluate.h"
+#include "memstats.h"
+#include "processor.h"
+#include "reduce.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+//values below 1 << LATENCY_BITS nanoseconds have a bucket each; above
+//  that each power of 2 is split into 1 << (LATENCY_BITS - 1) buckets,
+//  so a time is recorded to within 1/64 of it
+#define LATENCY_BITS 7
+#define LATENCY_HALF (1 << (LATENCY_BITS - 1))
+#define LATENCY_BUCKETS ((64 - LATENCY_BITS + 2) * LATENCY_HALF)
+//bytes reserved for each symbol in the table, its slab and index
+#define SYMBOL_BYTES 64
+//size of the buffers of the streams
+#define STREAM_BUFFER 65536
+
+
+int realtime = 0;
+
+//limits the mode was started with
+static RealtimeLimits active;
+//bytes the pools must have left for a line to run
+static size_t statementReserve;
+//bytes reserved for the pools
+static size_t reserved;
+
+//statements recorded in each bucket
+static uint64_t buckets[LATENCY_BUCKETS];
+static uint64_t recorded;
+static long long fastest = -1;
+static long long slowest;
+static long double totalTime;
+
+static char outputBuffer[STREAM_BUFFER];
+static char inputBuffer[STREAM_BUFFER];
+
+
+//Set the limits from a list
+int parseRealtimeLimits(const char* spec, RealtimeLimits* limits){
+  char* copy;
+  char* item;
+  char* value;
+  char* end;
+  char* save = NULL;
+  unsigned long long number;
+  int valid = 1;
+
+  limits->symbols = 65536;
+  limits->tokens = 256;
+  limits->depth = 64;
+  limits->line = 1024;
+  limits->memory = 64;
+  if(!spec){
+    return 1;
+  }
+
+  copy = strdup(spec);
+  for(item = strtok_r(copy, ",", &save); item && valid; item = strtok_r(NULL, ",", &save)){
+    value = strchr(item, '=');
+    if(!value){
+      valid = 0;
+      break;
+    }
+    *value++ = '\0';
+    number = strtoull(value, &end, 10);
+    valid = *value && !*end && number > 0 && number <= (1ULL << 30);
+    if(strcmp(item, "symbols") == 0){
+      limits->symbols = number;
+    }
+    else if(strcmp(item, "tokens") == 0){
+      limits->tokens = number;
+    }
+    else if(strcmp(item, "depth") == 0){
+      limits->depth = number;
+    }
+    else if(strcmp(item, "line") == 0){
+      limits->line = number;
+    }
+    else if(strcmp(item, "memory") == 0){
+      limits->memory = number;
+    }
+    else{
+      valid = 0;
+    }
+  }
+  free(copy);
+  return valid;
+}
+
+
+//Enter realtime mode
+int startRealtime(const RealtimeLimits* limits, size_t tableSize, FILE* input){
+  size_t symbolBytes = limits->symbols * SYMBOL_BYTES;
+
+  active = *limits;
+  reserved = limits->memory << 20;
+  //a statement keeps its text a few times over, and each token is
+  //  kept in the postfix, the list it is built in, the stack it is
+  //  evaluated on, and its bound symbol and version; blocks are
+  //  rounded up to powers of 2
+  statementReserve = 2 * (16 * limits->line + 128 * limits->tokens) + 65536;
+
+  if(tableSize > limits->symbols){
+    fprintf(stderr, "The symbol file has more than %zu symbols\n", limits->symbols);
+    return 0;
+  }
+  if(reserved < symbolBytes + 2 * statementReserve){
+    fprintf(stderr, "Realtime memory must be at least %zu MB for these limits\n",
+	    ((symbolBytes + 2 * statementReserve) >> 20) + 1);
+    return 0;
+  }
+  if(!reservePools(reserved)){
+    fprintf(stderr, "Could not reserve %zu MB for realtime pools\n", limits->memory);
+    return 0;
+  }
+  setExpressionLimits(limits->tokens, limits->depth);
+  setSymbolLimit(limits->symbols);
+
+  //stdio would allocate the buffers on first use
+  setvbuf(stdout, outputBuffer, isatty(STDOUT_FILENO) ? _IOLBF : _IOFBF,
+	  sizeof(outputBuffer));
+  if(input){
+    setvbuf(input, inputBuffer, _IOFBF, sizeof(inputBuffer));
+  }
+  startReducers();
+
+  if(mlockall(MCL_CURRENT | MCL_FUTURE) != 0){
+    fprintf(stderr, "Could not lock memory (%s); running without it\n", strerror(errno));
+  }
+  realtime = 1;
+  return 1;
+}
+
+
+//Check that a line can run
+int admitLine(size_t length, size_t tableSize){
+  //room is kept for the symbols the table can still grow by
+  size_t needed = statementReserve + (active.symbols - tableSize) * SYMBOL_BYTES;
+
+  if(length > active.line){
+    diagnose(DiagPoolExhausted, "Error: line longer than %zu characters\n", active.line);
+    return 0;
+  }
+  if(poolAvailable() < needed){
+    diagnose(DiagPoolExhausted, "Error: realtime pools exhausted; %zu of %zu MB used\n",
+	     (reserved - poolAvailable()) >> 20, active.memory);
+    return 0;
+  }
+  return 1;
+}
+
+
+//Get the time from a monotonic clock
+long long realtimeClock(void){
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+
+///Find the bucket of a time
+///@param value the time in nanoseconds
+///@returns the index of the bucket
+static size_t bucketOf(uint64_t value){
+  int shift;
+
+  if(value < (1 << LATENCY_BITS)){
+    return value;
+  }
+  shift = 64 - __builtin_clzll(value) - LATENCY_BITS;
+  return ((size_t) shift << (LATENCY_BITS - 1)) + (value >> shift);
+}
+
+
+///Get the highest time recorded in a bucket
+///@param index the index of the bucket
+///@returns the time in nanoseconds
+static uint64_t highestIn(size_t index){
+  int shift;
+
+  if(index < (1 << LATENCY_BITS)){
+    return index;
+  }
+  shift = index / LATENCY_HALF - 1;
+  return (((uint64_t) (index - shift * LATENCY_HALF) + 1) << shift) - 1;
+}
+
+
+//Record the time a statement took
+void recordLatency(long long nanoseconds){
+  if(nanoseconds < 0){
+    nanoseconds = 0;
+  }
+  buckets[bucketOf(nanoseconds)]++;
+  recorded++;
+  totalTime += nanoseconds;
+  if(fastest < 0 || nanoseconds < fastest){
+    fastest = nanoseconds;
+  }
+  if(nanoseconds > slowest){
+    slowest = nanoseconds;
+  }
+  return;
+}
+
+
+///Find the time at a percentile of the histogram
+///@param percentile from 0 to 100
+///@returns the highest time in the bucket it falls in, at most the
+///  slowest time recorded
+static long long valueAt(double percentile){
+  uint64_t target = (uint64_t) (percentile / 100.0 * recorded + 0.5);
+  uint64_t seen = 0;
+  size_t i;
+
+  if(target < 1){
+    target = 1;
+  }
+  for(i = 0; i < LATENCY_BUCKETS; i++){
+    seen += buckets[i];
+    if(seen >= target){
+      return (long long) highestIn(i) < slowest ? (long long) highestIn(i) : slowest;
+    }
+  }
+  return slowest;
+}
+
+
+//Print the histogram
+void printLatency(FILE* out){
+  static const double percentiles[] = {50, 90, 99, 99.9, 99.99};
+  size_t i;
+
+  fprintf(out, "Statement latency: %llu statements, mean %.0f ns\n",
+	  (unsigned long long) recorded, recorded ? (double) (totalTime / recorded) : 0.0);
+  if(recorded){
+    fprintf(out, "  min     %12lld ns\n", fastest);
+    for(i = 0; i < sizeof(percentiles) / sizeof(percentiles[0]); i++){
+      fprintf(out, "  p%-6g %12lld ns\n", percentiles[i], valueAt(percentiles[i]));
+    }
+    fprintf(out, "  max     %12lld ns\n", slowest);
+  }
+  fprintf(out, "Realtime pools: %zu of %zu bytes used\n", reserved - poolAvailable(),
+	  reserved);
+  return;
+}
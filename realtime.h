@@ -0,0 +1,81 @@
+///file:realtime.h
+///description:declarations for running statements with every pool
+///  reserved up front, memory locked, and a histogram of the time
+///  each statement takes
+///author: avv8047 : Azhur Viano
+
+
+#ifndef REALTIME_H
+#define REALTIME_H
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stddef.h>
+
+
+//Maximums the pools are reserved for
+typedef struct RealtimeLimits_ {
+  //symbols in the table, counting those of the symbol file
+  size_t symbols;
+  //postfix tokens of an expression
+  size_t tokens;
+  //values on the stack while evaluating an expression
+  size_t depth;
+  //characters of a line of the program
+  size_t line;
+  //megabytes reserved for everything allocated while running
+  size_t memory;
+} RealtimeLimits;
+
+
+//whether statements run in realtime mode
+extern int realtime;
+
+
+///Set limits to their defaults, then to those given as a comma
+///  separated list such as symbols=1000,tokens=64,depth=16,line=256,
+///  memory=32
+///@param spec the list, or NULL for the defaults
+///@param limits set to the limits
+///@returns 1 on success, 0 if the list is not valid
+int parseRealtimeLimits(const char* spec, RealtimeLimits* limits);
+
+
+///Enter realtime mode once start-up is done: reserve the pools, limit
+///  the sizes of statements, give the streams buffers of their own,
+///  start the threads of reductions and lock the memory of the process
+///@param limits the limits
+///@param tableSize the symbols already in the table
+///@param input the program input
+///@returns 1 on success, 0 if the pools could not be reserved
+int startRealtime(const RealtimeLimits* limits, size_t tableSize, FILE* input);
+
+
+///Check that a line can run: it is no longer than the limit and the
+///  pools have room for the largest statement and for the symbols not
+///  yet defined. Errors are reported with diagnose
+///@param length the length of the line
+///@param tableSize the symbols in the table
+///@returns 1 if it can run, 0 otherwise
+int admitLine(size_t length, size_t tableSize);
+
+
+///Get the time from a monotonic clock
+///@returns the time in nanoseconds
+long long realtimeClock(void);
+
+
+///Record the time a statement took in the histogram
+///@param nanoseconds the time
+void recordLatency(long long nanoseconds);
+
+
+///Print the percentiles of the histogram and the memory of the pools
+///  used
+///@param out the stream to print to
+void printLatency(FILE* out);
+
+#endif
@@ -0,0 +1,580 @@
+///file:reduce.c
+///description:arrays of numbers and the reductions and scans over
+///  them. An array is split into chunks of REDUCE_CHUNK values that a
+///  pool of threads reduces with the vector kernels, and the results
+///  of the chunks are combined in a fixed tree
+///author: avv8047 : Azhur Viano
+
+
+#include "reduce.h"
+#include "diagnostics.h"
+#include "memstats.h"
+#include "vector.h"
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+
+
+//A reduction or scan split into chunks
+typedef struct Job_ {
+  ReduceKind kind;
+  const NumericArray* a;
+  //second array of a dot product, or NULL
+  const NumericArray* b;
+  //type the values are combined as
+  Type type;
+  //result of each chunk; for the second pass of a scan, the sum of
+  //  the values before each chunk
+  Value* partials;
+  //array written by the second pass of a scan, NULL otherwise
+  NumericArray* out;
+  //work run for each chunk in place of a reduction, or NULL
+  ChunkWork work;
+  void* data;
+  size_t chunks;
+  //next chunk to be taken by a thread
+  size_t next;
+} Job;
+
+
+//names the reductions are called by
+static const char* reductionNames[] = {
+  [ReduceSum] = "sum",
+  [ReduceMin] = "min",
+  [ReduceMax] = "max",
+  [ReduceDot] = "dot",
+  [ReducePrefixSum] = "prefix_sum",
+};
+
+//every array created, indexed by the value of its symbols; the arrays
+//  are allocated one at a time so they do not move as more are added
+static NumericArray** arrays;
+static size_t arrayCount;
+static size_t arrayCapacity;
+
+//kernels for the instruction set of the processor
+static const Kernels* kernels;
+
+//threads reductions use, counting the one executing statements; 0
+//  until it is set or first needed
+static int threadLimit;
+static pthread_once_t limitOnce = PTHREAD_ONCE_INIT;
+//threads started besides the one executing statements
+static pthread_t reducers[MAX_REDUCERS];
+static int reducerCount;
+//wakes the threads for each job, and tells when they are done with it
+static pthread_mutex_t poolLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t poolStart = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t poolIdle = PTHREAD_COND_INITIALIZER;
+//number of the job posted last, and the job while threads may join it
+static unsigned long generation;
+static Job* currentJob;
+//threads that joined the current job and have not finished with it
+static int active;
+static int stopping;
+//held while a job runs, since the pool runs one at a time
+static pthread_mutex_t jobLock = PTHREAD_MUTEX_INITIALIZER;
+static int forkHandled;
+
+
+//Create an array of zeros
+int createArray(Type type, size_t length){
+  NumericArray** grown;
+  NumericArray* array;
+  Value* values;
+
+  if(length > MAX_ARRAY_LENGTH){
+    return -1;
+  }
+  if(arrayCount == arrayCapacity){
+    grown = memRealloc(MemArrays, arrays, sizeof(NumericArray*) *
+		       (arrayCapacity ? arrayCapacity * 2 : 16));
+    if(!grown){
+      return -1;
+    }
+    arrays = grown;
+    arrayCapacity = arrayCapacity ? arrayCapacity * 2 : 16;
+  }
+
+  //the memory can run out when it is reserved up front
+  array = memAlloc(MemArrays, sizeof(NumericArray));
+  values = memAlloc(MemArrays, sizeof(Value) * (length + 1));
+  if(!array || !values){
+    memFree(array);
+    memFree(values);
+    return -1;
+  }
+  array->type = type;
+  array->length = length;
+  array->values = values;
+  memset(array->values, 0, sizeof(Value) * length);
+  arrays[arrayCount] = array;
+  return (int) arrayCount++;
+}
+
+
+//Get an array
+NumericArray* getArray(int index){
+  return arrays[index];
+}
+
+
+//Stop the threads of the pool
+static void stopReducers(void){
+  int i;
+
+  pthread_mutex_lock(&poolLock);
+  stopping = 1;
+  pthread_cond_broadcast(&poolStart);
+  pthread_mutex_unlock(&poolLock);
+  for(i = 0; i < reducerCount; i++){
+    pthread_join(reducers[i], NULL);
+  }
+  reducerCount = 0;
+  stopping = 0;
+  return;
+}
+
+
+//Free every array
+void clearArrays(void){
+  size_t i;
+
+  stopReducers();
+  for(i = 0; i < arrayCount; i++){
+    memFree(arrays[i]->values);
+    memFree(arrays[i]);
+  }
+  memFree(arrays);
+  arrays = NULL;
+  arrayCount = 0;
+  arrayCapacity = 0;
+  return;
+}
+
+
+//Set the number of threads reductions use
+void setReduceThreads(int threads){
+  threadLimit = threads;
+  return;
+}
+
+
+//Find a built-in reduction by name
+int findReduction(const char* name){
+  size_t i;
+
+  for(i = 0; i < sizeof(reductionNames) / sizeof(reductionNames[0]); i++){
+    if(strcmp(name, reductionNames[i]) == 0){
+      return (int) i;
+    }
+  }
+  return -1;
+}
+
+
+//Get the number of arrays a reduction takes
+int reductionArity(ReduceKind kind){
+  return kind == ReduceDot ? 2 : 1;
+}
+
+
+///Combine two partial results of a reduction
+///@param kind the reduction; a scan or dot product adds
+///@param type the type of the values
+///@param x the first partial result
+///@param y the second partial result
+///@returns the combined result
+static Value combine(ReduceKind kind, Type type, Value x, Value y){
+  switch(kind){
+  case ReduceMin:
+    if(type == Integer){
+      minIntStep(x, y);
+    }
+    else{
+      minFloatStep(x, y);
+    }
+    break;
+  case ReduceMax:
+    if(type == Integer){
+      maxIntStep(x, y);
+    }
+    else{
+      maxFloatStep(x, y);
+    }
+    break;
+  default:
+    if(type == Integer){
+      addIntStep(x, y);
+    }
+    else{
+      addFloatStep(x, y);
+    }
+  }
+  return x;
+}
+
+
+///Get the kernel folding one array for a reduction
+///@param kind the reduction, other than a dot product
+///@param type the type of the values
+///@returns the kernel
+static FoldKernel foldKernel(ReduceKind kind, Type type){
+  switch(kind){
+  case ReduceMin:
+    return type == Integer ? kernels->minInt : kernels->minFloat;
+  case ReduceMax:
+    return type == Integer ? kernels->maxInt : kernels->maxFloat;
+  default:
+    return type == Integer ? kernels->sumInt : kernels->sumFloat;
+  }
+}
+
+
+///Convert integers to floats
+///@param out set to the floats
+///@param in the integers
+///@param n the number of values
+///@returns out
+static const Value* convertChunk(Value* out, const Value* in, size_t n){
+  size_t whole = n - n % VECTOR_LANES;
+  size_t i;
+
+  kernels->toFloat(out, in, whole);
+  for(i = whole; i < n; i++){
+    out[i].fVal = (float) in[i].iVal;
+  }
+  return out;
+}
+
+
+///Reduce one chunk: the kernel folds the values into VECTOR_LANES
+///  partial results, the values after the last whole step are folded
+///  into them the same way, and the lanes are combined in a tree
+///@param job the job
+///@param chunk the index of the chunk
+///@returns the result of the chunk
+static Value reduceChunk(const Job* job, size_t chunk){
+  size_t first = chunk * REDUCE_CHUNK;
+  size_t n = job->a->length - first < REDUCE_CHUNK ? job->a->length - first : REDUCE_CHUNK;
+  size_t whole = n - n % VECTOR_LANES;
+  const Value* a = job->a->values + first;
+  const Value* b = job->b ? job->b->values + first : NULL;
+  //a dot product of integers and reals is taken as reals
+  Value converted[REDUCE_CHUNK];
+  Value lanes[VECTOR_LANES];
+  Value product;
+  size_t width;
+  size_t i;
+
+  if(job->type == Float && job->a->type == Integer){
+    a = convertChunk(converted, a, n);
+  }
+  else if(b && job->type == Float && job->b->type == Integer){
+    b = convertChunk(converted, b, n);
+  }
+
+  for(i = 0; i < VECTOR_LANES; i++){
+    if(job->kind == ReduceMin || job->kind == ReduceMax){
+      lanes[i] = a[0];
+    }
+    else if(job->type == Integer){
+      lanes[i].iVal = 0;
+    }
+    else{
+      lanes[i].fVal = 0.0f;
+    }
+  }
+
+  if(b && job->type == Integer){
+    kernels->dotInt(lanes, a, b, whole);
+    for(i = whole; i < n; i++){
+      product.iVal = (int) ((unsigned) a[i].iVal * (unsigned) b[i].iVal);
+      addIntStep(lanes[i % VECTOR_LANES], product);
+    }
+  }
+  else if(b){
+    kernels->dotFloat(lanes, a, b, whole);
+    for(i = whole; i < n; i++){
+      product.fVal = a[i].fVal * b[i].fVal;
+      addFloatStep(lanes[i % VECTOR_LANES], product);
+    }
+  }
+  else{
+    foldKernel(job->kind, job->type)(lanes, a, whole);
+    for(i = whole; i < n; i++){
+      lanes[i % VECTOR_LANES] = combine(job->kind, job->type, lanes[i % VECTOR_LANES], a[i]);
+    }
+  }
+
+  for(width = VECTOR_LANES / 2; width > 0; width /= 2){
+    for(i = 0; i < width; i++){
+      lanes[i] = combine(job->kind, job->type, lanes[i], lanes[i + width]);
+    }
+  }
+  return lanes[0];
+}
+
+
+///Write the running sums of one chunk, starting from the sum of the
+///  values before it
+///@param job the job
+///@param chunk the index of the chunk
+static void scanChunk(const Job* job, size_t chunk){
+  size_t first = chunk * REDUCE_CHUNK;
+  size_t n = job->a->length - first < REDUCE_CHUNK ? job->a->length - first : REDUCE_CHUNK;
+  const Value* in = job->a->values + first;
+  Value* out = job->out->values + first;
+  Value sum = job->partials[chunk];
+  size_t i;
+
+  if(job->type == Integer){
+    for(i = 0; i < n; i++){
+      addIntStep(sum, in[i]);
+      out[i] = sum;
+    }
+  }
+  else{
+    for(i = 0; i < n; i++){
+      addFloatStep(sum, in[i]);
+      out[i] = sum;
+    }
+  }
+  return;
+}
+
+
+///Take chunks of a job until there are none left
+///@param job the job
+static void runChunks(Job* job){
+  size_t chunk;
+
+  while((chunk = __atomic_fetch_add(&job->next, 1, __ATOMIC_RELAXED)) < job->chunks){
+    if(job->work){
+      job->work(job->data, chunk);
+    }
+    else if(job->out){
+      scanChunk(job, chunk);
+    }
+    else{
+      job->partials[chunk] = reduceChunk(job, chunk);
+    }
+  }
+  return;
+}
+
+
+///Run the chunks of each job as it is posted, until the pool stops
+///@param arg unused
+///@returns NULL
+static void* reducerMain(void* arg){
+  unsigned long seen = 0;
+  Job* job;
+
+  (void) arg;
+  pthread_mutex_lock(&poolLock);
+  for(;;){
+    while(!stopping && (!currentJob || generation == seen)){
+      pthread_cond_wait(&poolStart, &poolLock);
+    }
+    if(stopping){
+      break;
+    }
+    seen = generation;
+    job = currentJob;
+    active++;
+    pthread_mutex_unlock(&poolLock);
+
+    runChunks(job);
+
+    pthread_mutex_lock(&poolLock);
+    if(--active == 0){
+      pthread_cond_signal(&poolIdle);
+    }
+  }
+  pthread_mutex_unlock(&poolLock);
+  return NULL;
+}
+
+
+///The threads of the pool are not copied by fork, so a child starts
+///  its own
+static void forgetReducers(void){
+  pthread_mutex_init(&poolLock, NULL);
+  pthread_mutex_init(&jobLock, NULL);
+  pthread_cond_init(&poolStart, NULL);
+  pthread_cond_init(&poolIdle, NULL);
+  reducerCount = 0;
+  currentJob = NULL;
+  active = 0;
+  return;
+}
+
+
+///Use a thread per processor unless the number was set
+static void defaultThreads(void){
+  long processors;
+
+  if(!threadLimit){
+    processors = sysconf(_SC_NPROCESSORS_ONLN);
+    threadLimit = processors < 1 ? 1 : processors > MAX_REDUCERS ? MAX_REDUCERS : (int) processors;
+  }
+  return;
+}
+
+
+//Get the number of threads reductions use
+int reduceThreads(void){
+  //threads evaluating expressions may ask at the same time
+  pthread_once(&limitOnce, defaultThreads);
+  return threadLimit;
+}
+
+
+//Start the threads reductions use
+void startReducers(void){
+  reduceThreads();
+  if(!forkHandled){
+    pthread_atfork(NULL, NULL, forgetReducers);
+    forkHandled = 1;
+  }
+  while(reducerCount < threadLimit - 1 &&
+	pthread_create(&reducers[reducerCount], NULL, reducerMain, NULL) == 0){
+    reducerCount++;
+  }
+  return;
+}
+
+
+///Run the chunks of a job, on the pool if there is more than one
+///@param job the job
+static void runJob(Job* job){
+  job->next = 0;
+  if(job->chunks > 1 && threadLimit != 1){
+    startReducers();
+  }
+  if(job->chunks < 2 || !reducerCount){
+    runChunks(job);
+    return;
+  }
+
+  pthread_mutex_lock(&poolLock);
+  currentJob = job;
+  generation++;
+  pthread_cond_broadcast(&poolStart);
+  pthread_mutex_unlock(&poolLock);
+
+  runChunks(job);
+
+  //every chunk has been taken; wait for the threads still running one
+  pthread_mutex_lock(&poolLock);
+  currentJob = NULL;
+  while(active){
+    pthread_cond_wait(&poolIdle, &poolLock);
+  }
+  pthread_mutex_unlock(&poolLock);
+  return;
+}
+
+
+//Run work split into chunks on the threads of the reductions
+int shareChunks(size_t chunks, ChunkWork work, void* data){
+  Job job;
+
+  if(chunks < 2 || reduceThreads() == 1 || pthread_mutex_trylock(&jobLock) != 0){
+    return 0;
+  }
+  startReducers();
+  if(!reducerCount){
+    pthread_mutex_unlock(&jobLock);
+    return 0;
+  }
+  memset(&job, 0, sizeof(job));
+  job.work = work;
+  job.data = data;
+  job.chunks = chunks;
+  runJob(&job);
+  pthread_mutex_unlock(&jobLock);
+  return 1;
+}
+
+
+//Reduce or scan arrays
+int reduceArrays(ReduceKind kind, int a, int b, Type* type, Value* result){
+  Job job;
+  Value sum;
+  Value total;
+  size_t step;
+  size_t i;
+  int index = -1;
+
+  job.kind = kind;
+  job.a = arrays[a];
+  job.b = kind == ReduceDot ? arrays[b] : NULL;
+  job.type = (job.a->type == Float || (job.b && job.b->type == Float)) ? Float : Integer;
+  job.out = NULL;
+  job.work = NULL;
+  job.chunks = (job.a->length + REDUCE_CHUNK - 1) / REDUCE_CHUNK;
+
+  if((kind == ReduceMin || kind == ReduceMax) && !job.a->length){
+    diagnose(DiagBadExpression, "Error: %s of an empty array\n", reductionNames[kind]);
+    return 0;
+  }
+  if(job.b && job.b->length != job.a->length){
+    diagnose(DiagBadExpression, "Error: dot of arrays of %zu and %zu values\n",
+	     job.a->length, job.b->length);
+    return 0;
+  }
+  if(!kernels){
+    kernels = selectKernels(NULL);
+  }
+
+  job.partials = memAlloc(MemArrays, sizeof(Value) * (job.chunks + 1));
+  if(!job.partials){
+    diagnose(DiagPoolExhausted, "Error: no memory left to reduce an array\n");
+    return 0;
+  }
+  pthread_mutex_lock(&jobLock);
+  runJob(&job);
+  pthread_mutex_unlock(&jobLock);
+
+  if(kind == ReducePrefixSum){
+    //each chunk starts from the sum of the chunks before it
+    memset(&sum, 0, sizeof(sum));
+    for(i = 0; i < job.chunks; i++){
+      total = job.partials[i];
+      job.partials[i] = sum;
+      sum = combine(kind, job.type, sum, total);
+    }
+    index = createArray(job.type, job.a->length);
+    if(index < 0){
+      diagnose(DiagPoolExhausted, "Error: no memory left for the result of prefix_sum\n");
+      memFree(job.partials);
+      return 0;
+    }
+    job.out = arrays[index];
+    pthread_mutex_lock(&jobLock);
+    runJob(&job);
+    pthread_mutex_unlock(&jobLock);
+    *type = Array;
+    result->iVal = index;
+  }
+  else{
+    //combine the chunks pairwise, so the tree only depends on the length
+    for(step = 1; step < job.chunks; step *= 2){
+      for(i = 0; i + step < job.chunks; i += 2 * step){
+	job.partials[i] = combine(kind, job.type, job.partials[i], job.partials[i + step]);
+      }
+    }
+    *type = job.type;
+    if(job.chunks){
+      *result = job.partials[0];
+    }
+    else{
+      memset(result, 0, sizeof(Value));
+    }
+  }
+
+  memFree(job.partials);
+  return 1;
+}
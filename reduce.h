@@ -0,0 +1,114 @@
+///file:reduce.h
+///description:declarations for arrays of numbers and the reductions
+///  and scans over them, run in chunks on a pool of threads
+///author: avv8047 : Azhur Viano
+
+
+#ifndef REDUCE_H
+#define REDUCE_H
+
+#include "symbolTable.h"
+
+//values each thread takes at a time; 64KB of them, so that a chunk
+//  stays in the cache while it is reduced
+#define REDUCE_CHUNK 16384
+//most threads reductions can use
+#define MAX_REDUCERS 64
+//most values an array can have
+#define MAX_ARRAY_LENGTH (1 << 30)
+
+
+//Work done one chunk at a time, by whichever thread takes the chunk
+typedef void (*ChunkWork)(void* data, size_t chunk);
+
+
+//Built-in reductions and scans called from expressions
+typedef enum ReduceKind_ {
+  ReduceSum, ReduceMin, ReduceMax, ReduceDot, ReducePrefixSum
+} ReduceKind;
+
+
+//An array of integers or reals. Arrays are never changed once they
+//  are filled, so tables, snapshots and forks share them freely
+typedef struct NumericArray_ {
+  //type of the values, Integer or Float
+  Type type;
+  size_t length;
+  Value* values;
+} NumericArray;
+
+
+///Create an array of zeros. Must only be called by the thread
+///  executing statements
+///@param type the type of the values, Integer or Float
+///@param length the number of values, at most MAX_ARRAY_LENGTH
+///@returns the number of the array, used as the value of its symbol,
+///  or -1 if it is too long or there is no memory left for it
+int createArray(Type type, size_t length);
+
+
+///Get an array
+///@param index the number from createArray
+///@returns the array
+NumericArray* getArray(int index);
+
+
+///Free every array and stop the threads of the reductions; symbols of
+///  arrays must not be used afterwards
+void clearArrays(void);
+
+
+///Set the number of threads reductions use, counting the thread
+///  executing statements; by default it is the number of processors
+///@param threads from 1 to MAX_REDUCERS
+void setReduceThreads(int threads);
+
+
+///Get the number of threads reductions use, counting the thread
+///  executing statements
+///@returns the number set, or else the number of processors
+int reduceThreads(void);
+
+
+///Start the threads reductions use now rather than with the first
+///  reduction that needs them
+void startReducers(void);
+
+
+///Run work split into chunks on the threads of the reductions, with
+///  the calling thread taking chunks as well. Any thread may call it;
+///  the work is left to the caller when there is only one thread or
+///  the pool is busy with other work
+///@param chunks the number of chunks
+///@param work run once for each chunk, from 0 to chunks - 1
+///@param data passed to work
+///@returns 1 if every chunk was run, 0 if none was
+int shareChunks(size_t chunks, ChunkWork work, void* data);
+
+
+///Find a built-in reduction by name
+///@param name the name it is called by
+///@returns the reduction, or -1 if there is none by that name
+int findReduction(const char* name);
+
+
+///Get the number of arrays a reduction takes
+///@param kind the reduction
+///@returns 1 or 2
+int reductionArity(ReduceKind kind);
+
+
+///Reduce or scan arrays. Sums and dot products of integers wrap on
+///  overflow. Floats are added in a tree whose shape only depends on
+///  the length, so the result does not depend on the number of
+///  threads. Errors are reported with diagnose
+///@param kind the reduction
+///@param a the number of the first array
+///@param b the number of the second array of a dot product
+///@param type set to the type of the result; Array for a scan
+///@param result set to the result; the number of the new array for
+///  a scan
+///@returns 1 on success, 0 on error
+int reduceArrays(ReduceKind kind, int a, int b, Type* type, Value* result);
+
+#endif
@@ -0,0 +1,102 @@
+///file:ring.c
+///description: lock-free single-producer, single-consumer ring buffer
+///author: avv8047 : Azhur Viano
+
+
+#include "ring.h"
+#include <sched.h>
+
+//times to spin on a full or empty ring before yielding the processor
+#define SPIN_LIMIT 64
+
+
+///Create a new ring
+Ring* CreateRing(size_t capacity){
+  Ring* ring = malloc(sizeof(Ring));
+  size_t size = 1;
+
+  while(size < capacity){
+    size *= 2;
+  }
+
+  ring->slots = malloc(sizeof(void*) * size);
+  ring->mask = size - 1;
+  ring->head = 0;
+  ring->tail = 0;
+
+  return ring;
+}
+
+
+///Destroy a ring
+void DestroyRing(Ring* ring){
+  free(ring->slots);
+  free(ring);
+  return;
+}
+
+
+///Push without waiting
+int TryPushRing(Ring* ring, void* data){
+  size_t tail = ring->tail;
+  size_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+  if(tail - head > ring->mask){
+    return 0;
+  }
+
+  ring->slots[tail & ring->mask] = data;
+  //publish the slot before the new tail
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+  return 1;
+}
+
+
+///Pop without waiting
+void* TryPopRing(Ring* ring){
+  size_t head = ring->head;
+  size_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  void* data;
+
+  if(head == tail){
+    return NULL;
+  }
+
+  data = ring->slots[head & ring->mask];
+  //release the slot only after it has been read
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+  return data;
+}
+
+
+///Push, waiting for space
+void PushRing(Ring* ring, void* data){
+  int spins = 0;
+
+  while(!TryPushRing(ring, data)){
+    if(++spins >= SPIN_LIMIT){
+      sched_yield();
+      spins = 0;
+    }
+  }
+
+  return;
+}
+
+
+///Pop, waiting for an entry
+void* PopRing(Ring* ring){
+  int spins = 0;
+  void* data;
+
+  while(!(data = TryPopRing(ring))){
+    if(++spins >= SPIN_LIMIT){
+      sched_yield();
+      spins = 0;
+    }
+  }
+
+  return data;
+}
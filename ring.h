@@ -0,0 +1,62 @@
+///file:ring.h
+///description:declarations for a lock-free single-producer,
+///  single-consumer ring buffer used to pass work between threads
+///author: avv8047 : Azhur Viano
+#ifndef RING_H
+#define RING_H
+
+#include <stdlib.h>
+
+//size of a cache line, used to keep the two ends of a ring apart
+#define CACHE_LINE 64
+
+
+///Ring of pointers shared by exactly one producer and one consumer.
+///  head is only written by the consumer and tail only by the producer
+typedef struct Ring_ {
+  void** slots;
+  size_t mask;
+  char padHead[CACHE_LINE];
+  size_t head;
+  char padTail[CACHE_LINE];
+  size_t tail;
+  char padEnd[CACHE_LINE];
+} Ring;
+
+
+///Create a new empty ring
+///@param capacity the minimum number of entries; rounded up to a power of 2
+///@returns a pointer to the new ring
+Ring* CreateRing(size_t capacity);
+
+
+///Free a ring; any entries still in it are not freed
+///@param ring the ring to free
+void DestroyRing(Ring* ring);
+
+
+///Push an entry without waiting
+///@param ring the ring to push onto, only called from the producer
+///@param data the entry, which must not be NULL
+///@returns 1 if the entry was pushed, 0 if the ring was full
+int TryPushRing(Ring* ring, void* data);
+
+
+///Pop an entry without waiting
+///@param ring the ring to pop from, only called from the consumer
+///@returns the oldest entry, or NULL if the ring was empty
+void* TryPopRing(Ring* ring);
+
+
+///Push an entry, waiting while the ring is full
+///@param ring the ring to push onto, only called from the producer
+///@param data the entry, which must not be NULL
+void PushRing(Ring* ring, void* data);
+
+
+///Pop an entry, waiting while the ring is empty
+///@param ring the ring to pop from, only called from the consumer
+///@returns the oldest entry
+void* PopRing(Ring* ring);
+
+#endif
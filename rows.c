@@ -0,0 +1,422 @@
+///file:rows.c
+///description:runs a compiled Fred program for each row of a
+///  memory mapped CSV file
+///author: avv8047 : Azhur Viano
+
+
+#include "rows.h"
+#include "memstats.h"
+#include "profile.h"
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+//size of the buffer for the output CSV
+#define SINK_BUFFER (1 << 20)
+//input that has been parsed is dropped from memory in steps of this
+//  many bytes, a multiple of the page size
+#define RELEASE_STEP (64 << 20)
+
+
+//A run of a program over the rows of a CSV file
+typedef struct Rows_ {
+  //symbols each row starts from
+  SymbolTable* baseline;
+  //symbols of the row being run
+  SymbolTable* table;
+  //compiled program
+  Statement** statements;
+  size_t statementCount;
+  //symbol each column is stored in
+  SymbolId* columns;
+  size_t columnCount;
+  //names of the symbols written after each row
+  char** selected;
+  size_t selectedCount;
+  //output CSV, and where prt and display statements print
+  FILE* sink;
+  FILE* out;
+  //rows run, and rows skipped because of an error
+  size_t rows;
+  size_t errors;
+} Rows;
+
+
+///Compile every statement of a program
+///@param rows the run to store the statements in
+///@param program the program
+static void compileProgram(Rows* rows, FILE* program){
+  char* line = NULL;
+  size_t len = 0;
+  size_t capacity = 0;
+  size_t number = 0;
+
+  while(readLine(&line, &len, program) != -1){
+    number++;
+    if(strnlen(line, 1) == 0){
+      continue;
+    }
+    if(rows->statementCount == capacity){
+      capacity = capacity ? capacity * 2 : 64;
+      rows->statements = realloc(rows->statements, sizeof(Statement*) * capacity);
+    }
+    profileAt(number, ProfParse);
+    rows->statements[rows->statementCount] = compileStatement(line);
+    rows->statements[rows->statementCount++]->line = number;
+  }
+  profileAt(0, ProfOther);
+  memFree(line);
+  return;
+}
+
+
+///Split a comma separated list of names, trimming blanks and quotes
+///@param list the list, split in place
+///@param names set to the names, which point into list
+///@returns the number of names
+static size_t splitNames(char* list, char*** names){
+  size_t count = 0;
+  size_t capacity = 8;
+  char* save = NULL;
+  char* name;
+  char* end;
+
+  *names = malloc(sizeof(char*) * capacity);
+  for(name = strtok_r(list, ",", &save); name; name = strtok_r(NULL, ",", &save)){
+    name += strspn(name, " \t\"");
+    end = name + strlen(name);
+    while(end > name && strchr(" \t\r\n\"", end[-1])){
+      end--;
+    }
+    *end = '\0';
+
+    if(count == capacity){
+      capacity *= 2;
+      *names = realloc(*names, sizeof(char*) * capacity);
+    }
+    (*names)[count++] = name;
+  }
+  return count;
+}
+
+
+///Bind the columns named in the header to symbols
+///@param rows the run
+///@param header the header line, without its newline
+///@param csvPath the name of the CSV file, for errors
+///@returns 1 if every column is a symbol, else 0
+static int bindColumns(Rows* rows, char* header, const char* csvPath){
+  char** names;
+  size_t i;
+  int bound = 1;
+
+  rows->columnCount = splitNames(header, &names);
+  rows->columns = malloc(sizeof(SymbolId) * (rows->columnCount + 1));
+  for(i = 0; i < rows->columnCount; i++){
+    rows->columns[i] = GetSymbol(rows->baseline, names[i]);
+    if(rows->columns[i] == NO_SYMBOL){
+      fprintf(stderr, "Column %s of %s is not a symbol in the table\n",
+	      names[i], csvPath);
+      bound = 0;
+    }
+  }
+  if(!rows->columnCount){
+    fprintf(stderr, "No columns in the header of %s\n", csvPath);
+    bound = 0;
+  }
+  free(names);
+  return bound;
+}
+
+
+///Skip spaces and tabs
+///@param text the text
+///@returns the first other character
+static const char* skipBlanks(const char* text){
+  while(*text == ' ' || *text == '\t'){
+    text++;
+  }
+  return text;
+}
+
+
+///Check whether a character ends a field
+///@param c the character
+///@returns 1 if it does, else 0
+static int endsField(char c){
+  return (c == ',' || c == '\n' || c == '\r');
+}
+
+
+///Parse a field of a row where it lies in the input
+///@param field the start of the field; the row must end with a newline
+///@param type the type of the symbol the column is stored in
+///@param value set to the value of the field
+///@param status set to 1 if there was a value, 0 if the field is
+///  empty, and -1 if it is not a number of the type
+///@returns the character ending the field
+static const char* parseField(const char* field, Type type, Value* value,
+			      int* status){
+  char* end;
+
+  field = skipBlanks(field);
+  if(endsField(*field)){
+    *status = 0;
+    return field;
+  }
+
+  if(type == Integer){
+    value->iVal = (int) strtol(field, &end, 10);
+  }
+  else{
+    value->fVal = strtof(field, &end);
+  }
+  end = (char*) skipBlanks(end);
+
+  *status = 1;
+  if(end == field || !endsField(*end)){
+    *status = -1;
+    while(!endsField(*end)){
+      end++;
+    }
+  }
+  return end;
+}
+
+
+///Write the selected symbols as a row of the output CSV
+///@param rows the run
+static void writeRow(Rows* rows){
+  SymbolId symbol;
+  size_t i;
+
+  for(i = 0; i < rows->selectedCount; i++){
+    if(i > 0){
+      putc(',', rows->sink);
+    }
+    symbol = GetSymbol(rows->table, rows->selected[i]);
+    if(symbol == NO_SYMBOL){
+      continue;
+    }
+    if(GetSymbolType(rows->table, symbol) == Float){
+      fprintf(rows->sink, "%.3f", GetSymbolValue(rows->table, symbol).fVal);
+    }
+    else{
+      fprintf(rows->sink, "%d", GetSymbolValue(rows->table, symbol).iVal);
+    }
+  }
+  putc('\n', rows->sink);
+  return;
+}
+
+
+///Run the program for one row
+///@param rows the run
+///@param line the row, which must end with a newline
+///@param number the line number of the row
+///@returns the start of the next row
+static const char* runRow(Rows* rows, const char* line, size_t number){
+  const char* field = skipBlanks(line);
+  Value value;
+  int status;
+  int valid = 1;
+  size_t count = 0;
+  size_t i;
+
+  //blank line
+  if(*field == '\n' || (*field == '\r' && field[1] == '\n')){
+    return strchr(field, '\n') + 1;
+  }
+
+  ResetTable(rows->table, rows->baseline);
+
+  //store each field in the symbol of its column
+  do{
+    if(count == rows->columnCount){
+      count++;
+      break;
+    }
+    field = parseField(field, GetSymbolType(rows->table, rows->columns[count]),
+		       &value, &status);
+    if(status > 0){
+      SetSymbolValue(rows->table, rows->columns[count], value);
+    }
+    else if(status < 0 && valid){
+      setDiagnosticLine(number);
+      diagnose(DiagBadRow, "Error: invalid value for %s\n",
+	       GetSymbolName(rows->table, rows->columns[count]));
+      valid = 0;
+    }
+    count++;
+  } while(*field++ == ',');
+
+  if(count != rows->columnCount && valid){
+    setDiagnosticLine(number);
+    diagnose(DiagBadRow, "Error: row has %zu fields, expected %zu\n",
+	     count, rows->columnCount);
+    valid = 0;
+  }
+  field = strchr(field - 1, '\n') + 1;
+
+  if(!valid){
+    rows->errors++;
+    return field;
+  }
+
+  for(i = 0; i < rows->statementCount; i++){
+    executeStatement(rows->table, rows->statements[i], rows->out);
+  }
+  //the fields of the next row are counted outside any line
+  profileAt(0, ProfOutput);
+  writeRow(rows);
+  profilePhase(ProfOther);
+  rows->rows++;
+  return field;
+}
+
+
+///Run the program for every row of a mapped CSV file
+///@param rows the run
+///@param data the mapped file
+///@param size the size of the file
+///@param line the first row, after the header
+static void runRows(Rows* rows, const char* data, size_t size,
+		    const char* line){
+  const char* end = data + size;
+  const char* last = memrchr(line, '\n', end - line);
+  char* tail;
+  size_t released = 0;
+  size_t number = 1;
+  size_t length;
+
+  //rows ending with a newline are parsed where they lie
+  while(last && line <= last){
+    line = runRow(rows, line, ++number);
+
+    if((size_t) (line - data) - released >= RELEASE_STEP){
+      madvise((char*) data + released, RELEASE_STEP, MADV_DONTNEED);
+      released += RELEASE_STEP;
+    }
+  }
+
+  //a last row without a newline is copied so it can end with one
+  if(line < end){
+    length = (size_t) (end - line);
+    tail = malloc(length + 2);
+    memcpy(tail, line, length);
+    tail[length] = '\n';
+    tail[length + 1] = '\0';
+    runRow(rows, tail, ++number);
+    free(tail);
+  }
+  return;
+}
+
+
+///Run a program for every row of a CSV file
+int processRows(SymbolTable* baseline, FILE* program, const char* csvPath,
+		const char* select, const char* sinkPath){
+  Rows rows;
+  struct timespec start;
+  struct timespec finish;
+  struct stat info;
+  char* selectList = NULL;
+  char* header;
+  char* line;
+  void* data = MAP_FAILED;
+  double seconds;
+  size_t i;
+  int fd;
+
+  memset(&rows, 0, sizeof(rows));
+  rows.baseline = baseline;
+
+  fd = open(csvPath, O_RDONLY);
+  if(fd < 0 || fstat(fd, &info) < 0){
+    fprintf(stderr, "Error opening CSV file %s\n", csvPath);
+    if(fd >= 0){
+      close(fd);
+    }
+    return EXIT_FAILURE;
+  }
+  if(info.st_size > 0){
+    data = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if(data == MAP_FAILED){
+    fprintf(stderr, "Error reading CSV file %s\n", csvPath);
+    return EXIT_FAILURE;
+  }
+  madvise(data, info.st_size, MADV_SEQUENTIAL);
+
+  //the header names the symbol of each column
+  line = memchr(data, '\n', info.st_size);
+  header = strndup(data, line ? (size_t) (line - (char*) data) : (size_t) info.st_size);
+  if(!bindColumns(&rows, header, csvPath)){
+    free(header);
+    free(rows.columns);
+    munmap(data, info.st_size);
+    return EXIT_FAILURE;
+  }
+  free(header);
+  line = line ? line + 1 : (char*) data + info.st_size;
+
+  rows.sink = sinkPath ? fopen(sinkPath, "w") : stdout;
+  if(!rows.sink){
+    fprintf(stderr, "Error opening output CSV file %s\n", sinkPath);
+    munmap(data, info.st_size);
+    return EXIT_FAILURE;
+  }
+  setvbuf(rows.sink, NULL, _IOFBF, SINK_BUFFER);
+  //keep the output CSV clean when it goes to stdout
+  rows.out = sinkPath ? stdout : fopen("/dev/null", "w");
+
+  //output every symbol of the baseline unless told otherwise
+  if(select){
+    selectList = strdup(select);
+    rows.selectedCount = splitNames(selectList, &rows.selected);
+  }
+  else{
+    rows.selectedCount = baseline->size;
+    rows.selected = malloc(sizeof(char*) * (baseline->size + 1));
+    for(i = 0; i < baseline->size; i++){
+      rows.selected[i] = (char*) GetSymbolName(baseline, (SymbolId) i);
+    }
+  }
+  for(i = 0; i < rows.selectedCount; i++){
+    fprintf(rows.sink, i ? ",%s" : "%s", rows.selected[i]);
+  }
+  putc('\n', rows.sink);
+
+  compileProgram(&rows, program);
+  rows.table = CopyTable(baseline);
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  runRows(&rows, data, info.st_size, line);
+  fflush(rows.sink);
+  clock_gettime(CLOCK_MONOTONIC, &finish);
+
+  seconds = (finish.tv_sec - start.tv_sec) + (finish.tv_nsec - start.tv_nsec) / 1e9;
+  flushDiagnostics();
+  fprintf(stderr, "Rows: %zu run, %zu skipped for errors, %.3f s, %.0f rows per second\n",
+	  rows.rows, rows.errors, seconds, seconds > 0 ? rows.rows / seconds : 0.0);
+
+  for(i = 0; i < rows.statementCount; i++){
+    DestroyStatement(rows.statements[i]);
+  }
+  free(rows.statements);
+  free(rows.columns);
+  free(rows.selected);
+  free(selectList);
+  DestroyTable(rows.table);
+  if(sinkPath){
+    fclose(rows.sink);
+  }
+  else{
+    fclose(rows.out);
+  }
+  munmap(data, info.st_size);
+  return EXIT_SUCCESS;
+}
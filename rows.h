@@ -0,0 +1,30 @@
+///file:rows.h
+///description:declarations for running a Fred program once for each
+///  row of a CSV file
+///author: avv8047 : Azhur Viano
+
+
+#ifndef ROWS_H
+#define ROWS_H
+
+#include "processor.h"
+
+
+///Compile a program once and run it for every row of a CSV file. The
+///  header names the symbol each column is stored in; every row starts
+///  from the baseline symbols with its fields stored in those symbols,
+///  as if it were a symbol file of its own. After each row the
+///  selected symbols are written as a row of the output CSV. prt and
+///  display output goes to stdout unless the output CSV does, and a
+///  report of the rows per second is printed to stderr at the end
+///@param baseline the symbols each row starts from
+///@param program the program
+///@param csvPath the input CSV file
+///@param select comma separated symbols to output, or NULL for every
+///  symbol of the baseline
+///@param sinkPath the output CSV file, or NULL for stdout
+///@returns the exit status
+int processRows(SymbolTable* baseline, FILE* program, const char* csvPath,
+		const char* select, const char* sinkPath);
+
+#endif
@@ -0,0 +1,1086 @@
+///file:scenario.c
+///description:runs a Fred program against many symbol files at once,
+///  keeping one column of values per symbol
+///author: avv8047 : Azhur Viano
+
+
+#include "scenario.h"
+#include "memstats.h"
+#include "profile.h"
+#include "vector.h"
+#include <stdarg.h>
+
+//scenarios evaluated at a time, so temporary columns stay in cache;
+//  a multiple of VECTOR_LANES
+#define CHUNK 256
+//alignment of the columns, for the widest kernels
+#define COLUMN_ALIGN 32
+
+
+//Kinds of output recorded while running
+typedef enum record_kind {TextRecord, ValueRecord} RecordKind;
+
+
+//Output of a statement, written out for each scenario at the end
+typedef struct Record_ {
+  RecordKind kind;
+  //text: the text, its length and the space allocated for it
+  char* text;
+  size_t length;
+  size_t capacity;
+  //value: the type and the value for every scenario
+  Type type;
+  Value* values;
+  //scenarios the output is for, or NULL for all of them
+  int32_t* mask;
+} Record;
+
+
+//Scenarios being run
+typedef struct Scenarios_ {
+  //names and types of the symbols; the values are only used to dump
+  SymbolTable* schema;
+  //column of values for each symbol
+  Value** columns;
+  size_t columnCapacity;
+  //symbol file of each scenario
+  char** paths;
+  size_t count;
+  //count rounded up to a multiple of CHUNK
+  size_t padded;
+  //mask selecting every scenario
+  int32_t* all;
+  //output recorded so far
+  Record* records;
+  size_t recordCount;
+  size_t recordCapacity;
+  const Kernels* kernels;
+  //temporary columns of CHUNK values for evaluating a chunk
+  Value* scratch;
+  size_t scratchSize;
+  size_t scratchUsed;
+  //set when the run could not do what running alone would have
+  int failed;
+} Scenarios;
+
+
+//A column of values on the evaluation stack
+typedef struct Column_ {
+  Type type;
+  const Value* values;
+} Column;
+
+DEFINE_STACK(ColumnStack, Column)
+
+
+///Allocate a zeroed column
+///@param size the size in bytes
+///@returns the column
+static void* CreateColumn(size_t size){
+  void* column = NULL;
+
+  if(posix_memalign(&column, COLUMN_ALIGN, size) != 0){
+    return NULL;
+  }
+  memset(column, 0, size);
+  return column;
+}
+
+
+///Add the column for a new symbol
+///@param scenarios the scenarios
+///@param id the symbol
+static void addColumn(Scenarios* scenarios, SymbolId id){
+  if(id >= scenarios->columnCapacity){
+    scenarios->columnCapacity = scenarios->columnCapacity ?
+      scenarios->columnCapacity * 2 : 64;
+    scenarios->columns = realloc(scenarios->columns,
+				 sizeof(Value*) * scenarios->columnCapacity);
+  }
+  scenarios->columns[id] = CreateColumn(sizeof(Value) * scenarios->padded);
+  return;
+}
+
+
+///Check whether any scenario is selected in part of a mask
+///@param mask the mask
+///@param n the number of scenarios to check
+///@returns 1 if one is, else 0
+static int anyLane(const int32_t* mask, size_t n){
+  size_t i;
+
+  for(i = 0; i < n; i++){
+    if(mask[i]){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+
+///Check whether a mask selects every scenario
+///@param scenarios the scenarios
+///@param mask the mask
+///@returns 1 if it does, else 0
+static int allLanes(Scenarios* scenarios, const int32_t* mask){
+  return (mask == scenarios->all ||
+	  memcmp(mask, scenarios->all, sizeof(int32_t) * scenarios->padded) == 0);
+}
+
+
+///Print an error that only applies to one scenario
+///@param scenarios the scenarios
+///@param lane the scenario
+///@param code the kind of error
+///@param format printf-style format of the message
+static void laneError(Scenarios* scenarios, size_t lane, DiagnosticCode code,
+		      const char* format, ...){
+  char message[256];
+  va_list args;
+
+  va_start(args, format);
+  vsnprintf(message, sizeof(message), format, args);
+  va_end(args);
+  diagnose(code, "%s: %s", scenarios->paths[lane], message);
+  return;
+}
+
+
+///Start a new output record
+///@param scenarios the scenarios
+///@param kind the kind of record
+///@param mask the scenarios it is for
+///@returns the record
+static Record* addRecord(Scenarios* scenarios, RecordKind kind,
+			 const int32_t* mask){
+  Record* record;
+
+  if(scenarios->recordCount == scenarios->recordCapacity){
+    scenarios->recordCapacity = scenarios->recordCapacity ?
+      scenarios->recordCapacity * 2 : 64;
+    scenarios->records = realloc(scenarios->records,
+				 sizeof(Record) * scenarios->recordCapacity);
+  }
+  record = &scenarios->records[scenarios->recordCount++];
+  record->kind = kind;
+  record->text = NULL;
+  record->length = 0;
+  record->capacity = 0;
+  record->type = Unknown;
+  record->values = NULL;
+  record->mask = NULL;
+  if(!allLanes(scenarios, mask)){
+    record->mask = malloc(sizeof(int32_t) * scenarios->padded);
+    memcpy(record->mask, mask, sizeof(int32_t) * scenarios->padded);
+  }
+  return record;
+}
+
+
+///Record text printed by some scenarios
+///@param scenarios the scenarios
+///@param text the text
+///@param mask the scenarios printing it
+static void recordText(Scenarios* scenarios, const char* text,
+		       const int32_t* mask){
+  size_t length = strlen(text);
+  Record* record = NULL;
+
+  //text printed by every scenario is kept together
+  if(scenarios->recordCount && allLanes(scenarios, mask)){
+    record = &scenarios->records[scenarios->recordCount - 1];
+    if(record->kind != TextRecord || record->mask){
+      record = NULL;
+    }
+  }
+  if(!record){
+    record = addRecord(scenarios, TextRecord, mask);
+  }
+
+  if(record->length + length + 1 > record->capacity){
+    record->capacity = (record->length + length + 1) * 2;
+    record->text = realloc(record->text, record->capacity);
+  }
+  memcpy(record->text + record->length, text, length + 1);
+  record->length += length;
+  return;
+}
+
+
+///Record the current values of a symbol printed by some scenarios
+///@param scenarios the scenarios
+///@param id the symbol
+///@param mask the scenarios printing it
+static void recordValues(Scenarios* scenarios, SymbolId id,
+			 const int32_t* mask){
+  Record* record = addRecord(scenarios, ValueRecord, mask);
+
+  record->type = GetSymbolType(scenarios->schema, id);
+  record->values = malloc(sizeof(Value) * scenarios->padded);
+  memcpy(record->values, scenarios->columns[id],
+	 sizeof(Value) * scenarios->padded);
+  return;
+}
+
+
+///Make room for temporary columns
+///@param scenarios the scenarios
+///@param slots the number of columns of CHUNK values needed
+static void reserveScratch(Scenarios* scenarios, size_t slots){
+  if(slots > scenarios->scratchSize){
+    free(scenarios->scratch);
+    scenarios->scratch = malloc(sizeof(Value) * CHUNK * slots);
+    scenarios->scratchSize = slots;
+  }
+  return;
+}
+
+
+///Take a temporary column reserved with reserveScratch
+///@param scenarios the scenarios
+///@returns the column of CHUNK values
+static Value* takeScratch(Scenarios* scenarios){
+  return scenarios->scratch + CHUNK * scenarios->scratchUsed++;
+}
+
+
+///Count the temporary columns evaluating an expression may take
+///@param expression the expression
+///@returns the number of columns
+static size_t scratchFor(Expression* expression){
+  //a result and a converted operand for each token, and a conversion
+  //  of the final result
+  return 2 * expression->size + 1;
+}
+
+
+///Bind the references of an expression to the symbols, reporting any
+///  error once for all scenarios
+///@param scenarios the scenarios
+///@param expression the expression
+///@returns the bound symbols, or NULL if the expression cannot be
+///  evaluated
+static SymbolId* bindScenarios(Scenarios* scenarios, Expression* expression){
+  SymbolId* bound;
+  const char* missing;
+  int reduces = 0;
+  size_t i;
+
+  //inlining can change the tokens, so it is done before binding
+  inlineCalls(scenarios->schema, expression);
+  bound = malloc(sizeof(SymbolId) * (expression->size + 1));
+  missing = bindExpression(scenarios->schema, expression, bound);
+  for(i = 0; i < expression->size; i++){
+    reduces = reduces || expression->tokens[i].type == Reduce;
+  }
+
+  //scenarios have no arrays to reduce
+  if(reduces){
+    diagnose(DiagBadExpression, "Error: reductions cannot be run for scenarios, in %s\n",
+	     expression->source);
+  }
+  else if(missing && GetSymbol(scenarios->schema, missing) == NO_SYMBOL){
+    diagnose(DiagUnknownSymbol, "Error: symbol %s not found in table\n", missing);
+  }
+  else if(missing){
+    diagnose(DiagBadExpression, "Error: %s is not used as it was defined in %s\n",
+	     missing, expression->source);
+  }
+  else if(expression->error){
+    diagnose(DiagBadExpression, "%s", expression->error);
+  }
+  //the columns are evaluated a chunk at a time, with no frames for calls
+  else if(expression->dispatched){
+    diagnose(DiagBadExpression,
+	     "Error: only calls to functions that are inlined can be run for "
+	     "scenarios, in %s\n", expression->source);
+  }
+  else{
+    return bound;
+  }
+  free(bound);
+  return NULL;
+}
+
+
+///Divide or take the modulo of integers one scenario at a time,
+///  since there are no vector instructions for it
+///@param scenarios the scenarios
+///@param operator '/' or '%'
+///@param out set to the results
+///@param a the dividends
+///@param b the divisors
+///@param first the first scenario of the chunk
+///@param valid the scenarios to evaluate, cleared where there is an error
+static void divideInt(Scenarios* scenarios, int operator, Value* out,
+		      const Value* a, const Value* b, size_t first,
+		      int32_t* valid){
+  size_t i;
+
+  for(i = 0; i < CHUNK; i++){
+    out[i].iVal = 0;
+    if(!valid[i]){
+      continue;
+    }
+    //an error, as when fred runs alone, but only for this scenario
+    if(b[i].iVal == 0){
+      valid[i] = 0;
+      laneError(scenarios, first + i, DiagDivideByZero,
+		"Error: division by zero\n");
+    }
+    //the one quotient that overflows wraps around
+    else if(b[i].iVal == -1){
+      out[i].iVal = (operator == '/') ? (int) (0u - (unsigned) a[i].iVal) : 0;
+    }
+    else{
+      out[i].iVal = (operator == '/') ? a[i].iVal / b[i].iVal : a[i].iVal % b[i].iVal;
+    }
+  }
+  return;
+}
+
+
+///Take the modulo of floats that must be whole numbers, giving
+///  integers, one scenario at a time
+///@param scenarios the scenarios
+///@param out set to the results
+///@param a the dividends
+///@param b the divisors
+///@param first the first scenario of the chunk
+///@param valid the scenarios to evaluate, cleared where there is an error
+static void moduloFloat(Scenarios* scenarios, Value* out, const Value* a,
+			const Value* b, size_t first, int32_t* valid){
+  Value dividend[CHUNK];
+  Value divisor[CHUNK];
+  size_t i;
+
+  for(i = 0; i < CHUNK; i++){
+    dividend[i].iVal = 0;
+    divisor[i].iVal = 1;
+    if(!valid[i]){
+      continue;
+    }
+    if(a[i].fVal - (int) a[i].fVal != 0 || b[i].fVal - (int) b[i].fVal != 0){
+      valid[i] = 0;
+      laneError(scenarios, first + i, DiagFloatModulo,
+		"Error: modulo operator used on float operands %f and %f\n",
+		a[i].fVal, b[i].fVal);
+      continue;
+    }
+    dividend[i].iVal = (int) a[i].fVal;
+    divisor[i].iVal = (int) b[i].fVal;
+  }
+  divideInt(scenarios, '%', out, dividend, divisor, first, valid);
+  return;
+}
+
+
+///Apply an operator to two columns of a chunk
+///@param scenarios the scenarios
+///@param operator the operator character
+///@param a the left operand
+///@param b the right operand
+///@param first the first scenario of the chunk
+///@param valid the scenarios to evaluate, cleared where there is an error
+///@returns the result
+static Column applyOperator(Scenarios* scenarios, int operator, Column a,
+			    Column b, size_t first, int32_t* valid){
+  const Kernels* kernels = scenarios->kernels;
+  Value* out = takeScratch(scenarios);
+  Value* converted;
+  Column result;
+  int isFloat;
+
+  //perform type conversions if necessary
+  if(a.type != b.type){
+    converted = takeScratch(scenarios);
+    if(a.type == Integer){
+      kernels->toFloat(converted, a.values, CHUNK);
+      a.values = converted;
+    }
+    else{
+      kernels->toFloat(converted, b.values, CHUNK);
+      b.values = converted;
+    }
+  }
+  isFloat = (a.type == Float || b.type == Float);
+  result.type = isFloat ? Float : Integer;
+  result.values = out;
+
+  switch(operator){
+  case '+':
+    (isFloat ? kernels->addFloat : kernels->addInt)(out, a.values, b.values, CHUNK);
+    break;
+  case '-':
+    (isFloat ? kernels->subFloat : kernels->subInt)(out, a.values, b.values, CHUNK);
+    break;
+  case '*':
+    (isFloat ? kernels->mulFloat : kernels->mulInt)(out, a.values, b.values, CHUNK);
+    break;
+  case '/':
+    if(isFloat){
+      kernels->divFloat(out, a.values, b.values, CHUNK);
+    }
+    else{
+      divideInt(scenarios, '/', out, a.values, b.values, first, valid);
+    }
+    break;
+  case '%':
+    if(isFloat){
+      moduloFloat(scenarios, out, a.values, b.values, first, valid);
+      result.type = Integer;
+    }
+    else{
+      divideInt(scenarios, '%', out, a.values, b.values, first, valid);
+    }
+    break;
+  default:
+    break;
+  }
+  return result;
+}
+
+
+///Evaluate a bound expression for a chunk of scenarios
+///@param scenarios the scenarios
+///@param expression the expression
+///@param bound the symbols from bindScenarios
+///@param first the first scenario of the chunk
+///@param valid the scenarios to evaluate, cleared where there is an error
+///@returns the result, which must not be written to
+static Column evaluateChunk(Scenarios* scenarios, Expression* expression,
+			    SymbolId* bound, size_t first, int32_t* valid){
+  ColumnStack stack;
+  Column column;
+  Column right;
+  Value* constant;
+  Token* token;
+  size_t i;
+  size_t j;
+
+  InitColumnStack(&stack);
+
+  for(i = 0; i < expression->size; i++){
+    token = &expression->tokens[i];
+    switch(token->type){
+    case Operand:
+      constant = takeScratch(scenarios);
+      for(j = 0; j < CHUNK; j++){
+	constant[j] = token->value;
+      }
+      column.type = token->valType;
+      column.values = constant;
+      break;
+    case Reference:
+      column.type = GetSymbolType(scenarios->schema, bound[i]);
+      column.values = scenarios->columns[bound[i]] + first;
+      break;
+    default:
+      right = PopColumnStack(&stack);
+      column = PopColumnStack(&stack);
+      column = applyOperator(scenarios, token->value.iVal, column, right,
+			     first, valid);
+      break;
+    }
+    PushColumnStack(&stack, column);
+  }
+
+  column = PopColumnStack(&stack);
+  FreeColumnStack(&stack);
+  return column;
+}
+
+
+static void executeScenarios(Scenarios* scenarios, Statement* statement,
+			     const int32_t* mask);
+
+
+///Run a define statement, which must apply to every scenario since
+///  they share their symbols
+///@param scenarios the scenarios
+///@param statement the define statement
+///@param mask the scenarios running it
+static void defineScenarios(Scenarios* scenarios, Statement* statement,
+			    const int32_t* mask){
+  Value value;
+  SymbolId id;
+  size_t i;
+
+  if(!allLanes(scenarios, mask)){
+    diagnose(DiagBadDefine,
+	     "define error: symbols must be defined in every scenario\n");
+    scenarios->failed = 1;
+    return;
+  }
+
+  if(statement->lengths){
+    diagnose(DiagBadDefine, "define error: arrays cannot be defined for scenarios\n");
+    scenarios->failed = 1;
+    return;
+  }
+
+  value.iVal = 0;
+  for(i = 0; i < statement->count; i++){
+    id = AddSymbol(scenarios->schema, statement->items[i], statement->type, value);
+    if(id == NO_SYMBOL){
+      diagnose(DiagDuplicateSymbol, "Symbol %s already exists in table\n",
+	       statement->items[i]);
+    }
+    else{
+      addColumn(scenarios, id);
+    }
+  }
+  return;
+}
+
+
+///Run a function statement, which must apply to every scenario since
+///  they share their symbols
+///@param scenarios the scenarios
+///@param statement the function statement
+///@param mask the scenarios running it
+static void functionScenarios(Scenarios* scenarios, Statement* statement,
+			      const int32_t* mask){
+  SymbolId id;
+
+  if(!allLanes(scenarios, mask)){
+    diagnose(DiagBadFunction,
+	     "function error: functions must be defined in every scenario\n");
+    scenarios->failed = 1;
+    return;
+  }
+
+  id = defineFunction(scenarios->schema, statement->target, statement->left);
+  //the column is unused but keeps one per symbol
+  if(id != NO_SYMBOL){
+    addColumn(scenarios, id);
+  }
+  return;
+}
+
+
+///Run a let statement
+///@param scenarios the scenarios
+///@param statement the let statement
+///@param mask the scenarios running it
+static void letScenarios(Scenarios* scenarios, Statement* statement,
+			 const int32_t* mask){
+  int32_t valid[CHUNK];
+  SymbolId target = GetSymbol(scenarios->schema, statement->target);
+  SymbolId* bound;
+  Type type;
+  Column result;
+  Value* converted;
+  size_t first;
+  size_t i;
+
+  if(target == NO_SYMBOL){
+    diagnose(DiagUnknownSymbol, "let error: no symbol %s in table\n",
+	     statement->target);
+    return;
+  }
+  if(GetSymbolType(scenarios->schema, target) == Function){
+    diagnose(DiagBadExpression, "let error: %s is a function\n", statement->target);
+    return;
+  }
+  bound = bindScenarios(scenarios, statement->left);
+  if(!bound){
+    return;
+  }
+  type = GetSymbolType(scenarios->schema, target);
+  reserveScratch(scenarios, scratchFor(statement->left));
+
+  for(first = 0; first < scenarios->padded; first += CHUNK){
+    if(!anyLane(mask + first, CHUNK)){
+      continue;
+    }
+    memcpy(valid, mask + first, sizeof(valid));
+    scenarios->scratchUsed = 0;
+    result = evaluateChunk(scenarios, statement->left, bound, first, valid);
+
+    //convert to the type of the symbol
+    if(type != result.type){
+      converted = takeScratch(scenarios);
+      if(type == Integer){
+	for(i = 0; i < CHUNK; i++){
+	  converted[i].iVal = valid[i] ? roundEven(result.values[i].fVal) : 0;
+	}
+      }
+      else{
+	scenarios->kernels->toFloat(converted, result.values, CHUNK);
+      }
+      result.values = converted;
+    }
+    scenarios->kernels->select(scenarios->columns[target] + first,
+			       result.values, valid, CHUNK);
+  }
+
+  free(bound);
+  return;
+}
+
+
+///Compare two columns of a chunk
+///@param scenarios the scenarios
+///@param branch the comparison
+///@param left the left hand side
+///@param right the right hand side
+///@param out set to -1 where the comparison is true, else 0
+static void compareChunk(Scenarios* scenarios, Branch* branch, Column left,
+			 Column right, int32_t* out){
+  const Kernels* kernels = scenarios->kernels;
+  Value* converted;
+  int isFloat = (left.type == Float || right.type == Float);
+  size_t i;
+
+  //reals are always compared as reals
+  if(isFloat && left.type != Float){
+    converted = takeScratch(scenarios);
+    kernels->toFloat(converted, left.values, CHUNK);
+    left.values = converted;
+  }
+  if(isFloat && right.type != Float){
+    converted = takeScratch(scenarios);
+    kernels->toFloat(converted, right.values, CHUNK);
+    right.values = converted;
+  }
+
+  switch(branch->operator){
+  case GT:
+    (isFloat ? kernels->gtFloat : kernels->gtInt)(out, left.values, right.values, CHUNK);
+    break;
+  case LT:
+    (isFloat ? kernels->ltFloat : kernels->ltInt)(out, left.values, right.values, CHUNK);
+    break;
+  default:
+    (isFloat ? kernels->eqFloat : kernels->eqInt)(out, left.values, right.values, CHUNK);
+    break;
+  }
+
+  if(branch->invert){
+    for(i = 0; i < CHUNK; i++){
+      out[i] = ~out[i];
+    }
+  }
+  return;
+}
+
+
+///Run an if statement. Each comparison is run for the scenarios that
+///  reach it, and is skipped entirely when none do
+///@param scenarios the scenarios
+///@param statement the if statement
+///@param mask the scenarios running it
+static void ifScenarios(Scenarios* scenarios, Statement* statement,
+			const int32_t* mask){
+  size_t count = statement->branchCount;
+  //scenarios of the chunk reaching each branch
+  int32_t* arrive = malloc(sizeof(int32_t) * CHUNK * count);
+  //scenarios for which the condition is true
+  int32_t* taken = CreateColumn(sizeof(int32_t) * scenarios->padded);
+  SymbolId** left = calloc(count, sizeof(SymbolId*));
+  SymbolId** right = calloc(count, sizeof(SymbolId*));
+  //whether each branch has been bound: 1 if it was, -1 if it failed
+  int* state = calloc(count, sizeof(int));
+  int32_t leftValid[CHUNK];
+  int32_t rightValid[CHUNK];
+  int32_t compared[CHUNK];
+  Column leftResult;
+  Column rightResult;
+  Branch* branch;
+  size_t slots = 0;
+  size_t first;
+  size_t b;
+  size_t i;
+  int next;
+
+  for(b = 0; b < count; b++){
+    slots += scratchFor(statement->branches[b].left) +
+      scratchFor(statement->branches[b].right);
+  }
+  reserveScratch(scenarios, slots);
+
+  for(first = 0; first < scenarios->padded; first += CHUNK){
+    if(!anyLane(mask + first, CHUNK)){
+      continue;
+    }
+    memset(arrive, 0, sizeof(int32_t) * CHUNK * count);
+    memcpy(arrive, mask + first, sizeof(int32_t) * CHUNK);
+
+    //branches only lead forward, so one pass in order visits them all
+    for(b = 0; b < count; b++){
+      branch = &statement->branches[b];
+      if(!anyLane(arrive + b * CHUNK, CHUNK)){
+	continue;
+      }
+      if(!state[b]){
+	left[b] = bindScenarios(scenarios, branch->left);
+	right[b] = bindScenarios(scenarios, branch->right);
+	state[b] = (left[b] && right[b]) ? 1 : -1;
+      }
+      //either side failed to evaluate; the condition is false
+      if(state[b] < 0){
+	continue;
+      }
+
+      scenarios->scratchUsed = 0;
+      memcpy(leftValid, arrive + b * CHUNK, sizeof(leftValid));
+      memcpy(rightValid, arrive + b * CHUNK, sizeof(rightValid));
+      leftResult = evaluateChunk(scenarios, branch->left, left[b], first, leftValid);
+      rightResult = evaluateChunk(scenarios, branch->right, right[b], first, rightValid);
+      compareChunk(scenarios, branch, leftResult, rightResult, compared);
+
+      for(i = 0; i < CHUNK; i++){
+	if(!leftValid[i] || !rightValid[i]){
+	  continue;
+	}
+	next = compared[i] ? branch->onTrue : branch->onFalse;
+	if(next >= 0){
+	  arrive[next * CHUNK + i] = -1;
+	}
+	else if(next == CONDITION_TRUE){
+	  taken[first + i] = -1;
+	}
+      }
+    }
+  }
+
+  if(anyLane(taken, scenarios->padded)){
+    executeScenarios(scenarios, statement->then, taken);
+  }
+
+  for(b = 0; b < count; b++){
+    free(left[b]);
+    free(right[b]);
+  }
+  free(left);
+  free(right);
+  free(state);
+  free(taken);
+  free(arrive);
+  return;
+}
+
+
+///Run a display statement
+///@param scenarios the scenarios
+///@param statement the display statement
+///@param mask the scenarios running it
+static void displayScenarios(Scenarios* scenarios, Statement* statement,
+			     const int32_t* mask){
+  char constant[64];
+  char* tokString;
+  SymbolId symbol;
+  size_t i;
+
+  for(i = 0; i < statement->count; i++){
+    tokString = statement->items[i];
+
+    //token is a variable identifier
+    if(isalpha(tokString[0])){
+      symbol = GetSymbol(scenarios->schema, tokString);
+      if(symbol != NO_SYMBOL && GetSymbolType(scenarios->schema, symbol) == Function){
+	diagnose(DiagBadExpression, "Error: function %s cannot be displayed\n",
+		 tokString);
+      }
+      else if(symbol != NO_SYMBOL){
+	recordValues(scenarios, symbol, mask);
+      }
+      else{
+	diagnose(DiagUnknownSymbol, "Error: symbol %s not found in symbol table\n",
+		 tokString);
+      }
+    }
+    //token is a numeric constant
+    else if(isdigit(tokString[0]) || tokString[0] == '-'){
+      if(isFloat(tokString)){
+	snprintf(constant, sizeof(constant), " %.3f ", strtof(tokString, NULL));
+      }
+      else{
+	snprintf(constant, sizeof(constant), " %d ",
+		 (int) strtol(tokString, NULL, 10));
+      }
+      recordText(scenarios, constant, mask);
+    }
+    else{
+      diagnose(DiagInvalidToken, "Error: invalid token %s\n", tokString);
+    }
+  }
+  recordText(scenarios, "\n", mask);
+  return;
+}
+
+
+///Run a compiled statement for some of the scenarios
+///@param scenarios the scenarios
+///@param statement the statement
+///@param mask the scenarios to run it for
+static void executeScenarios(Scenarios* scenarios, Statement* statement,
+			     const int32_t* mask){
+  if(statement->error){
+    diagnose(statement->errorCode, "%s", statement->error);
+    return;
+  }
+
+  switch(statement->kind){
+  case DefineStatement:
+    defineScenarios(scenarios, statement, mask);
+    break;
+  case LetStatement:
+    letScenarios(scenarios, statement, mask);
+    break;
+  case IfStatement:
+    ifScenarios(scenarios, statement, mask);
+    break;
+  case PrtStatement:
+    if(statement->output){
+      recordText(scenarios, statement->output, mask);
+    }
+    break;
+  case DisplayStatement:
+    displayScenarios(scenarios, statement, mask);
+    break;
+  case FunctionStatement:
+    functionScenarios(scenarios, statement, mask);
+    break;
+  default:
+    break;
+  }
+  return;
+}
+
+
+///Read the symbol file of every scenario into the columns
+///@param scenarios the scenarios, with their paths
+///@returns 1 if every file has the same symbols, else 0
+static int loadColumns(Scenarios* scenarios){
+  SymbolTable* table;
+  SymbolId symbol;
+  SymbolId id;
+  FILE* symbolFile;
+  size_t lane;
+  int same = 1;
+
+  for(lane = 0; lane < scenarios->count && same; lane++){
+    symbolFile = fopen(scenarios->paths[lane], "r");
+    if(!symbolFile){
+      fprintf(stderr, "Error in opening symbol file %s\n", scenarios->paths[lane]);
+      return 0;
+    }
+    table = CreateTable();
+    processSymbolFile(table, symbolFile);
+    fclose(symbolFile);
+
+    //a column holds one value per scenario
+    for(id = 0; id < table->size && same; id++){
+      if(GetSymbolType(table, id) == Array){
+	fprintf(stderr, "Scenario %s has array %s, which scenarios cannot hold\n",
+		scenarios->paths[lane], GetSymbolName(table, id));
+	same = 0;
+      }
+    }
+    if(!same){
+      DestroyTable(table);
+      return 0;
+    }
+
+    //the first scenario decides the symbols
+    if(lane == 0){
+      for(id = 0; id < table->size; id++){
+	symbol = AddSymbol(scenarios->schema, GetSymbolName(table, id),
+			   GetSymbolType(table, id), GetSymbolValue(table, id));
+	addColumn(scenarios, symbol);
+      }
+    }
+
+    same = (table->size == scenarios->schema->size);
+    for(id = 0; id < table->size && same; id++){
+      symbol = GetSymbol(scenarios->schema, GetSymbolName(table, id));
+      same = (symbol != NO_SYMBOL &&
+	      GetSymbolType(scenarios->schema, symbol) == GetSymbolType(table, id));
+      if(same){
+	scenarios->columns[symbol][lane] = GetSymbolValue(table, id);
+      }
+    }
+    if(!same){
+      fprintf(stderr, "Scenario %s does not have the same symbols as %s\n",
+	      scenarios->paths[lane], scenarios->paths[0]);
+    }
+    DestroyTable(table);
+  }
+  return same;
+}
+
+
+///Read the list of scenarios and their symbols
+///@param scenarios the scenarios to fill in
+///@param listPath the file naming one symbol file per line
+///@returns 1 if they were loaded, else 0
+static int loadScenarios(Scenarios* scenarios, const char* listPath){
+  FILE* list = fopen(listPath, "r");
+  char* line = NULL;
+  size_t len = 0;
+  size_t capacity = 0;
+  size_t lane;
+
+  if(!list){
+    fprintf(stderr, "Error opening scenario list %s\n", listPath);
+    return 0;
+  }
+  while(getline(&line, &len, list) != -1){
+    line[strcspn(line, "\r\n")] = '\0';
+    if(!line[0]){
+      continue;
+    }
+    if(scenarios->count == capacity){
+      capacity = capacity ? capacity * 2 : 64;
+      scenarios->paths = realloc(scenarios->paths, sizeof(char*) * capacity);
+    }
+    scenarios->paths[scenarios->count++] = strdup(line);
+  }
+  free(line);
+  fclose(list);
+
+  if(!scenarios->count){
+    fprintf(stderr, "No scenarios listed in %s\n", listPath);
+    return 0;
+  }
+
+  scenarios->padded = (scenarios->count + CHUNK - 1) / CHUNK * CHUNK;
+  scenarios->all = CreateColumn(sizeof(int32_t) * scenarios->padded);
+  for(lane = 0; lane < scenarios->count; lane++){
+    scenarios->all[lane] = -1;
+  }
+  return loadColumns(scenarios);
+}
+
+
+///Write the output and final symbols of every scenario
+///@param scenarios the scenarios
+///@returns 1 if every output was written, else 0
+static int writeScenarios(Scenarios* scenarios){
+  SymbolTable* schema = scenarios->schema;
+  Record* record;
+  char* path;
+  FILE* out;
+  SymbolId id;
+  size_t lane;
+  size_t i;
+
+  for(lane = 0; lane < scenarios->count; lane++){
+    path = malloc(strlen(scenarios->paths[lane]) + 5);
+    sprintf(path, "%s.out", scenarios->paths[lane]);
+    out = fopen(path, "w");
+    if(!out){
+      fprintf(stderr, "Error opening output file %s\n", path);
+      free(path);
+      return 0;
+    }
+    free(path);
+
+    for(i = 0; i < scenarios->recordCount; i++){
+      record = &scenarios->records[i];
+      if(record->mask && !record->mask[lane]){
+	continue;
+      }
+      if(record->kind == TextRecord){
+	fwrite(record->text, 1, record->length, out);
+      }
+      else if(record->type == Float){
+	fprintf(out, " %.3f ", record->values[lane].fVal);
+      }
+      else{
+	fprintf(out, " %d ", record->values[lane].iVal);
+      }
+    }
+
+    //print table contents
+    for(id = 0; id < schema->size; id++){
+      if(GetSymbolType(schema, id) != Function){
+	SetSymbolValue(schema, id, scenarios->columns[id][lane]);
+      }
+    }
+    dumpTable(schema, out);
+    fclose(out);
+  }
+  return 1;
+}
+
+
+///Free the scenarios
+///@param scenarios the scenarios
+static void DestroyScenarios(Scenarios* scenarios){
+  size_t i;
+
+  for(i = 0; i < scenarios->schema->size; i++){
+    free(scenarios->columns[i]);
+  }
+  for(i = 0; i < scenarios->recordCount; i++){
+    free(scenarios->records[i].text);
+    free(scenarios->records[i].values);
+    free(scenarios->records[i].mask);
+  }
+  for(i = 0; i < scenarios->count; i++){
+    free(scenarios->paths[i]);
+  }
+  free(scenarios->columns);
+  free(scenarios->records);
+  free(scenarios->paths);
+  free(scenarios->all);
+  free(scenarios->scratch);
+  DestroyTable(scenarios->schema);
+  return;
+}
+
+
+///Run a program for every scenario
+int processScenarios(const char* listPath, FILE* input, const char* simd){
+  Scenarios scenarios;
+  Statement* statement;
+  char* line = NULL;
+  size_t len = 0;
+  size_t number = 0;
+  int status = EXIT_FAILURE;
+
+  memset(&scenarios, 0, sizeof(scenarios));
+  scenarios.kernels = selectKernels(simd);
+  if(!scenarios.kernels){
+    fprintf(stderr, "SIMD kernels %s are not supported\n", simd);
+    return EXIT_FAILURE;
+  }
+  scenarios.schema = CreateTable();
+
+  if(loadScenarios(&scenarios, listPath)){
+    recordText(&scenarios, ">", scenarios.all);
+
+    while(readLine(&line, &len, input) != -1){
+      setDiagnosticLine(++number);
+      recordText(&scenarios, ":::", scenarios.all);
+      recordText(&scenarios, line, scenarios.all);
+      recordText(&scenarios, "\n", scenarios.all);
+
+      if(strnlen(line, 1) != 0){
+	profileAt(number, ProfParse);
+	statement = compileStatement(line);
+	profilePhase(ProfEval);
+	if(profiling){
+	  countExecution(number);
+	}
+	executeScenarios(&scenarios, statement, scenarios.all);
+	DestroyStatement(statement);
+	profileAt(0, ProfOther);
+      }
+      recordText(&scenarios, ">", scenarios.all);
+    }
+    recordText(&scenarios, "\n", scenarios.all);
+    memFree(line);
+
+    profileAt(0, ProfOutput);
+    if(writeScenarios(&scenarios) && !scenarios.failed){
+      status = EXIT_SUCCESS;
+    }
+  }
+
+  DestroyScenarios(&scenarios);
+  return status;
+}
@@ -0,0 +1,26 @@
+///file:scenario.h
+///description:declarations for running a Fred program against many
+///  symbol files at once
+///author: avv8047 : Azhur Viano
+
+
+#ifndef SCENARIO_H
+#define SCENARIO_H
+
+#include "processor.h"
+
+
+///Run a program once for every symbol file in a list. Each symbol is
+///  stored as a column with one value per scenario, and arithmetic is
+///  applied to whole columns with the vector kernels. The output of
+///  scenario path, the same as running fred -s path alone, is written
+///  to path.out. Errors that only some scenarios hit are printed with
+///  the path of the scenario in front
+///@param listPath file naming one symbol file per line; every symbol
+///  file must have the same symbols with the same types
+///@param input the program
+///@param simd the kernels to use, or NULL for the best supported
+///@returns the exit status
+int processScenarios(const char* listPath, FILE* input, const char* simd);
+
+#endif
@@ -0,0 +1,408 @@
+///file:server.c
+///description:a long-running fred server. An epoll event loop accepts
+///  connections on a Unix domain socket and runs each one as an
+///  isolated session with its own symbol table
+///@author: avv8047 : Azhur Viano
+
+
+#include "server.h"
+#include "protocol.h"
+#include "profile.h"
+#include "probes.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+//most events handled per call to epoll_wait
+#define MAX_EVENTS 64
+//amount read from a connection at a time
+#define READ_SIZE 65536
+//connections waiting to be accepted
+#define BACKLOG 128
+
+
+//A client connection and its session
+typedef struct Session_ {
+  int fd;
+  SymbolTable* table;
+  //bytes received that do not yet make up a whole frame
+  char* in;
+  size_t inSize;
+  size_t inCapacity;
+  //responses waiting to be sent
+  char* out;
+  size_t outSize;
+  size_t outSent;
+  size_t outCapacity;
+  //1 once the session should be closed when its output is sent
+  int closing;
+  //1 while the connection is watched for EPOLLOUT
+  int writing;
+  //neighbours in the list of open sessions
+  struct Session_* prev;
+  struct Session_* next;
+} Session;
+
+
+//open sessions, closed when the server stops
+static Session* sessions = NULL;
+
+
+//set by the signal handler to stop the event loop
+static volatile sig_atomic_t stopping = 0;
+
+
+///Stop the event loop on SIGINT or SIGTERM
+///@param sig the signal number
+static void stopServer(int sig){
+  (void) sig;
+  stopping = 1;
+}
+
+
+///Make sure a buffer has room for more bytes
+///@param buffer the buffer
+///@param capacity the capacity of the buffer
+///@param needed the number of bytes the buffer has to hold
+static void reserve(char** buffer, size_t* capacity, size_t needed){
+  if(needed <= *capacity){
+    return;
+  }
+  if(*capacity == 0){
+    *capacity = 256;
+  }
+  while(*capacity < needed){
+    *capacity *= 2;
+  }
+  *buffer = realloc(*buffer, *capacity);
+  return;
+}
+
+
+///Add a response frame to a session's output
+///@param session the session
+///@param type the frame type
+///@param payload the payload
+///@param size the size of the payload
+static void queueFrame(Session* session, char type, const char* payload, size_t size){
+  reserve(&session->out, &session->outCapacity,
+	  session->outSize + FRAME_HEADER + size);
+  packFrameHeader((unsigned char*) session->out + session->outSize, type, size);
+  memcpy(session->out + session->outSize + FRAME_HEADER, payload, size);
+  session->outSize += FRAME_HEADER + size;
+  return;
+}
+
+
+///Run one request and queue its response
+///@param session the session the request came from
+///@param type the type of the request
+///@param payload the payload of the request, null terminated
+static void handleRequest(Session* session, char type, char* payload){
+  char* output = NULL;
+  size_t size = 0;
+  FILE* out;
+  Statement* statement;
+  char* line;
+  char* save = NULL;
+  size_t number = 0;
+
+  if(type != FRAME_STATEMENTS && type != FRAME_DUMP){
+    queueFrame(session, FRAME_ERROR, "unknown request type", 20);
+    session->closing = 1;
+    return;
+  }
+
+  out = open_memstream(&output, &size);
+
+  if(type == FRAME_STATEMENTS){
+    for(line = strtok_r(payload, "\n", &save);
+	line;
+	line = strtok_r(NULL, "\n", &save)){
+      profileAt(++number, ProfParse);
+      statement = compileStatement(line);
+      statement->line = number;
+      executeStatement(session->table, statement, out);
+      DestroyStatement(statement);
+    }
+    profileAt(0, ProfOther);
+  }
+  else{
+    dumpTable(session->table, out);
+  }
+  //errors are written out with every response rather than left waiting
+  flushDiagnostics();
+
+  fclose(out);
+  queueFrame(session, FRAME_OUTPUT, output, size);
+  free(output);
+  return;
+}
+
+
+///Run every whole request received on a session
+///@param session the session
+static void handleInput(Session* session){
+  size_t used = 0;
+  uint32_t size;
+  char type;
+  char saved;
+
+  while(!session->closing && session->inSize - used >= FRAME_HEADER){
+    size = unpackFrameHeader((unsigned char*) session->in + used, &type);
+    if(size > MAX_FRAME){
+      queueFrame(session, FRAME_ERROR, "frame too large", 15);
+      session->closing = 1;
+      break;
+    }
+    if(session->inSize - used < FRAME_HEADER + size){
+      break;
+    }
+
+    //terminate the payload in place for the statement parser
+    reserve(&session->in, &session->inCapacity, session->inSize + 1);
+    saved = session->in[used + FRAME_HEADER + size];
+    session->in[used + FRAME_HEADER + size] = '\0';
+    handleRequest(session, type, session->in + used + FRAME_HEADER);
+    session->in[used + FRAME_HEADER + size] = saved;
+
+    used += FRAME_HEADER + size;
+  }
+
+  memmove(session->in, session->in + used, session->inSize - used);
+  session->inSize -= used;
+  return;
+}
+
+
+///Close a session and free it
+///@param epfd the epoll instance
+///@param session the session
+static void closeSession(int epfd, Session* session){
+  if(session->prev){
+    session->prev->next = session->next;
+  }
+  else{
+    sessions = session->next;
+  }
+  if(session->next){
+    session->next->prev = session->prev;
+  }
+
+  epoll_ctl(epfd, EPOLL_CTL_DEL, session->fd, NULL);
+  close(session->fd);
+  DestroyTable(session->table);
+  free(session->in);
+  free(session->out);
+  free(session);
+  return;
+}
+
+
+///Send as much queued output as the socket takes
+///@param epfd the epoll instance
+///@param session the session
+///@returns 0 if the session is still open, -1 if it was closed
+static int flushSession(int epfd, Session* session){
+  struct epoll_event event;
+  ssize_t n;
+
+  while(session->outSent < session->outSize){
+    n = write(session->fd, session->out + session->outSent,
+	      session->outSize - session->outSent);
+    if(n < 0 && errno == EINTR){
+      continue;
+    }
+    if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+      break;
+    }
+    if(n <= 0){
+      closeSession(epfd, session);
+      return -1;
+    }
+    session->outSent += n;
+    PROBE2(output_flush, session->fd, n);
+  }
+
+  if(session->outSent == session->outSize){
+    session->outSent = 0;
+    session->outSize = 0;
+    if(session->closing){
+      closeSession(epfd, session);
+      return -1;
+    }
+  }
+
+  //only wait for the socket to be writable while output is pending
+  if((session->outSize != 0) != session->writing){
+    session->writing = (session->outSize != 0);
+    event.events = EPOLLIN | (session->writing ? EPOLLOUT : 0);
+    event.data.ptr = session;
+    epoll_ctl(epfd, EPOLL_CTL_MOD, session->fd, &event);
+  }
+  return 0;
+}
+
+
+///Read what a session has sent and run the requests in it
+///@param epfd the epoll instance
+///@param session the session
+static void readSession(int epfd, Session* session){
+  ssize_t n;
+
+  while(1){
+    reserve(&session->in, &session->inCapacity, session->inSize + READ_SIZE);
+    n = read(session->fd, session->in + session->inSize, READ_SIZE);
+    if(n < 0 && errno == EINTR){
+      continue;
+    }
+    if(n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)){
+      break;
+    }
+    if(n <= 0){
+      //the client hung up; drop anything it did not wait for
+      closeSession(epfd, session);
+      return;
+    }
+    session->inSize += n;
+    handleInput(session);
+  }
+
+  flushSession(epfd, session);
+  return;
+}
+
+
+///Accept every waiting connection and start a session for each
+///@param epfd the epoll instance
+///@param listener the listening socket
+///@param baseline the table sessions start from
+static void acceptSessions(int epfd, int listener, SymbolTable* baseline){
+  struct epoll_event event;
+  Session* session;
+  int fd;
+
+  while((fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0){
+    session = calloc(1, sizeof(Session));
+    session->fd = fd;
+    session->table = ForkTable(baseline);
+
+    event.events = EPOLLIN;
+    event.data.ptr = session;
+    if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &event) != 0){
+      perror("epoll_ctl");
+      DestroyTable(session->table);
+      close(fd);
+      free(session);
+      continue;
+    }
+
+    session->next = sessions;
+    if(sessions){
+      sessions->prev = session;
+    }
+    sessions = session;
+  }
+  return;
+}
+
+
+///Create the listening socket
+///@param path the path to bind to
+///@returns the socket, or -1 on error
+static int listenOn(const char* path){
+  struct sockaddr_un address;
+  int fd;
+
+  if(strlen(path) >= sizeof(address.sun_path)){
+    fprintf(stderr, "Socket path too long: %s\n", path);
+    return -1;
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if(fd < 0){
+    perror("socket");
+    return -1;
+  }
+
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  strcpy(address.sun_path, path);
+  //replace a socket left behind by an earlier server
+  unlink(path);
+
+  if(bind(fd, (struct sockaddr*) &address, sizeof(address)) != 0 ||
+     listen(fd, BACKLOG) != 0){
+    fprintf(stderr, "Error listening on %s: %s\n", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+
+///Serve sessions until interrupted
+int serveSessions(const char* path, SymbolTable* baseline){
+  struct epoll_event events[MAX_EVENTS];
+  struct epoll_event event;
+  struct sigaction action;
+  Session* session;
+  int listener;
+  int epfd;
+  int count;
+  int i;
+
+  listener = listenOn(path);
+  if(listener < 0){
+    return EXIT_FAILURE;
+  }
+
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  event.events = EPOLLIN;
+  event.data.ptr = NULL;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, listener, &event);
+
+  //no SA_RESTART, so epoll_wait returns when a signal arrives
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stopServer;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  while(!stopping){
+    count = epoll_wait(epfd, events, MAX_EVENTS, -1);
+    if(count < 0){
+      if(errno == EINTR){
+	continue;
+      }
+      perror("epoll_wait");
+      break;
+    }
+
+    for(i = 0; i < count; i++){
+      session = (Session*) events[i].data.ptr;
+      if(!session){
+	acceptSessions(epfd, listener, baseline);
+      }
+      else if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)){
+	readSession(epfd, session);
+      }
+      else if(events[i].events & EPOLLOUT){
+	flushSession(epfd, session);
+      }
+    }
+  }
+
+  while(sessions){
+    closeSession(epfd, sessions);
+  }
+  close(epfd);
+  close(listener);
+  unlink(path);
+  return EXIT_SUCCESS;
+}
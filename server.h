@@ -0,0 +1,22 @@
+///file:server.h
+///description:declarations for serving Fred sessions over a Unix
+///  domain socket
+///author: avv8047 : Azhur Viano
+
+
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "processor.h"
+
+
+///Serve Fred sessions on a Unix domain socket until interrupted.
+///  Each connection gets its own session with a copy of the baseline
+///  table, and talks to the server with the frames in protocol.h
+///@param path the path of the socket to listen on
+///@param baseline the table every session starts from
+///@returns EXIT_SUCCESS when stopped by SIGINT or SIGTERM,
+///  EXIT_FAILURE if the socket could not be set up
+int serveSessions(const char* path, SymbolTable* baseline);
+
+#endif
@@ -1,44 +1,87 @@
 ///file:stack.h
-///description:declarations for an stack data structure
+///description:declarations for typed stack data structures
 ///author: avv8047 : Azhur Viano
 #ifndef STACK_H
 #define STACK_H
 
 #include <stdlib.h>
 #include <stdbool.h>
+#include <assert.h>
 
+#include "memstats.h"
 
-///Stack struct has an array of data, a size, and a capacity
-typedef struct {
-  void** data;
-  size_t size;
-  size_t capacity;
-} Stack;
+//number of elements a stack holds before it moves to the heap
+#define STACK_INLINE 32
 
 
-///Create a new empty stack
-///@returns a pointer to the new empty stack
-Stack* CreateStack(void);
+///Grow the storage of a stack to twice its capacity, moving it from
+///  the inline buffer to the heap the first time
+///@param data the current storage
+///@param buffer the inline buffer of the stack
+///@param capacity the capacity in elements, doubled if it grew
+///@param elementSize the size of an element
+///@returns the new storage, or NULL if there is no memory left, in
+///  which case data is left as it was
+void* GrowStack(void* data, void* buffer, size_t* capacity, size_t elementSize);
 
 
+///Define a stack of Element named Name. The first STACK_INLINE
+///  elements are stored inside the struct, so a stack declared as a
+///  local variable only uses the heap when it gets deeper than that.
+///  A stack must not be copied, since data may point into itself.
+///  Pushing returns 0, leaving the stack as it was, when it cannot grow
+#define DEFINE_STACK(Name, Element)					\
+  typedef struct Name##_ {						\
+    Element* data;							\
+    size_t size;							\
+    size_t capacity;							\
+    Element buffer[STACK_INLINE];					\
+  } Name;								\
+									\
+  static inline void Init##Name(Name* stack){				\
+    stack->data = stack->buffer;					\
+    stack->size = 0;							\
+    stack->capacity = STACK_INLINE;					\
+  }									\
+									\
+  static inline void Free##Name(Name* stack){				\
+    if(stack->data != stack->buffer){					\
+      memFree(stack->data);						\
+    }									\
+  }									\
+									\
+  static inline int Empty##Name(Name* stack){				\
+    return (stack->size == 0);						\
+  }									\
+									\
+  static inline int Push##Name(Name* stack, Element element){		\
+    Element* grown;							\
+									\
+    if(stack->size == stack->capacity){					\
+      grown = (Element*) GrowStack(stack->data, stack->buffer,		\
+				   &stack->capacity, sizeof(Element));	\
+      if(!grown){							\
+	return 0;							\
+      }									\
+      stack->data = grown;						\
+    }									\
+    stack->data[stack->size++] = element;				\
+    return 1;								\
+  }									\
+									\
+  static inline Element Pop##Name(Name* stack){			\
+    assert(!Empty##Name(stack));					\
+    return stack->data[--stack->size];					\
+  }									\
+									\
+  static inline Element* Top##Name(Name* stack){			\
+    assert(!Empty##Name(stack));					\
+    return &stack->data[stack->size - 1];				\
+  }
 
-///Delete the stack
-///@param stack the stack to be deleted
-void DestroyStack(Stack* stack);
 
-///Check whether the stack is empty
-///@param stack a pointer to the stack to check
-///@returns whether or not the stack is empty
-int EmptyStack(Stack* stack);
-
-///Pop the top element of the stack
-///@param stack a pointer to the stack to op from
-void* PopStack(Stack* stack);
-
-///Push an element onto the stack
-///@param stack a pointer to the stack
-///@param data the data to push
-void PushStack(Stack* stack, void* data);
+///Stack of operator characters, used when converting to postfix
+DEFINE_STACK(OperatorStack, char)
 
 
 #endif
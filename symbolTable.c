@@ -4,118 +4,678 @@
 
 
 #include "symbolTable.h"
+#include "memstats.h"
+#include "metrics.h"
+#include "probes.h"
+
+//number of index entries in a new table
+#define INITIAL_INDEX 64
+//entries in each page of the index; a power of 2. Tables that share
+//  pages copy a whole page before writing to it
+#define INDEX_SHIFT 8
+#define INDEX_PAGE (1 << INDEX_SHIFT)
+
+//entry of the index at a position
+#define INDEX_ENTRY(table, i) \
+  ((table)->index[(i) >> INDEX_SHIFT][(i) & (INDEX_PAGE - 1)])
+
+//serial number of the last table created
+static uint64_t lastSerial = 0;
+
+
+///Hash a packed name into an index position
+///@param name the packed name
+///@returns the hash
+static size_t hashName(uint64_t name){
+  name ^= name >> 33;
+  name *= 0xff51afd7ed558ccdULL;
+  name ^= name >> 33;
+  return (size_t) name;
+}
+
+
+//Header in front of memory that tables can share: slabs, pages of the
+//  index and the arrays of either. Shared memory is never written; a
+//  table copies it first
+typedef union Shared_ {
+  //number of tables or arrays holding the memory
+  uint32_t refs;
+  //keeps the memory after the header aligned
+  uint64_t align;
+} Shared;
+
+
+///Allocate memory that tables can share, held once
+///@param size the size in bytes
+///@returns the memory, after its header
+static void* allocShared(size_t size){
+  Shared* shared = memAlloc(MemSymbols, sizeof(Shared) + size);
+
+  shared->refs = 1;
+  return shared + 1;
+}
+
+
+///Hold shared memory once more
+///@param data the memory
+///@returns the memory
+static void* retainShared(void* data){
+  __atomic_add_fetch(&((Shared*) data - 1)->refs, 1, __ATOMIC_RELAXED);
+  return data;
+}
+
+
+///Check whether memory is held more than once, so it must be copied
+///  before being written
+///@param data the memory
+///@returns 1 if it is shared, 0 if only the caller holds it
+static int isShared(void* data){
+  return __atomic_load_n(&((Shared*) data - 1)->refs, __ATOMIC_ACQUIRE) > 1;
+}
+
+
+///Let go of shared memory
+///@param data the memory
+///@returns 1 if that was the last hold, so the memory is to be freed
+static int releaseShared(void* data){
+  return __atomic_sub_fetch(&((Shared*) data - 1)->refs, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+
+///Free shared memory that is no longer held
+///@param data the memory
+static void freeShared(void* data){
+  memFree((Shared*) data - 1);
+  return;
+}
+
+
+///Let go of the array of slabs of a table, and of its slabs if the
+///  table held the last of the array
+///@param table a pointer to the table
+static void releaseSlabs(SymbolTable* table){
+  size_t i;
+
+  if(table->slabs && releaseShared(table->slabs)){
+    for(i = 0; i < table->slabCount; i++){
+      if(releaseShared(table->slabs[i])){
+	freeShared(table->slabs[i]);
+      }
+    }
+    freeShared(table->slabs);
+  }
+  table->slabs = NULL;
+  return;
+}
+
+
+///Get the number of pages of an index
+///@param mask the size of the index less 1
+///@returns the number of pages
+static size_t indexPages(size_t mask){
+  return (mask >> INDEX_SHIFT) + 1;
+}
+
+
+///Get the size of the pages of an index
+///@param mask the size of the index less 1
+///@returns the size of each page in bytes
+static size_t pageBytes(size_t mask){
+  return sizeof(IndexEntry) * (mask < INDEX_PAGE ? mask + 1 : INDEX_PAGE);
+}
+
+
+///Let go of an index, and of its pages if that was the last hold
+///@param index the array of pages
+///@param mask the size of the index less 1
+static void releaseIndex(IndexEntry** index, size_t mask){
+  size_t i;
+
+  if(releaseShared(index)){
+    for(i = 0; i < indexPages(mask); i++){
+      if(releaseShared(index[i])){
+	freeShared(index[i]);
+      }
+    }
+    freeShared(index);
+  }
+  return;
+}
+
+
+///Allocate an empty index
+///@param size the number of entries, a power of 2
+///@returns the array of pages
+static IndexEntry** CreateIndex(size_t size){
+  IndexEntry** index = allocShared(sizeof(IndexEntry*) * indexPages(size - 1));
+  size_t entries = pageBytes(size - 1) / sizeof(IndexEntry);
+  size_t i;
+  size_t j;
+
+  for(i = 0; i < indexPages(size - 1); i++){
+    index[i] = allocShared(pageBytes(size - 1));
+    for(j = 0; j < entries; j++){
+      index[i][j].id = NO_SYMBOL;
+    }
+  }
+  return index;
+}
+
+
+///Copy the entries of one index into another of the same size
+///@param to the index to copy into, whose pages are its own
+///@param from the index to copy
+///@param mask the size of both indexes less 1
+static void copyIndex(IndexEntry** to, IndexEntry** from, size_t mask){
+  size_t i;
+
+  for(i = 0; i < indexPages(mask); i++){
+    memcpy(to[i], from[i], pageBytes(mask));
+  }
+  return;
+}
 
 
 ///Create a new table
 SymbolTable* CreateTable(void){
-  SymbolTable* table = malloc(sizeof(SymbolTable));
+  SymbolTable* table = memAlloc(MemSymbols, sizeof(SymbolTable));
   
-  table->head = NULL;
+  table->slabs = NULL;
+  table->slabCount = 0;
+  table->slabCapacity = 0;
+  table->index = CreateIndex(INITIAL_INDEX);
+  table->indexMask = INITIAL_INDEX - 1;
   table->size = 0;
+  table->serial = __atomic_add_fetch(&lastSerial, 1, __ATOMIC_RELAXED);
+  table->shared = 0;
+  table->exported = NULL;
+  table->source = NULL;
 
   return table;
 }
 
 
-///Free all memory associated with a symbol
-///@param symbol a pointer to the symbol to free
-static void DestroySymbol(Symbol* symbol){
-  free(symbol->name);
-  free(symbol);
+///Destroy a table
+void DestroyTable(SymbolTable* table){
+  countMetric(MetricSymbols, -(int64_t) table->size);
+  releaseSlabs(table);
+  releaseIndex(table->index, table->indexMask);
+  memFree(table);
+}
+
+
+///Copy a table
+SymbolTable* CopyTable(SymbolTable* table){
+  SymbolTable* copy = memAlloc(MemSymbols, sizeof(SymbolTable));
+  size_t i;
+
+  *copy = *table;
+  copy->slabs = NULL;
+  if(table->slabCapacity){
+    copy->slabs = allocShared(sizeof(Slab*) * table->slabCapacity);
+  }
+  for(i = 0; i < table->slabCount; i++){
+    copy->slabs[i] = allocShared(sizeof(Slab));
+    memcpy(copy->slabs[i], table->slabs[i], sizeof(Slab));
+  }
+  copy->index = CreateIndex(table->indexMask + 1);
+  copyIndex(copy->index, table->index, table->indexMask);
+  copy->serial = __atomic_add_fetch(&lastSerial, 1, __ATOMIC_RELAXED);
+  copy->shared = 0;
+  copy->exported = NULL;
+  countMetric(MetricSymbols, copy->size);
+
+  return copy;
+}
+
+
+///Make a table share the memory of another
+///@param table a pointer to the table, which holds no memory
+///@param source a pointer to the table to share with
+static void shareTable(SymbolTable* table, SymbolTable* source){
+  //the table stays exported, or not, as it was
+  ExportSegment* exported = table->exported;
+
+  //a snapshot is already marked, and is not written by the threads
+  //  forking it
+  if(!source->shared){
+    source->shared = 1;
+  }
+  *table = *source;
+  table->exported = exported;
+  if(table->slabs){
+    retainShared(table->slabs);
+  }
+  retainShared(table->index);
+  table->serial = __atomic_add_fetch(&lastSerial, 1, __ATOMIC_RELAXED);
+  countMetric(MetricSymbols, table->size);
   return;
 }
 
 
-///Destroy a table
-void DestroyTable(SymbolTable* table){
-  SymbolNode* cur = table->head;
-  SymbolNode* next;
+///Take a snapshot of a table
+SymbolTable* SnapshotTable(SymbolTable* table){
+  SymbolTable* snapshot = memAlloc(MemSymbols, sizeof(SymbolTable));
+
+  snapshot->exported = NULL;
+  shareTable(snapshot, table);
+  return snapshot;
+}
+
+
+///Fork a table
+SymbolTable* ForkTable(SymbolTable* table){
+  SymbolTable* fork = memAlloc(MemSymbols, sizeof(SymbolTable));
+
+  fork->exported = NULL;
+  shareTable(fork, table);
+  return fork;
+}
+
+
+///Make the array of slabs of a table its own, holding each slab in the
+///  copy once more
+///@param table a pointer to the table
+static void ownSlabs(SymbolTable* table){
+  Slab** slabs;
+  size_t i;
+
+  if(!table->slabs || !isShared(table->slabs)){
+    return;
+  }
+  slabs = allocShared(sizeof(Slab*) * table->slabCapacity);
+  for(i = 0; i < table->slabCount; i++){
+    slabs[i] = retainShared(table->slabs[i]);
+  }
+  releaseSlabs(table);
+  table->slabs = slabs;
+  return;
+}
+
+
+///Get a slab that can be written
+Slab* WritableSlab(SymbolTable* table, SymbolId id){
+  Slab** slab;
+  Slab* copy;
+
+  ownSlabs(table);
+  slab = &table->slabs[id >> SLAB_SHIFT];
+  if(isShared(*slab)){
+    copy = allocShared(sizeof(Slab));
+    memcpy(copy, *slab, sizeof(Slab));
+    if(releaseShared(*slab)){
+      freeShared(*slab);
+    }
+    *slab = copy;
+  }
+  return *slab;
+}
+
+
+///Make the page of the index holding a position the table's own, and
+///  the array of pages with it
+///@param table a pointer to the table
+///@param position the position in the index
+static void ownIndexPage(SymbolTable* table, size_t position){
+  IndexEntry** index = table->index;
+  IndexEntry** page;
+  IndexEntry* copy;
+  size_t i;
+
+  if(isShared(index)){
+    index = allocShared(sizeof(IndexEntry*) * indexPages(table->indexMask));
+    for(i = 0; i < indexPages(table->indexMask); i++){
+      index[i] = retainShared(table->index[i]);
+    }
+    releaseIndex(table->index, table->indexMask);
+    table->index = index;
+  }
 
-  while(cur){
-    next = cur->next;
-    DestroySymbol(cur->symbol);
-    free(cur);
-    cur = next;
+  page = &index[position >> INDEX_SHIFT];
+  if(isShared(*page)){
+    copy = allocShared(pageBytes(table->indexMask));
+    memcpy(copy, *page, pageBytes(table->indexMask));
+    if(releaseShared(*page)){
+      freeShared(*page);
+    }
+    *page = copy;
   }
+  return;
+}
+
+
+///Pack a name into a word
+SymbolName PackName(const char* name){
+  SymbolName packed;
 
-  free(table);
+  packed.word = 0;
+  strncpy(packed.text, name, MAX_SYM_LEN);
+  return packed;
 }
-    
 
-///Add a symbol to the table
-int AddSymbol(SymbolTable* table, Symbol* symbol){
-  SymbolNode* cur = table->head;
-  SymbolNode* newNode = malloc(sizeof(SymbolNode));
-  newNode->symbol = symbol;
-  int result = 1;
-  
-  if(!cur || (result = strcmp(cur->symbol->name, symbol->name)) >= 0){
-    if(result == 0){
-      free(newNode);
-      return 0;
+
+///Find the index position of a name
+///@param table a pointer to the table
+///@param name the packed name
+///@returns the position holding the name, or the empty position
+///  where it would be added
+static size_t findEntry(SymbolTable* table, uint64_t name){
+  size_t i = hashName(name) & table->indexMask;
+  IndexEntry* entry = &INDEX_ENTRY(table, i);
+
+  while(entry->id != NO_SYMBOL && entry->name != name){
+    i = (i + 1) & table->indexMask;
+    entry = &INDEX_ENTRY(table, i);
+  }
+  return i;
+}
+
+
+///Double the size of the index
+///@param table a pointer to the table
+static void growIndex(SymbolTable* table){
+  IndexEntry** old = table->index;
+  size_t oldMask = table->indexMask;
+  IndexEntry* entry;
+  size_t i;
+
+  table->index = CreateIndex((oldMask + 1) * 2);
+  table->indexMask = (oldMask + 1) * 2 - 1;
+  for(i = 0; i <= oldMask; i++){
+    entry = &old[i >> INDEX_SHIFT][i & (INDEX_PAGE - 1)];
+    if(entry->id != NO_SYMBOL){
+      INDEX_ENTRY(table, findEntry(table, entry->name)) = *entry;
+    }
+  }
+  releaseIndex(old, oldMask);
+  return;
+}
+
+
+///Add an empty slab to the end of a table whose array of slabs is its own.
+///  The allocations are not checked: in realtime mode admitLine keeps
+///  room in the pools for every symbol the table can still grow by
+///@param table a pointer to the table
+static void addSlab(SymbolTable* table){
+  Shared* shared;
+
+  if(!table->slabs){
+    table->slabCapacity = 4;
+    table->slabs = allocShared(sizeof(Slab*) * table->slabCapacity);
+  }
+  else if(table->slabCount == table->slabCapacity){
+    table->slabCapacity *= 2;
+    shared = memRealloc(MemSymbols, (Shared*) table->slabs - 1,
+			sizeof(Shared) + sizeof(Slab*) * table->slabCapacity);
+    table->slabs = (Slab**) (shared + 1);
+  }
+  table->slabs[table->slabCount++] = allocShared(sizeof(Slab));
+  return;
+}
+
+
+///Export every symbol of a table again once it has been reset
+///@param table a pointer to the table
+static void reexportTable(SymbolTable* table){
+  Slab* slab;
+  size_t i;
+
+  if(!table->exported){
+    return;
+  }
+  for(i = 0; i < table->size; i++){
+    slab = table->slabs[i >> SLAB_SHIFT];
+    exportSymbol(table->exported, (uint32_t) i, slab->names[i & SLAB_MASK].word,
+		 slab->types[i & SLAB_MASK], (uint32_t) slab->values[i & SLAB_MASK].iVal);
+  }
+  exportSize(table->exported, table->size);
+  return;
+}
+
+
+///Reset a table to the symbols of another
+void ResetTable(SymbolTable* table, SymbolTable* baseline){
+  size_t remaining = baseline->size;
+  size_t count;
+  size_t i;
+
+  //shared memory would have to be copied before being written, so the
+  //  table shares the baseline's instead
+  countMetric(MetricSymbols, -(int64_t) table->size);
+  if(table->shared || baseline->shared){
+    releaseSlabs(table);
+    releaseIndex(table->index, table->indexMask);
+    shareTable(table, baseline);
+    reexportTable(table);
+    return;
+  }
+
+  for(i = 0; remaining > 0; i++){
+    if(i == table->slabCount){
+      addSlab(table);
     }
-    newNode->next = cur;
-    table->head = newNode;
-    return 1;
+    count = remaining < SLAB_SIZE ? remaining : SLAB_SIZE;
+    memcpy(table->slabs[i]->names, baseline->slabs[i]->names, sizeof(SymbolName) * count);
+    memcpy(table->slabs[i]->values, baseline->slabs[i]->values, sizeof(Value) * count);
+    memcpy(table->slabs[i]->versions, baseline->slabs[i]->versions, sizeof(uint32_t) * count);
+    memcpy(table->slabs[i]->types, baseline->slabs[i]->types, count);
+    remaining -= count;
+  }
+
+  if(table->indexMask != baseline->indexMask){
+    releaseIndex(table->index, table->indexMask);
+    table->index = CreateIndex(baseline->indexMask + 1);
+    table->indexMask = baseline->indexMask;
+  }
+  copyIndex(table->index, baseline->index, baseline->indexMask);
+  table->size = baseline->size;
+  countMetric(MetricSymbols, table->size);
+  table->serial = __atomic_add_fetch(&lastSerial, 1, __ATOMIC_RELAXED);
+  reexportTable(table);
+  return;
+}
+
+
+///Add a symbol that is not in a table
+///@param table a pointer to the table
+///@param packed the name of the symbol
+///@param entry the entry of the index for the name, from findEntry
+///@param type the type of the symbol
+///@param value the initial value of the symbol
+///@returns the id of the new symbol
+static SymbolId insertSymbol(SymbolTable* table, SymbolName packed, size_t entry,
+			     Type type, Value value){
+  SymbolId id = (SymbolId) table->size;
+  Slab* slab;
+
+  if(table->shared){
+    ownIndexPage(table, entry);
+    ownSlabs(table);
   }
 
-  SymbolNode* prev = cur;
-  cur = cur->next;
+  //start a new slab when the last one is full, unless a reset table
+  //  still has it
+  if((id >> SLAB_SHIFT) == table->slabCount){
+    addSlab(table);
+  }
+
+  slab = table->shared ? WritableSlab(table, id) : table->slabs[id >> SLAB_SHIFT];
+  slab->names[id & SLAB_MASK] = packed;
+  slab->types[id & SLAB_MASK] = (unsigned char) type;
+  slab->values[id & SLAB_MASK] = value;
+  slab->versions[id & SLAB_MASK] = 0;
 
-  while(cur && (result = strcmp(cur->symbol->name, symbol->name)) < 0){
-    prev = cur;
-    cur = cur->next;
+  INDEX_ENTRY(table, entry).name = packed.word;
+  INDEX_ENTRY(table, entry).id = id;
+  table->size++;
+  countMetric(MetricSymbols, 1);
+  if(table->exported){
+    exportSymbol(table->exported, id, packed.word, (unsigned char) type,
+		 (uint32_t) value.iVal);
+    exportSize(table->exported, table->size);
   }
 
-  if(result == 0){
-    free(newNode);
-    return 0;
+  if(table->size * 2 > table->indexMask + 1){
+    growIndex(table);
   }
+  return id;
+}
 
-  newNode->next = cur;
-  prev->next = newNode;
 
-  return 1;
+///Add a symbol that is not in a table from the source of the table
+///@param table a pointer to the table
+///@param packed the name of the symbol
+///@param entry the entry of the index for the name, from findEntry
+///@returns the id of the new symbol, or NO_SYMBOL if the table has no
+///  source or the source does not have the symbol
+static SymbolId loadSymbol(SymbolTable* table, SymbolName packed, size_t entry){
+  SymbolSource* source = table->source;
+  size_t index;
+  Type type;
+  Value value;
+
+  if(!source){
+    return NO_SYMBOL;
+  }
+  index = source->find(source, packed.word);
+  if(index == source->size || !source->read(source, index, 1, &type, &value)){
+    return NO_SYMBOL;
+  }
+  return insertSymbol(table, packed, entry, type, value);
+}
+
+
+///Add a symbol to the table
+SymbolId AddSymbol(SymbolTable* table, const char* name, Type type, Value value){
+  SymbolName packed = PackName(name);
+  size_t entry = findEntry(table, packed.word);
+  SymbolId id;
+
+  //a symbol of the source is already in the table, and is added from
+  //  it instead
+  if(INDEX_ENTRY(table, entry).id != NO_SYMBOL ||
+     loadSymbol(table, packed, entry) != NO_SYMBOL){
+    PROBE2(symbol_add, name, -1);
+    return NO_SYMBOL;
+  }
+
+  id = insertSymbol(table, packed, entry, type, value);
+  PROBE2(symbol_add, name, id);
+  return id;
 }
 
 
 
 ///Get a symbol from the table
-Symbol* GetSymbol(SymbolTable* table, char* name){
-  SymbolNode* cur = table->head;
-  while(cur){
-if(strncmp(cur->symbol->name, name, MAX_SYM_LEN) == 0){
-      return cur->symbol;
-    }
-    cur = cur->next;
+SymbolId GetSymbol(SymbolTable* table, const char* name){
+  SymbolName packed = PackName(name);
+  size_t entry = findEntry(table, packed.word);
+  SymbolId id = INDEX_ENTRY(table, entry).id;
+
+  if(id == NO_SYMBOL && table->source){
+    id = loadSymbol(table, packed, entry);
   }
+  countMetric(MetricLookups, 1);
+  PROBE2(symbol_lookup, name, id == NO_SYMBOL ? -1 : (long) id);
+  return id;
+}
+
+
+//Name and id of a symbol, sorted by dumpTable
+typedef struct SortEntry_ {
+  SymbolName name;
+  SymbolId id;
+} SortEntry;
+
 
-  return NULL;
+///Compare the names of two symbols for qsort
+///@param a the first entry
+///@param b the second entry
+///@returns the order of the names
+static int compareNames(const void* a, const void* b){
+  return strcmp(((const SortEntry*) a)->name.text,
+		((const SortEntry*) b)->name.text);
 }
 
 
-///Dump the table and its contents to standard output
-void dumpTable(SymbolTable* table){
-  SymbolNode* cur = table->head;
+///Print a line of the dump of a table
+///@param out the stream to print to
+///@param name the name of the symbol
+///@param type the type of the symbol
+///@param value the value of the symbol
+static void dumpSymbol(FILE* out, const char* name, Type type, Value value){
+  fprintf(out, "%s\t", name);
+  switch(type){
+  case Integer:
+    fprintf(out, "integer\t%d\n", value.iVal);
+    break;
+  case Float:
+    fprintf(out, "real\t%.3f\n", value.fVal);
+    break;
+  case Function:
+    fprintf(out, "function\t-\n");
+    break;
+  case Array:
+    fprintf(out, "array\t-\n");
+    break;
+  default:
+    fprintf(out, "unknown\tunknown\n");
+  }
+  return;
+}
+
+
+///Dump the table and its contents
+void dumpTable(SymbolTable* table, FILE* out){
+  SortEntry* order = memAlloc(MemSymbols, sizeof(SortEntry) * (table->size + 1));
+  SymbolSource* source = table->source;
+  SymbolName name;
+  SymbolId id;
+  Type type;
+  Value value;
+  size_t i;
+  size_t next = 0;
 
-  printf("Symbol Table Contents\n");
-  printf("Name\tType\tValue\n");
-  printf("=====================\n");
+  fprintf(out, "Symbol Table Contents\n");
+  fprintf(out, "Name\tType\tValue\n");
+  fprintf(out, "=====================\n");
 
-  while(cur){
-    printf("%s\t", cur->symbol->name);
-    switch(cur->symbol->type){
-    case Integer:
-      printf("integer\t%d\n", cur->symbol->value.iVal);
-      break;
-    case Float:
-      printf("real\t%.3f\n", cur->symbol->value.fVal);
-      break;
-    default:
-      printf("unknown\tunknown\n");
+  //without the memory to sort them, which only runs out once the
+  //  realtime pools are exhausted, the symbols of the table are dumped
+  //  in the order they were added
+  if(!order){
+    for(i = 0; i < table->size; i++){
+      dumpSymbol(out, table->slabs[i >> SLAB_SHIFT]->names[i & SLAB_MASK].text,
+		 GetSymbolType(table, (SymbolId) i), GetSymbolValue(table, (SymbolId) i));
+    }
+    return;
+  }
+  for(i = 0; i < table->size; i++){
+    order[i].id = (SymbolId) i;
+    order[i].name = table->slabs[i >> SLAB_SHIFT]->names[i & SLAB_MASK];
+  }
+  qsort(order, table->size, sizeof(SortEntry), compareNames);
+
+  //the symbols of the source are in order too, and those not in the
+  //  table are read for the dump without adding them
+  for(i = 0; i <= table->size; i++){
+    for(; source && next < source->size; next++){
+      name = source->name(source, next);
+      if(i < table->size && strcmp(name.text, order[i].name.text) >= 0){
+	break;
+      }
+      if(INDEX_ENTRY(table, findEntry(table, name.word)).id == NO_SYMBOL &&
+	 source->read(source, next, 0, &type, &value)){
+	dumpSymbol(out, name.text, type, value);
+      }
+    }
+    if(i < table->size){
+      id = order[i].id;
+      dumpSymbol(out, order[i].name.text, GetSymbolType(table, id),
+		 GetSymbolValue(table, id));
     }
-    cur = cur->next;
   }
 
+  memFree(order);
   return;
 }
@@ -5,17 +5,34 @@
 
 #ifndef SYM_TABLE_H
 #define SYM_TABLE_H
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <stdint.h>
+
+#include "export.h"
 
 #define MAX_SYM_LEN 7
 
+//number of symbols in each slab; a power of 2. Tables that share
+//  slabs copy a whole slab before writing to it, so slabs are kept small
+#define SLAB_SHIFT 8
+#define SLAB_SIZE (1 << SLAB_SHIFT)
+#define SLAB_MASK (SLAB_SIZE - 1)
+
+//id returned when a symbol is not in the table
+#define NO_SYMBOL UINT32_MAX
 
-///Types a symbol can have
+
+///Types a symbol can have; the value of a Function is the number the
+///  function was registered under by defineFunction, and of an Array
+///  the number of its values from createArray
 typedef enum types_enum {
-  Integer, Float, Unknown
+  Integer, Float, Unknown, Function, Array
 } Type;
 
 ///Value of a symbol can be either an int or a float
@@ -25,25 +42,78 @@ typedef union val_union {
 } Value;
 
 
+///Name of a symbol, stored inline and padded with zeros so that two
+///  names can be compared as a single word
+typedef union SymbolName_ {
+  char text[MAX_SYM_LEN + 1];
+  uint64_t word;
+} SymbolName;
+
+
+///Symbols are identified by their position in the table
+typedef uint32_t SymbolId;
 
-///Symbol has a name, a type, and a value
-typedef struct Symbol_ {
-  char* name;
-  Type type;
-  Value value;
-} Symbol;
 
-///Node within the symbol table
-typedef struct SymbolNode_ {
-  struct SymbolNode_* next;
-  Symbol* symbol;
-} SymbolNode;
+///A slab of symbols with their names, types and values kept in
+///  seperate dense arrays
+typedef struct Slab_ {
+  SymbolName names[SLAB_SIZE];
+  Value values[SLAB_SIZE];
+  //number of times each value has been written
+  uint32_t versions[SLAB_SIZE];
+  unsigned char types[SLAB_SIZE];
+} Slab;
+
+
+///Entry of the index from names to symbols
+typedef struct IndexEntry_ {
+  uint64_t name;
+  SymbolId id;
+} IndexEntry;
+
+
+///Symbols a table adds the first time they are looked up instead of
+///  holding them all, such as those of a symbol file loaded lazily
+typedef struct SymbolSource_ {
+  //number of symbols, in the order of their names
+  size_t size;
+  //find a symbol by its packed name
+  //@returns its index, or size if the source does not have it
+  size_t (*find)(struct SymbolSource_* source, uint64_t name);
+  //get the name of the symbol at an index
+  SymbolName (*name)(struct SymbolSource_* source, size_t index);
+  //read the type and value of the symbol at an index; an array is
+  //  only created if create is set
+  //@returns 1 on success, 0 if it could not be read
+  int (*read)(struct SymbolSource_* source, size_t index, int create,
+	      Type* type, Value* value);
+} SymbolSource;
 
 
 ///The symbol table
 typedef struct SymbolTable_ {
-  SymbolNode* head;
+  //slabs holding the symbols in the order they were added
+  Slab** slabs;
+  size_t slabCount;
+  size_t slabCapacity;
+  //open addressed hash index, at most half full, in pages that can
+  //  be shared with other tables
+  IndexEntry** index;
+  size_t indexMask;
   size_t size;
+  //number unique to this table among all tables created by the
+  //  process, never 0; lets cached symbol ids be checked against it
+  uint64_t serial;
+  //set once the table has been snapshotted or forked, after which its
+  //  slabs, array of slabs and index may be shared with other tables
+  //  and are copied before being written
+  int shared;
+  //segment the symbols are exported to as they are written, NULL if
+  //  not exported; snapshots and forks are not
+  ExportSegment* exported;
+  //symbols added once looked up, NULL if none; shared by every copy,
+  //  snapshot and fork of the table, and kept open by its owner
+  SymbolSource* source;
 } SymbolTable;
 
 
@@ -57,23 +127,131 @@ SymbolTable* CreateTable(void);
 void DestroyTable(SymbolTable* table);
 
 
+///Create a copy of a table and all of its symbols
+///@param table a pointer to the table to copy
+///@returns a pointer to the new table
+SymbolTable* CopyTable(SymbolTable* table);
+
+
+///Take a snapshot of a table in constant time. The snapshot shares the
+///  memory of the table, and whichever of them is written to first
+///  copies only the slab it writes. A snapshot is not written to; it
+///  is kept to fork or reset tables from, which may be done from
+///  several threads at once
+///@param table a pointer to the table
+///@returns a pointer to the snapshot, freed with DestroyTable
+SymbolTable* SnapshotTable(SymbolTable* table);
+
+
+///Create a table in constant time that starts with the symbols of a
+///  snapshot or another table and shares their memory until either is
+///  written. Setting a value copies the slab of the symbol, adding a
+///  symbol also copies the index
+///@param table a pointer to the snapshot or table to fork
+///@returns a pointer to the new table, with its own serial
+SymbolTable* ForkTable(SymbolTable* table);
+
+
+///Reset a table to the symbols and values of another, reusing its
+///  memory, or sharing that of the other if either table is shared.
+///  The table gets a new serial, since its symbols may have different
+///  ids than before
+///@param table a pointer to the table to reset
+///@param baseline a pointer to the table to copy
+void ResetTable(SymbolTable* table, SymbolTable* baseline);
+
+
+///Pack a name into its inline form, keeping at most MAX_SYM_LEN
+///  characters
+///@param name the null-terminated name
+///@returns the packed name
+SymbolName PackName(const char* name);
+
+
 ///Add a new symbol to the table
 ///@param table the table to add a symbol to
-///@param symbol a pointer to the symbol to add
-///@returns 1 if the symbol was successfully added, 0 if
-///  the symbol already existed in the table
-int AddSymbol(SymbolTable* table, Symbol* symbol);
+///@param name the name of the symbol; only the first MAX_SYM_LEN
+///  characters are kept
+///@param type the type of the symbol
+///@param value the initial value of the symbol
+///@returns the id of the new symbol, or NO_SYMBOL if
+///  the symbol already existed in the table or its source, which adds
+///  it from the source
+SymbolId AddSymbol(SymbolTable* table, const char* name, Type type, Value value);
 
 
 ///Get a symbol from the table
 ///@param table a pointer to the symbol table to search
 ///@param name the name of the symbol to retrieve
-///@returns the symbol if found, NULL otherwise
-Symbol* GetSymbol(SymbolTable* table, char* name);
+///@returns the id of the symbol if found, added from the source of the
+///  table if it has one, NO_SYMBOL otherwise
+SymbolId GetSymbol(SymbolTable* table, const char* name);
+
+
+///Get a slab of a shared table that can be written, copying it and the
+///  array of slabs first if another table shares them
+///@param table a pointer to the table
+///@param id the id of a symbol in the slab
+///@returns the slab
+Slab* WritableSlab(SymbolTable* table, SymbolId id);
+
+
+///Get the name of a symbol
+///@param table a pointer to the table
+///@param id the id of the symbol
+///@returns the null-terminated name, stored in the table
+static inline const char* GetSymbolName(SymbolTable* table, SymbolId id){
+  return table->slabs[id >> SLAB_SHIFT]->names[id & SLAB_MASK].text;
+}
+
+
+///Get the type of a symbol
+///@param table a pointer to the table
+///@param id the id of the symbol
+///@returns the type of the symbol
+static inline Type GetSymbolType(SymbolTable* table, SymbolId id){
+  return (Type) table->slabs[id >> SLAB_SHIFT]->types[id & SLAB_MASK];
+}
+
+
+///Get the value of a symbol
+///@param table a pointer to the table
+///@param id the id of the symbol
+///@returns the value of the symbol
+static inline Value GetSymbolValue(SymbolTable* table, SymbolId id){
+  return table->slabs[id >> SLAB_SHIFT]->values[id & SLAB_MASK];
+}
+
+
+///Get the write version of a symbol, which changes every time its
+///  value is set
+///@param table a pointer to the table
+///@param id the id of the symbol
+///@returns the version of the symbol
+static inline uint32_t GetSymbolVersion(SymbolTable* table, SymbolId id){
+  return table->slabs[id >> SLAB_SHIFT]->versions[id & SLAB_MASK];
+}
+
+
+///Set the value of a symbol and bump its version
+///@param table a pointer to the table
+///@param id the id of the symbol
+///@param value the new value, of the symbol's type
+static inline void SetSymbolValue(SymbolTable* table, SymbolId id, Value value){
+  Slab* slab = table->shared ? WritableSlab(table, id) : table->slabs[id >> SLAB_SHIFT];
+
+  slab->values[id & SLAB_MASK] = value;
+  slab->versions[id & SLAB_MASK]++;
+  if(table->exported){
+    exportValue(table->exported, id, (uint32_t) value.iVal);
+  }
+}
 
 
-///Print the symbol table contents to stdout
+///Print the symbol table contents, sorted by name, along with the
+///  symbols of its source not yet added, which are not added
 ///@param table a pointer to the table
-void dumpTable(SymbolTable* table);
+///@param out the stream to print to
+void dumpTable(SymbolTable* table, FILE* out);
 
 #endif
@@ -0,0 +1,69 @@
+#!/bin/sh
+# file: diagnostics.sh
+# description: checks that buffered diagnostics reach a redirected
+#   stderr when a program divides by zero and when fred is killed
+# usage: tests/diagnostics.sh [ path-to-fred ]
+
+fred=$(cd "$(dirname "${1:-./fred}")" && pwd)/$(basename "${1:-./fred}")
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+status=0
+
+# fail unless the stderr of the last run has a line matching a pattern
+expect(){
+  if ! grep -q "$2" "$scratch/err"; then
+    echo "FAIL: $1: no line matching '$2' in stderr"
+    cat "$scratch/err"
+    status=1
+  fi
+}
+
+printf 'define integer a, b\nlet a = q + 1\nlet b = 7 / a\nlet b = 7 %% 0\ndisplay a, b\n' \
+  > "$scratch/zero.fred"
+"$fred" -f "$scratch/zero.fred" > /dev/null 2> "$scratch/err"
+result=$?
+if [ $result -ne 0 ]; then
+  echo "FAIL: division by zero: fred exited with $result"
+  status=1
+fi
+expect "division by zero" "E003 line 2"
+expect "division by zero" "E013 line 3"
+expect "division by zero" "E013 line 4"
+
+# a division by zero inside a run of + split between threads
+awk 'BEGIN{
+  printf "define integer a, z\nlet a = 1"
+  for(i = 0; i < 20000; i++) printf (i == 10000 ? " + 1 / z" : " + 1")
+  print "\ndisplay a"
+}' > "$scratch/split.fred"
+"$fred" --reduce-threads 4 -f "$scratch/split.fred" > /dev/null 2> "$scratch/err"
+expect "split run" "E013 line 2"
+if [ "$(grep -c '^E013' "$scratch/err")" -ne 1 ]; then
+  echo "FAIL: split run: the division by zero is not reported once"
+  cat "$scratch/err"
+  status=1
+fi
+
+# contexts report a failed condition once, as a run alone does
+mkdir "$scratch/contexts"
+printf 'define integer a, b, c\nlet a = 5\nif a / b > 1 then let c = 1\ndisplay c\n' \
+  > "$scratch/contexts/zero.fred"
+echo zero.fred > "$scratch/contexts/list"
+(cd "$scratch/contexts" && "$fred" --contexts list > /dev/null 2> "$scratch/err")
+expect "contexts" "E013 line 3"
+if [ "$(grep -c '^E013' "$scratch/err")" -ne 1 ]; then
+  echo "FAIL: contexts: the division by zero is not reported once"
+  cat "$scratch/err"
+  status=1
+fi
+
+for signal in TERM SEGV; do
+  (printf 'let a = q + 1\n'; sleep 2) | "$fred" > /dev/null 2> "$scratch/err" &
+  sleep 1
+  pkill -$signal -f "^$fred\$"
+  wait
+  expect "SIG$signal" "E003 line 1"
+done
+
+[ $status -eq 0 ] && echo "diagnostics: errors reported"
+exit $status
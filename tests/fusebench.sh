@@ -0,0 +1,41 @@
+#!/bin/sh
+# file: fusebench.sh
+# description: times a long program made of the let and if shapes run as
+#   superinstructions, with and without --no-fuse, and prints the best of
+#   several runs of each
+# usage: tests/fusebench.sh [ path-to-fred ] [ statements ] [ runs ]
+
+fred=${1:-./fred}
+statements=${2:-200000}
+runs=${3:-5}
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+
+awk -v n="$statements" 'BEGIN{
+  print "define integer i, total"
+  print "define real x, step"
+  print "let step = 0.5"
+  for(k = 0; k < n; k += 4){
+    print "let i = i + 1"
+    print "let total = total + i"
+    print "if i > 0 then let x = x + step"
+    print "if total < 0 then let total = 0"
+  }
+  print "display i, total, x"
+}' > "$scratch/bench.fred"
+
+# best elapsed seconds of the runs of fred with the given options
+best(){
+  for run in $(seq "$runs"); do
+    start=$(date +%s.%N)
+    "$fred" "$@" -f "$scratch/bench.fred" > /dev/null 2>&1
+    end=$(date +%s.%N)
+    awk -v s="$start" -v e="$end" 'BEGIN{ printf "%.3f\n", e - s }'
+  done | sort -n | head -1
+}
+
+fused=$(best)
+plain=$(best --no-fuse)
+echo "statements: $statements, best of $runs runs"
+echo "fused:      $fused s"
+echo "--no-fuse:  $plain s"
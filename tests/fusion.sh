@@ -0,0 +1,58 @@
+#!/bin/sh
+# file: fusion.sh
+# description: checks that superinstructions change nothing a program
+#   prints: runs each sample program with and without --no-fuse, alone,
+#   through the parser threads and as contexts sharing compiled
+#   expressions, and diffs the output; fused.fred overflows integers
+#   at INT_MAX and INT_MIN, so a fred built with -fsanitize=undefined
+#   also checks both paths wrap without undefined behavior
+# usage: tests/fusion.sh [ path-to-fred ]
+
+fred=$(cd "$(dirname "${1:-./fred}")" && pwd)/$(basename "${1:-./fred}")
+tests=$(cd "$(dirname "$0")" && pwd)
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+status=0
+
+# compare two outputs, printing the difference if there is one
+same(){
+  if ! cmp -s "$2" "$3"; then
+    echo "FAIL: $1 differs with --no-fuse"
+    diff "$2" "$3" | head -20
+    status=1
+  fi
+}
+
+for program in "$tests"/programs/*.fred; do
+  name=$(basename "$program")
+  for mode in "" "-p 2"; do
+    "$fred" $mode -s "$tests/programs/symbols.sym" -f "$program" \
+      > "$scratch/fused" 2>&1
+    "$fred" $mode --no-fuse -s "$tests/programs/symbols.sym" -f "$program" \
+      > "$scratch/plain" 2>&1
+    same "$name $mode" "$scratch/fused" "$scratch/plain"
+  done
+done
+
+# the contexts share the expression f(a), compiled once, while each
+# defines f differently
+mkdir "$scratch/fused.d" "$scratch/plain.d"
+for dir in fused.d plain.d; do
+  cp "$tests"/programs/*.fred "$scratch/$dir"
+  (cd "$scratch/$dir" && ls *.fred > list)
+done
+(cd "$scratch/fused.d" && "$fred" --contexts list -j 2 > /dev/null 2>&1)
+(cd "$scratch/plain.d" && "$fred" --contexts list -j 2 --no-fuse > /dev/null 2>&1)
+for out in "$scratch"/plain.d/*.out; do
+  name=$(basename "$out")
+  same "contexts $name" "$scratch/fused.d/$name" "$out"
+  "$fred" --no-fuse -f "$tests/programs/${name%.out}" > "$scratch/alone" 2> /dev/null
+  if ! cmp -s "$scratch/alone" "$out"; then
+    echo "FAIL: contexts $name differs from running it alone"
+    diff "$scratch/alone" "$out" | head -20
+    status=1
+  fi
+done
+
+[ $status -eq 0 ] && echo "fusion: outputs match"
+exit $status
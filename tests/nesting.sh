@@ -0,0 +1,127 @@
+#!/bin/sh
+# file: nesting.sh
+# description: stresses the typed stacks of the parser and evaluator
+#   with expressions nested thousands of levels deep, nested calls and
+#   random malformed expressions, checking that fred never dies of a
+#   signal and gets the deep ones right
+# usage: tests/nesting.sh [ path-to-fred ] [ depth ] [ programs ]
+
+fred=$(cd "$(dirname "${1:-./fred}")" && pwd)/$(basename "${1:-./fred}")
+depth=${2:-5000}
+programs=${3:-200}
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+status=0
+
+# run a program, failing if fred is killed or takes too long
+run(){
+  timeout 30 "$fred" $2 -f "$scratch/$1" > "$scratch/out" 2> "$scratch/err"
+  result=$?
+  if [ $result -ge 124 ]; then
+    echo "FAIL: $1 $2: fred exited with $result"
+    head -c 300 "$scratch/err"
+    status=1
+  fi
+}
+
+# fail unless the last run displayed a value
+shows(){
+  if ! grep -q "^ $2 $" "$scratch/out"; then
+    echo "FAIL: $1: expected $2"
+    status=1
+  fi
+}
+
+awk -v n="$depth" -v dir="$scratch" 'BEGIN{
+  # a single number in parentheses nested n deep
+  f = dir "/parens.fred"
+  print "define integer a" > f
+  printf "let a = " > f
+  for(i = 0; i < n; i++) printf "(" > f
+  printf "1" > f
+  for(i = 0; i < n; i++) printf ")" > f
+  print "\ndisplay a" > f
+
+  # a sum nested to the right, keeping every operator on the stack
+  f = dir "/right.fred"
+  print "define integer a" > f
+  printf "let a = " > f
+  for(i = 0; i < n; i++) printf "1 + (" > f
+  printf "1" > f
+  for(i = 0; i < n; i++) printf ")" > f
+  print "\ndisplay a" > f
+
+  # a flat run of n operators
+  f = dir "/flat.fred"
+  print "define integer a" > f
+  printf "let a = 1" > f
+  for(i = 0; i < n; i++) printf " * 1 + 1" > f
+  print "\ndisplay a" > f
+
+  # calls nested n deep, the nearest Fred has to unary operators
+  f = dir "/calls.fred"
+  print "define integer a\nfunction f(p) := p + 1" > f
+  printf "let a = " > f
+  for(i = 0; i < n; i++) printf "f(" > f
+  printf "0" > f
+  for(i = 0; i < n; i++) printf ")" > f
+  print "\ndisplay a" > f
+
+  # functions each calling the last, deeper than inlining allows
+  f = dir "/chain.fred"
+  print "define integer a\nfunction f0(p) := p + 1" > f
+  for(i = 1; i < 1000; i++) printf "function f%d(p) := f%d(p) + 1\n", i, i - 1 > f
+  print "let a = f999(0)\ndisplay a" > f
+
+  # deep but unbalanced, on either side, and in a condition
+  f = dir "/unbalanced.fred"
+  print "define integer a" > f
+  printf "let a = " > f
+  for(i = 0; i < n; i++) printf "(" > f
+  printf "1" > f
+  for(i = 1; i < n; i++) printf ")" > f
+  printf "\nlet a = 1" > f
+  for(i = 0; i < n; i++) printf ")" > f
+  printf "\nif " > f
+  for(i = 0; i < n; i++) printf "(" > f
+  print "a < 2 then let a = 2\ndisplay a" > f
+}'
+
+run parens.fred
+shows parens.fred 1
+run right.fred
+shows right.fred $((depth + 1))
+run flat.fred
+shows flat.fred $((depth + 1))
+run calls.fred
+shows calls.fred $depth
+run chain.fred
+run unbalanced.fred
+run right.fred "-p 2"
+shows "right.fred -p 2" $((depth + 1))
+
+# random expressions, mostly malformed, from a fixed seed
+awk -v programs="$programs" -v dir="$scratch" 'BEGIN{
+  split("( ) ( ) + - * / % 0 1 7 2.5 a b f( g( , q ) f( (", pieces, " ")
+  srand(31)
+  for(p = 0; p < programs; p++){
+    f = dir "/random" p ".fred"
+    print "define integer a, b\nfunction f(x) := x * 2\nfunction g(x, y) := x - y" > f
+    for(line = 0; line < 5; line++){
+      printf (line % 2 ? "if " : "let a = ") > f
+      count = int(rand() * (line == 4 ? 3000 : 60))
+      for(i = 0; i < count; i++) printf "%s ", pieces[int(rand() * 20) + 1] > f
+      print (line % 2 ? "< b then let b = a" : "") > f
+    }
+    print "display a, b" > f
+    close(f)
+  }
+}'
+p=0
+while [ $p -lt "$programs" ]; do
+  run random$p.fred
+  p=$((p + 1))
+done
+
+[ $status -eq 0 ] && echo "nesting: no crashes"
+exit $status
@@ -0,0 +1,55 @@
+#!/bin/sh
+# file: profilebench.sh
+# description: measures the cost of --profile by timing a long generated
+#   program with and without it, alternating the runs so both see the
+#   same machine, and prints the median, fastest and slowest of each
+# usage: tests/profilebench.sh [ path-to-fred ] [ statements ] [ runs ]
+
+fred=${1:-./fred}
+statements=${2:-400000}
+runs=${3:-9}
+scratch=$(mktemp -d)
+trap 'rm -rf "$scratch"' EXIT
+
+awk -v n="$statements" 'BEGIN{
+  print "define integer i, total"
+  print "define real x"
+  for(k = 0; k < n; k += 4){
+    print "let i = i + 1"
+    print "let total = (total + i * 3) % 1000"
+    print "let x = x / 2 + i"
+    print "if i > total then let total = total + 1"
+  }
+  print "display i, total, x"
+}' > "$scratch/bench.fred"
+
+# elapsed seconds of one run of fred with the given options
+elapsed(){
+  start=$(date +%s.%N)
+  "$fred" "$@" -f "$scratch/bench.fred" > /dev/null 2>&1
+  end=$(date +%s.%N)
+  awk -v s="$start" -v e="$end" 'BEGIN{ printf "%.4f\n", e - s }'
+}
+
+run=0
+while [ $run -lt "$runs" ]; do
+  elapsed >> "$scratch/plain"
+  elapsed --profile "$scratch/out.folded" >> "$scratch/profiled"
+  run=$((run + 1))
+done
+
+# median, fastest and slowest of a file of times
+summary(){
+  sort -n "$1" | awk '{ t[NR] = $1 }
+    END{ printf "%.3f %.3f %.3f\n", t[int((NR + 1) / 2)], t[1], t[NR] }'
+}
+
+set -- $(summary "$scratch/plain") $(summary "$scratch/profiled")
+echo "statements: $statements, $runs runs of each"
+echo "             median  fastest  slowest"
+echo "plain:       $1    $2    $3"
+echo "--profile:   $4    $5    $6"
+awk -v a="$1" -v b="$4" -v lo="$2" -v hi="$3" 'BEGIN{
+  printf "overhead of the medians: %.1f%%, spread of the plain runs: %.1f%%\n",
+    100 * (b - a) / a, 100 * (hi - lo) / a
+}'
@@ -0,0 +1,414 @@
+///file:vector.c
+///description:scalar, SSE and AVX2 kernels for the scenario engine
+///  and for reductions over arrays
+///author: avv8047 : Azhur Viano
+
+
+#include "vector.h"
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_KERNELS
+#endif
+
+
+//Integers wrap on overflow in every version, as they do in practice
+//  when expressions are evaluated one at a time
+
+#define SCALAR_INT(name, op)						\
+  static void name(Value* out, const Value* a, const Value* b, size_t n){ \
+    size_t i;								\
+    for(i = 0; i < n; i++){						\
+      out[i].iVal = (int) ((unsigned) a[i].iVal op (unsigned) b[i].iVal); \
+    }									\
+  }
+
+#define SCALAR_FLOAT(name, op)						\
+  static void name(Value* out, const Value* a, const Value* b, size_t n){ \
+    size_t i;								\
+    for(i = 0; i < n; i++){						\
+      out[i].fVal = a[i].fVal op b[i].fVal;				\
+    }									\
+  }
+
+#define SCALAR_COMPARE(name, field, op)					\
+  static void name(int32_t* out, const Value* a, const Value* b, size_t n){ \
+    size_t i;								\
+    for(i = 0; i < n; i++){						\
+      out[i] = -(a[i].field op b[i].field);				\
+    }									\
+  }
+
+SCALAR_INT(addIntScalar, +)
+SCALAR_INT(subIntScalar, -)
+SCALAR_INT(mulIntScalar, *)
+SCALAR_FLOAT(addFloatScalar, +)
+SCALAR_FLOAT(subFloatScalar, -)
+SCALAR_FLOAT(mulFloatScalar, *)
+SCALAR_FLOAT(divFloatScalar, /)
+SCALAR_COMPARE(gtIntScalar, iVal, >)
+SCALAR_COMPARE(ltIntScalar, iVal, <)
+SCALAR_COMPARE(eqIntScalar, iVal, ==)
+SCALAR_COMPARE(gtFloatScalar, fVal, >)
+SCALAR_COMPARE(ltFloatScalar, fVal, <)
+SCALAR_COMPARE(eqFloatScalar, fVal, ==)
+
+
+static void toFloatScalar(Value* out, const Value* in, size_t n){
+  size_t i;
+
+  for(i = 0; i < n; i++){
+    out[i].fVal = (float) in[i].iVal;
+  }
+  return;
+}
+
+
+static void selectScalar(Value* out, const Value* in, const int32_t* mask,
+			 size_t n){
+  size_t i;
+
+  for(i = 0; i < n; i++){
+    if(mask[i]){
+      out[i] = in[i];
+    }
+  }
+  return;
+}
+
+
+#define SCALAR_FOLD(name, step)						\
+  static void name(Value* lanes, const Value* a, size_t n){		\
+    size_t i;								\
+    size_t j;								\
+    for(i = 0; i < n; i += VECTOR_LANES){				\
+      for(j = 0; j < VECTOR_LANES; j++){				\
+	step(lanes[j], a[i + j]);					\
+      }									\
+    }									\
+  }
+
+SCALAR_FOLD(sumIntScalar, addIntStep)
+SCALAR_FOLD(sumFloatScalar, addFloatStep)
+SCALAR_FOLD(minIntScalar, minIntStep)
+SCALAR_FOLD(minFloatScalar, minFloatStep)
+SCALAR_FOLD(maxIntScalar, maxIntStep)
+SCALAR_FOLD(maxFloatScalar, maxFloatStep)
+
+
+static void dotIntScalar(Value* lanes, const Value* a, const Value* b, size_t n){
+  size_t i;
+  size_t j;
+
+  for(i = 0; i < n; i += VECTOR_LANES){
+    for(j = 0; j < VECTOR_LANES; j++){
+      lanes[j].iVal = (int) ((unsigned) lanes[j].iVal +
+			     (unsigned) a[i + j].iVal * (unsigned) b[i + j].iVal);
+    }
+  }
+  return;
+}
+
+
+static void dotFloatScalar(Value* lanes, const Value* a, const Value* b, size_t n){
+  size_t i;
+  size_t j;
+  float product;
+
+  for(i = 0; i < n; i += VECTOR_LANES){
+    for(j = 0; j < VECTOR_LANES; j++){
+      //rounded before the add, as the SIMD versions do
+      product = a[i + j].fVal * b[i + j].fVal;
+      lanes[j].fVal = lanes[j].fVal + product;
+    }
+  }
+  return;
+}
+
+
+static const Kernels scalarKernels = {
+  "scalar",
+  addIntScalar, subIntScalar, mulIntScalar,
+  addFloatScalar, subFloatScalar, mulFloatScalar, divFloatScalar,
+  gtIntScalar, ltIntScalar, eqIntScalar,
+  gtFloatScalar, ltFloatScalar, eqFloatScalar,
+  toFloatScalar, selectScalar,
+  sumIntScalar, sumFloatScalar, minIntScalar, minFloatScalar,
+  maxIntScalar, maxFloatScalar, dotIntScalar, dotFloatScalar
+};
+
+
+#ifdef HAVE_X86_KERNELS
+
+//Each x86 version is compiled for its own instruction set isa and only
+//  called once the CPU is known to support it. Width is the number of
+//  values in a register and Int its integer type
+
+#define SIMD_INT(name, isa, Int, width, load, store, op)		\
+  __attribute__((target(isa)))					\
+  static void name(Value* out, const Value* a, const Value* b, size_t n){ \
+    size_t i;								\
+    for(i = 0; i < n; i += width){					\
+      store((Int*) (out + i), op(load((const Int*) (a + i)),		\
+				 load((const Int*) (b + i))));		\
+    }									\
+  }
+
+#define SIMD_FLOAT(name, isa, width, load, store, op)		\
+  __attribute__((target(isa)))					\
+  static void name(Value* out, const Value* a, const Value* b, size_t n){ \
+    size_t i;								\
+    for(i = 0; i < n; i += width){					\
+      store((float*) (out + i), op(load((const float*) (a + i)),	\
+				   load((const float*) (b + i))));	\
+    }									\
+  }
+
+#define SIMD_COMPARE_INT(name, isa, Int, width, load, store, compare) \
+  __attribute__((target(isa)))					\
+  static void name(int32_t* out, const Value* a, const Value* b, size_t n){ \
+    size_t i;								\
+    for(i = 0; i < n; i += width){					\
+      store((Int*) (out + i), compare(load((const Int*) (a + i)),	\
+				      load((const Int*) (b + i))));	\
+    }									\
+  }
+
+#define SIMD_COMPARE_FLOAT(name, isa, Int, width, load, store, compare, cast) \
+  __attribute__((target(isa)))					\
+  static void name(int32_t* out, const Value* a, const Value* b, size_t n){ \
+    size_t i;								\
+    for(i = 0; i < n; i += width){					\
+      store((Int*) (out + i), cast(compare(load((const float*) (a + i)), \
+					   load((const float*) (b + i))))); \
+    }									\
+  }
+
+//Folds keep VECTOR_LANES / width registers, register j holding lanes
+//  j * width to j * width + width - 1. Elem is the type of a value in
+//  a register, int or float
+
+#define SIMD_FOLD(name, isa, Vec, Elem, width, load, store, op)	\
+  __attribute__((target(isa)))					\
+  static void name(Value* lanes, const Value* a, size_t n){		\
+    Vec acc[VECTOR_LANES / width];					\
+    size_t i;								\
+    size_t j;								\
+    for(j = 0; j < VECTOR_LANES / width; j++){				\
+      acc[j] = load((const Elem*) (lanes + j * width));		\
+    }									\
+    for(i = 0; i < n; i += VECTOR_LANES){				\
+      for(j = 0; j < VECTOR_LANES / width; j++){			\
+	acc[j] = op(acc[j], load((const Elem*) (a + i + j * width)));	\
+      }									\
+    }									\
+    for(j = 0; j < VECTOR_LANES / width; j++){				\
+      store((Elem*) (lanes + j * width), acc[j]);			\
+    }									\
+  }
+
+#define SIMD_DOT(name, isa, Vec, Elem, width, load, store, add, mul)	\
+  __attribute__((target(isa)))					\
+  static void name(Value* lanes, const Value* a, const Value* b, size_t n){ \
+    Vec acc[VECTOR_LANES / width];					\
+    size_t i;								\
+    size_t j;								\
+    for(j = 0; j < VECTOR_LANES / width; j++){				\
+      acc[j] = load((const Elem*) (lanes + j * width));		\
+    }									\
+    for(i = 0; i < n; i += VECTOR_LANES){				\
+      for(j = 0; j < VECTOR_LANES / width; j++){			\
+	acc[j] = add(acc[j], mul(load((const Elem*) (a + i + j * width)), \
+				 load((const Elem*) (b + i + j * width)))); \
+      }									\
+    }									\
+    for(j = 0; j < VECTOR_LANES / width; j++){				\
+      store((Elem*) (lanes + j * width), acc[j]);			\
+    }									\
+  }
+
+
+//SSE versions; integer multiply and blending need SSE4.1
+
+#define sseLt(a, b) _mm_cmplt_epi32(a, b)
+#define sseGt(a, b) _mm_cmpgt_epi32(a, b)
+#define sseEq(a, b) _mm_cmpeq_epi32(a, b)
+
+SIMD_INT(addIntSse, "sse4.1", __m128i, 4, _mm_loadu_si128, _mm_storeu_si128, _mm_add_epi32)
+SIMD_INT(subIntSse, "sse4.1", __m128i, 4, _mm_loadu_si128, _mm_storeu_si128, _mm_sub_epi32)
+SIMD_INT(mulIntSse, "sse4.1", __m128i, 4, _mm_loadu_si128, _mm_storeu_si128, _mm_mullo_epi32)
+SIMD_FLOAT(addFloatSse, "sse4.1", 4, _mm_loadu_ps, _mm_storeu_ps, _mm_add_ps)
+SIMD_FLOAT(subFloatSse, "sse4.1", 4, _mm_loadu_ps, _mm_storeu_ps, _mm_sub_ps)
+SIMD_FLOAT(mulFloatSse, "sse4.1", 4, _mm_loadu_ps, _mm_storeu_ps, _mm_mul_ps)
+SIMD_FLOAT(divFloatSse, "sse4.1", 4, _mm_loadu_ps, _mm_storeu_ps, _mm_div_ps)
+SIMD_COMPARE_INT(gtIntSse, "sse4.1", __m128i, 4, _mm_loadu_si128, _mm_storeu_si128, sseGt)
+SIMD_COMPARE_INT(ltIntSse, "sse4.1", __m128i, 4, _mm_loadu_si128, _mm_storeu_si128, sseLt)
+SIMD_COMPARE_INT(eqIntSse, "sse4.1", __m128i, 4, _mm_loadu_si128, _mm_storeu_si128, sseEq)
+SIMD_COMPARE_FLOAT(gtFloatSse, "sse4.1", __m128i, 4, _mm_loadu_ps, _mm_storeu_si128,
+		   _mm_cmpgt_ps, _mm_castps_si128)
+SIMD_COMPARE_FLOAT(ltFloatSse, "sse4.1", __m128i, 4, _mm_loadu_ps, _mm_storeu_si128,
+		   _mm_cmplt_ps, _mm_castps_si128)
+SIMD_COMPARE_FLOAT(eqFloatSse, "sse4.1", __m128i, 4, _mm_loadu_ps, _mm_storeu_si128,
+		   _mm_cmpeq_ps, _mm_castps_si128)
+
+#define sseLoadInt(p) _mm_loadu_si128((const __m128i*) (p))
+#define sseStoreInt(p, v) _mm_storeu_si128((__m128i*) (p), v)
+
+SIMD_FOLD(sumIntSse, "sse4.1", __m128i, int, 4, sseLoadInt, sseStoreInt, _mm_add_epi32)
+SIMD_FOLD(sumFloatSse, "sse4.1", __m128, float, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_add_ps)
+SIMD_FOLD(minIntSse, "sse4.1", __m128i, int, 4, sseLoadInt, sseStoreInt, _mm_min_epi32)
+SIMD_FOLD(minFloatSse, "sse4.1", __m128, float, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_min_ps)
+SIMD_FOLD(maxIntSse, "sse4.1", __m128i, int, 4, sseLoadInt, sseStoreInt, _mm_max_epi32)
+SIMD_FOLD(maxFloatSse, "sse4.1", __m128, float, 4, _mm_loadu_ps, _mm_storeu_ps, _mm_max_ps)
+SIMD_DOT(dotIntSse, "sse4.1", __m128i, int, 4, sseLoadInt, sseStoreInt,
+	 _mm_add_epi32, _mm_mullo_epi32)
+SIMD_DOT(dotFloatSse, "sse4.1", __m128, float, 4, _mm_loadu_ps, _mm_storeu_ps,
+	 _mm_add_ps, _mm_mul_ps)
+
+
+__attribute__((target("sse4.1")))
+static void toFloatSse(Value* out, const Value* in, size_t n){
+  size_t i;
+
+  for(i = 0; i < n; i += 4){
+    _mm_storeu_ps((float*) (out + i),
+		  _mm_cvtepi32_ps(_mm_loadu_si128((const __m128i*) (in + i))));
+  }
+  return;
+}
+
+
+__attribute__((target("sse4.1")))
+static void selectSse(Value* out, const Value* in, const int32_t* mask, size_t n){
+  size_t i;
+
+  for(i = 0; i < n; i += 4){
+    _mm_storeu_ps((float*) (out + i),
+		  _mm_blendv_ps(_mm_loadu_ps((const float*) (out + i)),
+				_mm_loadu_ps((const float*) (in + i)),
+				_mm_castsi128_ps(_mm_loadu_si128((const __m128i*) (mask + i)))));
+  }
+  return;
+}
+
+
+static const Kernels sseKernels = {
+  "sse",
+  addIntSse, subIntSse, mulIntSse,
+  addFloatSse, subFloatSse, mulFloatSse, divFloatSse,
+  gtIntSse, ltIntSse, eqIntSse,
+  gtFloatSse, ltFloatSse, eqFloatSse,
+  toFloatSse, selectSse,
+  sumIntSse, sumFloatSse, minIntSse, minFloatSse,
+  maxIntSse, maxFloatSse, dotIntSse, dotFloatSse
+};
+
+
+//AVX2 versions
+
+#define avxLt(a, b) _mm256_cmpgt_epi32(b, a)
+#define avxGt(a, b) _mm256_cmpgt_epi32(a, b)
+#define avxEq(a, b) _mm256_cmpeq_epi32(a, b)
+//ordered comparisons are false for NaN, like the C operators
+#define avxLtFloat(a, b) _mm256_cmp_ps(a, b, _CMP_LT_OQ)
+#define avxGtFloat(a, b) _mm256_cmp_ps(a, b, _CMP_GT_OQ)
+#define avxEqFloat(a, b) _mm256_cmp_ps(a, b, _CMP_EQ_OQ)
+
+SIMD_INT(addIntAvx2, "avx2", __m256i, 8, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_add_epi32)
+SIMD_INT(subIntAvx2, "avx2", __m256i, 8, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_sub_epi32)
+SIMD_INT(mulIntAvx2, "avx2", __m256i, 8, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_mullo_epi32)
+SIMD_FLOAT(addFloatAvx2, "avx2", 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_add_ps)
+SIMD_FLOAT(subFloatAvx2, "avx2", 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_sub_ps)
+SIMD_FLOAT(mulFloatAvx2, "avx2", 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_mul_ps)
+SIMD_FLOAT(divFloatAvx2, "avx2", 8, _mm256_loadu_ps, _mm256_storeu_ps, _mm256_div_ps)
+SIMD_COMPARE_INT(gtIntAvx2, "avx2", __m256i, 8, _mm256_loadu_si256, _mm256_storeu_si256, avxGt)
+SIMD_COMPARE_INT(ltIntAvx2, "avx2", __m256i, 8, _mm256_loadu_si256, _mm256_storeu_si256, avxLt)
+SIMD_COMPARE_INT(eqIntAvx2, "avx2", __m256i, 8, _mm256_loadu_si256, _mm256_storeu_si256, avxEq)
+SIMD_COMPARE_FLOAT(gtFloatAvx2, "avx2", __m256i, 8, _mm256_loadu_ps, _mm256_storeu_si256,
+		   avxGtFloat, _mm256_castps_si256)
+SIMD_COMPARE_FLOAT(ltFloatAvx2, "avx2", __m256i, 8, _mm256_loadu_ps, _mm256_storeu_si256,
+		   avxLtFloat, _mm256_castps_si256)
+SIMD_COMPARE_FLOAT(eqFloatAvx2, "avx2", __m256i, 8, _mm256_loadu_ps, _mm256_storeu_si256,
+		   avxEqFloat, _mm256_castps_si256)
+
+#define avxLoadInt(p) _mm256_loadu_si256((const __m256i*) (p))
+#define avxStoreInt(p, v) _mm256_storeu_si256((__m256i*) (p), v)
+
+SIMD_FOLD(sumIntAvx2, "avx2", __m256i, int, 8, avxLoadInt, avxStoreInt, _mm256_add_epi32)
+SIMD_FOLD(sumFloatAvx2, "avx2", __m256, float, 8, _mm256_loadu_ps, _mm256_storeu_ps,
+	  _mm256_add_ps)
+SIMD_FOLD(minIntAvx2, "avx2", __m256i, int, 8, avxLoadInt, avxStoreInt, _mm256_min_epi32)
+SIMD_FOLD(minFloatAvx2, "avx2", __m256, float, 8, _mm256_loadu_ps, _mm256_storeu_ps,
+	  _mm256_min_ps)
+SIMD_FOLD(maxIntAvx2, "avx2", __m256i, int, 8, avxLoadInt, avxStoreInt, _mm256_max_epi32)
+SIMD_FOLD(maxFloatAvx2, "avx2", __m256, float, 8, _mm256_loadu_ps, _mm256_storeu_ps,
+	  _mm256_max_ps)
+SIMD_DOT(dotIntAvx2, "avx2", __m256i, int, 8, avxLoadInt, avxStoreInt,
+	 _mm256_add_epi32, _mm256_mullo_epi32)
+SIMD_DOT(dotFloatAvx2, "avx2", __m256, float, 8, _mm256_loadu_ps, _mm256_storeu_ps,
+	 _mm256_add_ps, _mm256_mul_ps)
+
+
+__attribute__((target("avx2")))
+static void toFloatAvx2(Value* out, const Value* in, size_t n){
+  size_t i;
+
+  for(i = 0; i < n; i += 8){
+    _mm256_storeu_ps((float*) (out + i),
+		     _mm256_cvtepi32_ps(_mm256_loadu_si256((const __m256i*) (in + i))));
+  }
+  return;
+}
+
+
+__attribute__((target("avx2")))
+static void selectAvx2(Value* out, const Value* in, const int32_t* mask, size_t n){
+  size_t i;
+
+  for(i = 0; i < n; i += 8){
+    _mm256_storeu_ps((float*) (out + i),
+		     _mm256_blendv_ps(_mm256_loadu_ps((const float*) (out + i)),
+				      _mm256_loadu_ps((const float*) (in + i)),
+				      _mm256_castsi256_ps(_mm256_loadu_si256((const __m256i*) (mask + i)))));
+  }
+  return;
+}
+
+
+static const Kernels avx2Kernels = {
+  "avx2",
+  addIntAvx2, subIntAvx2, mulIntAvx2,
+  addFloatAvx2, subFloatAvx2, mulFloatAvx2, divFloatAvx2,
+  gtIntAvx2, ltIntAvx2, eqIntAvx2,
+  gtFloatAvx2, ltFloatAvx2, eqFloatAvx2,
+  toFloatAvx2, selectAvx2,
+  sumIntAvx2, sumFloatAvx2, minIntAvx2, minFloatAvx2,
+  maxIntAvx2, maxFloatAvx2, dotIntAvx2, dotFloatAvx2
+};
+
+#endif
+
+
+///Pick the kernels for an instruction set
+const Kernels* selectKernels(const char* name){
+#ifdef HAVE_X86_KERNELS
+  int avx2;
+  int sse;
+
+  __builtin_cpu_init();
+  avx2 = __builtin_cpu_supports("avx2");
+  sse = __builtin_cpu_supports("sse4.1");
+
+  if((!name || strcmp(name, "avx2") == 0) && avx2){
+    return &avx2Kernels;
+  }
+  if((!name || strcmp(name, "sse") == 0) && sse){
+    return &sseKernels;
+  }
+#endif
+  if(!name || strcmp(name, "scalar") == 0){
+    return &scalarKernels;
+  }
+  return NULL;
+}
@@ -0,0 +1,107 @@
+///file:vector.h
+///description:kernels applying arithmetic to many values at once,
+///  with versions for each instruction set chosen at runtime
+///author: avv8047 : Azhur Viano
+
+
+#ifndef VECTOR_H
+#define VECTOR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "symbolTable.h"
+
+//number of values the kernels handle per step; the counts passed to
+//  the kernels must be a multiple of this
+#define VECTOR_LANES 8
+
+
+///Apply an operator to two arrays of values
+///@param out set to the results
+///@param a the left operands
+///@param b the right operands
+///@param n the number of values
+typedef void (*BinaryKernel)(Value* out, const Value* a, const Value* b, size_t n);
+
+
+///Compare two arrays of values
+///@param out set to -1 where the comparison is true and 0 where it
+///  is false
+///@param a the left operands
+///@param b the right operands
+///@param n the number of values
+typedef void (*CompareKernel)(int32_t* out, const Value* a, const Value* b,
+			      size_t n);
+
+
+//Steps of the reductions: fold x into the partial result acc, the way
+//  every version of the kernels does
+#define addIntStep(acc, x) ((acc).iVal = (int) ((unsigned) (acc).iVal + (unsigned) (x).iVal))
+#define addFloatStep(acc, x) ((acc).fVal = (acc).fVal + (x).fVal)
+#define minIntStep(acc, x) ((acc).iVal = (acc).iVal < (x).iVal ? (acc).iVal : (x).iVal)
+#define minFloatStep(acc, x) ((acc).fVal = (acc).fVal < (x).fVal ? (acc).fVal : (x).fVal)
+#define maxIntStep(acc, x) ((acc).iVal = (acc).iVal > (x).iVal ? (acc).iVal : (x).iVal)
+#define maxFloatStep(acc, x) ((acc).fVal = (acc).fVal > (x).fVal ? (acc).fVal : (x).fVal)
+
+
+///Fold values into VECTOR_LANES partial results, lane i taking the
+///  values at i, i + VECTOR_LANES, and so on in order, so that every
+///  version gives the same partial results
+///@param lanes the partial results so far, updated
+///@param a the values
+///@param n the number of values
+typedef void (*FoldKernel)(Value* lanes, const Value* a, size_t n);
+
+
+///Add the products of two arrays of values into VECTOR_LANES partial
+///  sums, the same way as a FoldKernel
+///@param lanes the partial sums so far, updated
+///@param a the left values
+///@param b the right values
+///@param n the number of values
+typedef void (*DotKernel)(Value* lanes, const Value* a, const Value* b, size_t n);
+
+
+///Kernels for one instruction set
+typedef struct Kernels_ {
+  //name used to pick the kernels with --simd
+  const char* name;
+  BinaryKernel addInt;
+  BinaryKernel subInt;
+  BinaryKernel mulInt;
+  BinaryKernel addFloat;
+  BinaryKernel subFloat;
+  BinaryKernel mulFloat;
+  BinaryKernel divFloat;
+  CompareKernel gtInt;
+  CompareKernel ltInt;
+  CompareKernel eqInt;
+  CompareKernel gtFloat;
+  CompareKernel ltFloat;
+  CompareKernel eqFloat;
+  //convert integers to floats
+  void (*toFloat)(Value* out, const Value* in, size_t n);
+  //copy the values whose mask is -1, leaving the others
+  void (*select)(Value* out, const Value* in, const int32_t* mask, size_t n);
+  //reductions; a lane keeps its minimum or maximum unless a value is
+  //  less or greater than it, the way minps and maxps do
+  FoldKernel sumInt;
+  FoldKernel sumFloat;
+  FoldKernel minInt;
+  FoldKernel minFloat;
+  FoldKernel maxInt;
+  FoldKernel maxFloat;
+  DotKernel dotInt;
+  DotKernel dotFloat;
+} Kernels;
+
+
+///Get the kernels for an instruction set
+///@param name avx2, sse or scalar, or NULL for the best one the CPU
+///  supports
+///@returns the kernels, or NULL if the name is unknown or the CPU
+///  does not support it
+const Kernels* selectKernels(const char* name);
+
+#endif
@@ -0,0 +1,390 @@
+///file:watch.c
+///description:runs a Fred program again each time its file changes,
+///  resuming from a checkpoint of the symbols before the first change
+///author: avv8047 : Azhur Viano
+
+
+#include "watch.h"
+#include "memstats.h"
+#include "profile.h"
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+//time to wait for more events after a change, so that the writes of
+//  an editor saving the file are seen as one change, in milliseconds
+#define SETTLE_TIME 50
+//returned by firstChange when the program did not change
+#define NO_CHANGE ((size_t) -1)
+
+
+//Symbols as they were before a line of the program ran
+typedef struct Checkpoint_ {
+  //index of the line; every line before it has run
+  size_t line;
+  SymbolTable* snapshot;
+} Checkpoint;
+
+//Text of a program split into lines
+typedef struct Program_ {
+  char* text;
+  //start of each line in the text, with the end of the text after
+  //  the last line
+  size_t* starts;
+  size_t count;
+} Program;
+
+//State kept between runs of a watched program
+typedef struct Watch_ {
+  SymbolTable* table;
+  //symbols from the symbol file, which every run starts from
+  SymbolTable* baseline;
+  Program program;
+  //checkpoints in the order of their lines
+  Checkpoint* checkpoints;
+  size_t checkpointCount;
+  size_t checkpointCapacity;
+  size_t interval;
+  //buffer each line is copied into to be run
+  char* line;
+  size_t lineCapacity;
+} Watch;
+
+
+//set when fred is asked to stop
+static volatile sig_atomic_t stopping = 0;
+
+
+///Stop watching once the current run finishes
+///@param sig the signal number
+static void stopWatching(int sig){
+  (void) sig;
+  stopping = 1;
+  return;
+}
+
+
+///Read a program and split it into lines
+///@param path the program file
+///@param program set to the lines of the program
+///@returns 0 on success, -1 if the file could not be read
+static int readProgram(const char* path, Program* program){
+  FILE* file = fopen(path, "r");
+  struct stat info;
+  size_t length;
+  size_t capacity = 64;
+  size_t i;
+
+  if(!file || fstat(fileno(file), &info) < 0){
+    if(file){
+      fclose(file);
+    }
+    return -1;
+  }
+
+  program->text = memAlloc(MemLines, info.st_size + 1);
+  length = fread(program->text, 1, info.st_size, file);
+  fclose(file);
+  program->text[length] = '\0';
+
+  //lines keep their newlines, as readLine leaves them
+  program->starts = memAlloc(MemLines, sizeof(size_t) * capacity);
+  program->starts[0] = 0;
+  program->count = 0;
+  for(i = 0; i < length; i++){
+    if(program->text[i] == '\n' || i + 1 == length){
+      if(program->count + 2 > capacity){
+	capacity *= 2;
+	program->starts = memRealloc(MemLines, program->starts, sizeof(size_t) * capacity);
+      }
+      program->starts[++program->count] = i + 1;
+    }
+  }
+  return 0;
+}
+
+
+///Free the lines of a program
+///@param program the program
+static void freeProgram(Program* program){
+  memFree(program->text);
+  memFree(program->starts);
+  program->text = NULL;
+  program->starts = NULL;
+  program->count = 0;
+  return;
+}
+
+
+///Find the first line that differs between two versions of a program
+///@param old the version that last ran
+///@param new the version that replaces it
+///@returns the index of the first line that differs, or NO_CHANGE
+static size_t firstChange(Program* old, Program* new){
+  size_t count = old->count < new->count ? old->count : new->count;
+  size_t length;
+  size_t i;
+
+  for(i = 0; i < count; i++){
+    length = old->starts[i + 1] - old->starts[i];
+    if(length != new->starts[i + 1] - new->starts[i] ||
+       memcmp(old->text + old->starts[i], new->text + new->starts[i], length) != 0){
+      return i;
+    }
+  }
+  return old->count == new->count ? NO_CHANGE : count;
+}
+
+
+///Save the symbols as they are before a line runs
+///@param watch the watch
+///@param line the index of the line
+static void takeCheckpoint(Watch* watch, size_t line){
+  Checkpoint* checkpoint;
+
+  if(watch->checkpointCount == watch->checkpointCapacity){
+    watch->checkpointCapacity = watch->checkpointCapacity ? watch->checkpointCapacity * 2 : 16;
+    watch->checkpoints = memRealloc(MemSymbols, watch->checkpoints,
+				    sizeof(Checkpoint) * watch->checkpointCapacity);
+  }
+  checkpoint = &watch->checkpoints[watch->checkpointCount++];
+  checkpoint->line = line;
+  //the snapshot only keeps the slabs the following lines write to
+  checkpoint->snapshot = SnapshotTable(watch->table);
+  return;
+}
+
+
+///Drop the checkpoints after the first ones
+///@param watch the watch
+///@param keep the number of checkpoints to keep
+static void dropCheckpoints(Watch* watch, size_t keep){
+  while(watch->checkpointCount > keep){
+    watch->checkpointCount--;
+    DestroyTable(watch->checkpoints[watch->checkpointCount].snapshot);
+  }
+  return;
+}
+
+
+///Put the symbols back as they were before a line ran, from the last
+///  checkpoint at or before it, dropping the checkpoints after that
+///@param watch the watch
+///@param line the index of the first line that has to run again
+///@returns the index of the line to run from
+static size_t restoreCheckpoint(Watch* watch, size_t line){
+  size_t keep = watch->checkpointCount;
+
+  while(keep > 0 && watch->checkpoints[keep - 1].line > line){
+    keep--;
+  }
+  dropCheckpoints(watch, keep);
+
+  if(!keep){
+    ResetTable(watch->table, watch->baseline);
+    return 0;
+  }
+  ResetTable(watch->table, watch->checkpoints[keep - 1].snapshot);
+  return watch->checkpoints[keep - 1].line;
+}
+
+
+///Run the lines of the program from one line on, taking checkpoints
+///@param watch the watch
+///@param from the index of the first line to run
+static void runLines(Watch* watch, size_t from){
+  Program* program = &watch->program;
+  Statement* statement;
+  size_t length;
+  size_t i;
+
+  printf(">");
+
+  for(i = from; i < program->count; i++){
+    if(i > 0 && i % watch->interval == 0 &&
+       (!watch->checkpointCount || watch->checkpoints[watch->checkpointCount - 1].line < i)){
+      takeCheckpoint(watch, i);
+    }
+
+    //copy the line so it ends like one from readLine
+    length = program->starts[i + 1] - program->starts[i];
+    if(length + 1 > watch->lineCapacity){
+      watch->lineCapacity = length + 1;
+      watch->line = memRealloc(MemLines, watch->line, watch->lineCapacity);
+    }
+    memcpy(watch->line, program->text + program->starts[i], length);
+    watch->line[length] = '\0';
+
+    profileAt(i + 1, ProfOutput);
+    printf(":::%s\n", watch->line);
+
+    if(strnlen(watch->line, 1) != 0){
+      profilePhase(ProfParse);
+      statement = compileStatement(watch->line);
+      statement->line = i + 1;
+      executeStatement(watch->table, statement, stdout);
+      DestroyStatement(statement);
+    }
+
+    profilePhase(ProfOutput);
+    printf(">");
+    profileAt(0, ProfOther);
+  }
+
+  printf("\n");
+  return;
+}
+
+
+///Wait until the program file has been written or replaced
+///@param fd the inotify instance watching the directory of the file
+///@param name the name of the file in its directory
+///@returns 1 if it changed, 0 if fred is stopping or watching failed
+static int waitForChange(int fd, const char* name){
+  union {
+    struct inotify_event event;
+    char bytes[4096];
+  } buffer;
+  struct inotify_event* event;
+  struct pollfd wait = {fd, POLLIN, 0};
+  int changed = 0;
+  ssize_t n;
+  ssize_t i;
+  int ready;
+
+  while(!stopping){
+    //once the file has changed, wait for the events to settle
+    ready = poll(&wait, 1, changed ? SETTLE_TIME : -1);
+    if(ready < 0 && errno == EINTR){
+      continue;
+    }
+    if(ready < 0){
+      return 0;
+    }
+    if(ready == 0){
+      return 1;
+    }
+
+    n = read(fd, buffer.bytes, sizeof(buffer.bytes));
+    if(n < 0 && errno == EINTR){
+      continue;
+    }
+    if(n <= 0){
+      return 0;
+    }
+    for(i = 0; i < n; i += sizeof(struct inotify_event) + event->len){
+      event = (struct inotify_event*) (buffer.bytes + i);
+      if(event->mask & IN_IGNORED){
+	fprintf(stderr, "Watch: the directory of the program is gone\n");
+	return 0;
+      }
+      if(event->len && strcmp(event->name, name) == 0){
+	changed = 1;
+      }
+    }
+  }
+  return 0;
+}
+
+
+///Get the time in milliseconds
+///@returns the time
+static double milliseconds(void){
+  struct timespec now;
+
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1e3 + now.tv_nsec / 1e6;
+}
+
+
+///Run a program, then again from a checkpoint each time it changes
+int watchProgram(SymbolTable* table, const char* path, size_t interval){
+  Watch watch;
+  Program changed;
+  struct sigaction action;
+  //directory of the program and the name of the file in it
+  char* directory;
+  const char* name = strrchr(path, '/');
+  size_t first = NO_CHANGE;
+  size_t from = 0;
+  double start;
+  int fd;
+
+  if(name){
+    directory = strndup(path, name - path + 1);
+    name++;
+  }
+  else{
+    directory = strdup(".");
+    name = path;
+  }
+
+  memset(&watch, 0, sizeof(watch));
+  watch.table = table;
+  watch.interval = interval;
+  if(readProgram(path, &watch.program)){
+    fprintf(stderr, "Error reading program file %s\n", path);
+    free(directory);
+    return EXIT_FAILURE;
+  }
+
+  //editors often save by replacing the file, so its directory is watched
+  fd = inotify_init1(IN_CLOEXEC);
+  if(fd < 0 || inotify_add_watch(fd, directory, IN_CLOSE_WRITE | IN_MOVED_TO) < 0){
+    fprintf(stderr, "Error watching %s\n", path);
+    if(fd >= 0){
+      close(fd);
+    }
+    freeProgram(&watch.program);
+    free(directory);
+    return EXIT_FAILURE;
+  }
+
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = stopWatching;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+
+  watch.baseline = SnapshotTable(table);
+  do{
+    start = milliseconds();
+    runLines(&watch, from);
+    dumpTable(table, stdout);
+    fflush(stdout);
+    flushDiagnostics();
+    fprintf(stderr, "Watch: ran lines %zu to %zu of %s in %.3f ms",
+	    from + 1, watch.program.count, path, milliseconds() - start);
+    if(first != NO_CHANGE){
+      fprintf(stderr, " (first change at line %zu)", first + 1);
+    }
+    fprintf(stderr, "\n");
+
+    //wait for a change to a line
+    first = NO_CHANGE;
+    while(first == NO_CHANGE && waitForChange(fd, name)){
+      if(readProgram(path, &changed)){
+	continue;
+      }
+      first = firstChange(&watch.program, &changed);
+      freeProgram(&watch.program);
+      watch.program = changed;
+    }
+    if(first != NO_CHANGE){
+      from = restoreCheckpoint(&watch, first);
+    }
+  }while(first != NO_CHANGE);
+
+  dropCheckpoints(&watch, 0);
+  memFree(watch.checkpoints);
+  memFree(watch.line);
+  freeProgram(&watch.program);
+  DestroyTable(watch.baseline);
+  close(fd);
+  free(directory);
+  return EXIT_SUCCESS;
+}
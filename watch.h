@@ -0,0 +1,28 @@
+///file:watch.h
+///description:declarations for running a Fred program again each
+///  time its file changes, from a checkpoint before the first change
+///author: avv8047 : Azhur Viano
+
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include "processor.h"
+
+//statements run between checkpoints unless another interval is given
+#define WATCH_INTERVAL 1000
+
+
+///Run a program, then wait for its file to change and run it again
+///  from the last checkpoint before the first changed line, until
+///  interrupted. The symbols are saved every interval statements;
+///  after each run the table is dumped to stdout and the lines run
+///  and the time taken are printed to stderr
+///@param table the symbols read from the symbol file, which every
+///  run starts from
+///@param path the program file
+///@param interval the statements between checkpoints
+///@returns the exit status
+int watchProgram(SymbolTable* table, const char* path, size_t interval);
+
+#endif